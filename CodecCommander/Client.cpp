@@ -27,9 +27,47 @@ const IOExternalMethodDispatch CodecCommanderClient::sMethods[kClientNumMethods]
       0,
       1, // One output
       0
+    },
+    { // kClientExecuteVerbs
+      (IOExternalMethodAction)&CodecCommanderClient::executeVerbs,
+      0,
+      kIOUCVariableStructureSize, // Verbs
+      0,
+      kIOUCVariableStructureSize // Results
+    },
+    { // kClientRingDoorbell
+      (IOExternalMethodAction)&CodecCommanderClient::ringDoorbell,
+      0,
+      0,
+      0,
+      0
+    },
+    { // kClientDumpCodec
+      (IOExternalMethodAction)&CodecCommanderClient::dumpCodec,
+      0,
+      0,
+      0,
+      kIOUCVariableStructureSize // Snapshot
+    },
+    { // kClientTraceControl
+      (IOExternalMethodAction)&CodecCommanderClient::traceControl,
+      1, // Enable
+      0,
+      1, // Current position
+      0
+    },
+    { // kClientTraceDrain
+      (IOExternalMethodAction)&CodecCommanderClient::traceDrain,
+      1, // Position to read from
+      0,
+      2, // Next position, records lost
+      kIOUCVariableStructureSize // Records
     }
 };
 
+// Verbs taken from the submission ring per batch
+#define kClientRingChunk    64
+
 /*
  * Define the metaclass information that is used for runtime
  * typechecking of IOKit objects. We're a subclass of IOUserClient.
@@ -62,6 +100,16 @@ bool CodecCommanderClient::start(IOService * provider)
     
     mOpenCount = 1;
     
+    mRingLock = IOLockAlloc();
+    mDrainLoop = IOWorkLoop::workLoop();
+    mDrainTimer = IOTimerEventSource::timerEventSource(this, OSMemberFunctionCast(IOTimerEventSource::Action, this,
+                                                                                  &CodecCommanderClient::onDrainRings));
+    if (!mRingLock || !mDrainLoop || !mDrainTimer || mDrainLoop->addEventSource(mDrainTimer) != kIOReturnSuccess)
+    {
+        stop(provider);
+        return false;
+    }
+    
     return true;
 }
 
@@ -77,9 +125,52 @@ void CodecCommanderClient::stop(IOService * provider)
 {
     DebugLog("Client::stop\n");
     
+    // removing the source waits for a drain in progress
+    if (mDrainTimer)
+    {
+        mDrainTimer->cancelTimeout();
+        if (mDrainLoop)
+            mDrainLoop->removeEventSource(mDrainTimer);
+    }
+    OSSafeReleaseNULL(mDrainTimer);
+    OSSafeReleaseNULL(mDrainLoop);
+    
+    if (mRingLock)
+    {
+        IOLockLock(mRingLock);
+        OSSafeReleaseNULL(mRings);
+        IOLockUnlock(mRingLock);
+        IOLockFree(mRingLock);
+        mRingLock = NULL;
+    }
+    
     super::stop(provider);
 }
 
+IOReturn CodecCommanderClient::clientMemoryForType(UInt32 type, IOOptionBits* options, IOMemoryDescriptor** memory)
+{
+    if (type != kClientMemoryRings)
+        return kIOReturnBadArgument;
+    
+    IOLockLock(mRingLock);
+    if (!mRings)
+    {
+        mRings = IOBufferMemoryDescriptor::inTaskWithOptions(kernel_task, kIODirectionInOut | kIOMemoryKernelUserShared,
+                                                             sizeof(CodecCommanderRings), PAGE_SIZE);
+        if (mRings)
+            bzero(mRings->getBytesNoCopy(), sizeof(CodecCommanderRings));
+    }
+    IOLockUnlock(mRingLock);
+    
+    if (!mRings)
+        return kIOReturnNoMemory;
+    
+    // the caller consumes this reference
+    mRings->retain();
+    *memory = mRings;
+    return kIOReturnSuccess;
+}
+
 IOReturn CodecCommanderClient::externalMethod(uint32_t selector, IOExternalMethodArguments* arguments,
                                               IOExternalMethodDispatch* dispatch, OSObject* target, void* reference)
 
@@ -92,7 +183,8 @@ IOReturn CodecCommanderClient::externalMethod(uint32_t selector, IOExternalMetho
         
         if (!target)
         {
-            if (selector == kClientExecuteVerb)
+            if (selector == kClientExecuteVerb || selector == kClientExecuteVerbs || selector == kClientDumpCodec ||
+                selector == kClientTraceControl || selector == kClientTraceDrain)
                 target = mDriver;
             else
                 target = this;
@@ -108,3 +200,250 @@ IOReturn CodecCommanderClient::executeVerb(CodecCommander* target, void* referen
     return kIOReturnSuccess;
 }
 
+IOReturn CodecCommanderClient::executeVerbs(CodecCommander* target, void* reference, IOExternalMethodArguments* arguments)
+{
+    // Large batches arrive and leave as memory descriptors instead of inline structures
+    IOMemoryDescriptor* input = arguments->structureInputDescriptor;
+    IOMemoryDescriptor* output = arguments->structureOutputDescriptor;
+    IOByteCount inputSize = input ? input->getLength() : arguments->structureInputSize;
+    IOByteCount outputSize = output ? output->getLength() : arguments->structureOutputSize;
+
+    size_t count = inputSize / sizeof(UInt32);
+    if (!count || count > kClientMaxVerbs || inputSize % sizeof(UInt32) ||
+        outputSize < count * sizeof(CodecCommanderVerbResult))
+        return kIOReturnBadArgument;
+
+    // commands, responses and status side by side
+    size_t size = count * (2 * sizeof(UInt32) + sizeof(IOReturn));
+    UInt32* commands = (UInt32*)IOMalloc(size);
+    if (!commands)
+        return kIOReturnNoMemory;
+    UInt32* responses = commands + count;
+    IOReturn* status = (IOReturn*)(responses + count);
+
+    IOReturn result = kIOReturnSuccess;
+    if (input)
+    {
+        if ((result = input->prepare()) == kIOReturnSuccess)
+        {
+            if (input->readBytes(0, commands, inputSize) != inputSize)
+                result = kIOReturnVMError;
+            input->complete();
+        }
+    }
+    else
+        memcpy(commands, arguments->structureInput, inputSize);
+
+    if (result == kIOReturnSuccess)
+    {
+        DebugLog("Client::executeVerbs: %d verbs\n", (int)count);
+        target->executeCommands(commands, count, responses, status);
+
+        // Interleave into the output layout, reusing the command buffer
+        CodecCommanderVerbResult* results = (CodecCommanderVerbResult*)commands;
+        for (size_t i = 0; i < count; i++)
+        {
+            results[i].Response = responses[i];
+            results[i].Status = status[i];
+        }
+
+        IOByteCount resultSize = count * sizeof(CodecCommanderVerbResult);
+        if (output)
+        {
+            if ((result = output->prepare()) == kIOReturnSuccess)
+            {
+                if (output->writeBytes(0, results, resultSize) != resultSize)
+                    result = kIOReturnVMError;
+                output->complete();
+            }
+            arguments->structureOutputDescriptorSize = (UInt32)resultSize;
+        }
+        else
+        {
+            memcpy(arguments->structureOutput, results, resultSize);
+            arguments->structureOutputSize = (UInt32)resultSize;
+        }
+    }
+
+    IOFree(commands, size);
+    return result;
+}
+
+IOReturn CodecCommanderClient::dumpCodec(CodecCommander* target, void* reference, IOExternalMethodArguments* arguments)
+{
+    IOMemoryDescriptor* output = arguments->structureOutputDescriptor;
+    IOByteCount outputSize = output ? output->getLength() : arguments->structureOutputSize;
+    
+    size_t size = sizeof(CodecCommanderDump) + kClientDumpMaxNodes * sizeof(CodecCommanderDumpNode);
+    CodecCommanderDump* dump = (CodecCommanderDump*)IOMalloc(size);
+    if (!dump)
+        return kIOReturnNoMemory;
+    
+    IOReturn result = kIOReturnSuccess;
+    size_t length = target->dumpCodec(dump, size);
+    
+    if (!length)
+        result = kIOReturnNotReady;
+    else if (length > outputSize)
+        result = kIOReturnNoSpace;
+    else if (output)
+    {
+        if ((result = output->prepare()) == kIOReturnSuccess)
+        {
+            if (output->writeBytes(0, dump, length) != length)
+                result = kIOReturnVMError;
+            output->complete();
+        }
+        arguments->structureOutputDescriptorSize = (UInt32)length;
+    }
+    else
+    {
+        memcpy(arguments->structureOutput, dump, length);
+        arguments->structureOutputSize = (UInt32)length;
+    }
+    
+    IOFree(dump, size);
+    return result;
+}
+
+IOReturn CodecCommanderClient::traceControl(CodecCommander* target, void* reference, IOExternalMethodArguments* arguments)
+{
+    UInt32 position = 0;
+    IOReturn result = target->setTraceEnabled(arguments->scalarInput[0] != 0, &position);
+    arguments->scalarOutput[0] = position;
+    return result;
+}
+
+IOReturn CodecCommanderClient::traceDrain(CodecCommander* target, void* reference, IOExternalMethodArguments* arguments)
+{
+    IOMemoryDescriptor* output = arguments->structureOutputDescriptor;
+    IOByteCount outputSize = output ? output->getLength() : arguments->structureOutputSize;
+    
+    UInt32 maxCount = (UInt32)(outputSize / sizeof(CodecCommanderTraceRecord));
+    if (maxCount > kClientTraceEntries)
+        maxCount = kClientTraceEntries;
+    if (!maxCount)
+        return kIOReturnBadArgument;
+    
+    size_t size = maxCount * sizeof(CodecCommanderTraceRecord);
+    CodecCommanderTraceRecord* records = (CodecCommanderTraceRecord*)IOMalloc(size);
+    if (!records)
+        return kIOReturnNoMemory;
+    
+    UInt32 position = (UInt32)arguments->scalarInput[0], count = 0, lost = 0;
+    IOReturn result = target->readTrace(&position, records, maxCount, &count, &lost);
+    
+    if (result == kIOReturnSuccess)
+    {
+        IOByteCount length = count * sizeof(CodecCommanderTraceRecord);
+        if (output)
+        {
+            if ((result = output->prepare()) == kIOReturnSuccess)
+            {
+                if (output->writeBytes(0, records, length) != length)
+                    result = kIOReturnVMError;
+                output->complete();
+            }
+            arguments->structureOutputDescriptorSize = (UInt32)length;
+        }
+        else
+        {
+            memcpy(arguments->structureOutput, records, length);
+            arguments->structureOutputSize = (UInt32)length;
+        }
+        arguments->scalarOutput[0] = position;
+        arguments->scalarOutput[1] = lost;
+    }
+    
+    IOFree(records, size);
+    return result;
+}
+
+IOReturn CodecCommanderClient::ringDoorbell(CodecCommanderClient* target, void* reference, IOExternalMethodArguments* arguments)
+{
+    // a drain that gave up on corrupt indices reports it to the next doorbell
+    IOReturn result = target->mRingError;
+    target->mRingError = kIOReturnSuccess;
+    
+    if (result == kIOReturnSuccess && !target->mRings)
+        result = kIOReturnNotReady;
+    
+    // returns right away, the verbs run on the drain workloop
+    if (result == kIOReturnSuccess)
+        target->mDrainTimer->setTimeoutMS(0);
+    
+    return result;
+}
+
+void CodecCommanderClient::onDrainRings()
+{
+    IOReturn result = drainRings();
+    
+    if (result != kIOReturnSuccess)
+    {
+        AlwaysLog("Client::drainRings failed: %08x\n", result);
+        mRingError = result;
+    }
+}
+
+IOReturn CodecCommanderClient::drainRings()
+{
+    IOLockLock(mRingLock);
+    
+    if (!mRings)
+    {
+        IOLockUnlock(mRingLock);
+        return kIOReturnNotReady;
+    }
+    
+    CodecCommanderRings* rings = (CodecCommanderRings*)mRings->getBytesNoCopy();
+    UInt32 commands[kClientRingChunk];
+    UInt32 responses[kClientRingChunk];
+    IOReturn status[kClientRingChunk];
+    IOReturn result = kIOReturnSuccess;
+    
+    // The indices live in client memory, so take a snapshot and check it
+    do
+    {
+        for (;;)
+        {
+            UInt32 completed = rings->Completed;
+            UInt32 pending = rings->Submitted - completed;
+            
+            if (!pending || isInactive())
+                break;
+            
+            if (pending > kClientRingEntries)
+            {
+                result = kIOReturnBadArgument;
+                break;
+            }
+            
+            // read the verbs only after the index that published them
+            OSMemoryBarrier();
+            
+            UInt32 count = pending < kClientRingChunk ? pending : kClientRingChunk;
+            for (UInt32 i = 0; i < count; i++)
+                commands[i] = rings->Commands[(completed + i) % kClientRingEntries];
+            
+            mDriver->executeCommands(commands, count, responses, status);
+            
+            for (UInt32 i = 0; i < count; i++)
+            {
+                CodecCommanderVerbResult* entry = &rings->Results[(completed + i) % kClientRingEntries];
+                entry->Response = responses[i];
+                entry->Status = status[i];
+            }
+            
+            // publish the results before the index
+            OSMemoryBarrier();
+            rings->Completed = completed + count;
+        }
+    } while (result == kIOReturnSuccess && CCRingRelease(rings) && !isInactive());
+    
+    if (result != kIOReturnSuccess)
+        rings->Busy = 0;
+    
+    IOLockUnlock(mRingLock);
+    return result;
+}
@@ -0,0 +1,216 @@
+/*
+ *  Released under "The GNU General Public License (GPL-2.0)"
+ *
+ *  This program is free software; you can redistribute it and/or modify it
+ *  under the terms of the GNU General Public License as published by the
+ *  Free Software Foundation; either version 2 of the License, or (at your
+ *  option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ *  or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ *  for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ *
+ */
+
+#ifndef CodecCommander_ClientInterface_h
+#define CodecCommander_ClientInterface_h
+
+// Shared between the kext and its user clients (hda-verb), plain C only
+
+// External client methods
+enum
+{
+	kClientExecuteVerb = 0,		// scalar in: verb, scalar out: response
+	kClientExecuteVerbs,		// struct in: UInt32 verbs[], struct out: CodecCommanderVerbResult[]
+	kClientRingDoorbell,		// no arguments, starts draining the shared submission ring
+	kClientDumpCodec,			// struct out: CodecCommanderDump
+	kClientTraceControl,		// scalar in: enable, scalar out: trace position
+	kClientTraceDrain,			// scalar in: position, scalar out: next position, lost records,
+								// struct out: CodecCommanderTraceRecord[]
+	kClientNumMethods
+};
+
+// Largest batch accepted by kClientExecuteVerbs
+#define kClientMaxVerbs		4096
+
+// One result per verb of a kClientExecuteVerbs batch, in submission order
+typedef struct
+{
+	UInt32 Response;	// codec response, -1 if none
+	UInt32 Status;		// IOReturn, kIOReturnSuccess when the codec answered
+} CodecCommanderVerbResult;
+
+// Codec snapshot returned by kClientDumpCodec: the header is followed by one
+// record for the root node, one for the audio function group and one per widget
+#define kClientDumpVersion			1
+#define kClientDumpParameters		0x14	// GET_PARAMETER 0x00-0x13
+#define kClientDumpMaxConnections	32
+#define kClientDumpMaxAmpInputs		16		// amp index is 4 bits
+#define kClientDumpMaxNodes			256
+
+// GET verbs (payload 0) captured for every node, index into CodecCommanderDumpNode.Verbs
+enum
+{
+	kDumpStreamFormat,		// 0xA00
+	kDumpProcCoef,			// 0xC00
+	kDumpCoefIndex,			// 0xD00
+	kDumpConnectSelect,		// 0xF01
+	kDumpProcState,			// 0xF03
+	kDumpSDISelect,			// 0xF04
+	kDumpPowerState,		// 0xF05
+	kDumpConverter,			// 0xF06
+	kDumpPinControl,		// 0xF07
+	kDumpUnsolicited,		// 0xF08
+	kDumpPinSense,			// 0xF09
+	kDumpBeep,				// 0xF0A
+	kDumpEAPD,				// 0xF0C
+	kDumpDigital1,			// 0xF0D
+	kDumpDigital2,			// 0xF0E
+	kDumpVolumeKnob,		// 0xF0F
+	kDumpGPIOData,			// 0xF15
+	kDumpGPIOMask,			// 0xF16
+	kDumpGPIODirection,		// 0xF17
+	kDumpGPIOWakeMask,		// 0xF18
+	kDumpGPIOUnsolicited,	// 0xF19
+	kDumpGPIOSticky,		// 0xF1A
+	kDumpConfigDefault,		// 0xF1C
+	kDumpSubsystemId,		// 0xF20
+	kDumpVerbCount
+};
+
+typedef struct
+{
+	UInt8 Node;
+	UInt8 ConnectionCount;			// entries in Connections (expanded, capped)
+	UInt8 AmpInCount;				// entries in AmpIn
+	UInt8 Reserved;
+	UInt32 Parameters[kClientDumpParameters];
+	UInt32 Verbs[kDumpVerbCount];
+	UInt8 Connections[kClientDumpMaxConnections];
+	UInt8 AmpIn[kClientDumpMaxAmpInputs][2];	// per input index: left, right gain/mute
+	UInt8 AmpOut[2];							// left, right gain/mute
+	UInt8 Padding[2];
+} CodecCommanderDumpNode;
+
+typedef struct
+{
+	UInt32 Version;
+	UInt32 Size;					// bytes including all records
+	UInt32 Elapsed;					// time taken in us
+	UInt8 CodecAddress;
+	UInt8 AudioRoot;				// function group node
+	UInt8 StartNode;				// first widget
+	UInt8 NodeCount;				// widgets
+	CodecCommanderDumpNode Nodes[];	// root, function group, widgets
+} CodecCommanderDump;
+
+// Verb trace, a ring of the most recent kClientTraceEntries verbs
+#define kClientTraceEntries		4096
+
+enum	// CodecCommanderTraceRecord.Lane, the kext's submission lanes
+{
+	kTraceLanePower,
+	kTraceLaneCustom,
+	kTraceLaneClient,
+	kTraceLaneDiagnostic		// codec dump
+};
+
+enum	// CodecCommanderTraceRecord.Transport
+{
+	kTraceTransportPIO,
+	kTraceTransportDMA,
+	kTraceTransportCache,		// parameter answered from the cache
+	kTraceTransportNone			// not sent (breaker open)
+};
+
+enum	// CodecCommanderTraceRecord.Status
+{
+	kTraceStatusOK,
+	kTraceStatusTimeout,
+	kTraceStatusShortCircuited,
+	kTraceStatusMarker			// not a verb: Command is kTraceMarker*, Response kTraceTransition*
+};
+
+enum	// CodecCommanderTraceRecord.Command of markers
+{
+	kTraceMarkerBegin,
+	kTraceMarkerEnd
+};
+
+enum	// CodecCommanderTraceRecord.Response of markers
+{
+	kTraceTransitionSleep,
+	kTraceTransitionWake,
+	kTraceTransitionInit
+};
+
+typedef struct
+{
+	volatile UInt32 Sequence;	// position + 1 once the record is complete
+	UInt32 Command;
+	UInt32 Response;
+	UInt32 Latency;				// us
+	UInt64 Timestamp;			// us since boot
+	UInt8 Lane;
+	UInt8 Transport;
+	UInt8 Status;
+	UInt8 Reserved[5];
+} CodecCommanderTraceRecord;
+
+// Shared memory types (IOConnectMapMemory64)
+#define kClientMemoryRings	0
+
+// Submission and completion rings mapped into the client. Both rings share
+// one index space: the response to Commands[i] is written to Results[i], so
+// Results only need to be read before the client reuses that slot.
+#define kClientRingEntries	1024
+
+typedef struct
+{
+	volatile UInt32 Submitted;	// verbs queued by the client (free running)
+	volatile UInt32 Completed;	// verbs answered by the kext (free running)
+	volatile UInt32 Busy;		// drainer role, whoever claims it rings the doorbell
+	UInt32 Reserved;
+	UInt32 Commands[kClientRingEntries];
+	CodecCommanderVerbResult Results[kClientRingEntries];
+} CodecCommanderRings;
+
+// Ring protocol, one producer (the client) and one consumer (the kext).
+// The doorbell is only rung when the producer claims the idle drainer role,
+// the kext keeps draining until it can release the role with the ring empty.
+// The doorbell returns at once, the client keeps queueing and polls Completed.
+
+// Producer: free slots, given the index of the next result still to be read
+static inline UInt32 CCRingFree(const CodecCommanderRings* rings, UInt32 read)
+{
+	return kClientRingEntries - (rings->Submitted - read);
+}
+
+// Producer: queue one verb, the caller checks CCRingFree first
+static inline void CCRingPush(CodecCommanderRings* rings, UInt32 command)
+{
+	rings->Commands[rings->Submitted % kClientRingEntries] = command;
+	__sync_synchronize();
+	rings->Submitted++;
+}
+
+// Producer: true when the caller took the drainer role and must ring the doorbell
+static inline int CCRingClaim(CodecCommanderRings* rings)
+{
+	return __sync_bool_compare_and_swap(&rings->Busy, 0, 1);
+}
+
+// Consumer: give up the drainer role, true if verbs raced in and it was taken back
+static inline int CCRingRelease(CodecCommanderRings* rings)
+{
+	rings->Busy = 0;
+	__sync_synchronize();
+	return rings->Submitted != rings->Completed && CCRingClaim(rings);
+}
+
+#endif // CodecCommander_ClientInterface_h
@@ -18,6 +18,7 @@
  */
 
 #include "CodecCommander.h"
+#include "CodecTopology.h"
 
 //REVIEW: avoids problem with Xcode 5.1.0 where -dead_strip eliminates these required symbols
 #include <libkern/OSKextLib.h>
@@ -38,6 +39,21 @@ static IOPMPowerState powerStateArray[ kPowerStateCount ] =
 
 OSDefineMetaClassAndStructors(CodecCommander, IOService)
 
+// Adaptive Send Delay: readiness poll interval, safety margin and where the result is kept
+#define kSendDelayPollMS			5
+#define kSendDelayMarginMS			10
+#define kLearnedSendDelay			"Learned Send Delay"
+
+// Upper bound reported to power management for an asynchronous sleep (us)
+#define kAsyncPowerAckTimeUS		5000000
+
+// Audio device power state is still polled this many Check Intervals apart once its
+// power changes are followed, fugue and idle are not always power management changes
+#define kPowerFallbackIntervals		10
+
+// Custom commands per batch, their responses go to the stack of the caller
+#define kCustomCommandBatch			32
+
 //REVIEW: getHDADriver and getAudioDevice are only used by "Check Infinitely"
 // Note: "Check Infinitely" should be called "Check Periodically"
 
@@ -134,6 +150,18 @@ bool CodecCommander::start(IOService *provider)
 		stop(provider);
 		return false;
 	}
+
+	// verbs come from the PM thread, workloop actions and user clients, all of them
+	// are serialized through the command gate of our workloop
+	mWorkLoop = IOWorkLoop::workLoop();
+	mCommandGate = IOCommandGate::commandGate(this);
+	if (!mWorkLoop || !mCommandGate || mWorkLoop->addEventSource(mCommandGate) != kIOReturnSuccess)
+	{
+		AlwaysLog("Error creating workloop\n");
+		stop(provider);
+		return false;
+	}
+	mIntelHDA->setCommandGate(mCommandGate);
 	
 	// Populate HDA properties for client matching
 	setNumberProperty(this, kCodecVendorID, mIntelHDA->getCodecVendorId());
@@ -151,65 +179,50 @@ bool CodecCommander::start(IOService *provider)
 	setProperty("Merged Profile", mConfiguration->mMergedConfig);
 #endif
 
+	// switch to CORB/RIRB transport if requested (only possible while the rings are unused)
+	mIntelHDA->setCommandTimeout(mConfiguration->getCommandTimeout());
+	if (mConfiguration->getUseDMACommands())
+		mIntelHDA->setCommandMode(DMA);
+
+	beginTransition(kStateInit);
+
+	// Send Delay learned during earlier cycles
+	if (OSNumber* learned = OSDynamicCast(OSNumber, provider->getProperty(kLearnedSendDelay)))
+		mLearnedSendDelay = learned->unsigned32BitValue();
+
 	if (mConfiguration->getUpdateNodes())
 	{
 		// need to wait a bit until codec can actually respond to immediate verbs
-		IOSleep(mConfiguration->getSendDelay());
+		waitForCodec();
 
 		// Fetch Pin Capabilities from the range of nodes
 		DebugLog("Getting EAPD supported node list.\n");
 		
-		mEAPDCapableNodes = OSArray::withCapacity(3);
-		if (!mEAPDCapableNodes)
-		{
-			stop(provider);
-			return false;
-		}
-		
-		UInt16 start = mIntelHDA->getStartingNode();
-		UInt16 end = start + mIntelHDA->getTotalNodes();
-		for (UInt16 node = start; node < end; node++)
-		{
-			UInt32 response = mIntelHDA->sendCommand(node, HDA_VERB_GET_PARAM, HDA_PARM_PINCAP);
-			if (response == -1)
-			{
-				DebugLog("Failed to retrieve pin capabilities for node 0x%02x.\n", node);
-				continue;
-			}
-			
-			// if bit 16 is set in pincap - node supports EAPD
-			if (HDA_PINCAP_IS_EAPD_CAPABLE(response))
-			{
-				OSNumber* num = OSNumber::withNumber(node, 16);
-				if (num)
-				{
-					mEAPDCapableNodes->setObject(num);
-					num->release();
-				}
-				AlwaysLog("Node ID 0x%02x supports EAPD, will update state after sleep.\n", node);
-			}
-		}
+		if (CodecTopology* topology = mIntelHDA->getTopology())
+			mEAPDCapableNodes = topology->getEAPDCapablePins(&mEAPDCapableNodeCount);
+		else
+			AlwaysLog("Failed to enumerate codec widgets, EAPD will not be updated.\n");
+
+		for (int i = 0; i < mEAPDCapableNodeCount; i++)
+			AlwaysLog("Node ID 0x%02x supports EAPD, will update state after sleep.\n", mEAPDCapableNodes[i]);
 	}
 	
 	// Execute any custom commands registered for initialization
 	customCommands(kStateInit);
+	endTransition();
 	
-    // init power state management & set state as PowerOn
-    PMinit();
-    registerPowerDriver(this, powerStateArray, kPowerStateCount);
-	provider->joinPMtree(this);
+	// with the CORB/RIRB in our hands, jack events arrive as unsolicited responses
+	bool unsolicited = mIntelHDA->getCommandMode() == DMA;
 
-	// no need to start timer unless "Check Infinitely" is enabled
 	if (mConfiguration->getCheckInfinite())
 	{
 		DebugLog("Infinite workloop requested, will start now!\n");
 
-		// setup workloop and timer
-		mWorkLoop = IOWorkLoop::workLoop();
+		// timer polls only until the audio device shows up, see onTimerAction
 		mTimer = IOTimerEventSource::timerEventSource(this,
 													  OSMemberFunctionCast(IOTimerEventSource::Action, this,
 													  &CodecCommander::onTimerAction));
-		if (!mWorkLoop || !mTimer)
+		if (!mTimer)
 		{
 			stop(provider);
 			return false;
@@ -222,6 +235,29 @@ bool CodecCommander::start(IOService *provider)
 		}
 	}
 
+	if (mConfiguration->getAsyncPowerTransitions())
+	{
+		mPowerLock = IOLockAlloc();
+		mPowerTimer = IOTimerEventSource::timerEventSource(this,
+														   OSMemberFunctionCast(IOTimerEventSource::Action, this,
+														   &CodecCommander::onPowerAction));
+		if (!mPowerLock || !mPowerTimer || mWorkLoop->addEventSource(mPowerTimer) != kIOReturnSuccess)
+		{
+			stop(provider);
+			return false;
+		}
+	}
+
+	if (unsolicited && setupUnsolicitedEvents())
+		enableJackSense();
+
+    // init power state management & set state as PowerOn
+    PMinit();
+    registerPowerDriver(this, powerStateArray, kPowerStateCount);
+	provider->joinPMtree(this);
+
+	publishStatistics();
+
 	this->registerService(0);
     return true;
 }
@@ -239,6 +275,33 @@ void CodecCommander::stop(IOService *provider)
 	if (mWorkLoop && mTimer)
 		mWorkLoop->removeEventSource(mTimer);
     OSSafeReleaseNULL(mTimer);// disable outstanding calls
+	if (mPowerTimer)
+	{
+		mPowerTimer->cancelTimeout();
+		mWorkLoop->removeEventSource(mPowerTimer);
+		cancelPendingPowerState();
+	}
+	OSSafeReleaseNULL(mPowerTimer);
+	if (mPowerLock)
+	{
+		IOLockFree(mPowerLock);
+		mPowerLock = NULL;
+	}
+	if (mInterruptSource)
+	{
+		mInterruptSource->disable();
+		if (mIntelHDA)
+			mIntelHDA->disableUnsolicitedResponses();
+		mWorkLoop->removeEventSource(mInterruptSource);
+	}
+	OSSafeReleaseNULL(mInterruptSource);
+	if (mCommandGate)
+	{
+		if (mIntelHDA)
+			mIntelHDA->setCommandGate(NULL);
+		mWorkLoop->removeEventSource(mCommandGate);
+	}
+	OSSafeReleaseNULL(mCommandGate);
     OSSafeReleaseNULL(mWorkLoop);
 	
     PMstop();
@@ -251,7 +314,11 @@ void CodecCommander::stop(IOService *provider)
 	delete mConfiguration;
 	mConfiguration = NULL;
 	
-	OSSafeReleaseNULL(mEAPDCapableNodes);
+	mEAPDCapableNodes = NULL;
+	mEAPDCapableNodeCount = 0;
+	if (mPowerInterest && mAudioDevice)
+		mAudioDevice->deRegisterInterestedDriver(this);
+	mPowerInterest = false;
 	OSSafeReleaseNULL(mAudioDevice);
 	mProvider = NULL;
 
@@ -263,14 +330,43 @@ void CodecCommander::stop(IOService *provider)
  ******************************************************************************/
 void CodecCommander::onTimerAction()
 {
-	mTimer->setTimeoutMS(mConfiguration->getCheckInterval());
-
 	IOAudioDevice* audioDevice = getAudioDevice();
-	if (!audioDevice)
-		return;
 
+	// once the audio device is known its power changes are delivered through
+	// powerStateDidChangeTo, polling only catches what those miss
+	if (audioDevice && !mPowerInterest)
+	{
+		audioDevice->registerInterestedDriver(this);
+		mPowerInterest = true;
+		DebugLog("Following audio device power changes, polling slowed down\n");
+	}
+
+	UInt32 interval = mConfiguration->getCheckInterval();
+	mTimer->setTimeoutMS(mPowerInterest ? interval * kPowerFallbackIntervals : interval);
+
+	if (audioDevice)
+		checkPowerState();
+}
+
+/******************************************************************************
+ * CodecCommander::powerStateDidChangeTo - audio device changed power state
+ ******************************************************************************/
+IOReturn CodecCommander::powerStateDidChangeTo(IOPMPowerFlags capabilities, unsigned long stateNumber, IOService* whatDevice)
+{
+	// evaluate on the workloop, just like a timer tick
+	if (mPowerInterest && mTimer && whatDevice == mAudioDevice)
+		mTimer->setTimeoutMS(0);
+
+	return IOPMAckImplied;
+}
+
+/******************************************************************************
+ * CodecCommander::checkPowerState - handle codec power transitions (fugue state)
+ ******************************************************************************/
+void CodecCommander::checkPowerState()
+{
     // check if hda codec is powered - we are monitoring ocurrences of fugue state
-	IOAudioDevicePowerState powerState = audioDevice->getPowerState();
+	IOAudioDevicePowerState powerState = getAudioDevice()->getPowerState();
 	
 	// if hda codec changed power state
 	if (powerState != mHDAPrevPowerState)
@@ -297,11 +393,142 @@ void CodecCommander::onTimerAction()
 	}
 }
 
+/******************************************************************************
+ * CodecCommander::setupUnsolicitedEvents - attach to the controller interrupt
+ ******************************************************************************/
+bool CodecCommander::setupUnsolicitedEvents()
+{
+	IOPCIDevice* device = mIntelHDA->getDevice();
+	if (!device)
+		return false;
+
+	// prefer MSI if the controller provides it
+	int source = 0, type = 0;
+	for (int index = 0; device->getInterruptType(index, &type) == kIOReturnSuccess; index++)
+	{
+		if (type & kIOInterruptTypePCIMessaged)
+		{
+			source = index;
+			break;
+		}
+	}
+
+	mInterruptSource = IOFilterInterruptEventSource::filterInterruptEventSource(this,
+													OSMemberFunctionCast(IOInterruptEventSource::Action, this,
+													&CodecCommander::onInterrupt),
+													&CodecCommander::interruptFilter, device, source);
+	if (!mInterruptSource || mWorkLoop->addEventSource(mInterruptSource) != kIOReturnSuccess)
+	{
+		// normally the audio driver owns the interrupt
+		AlwaysLog("Unable to attach to controller interrupt, jack sense not available\n");
+		OSSafeReleaseNULL(mInterruptSource);
+		return false;
+	}
+
+	mInterruptSource->enable();
+
+	if (!mIntelHDA->enableUnsolicitedResponses())
+	{
+		mInterruptSource->disable();
+		mWorkLoop->removeEventSource(mInterruptSource);
+		OSSafeReleaseNULL(mInterruptSource);
+		return false;
+	}
+
+	return true;
+}
+
+/******************************************************************************
+ * CodecCommander::interruptFilter - primary interrupt, only touches registers
+ ******************************************************************************/
+bool CodecCommander::interruptFilter(OSObject* owner, IOFilterInterruptEventSource* source)
+{
+	CodecCommander* commander = (CodecCommander*)owner;
+
+	return commander->mIntelHDA && commander->mIntelHDA->acknowledgeInterrupt();
+}
+
+/******************************************************************************
+ * CodecCommander::onInterrupt - drain unsolicited responses on the workloop
+ ******************************************************************************/
+void CodecCommander::onInterrupt(IOInterruptEventSource* source, int count)
+{
+	UInt32 responses[kHDAUnsolicitedQueueSize];
+	UInt32 received = mIntelHDA->getUnsolicitedResponses(responses, kHDAUnsolicitedQueueSize);
+
+	for (UInt32 i = 0; i < received; i++)
+		handleUnsolicitedResponse(responses[i]);
+}
+
+/******************************************************************************
+ * CodecCommander::enableJackSense - request unsolicited responses from jack pins
+ ******************************************************************************/
+void CodecCommander::enableJackSense()
+{
+	if (!mInterruptSource)
+		return;
+
+	CodecTopology* topology = mIntelHDA->getTopology();
+	if (!topology)
+		return;
+
+	UInt8 pins[32];
+	UInt8 count = topology->getJackPins(pins, sizeof(pins));
+
+	UInt32 commands[32];
+	UInt32 enabled = 0;
+	for (int i = 0; i < count; i++)
+	{
+		// the tag of each pin is its node id, which must fit in 6 bits
+		UInt8 node = pins[i];
+		if (node > 0x3F ||
+			!HDA_WCAP_IS_UNSOL_CAPABLE(topology->getWidgetCaps(node)) ||
+			!HDA_PINCAP_IS_PRESENCE_DETECT(topology->getPinCaps(node)))
+			continue;
+
+		commands[enabled++] = HDA_COMMAND(node, HDA_VERB_SET_UNSOL_ENABLE, HDA_UNSOL_ENABLE(node));
+	}
+
+	if (enabled)
+		mIntelHDA->sendCommands(commands, enabled, commands);
+
+	DebugLog("Jack sense enabled on %d pins\n", enabled);
+}
+
+/******************************************************************************
+ * CodecCommander::handleUnsolicitedResponse - dispatch a jack event
+ ******************************************************************************/
+void CodecCommander::handleUnsolicitedResponse(UInt32 response)
+{
+	UInt8 node = HDA_UNSOL_TAG(response);
+
+	UInt32 sense = mIntelHDA->sendCommand(node, HDA_VERB_GET_PIN_SENSE, HDA_PARM_NULL);
+	if (sense == (UInt32)-1)
+		return;
+
+	bool present = HDA_PIN_SENSE_IS_PRESENT(sense);
+	DebugLog("Jack at node 0x%02x %s\n", node, present ? "plugged" : "unplugged");
+
+	// some codecs drop EAPD on the speaker pins when headphones are unplugged
+	// (the codec just answered, so no Send Delay - it would stall the workloop)
+	if (!present && !mEAPDPoweredDown && mConfiguration->getUpdateNodes())
+		setEAPD(0x02, false);
+}
+
 /******************************************************************************
  * CodecCommander::handleStateChange - handles transitioning from one state to another, i.e. sleep --> wake
  ******************************************************************************/
 void CodecCommander::handleStateChange(IOAudioDevicePowerState newState)
 {
+	beginTransition(newState == kIOAudioDeviceSleep ? kStateSleep : kStateWake);
+
+	// a codec that stopped answering is reset right away instead of timing out node by node
+	if (!mIntelHDA->isCodecResponsive() && mConfiguration->getPerformResetOnEAPDFail())
+	{
+		AlwaysLog("BLURP! codec not responding... attempt fix with codec reset\n");
+		performCodecReset();
+	}
+
 	switch (newState)
 	{
 		case kIOAudioDeviceSleep:
@@ -318,11 +545,17 @@ void CodecCommander::handleStateChange(IOAudioDevicePowerState newState)
 
 			customCommands(kStateSleep);
 			mEAPDPoweredDown = true;
+
+			// codec loses power, memoized parameters are re-read on wake
+			mIntelHDA->invalidateParameterCache();
 			break;
 
 		case kIOAudioDeviceIdle:	// note kIOAudioDeviceIdle is not used
 		case kIOAudioDeviceActive:
+		{
+			UInt64 start = getMicroseconds();
 			mIntelHDA->applyIntelTCSEL();
+			mProfiler.record(kPhaseTCSEL, start);
 			
 			if (mConfiguration->getUpdateNodes())
 			{
@@ -336,7 +569,65 @@ void CodecCommander::handleStateChange(IOAudioDevicePowerState newState)
 
 			customCommands(kStateWake);
 			mEAPDPoweredDown = false;
+
+			// unsolicited enables do not survive codec power loss
+			enableJackSense();
 			break;
+		}
+	}
+
+	if (endTransition())
+		publishStatistics();
+}
+
+/******************************************************************************
+ * CodecCommander::beginTransition - start profiling (and tracing) a transition
+ ******************************************************************************/
+static const char* kTransitionNames[] = { "Sleep", "Wake", "Init" };
+static const UInt32 kTransitionMarkers[] = { kTraceTransitionSleep, kTraceTransitionWake, kTraceTransitionInit };
+
+void CodecCommander::beginTransition(CodecCommanderState state)
+{
+	// nested transitions are part of the outer one
+	if (!mProfiler.beginTransition(kTransitionNames[state]))
+		return;
+
+	mTransition = state;
+	mIntelHDA->traceMarker(kTraceMarkerBegin, kTransitionMarkers[state]);
+
+	// a pin that timed out before (i.e. while powering down) may well answer now
+	mIntelHDA->resetNodeBreakers();
+}
+
+/******************************************************************************
+ * CodecCommander::endTransition - true if this closed the outermost transition
+ ******************************************************************************/
+bool CodecCommander::endTransition()
+{
+	if (!mProfiler.endTransition())
+		return false;
+
+	mIntelHDA->traceMarker(kTraceMarkerEnd, kTransitionMarkers[mTransition]);
+	return true;
+}
+
+/******************************************************************************
+ * CodecCommander::publishStatistics - export command path statistics
+ ******************************************************************************/
+void CodecCommander::publishStatistics()
+{
+	OSDictionary* statistics = mIntelHDA->createStatistics();
+	if (statistics)
+	{
+		setProperty("Command Statistics", statistics);
+		statistics->release();
+	}
+
+	OSDictionary* profile = mProfiler.createDictionary();
+	if (profile)
+	{
+		setProperty("Transition Profile", profile);
+		profile->release();
 	}
 }
 
@@ -345,47 +636,115 @@ void CodecCommander::handleStateChange(IOAudioDevicePowerState newState)
  ******************************************************************************/
 void CodecCommander::customCommands(CodecCommanderState newState)
 {
-	OSCollectionIterator* iterator = OSCollectionIterator::withCollection(mConfiguration->getCustomCommands());
-	if (!iterator) return;
-	
-	while (OSData* data = OSDynamicCast(OSData, iterator->getNextObject()))
+	UInt32 count;
+	const UInt32* commands = mConfiguration->getCustomCommands(newState, &count);
+	if (!count) return;
+
+	UInt64 start = getMicroseconds();
+#ifdef DEBUG
+	for (UInt32 i = 0; i < count; i++)
+		DebugLog("--> custom command 0x%08x\n", commands[i]);
+#endif
+
+	// The power thread and (sync mode with Check Infinitely) the timer both get here, so
+	// each call has its own responses. Profiles have a few commands, that is one batch.
+	UInt32 responses[kCustomCommandBatch];
+	for (UInt32 sent = 0; sent < count; sent += kCustomCommandBatch)
 	{
-		CustomCommand* customCommand = (CustomCommand*)data->getBytesNoCopy();
+		UInt32 batch = count - sent < kCustomCommandBatch ? count - sent : kCustomCommandBatch;
+		mIntelHDA->sendCommands(commands + sent, batch, responses, NULL, kHDALaneCustom);
+	}
+	mProfiler.record(kPhaseCustomCommands, start);
+}
+
+/******************************************************************************
+ * CodecCommander::waitForCodec - wait until the codec can take verbs
+ ******************************************************************************/
+void CodecCommander::waitForCodec()
+{
+	UInt32 sendDelay = mConfiguration->getSendDelay();
+	UInt64 start = getMicroseconds();
 
-		if ((customCommand->OnInit && (newState == kStateInit)) ||
-			(customCommand->OnWake && (newState == kStateWake)) ||
-			(customCommand->OnSleep && (newState == kStateSleep)))
+	if (!mConfiguration->getAdaptiveSendDelay())
+	{
+		IOSleep(sendDelay);
+		mProfiler.record(kPhaseSendDelay, start);
+		return;
+	}
+
+	// with the pin check EAPD pins must answer too, not just the function group (at init the
+	// pins are only found once the codec answers, so only the function group is polled)
+	const UInt8* pins = NULL;
+	UInt8 pinCount = 0;
+	if (mConfiguration->getPinReadinessCheck())
+	{
+		if (mEAPDCapableNodeCount)
 		{
-			for (int i = 0; i < customCommand->CommandCount; i++)
-			{
-				DebugLog("--> custom command 0x%08x\n", customCommand->Commands[i]);
-				executeCommand(customCommand->Commands[i]);
-			}
+			pins = mEAPDCapableNodes;
+			pinCount = mEAPDCapableNodeCount;
 		}
+		else
+			DebugLog("No EAPD pins known, Pin Readiness Check polls the function group only\n");
 	}
-	
-	iterator->release();
+
+	// poll until the codec answers, Send Delay is the upper bound
+	UInt32 elapsed = 0;
+	bool ready;
+	while (!(ready = mIntelHDA->isCodecReady(pins, pinCount)) && elapsed < sendDelay)
+	{
+		IOSleep(kSendDelayPollMS);
+		elapsed = (UInt32)((getMicroseconds() - start) / 1000);
+	}
+
+	if (ready)
+	{
+		// learn ready time plus margin: grow at once, shrink slowly
+		UInt32 target = elapsed + elapsed / 4 + kSendDelayMarginMS;
+		if (target >= mLearnedSendDelay)
+			mLearnedSendDelay = target;
+		else
+			mLearnedSendDelay = (mLearnedSendDelay * 3 + target) / 4;
+	}
+	else
+		mLearnedSendDelay = sendDelay;
+
+	if (mLearnedSendDelay > sendDelay)
+		mLearnedSendDelay = sendDelay;
+
+	// keep the safety margin beyond the moment the codec answered
+	if (elapsed < mLearnedSendDelay)
+		IOSleep(mLearnedSendDelay - elapsed);
+	mProfiler.record(kPhaseSendDelay, start);
+
+	DebugLog("Codec %s after %d ms, learned send delay %d ms\n", ready ? "ready" : "not ready", elapsed, mLearnedSendDelay);
+
+	// kept on the codec nub so it survives across cycles and driver reloads
+	setNumberProperty(mProvider, kLearnedSendDelay, mLearnedSendDelay);
 }
 
 /******************************************************************************
  * CodecCommander::setOutputs - set EAPD status bit on SP/HP
  ******************************************************************************/
-bool CodecCommander::setEAPD(UInt8 logicLevel)
+bool CodecCommander::setEAPD(UInt8 logicLevel, bool wait)
 {
     // some codecs will produce loud pop when EAPD is enabled too soon, need custom delay until codec inits
-    IOSleep(mConfiguration->getSendDelay());
+    if (wait)
+        waitForCodec();
 	
     // for nodes supporting EAPD bit 1 in logicLevel defines EAPD logic state: 1 - enable, 0 - disable
-	OSCollectionIterator* iterator = OSCollectionIterator::withCollection(mEAPDCapableNodes);
-	if (!iterator) return true;
-	
-	bool result = true;
-	while (OSNumber* nodeId = OSDynamicCast(OSNumber, iterator->getNextObject()))
-	{
-		if (-1 == mIntelHDA->sendCommand(nodeId->unsigned8BitValue(), HDA_VERB_EAPDBTL_SET, logicLevel))
-			result = false;
-	}
-	iterator->release();
+	UInt32 count = mEAPDCapableNodeCount;
+	if (!count) return true;
+
+	UInt64 start = getMicroseconds();
+	UInt32* commands = (UInt32*)IOMalloc(count * sizeof(UInt32));
+	if (!commands) return false;
+
+	for (UInt32 i = 0; i < count; i++)
+		commands[i] = HDA_COMMAND(mEAPDCapableNodes[i], HDA_VERB_EAPDBTL_SET, logicLevel);
+
+	bool result = mIntelHDA->sendCommands(commands, count, commands) == count;
+	IOFree(commands, count * sizeof(UInt32));
+	mProfiler.record(kPhaseEAPD, start);
 
 	return result;
 }
@@ -402,7 +761,9 @@ void CodecCommander::performCodecReset()
 
     if (!mColdBoot)
 	{
+		UInt64 start = getMicroseconds();
 		mIntelHDA->resetCodec();
+		mProfiler.record(kPhaseReset, start);
         mEAPDPoweredDown = true;
     }
 }
@@ -414,6 +775,31 @@ IOReturn CodecCommander::setPowerState(unsigned long powerStateOrdinal, IOServic
 {
 	DebugLog("setPowerState %ld\n", powerStateOrdinal);
 
+	if (mPowerTimer)
+		return queuePowerState(powerStateOrdinal, false, this);
+
+	performPowerState(powerStateOrdinal);
+	return IOPMAckImplied;
+}
+
+IOReturn CodecCommander::setPowerStateExternal(unsigned long powerStateOrdinal, IOService *powerHook)
+{
+	DebugLog("setPowerStateExternal %ld\n", powerStateOrdinal);
+
+	if (mPowerTimer)
+		return queuePowerState(powerStateOrdinal, true, powerHook);
+
+	performPowerStateExternal(powerStateOrdinal);
+	return IOPMAckImplied;
+}
+
+/******************************************************************************
+ * CodecCommander::performPowerState - codec work for a power state change
+ ******************************************************************************/
+void CodecCommander::performPowerState(unsigned long powerStateOrdinal)
+{
+	beginTransition(powerStateOrdinal == kPowerStateSleep ? kStateSleep : kStateWake);
+
 	switch (powerStateOrdinal)
 	{
 		case kPowerStateSleep:
@@ -452,12 +838,13 @@ IOReturn CodecCommander::setPowerState(unsigned long powerStateOrdinal, IOServic
 			break;
 	}
 	
-    return IOPMAckImplied;
+	if (endTransition())
+		publishStatistics();
 }
 
-IOReturn CodecCommander::setPowerStateExternal(unsigned long powerStateOrdinal, IOService *policyMaker)
+void CodecCommander::performPowerStateExternal(unsigned long powerStateOrdinal)
 {
-	DebugLog("setPowerStateExternal %ld\n", powerStateOrdinal);
+	beginTransition(powerStateOrdinal == kPowerStateSleep ? kStateSleep : kStateWake);
 
 	switch (powerStateOrdinal)
 	{
@@ -481,7 +868,153 @@ IOReturn CodecCommander::setPowerStateExternal(unsigned long powerStateOrdinal,
 			break;
 	}
 
-	return IOPMAckImplied;
+	if (endTransition())
+		publishStatistics();
+}
+
+/******************************************************************************
+ * CodecCommander::queuePowerState - hand a power transition to the workloop
+ ******************************************************************************/
+IOReturn CodecCommander::queuePowerState(unsigned long powerStateOrdinal, bool external, IOService* ackTarget)
+{
+	bool sleep = powerStateOrdinal == kPowerStateSleep;
+	int source = external ? 1 : 0;
+
+	IOLockLock(mPowerLock);
+
+	if (mPendingPowerState[source] != (unsigned long)-1)
+	{
+		// a queued transition that has not started yet is cancelled by one in the
+		// opposite direction from the same source (i.e. sleep followed by wake during
+		// fugue), neither runs; the other source keeps its own queued transition
+		if ((mPendingPowerState[source] == kPowerStateSleep) != sleep)
+		{
+			DebugLog("--> queued power state %ld cancelled by %ld\n", mPendingPowerState[source], powerStateOrdinal);
+
+			IOService* ack = mPendingAcks[source];
+			mPendingPowerState[source] = -1;
+			mPendingAcks[source] = NULL;
+			mPendingExternalFirst = !external;
+			IOLockUnlock(mPowerLock);
+
+			if (ack)
+				ack->acknowledgeSetPowerState();
+			return IOPMAckImplied;
+		}
+
+		// same direction again, completes with the queued one
+		bool wait = sleep && !mPendingAcks[source];
+		if (wait)
+			mPendingAcks[source] = ackTarget;
+		IOLockUnlock(mPowerLock);
+		return wait ? kAsyncPowerAckTimeUS : IOPMAckImplied;
+	}
+
+	if (mPendingPowerState[!source] == (unsigned long)-1)
+		mPendingExternalFirst = external;
+	mPendingPowerState[source] = powerStateOrdinal;
+
+	// wake is acknowledged right away so nothing waits on the codec, sleep must
+	// finish before power goes away and is acknowledged once done
+	mPendingAcks[source] = sleep ? ackTarget : NULL;
+
+	IOLockUnlock(mPowerLock);
+
+	mPowerTimer->setTimeoutMS(0);
+
+	return sleep ? kAsyncPowerAckTimeUS : IOPMAckImplied;
+}
+
+/******************************************************************************
+ * CodecCommander::cancelPendingPowerState - drop queued transitions, release waiters
+ ******************************************************************************/
+void CodecCommander::cancelPendingPowerState()
+{
+	IOService* acks[2];
+	UInt32 count = 0;
+	unsigned long powerStateOrdinal;
+
+	IOLockLock(mPowerLock);
+	do
+		count += dequeuePowerState(&powerStateOrdinal, NULL, NULL, acks + count);
+	while (powerStateOrdinal != (unsigned long)-1);
+	IOLockUnlock(mPowerLock);
+
+	for (UInt32 i = 0; i < count; i++)
+		acks[i]->acknowledgeSetPowerState();
+}
+
+/******************************************************************************
+ * CodecCommander::dequeuePowerState - take the earliest queued transition (lock held)
+ ******************************************************************************/
+UInt32 CodecCommander::dequeuePowerState(unsigned long* powerStateOrdinal, bool* internal, bool* external, IOService** acks)
+{
+	int first = mPendingExternalFirst ? 1 : 0;
+	if (mPendingPowerState[first] == (unsigned long)-1)
+		first = !first;
+	unsigned long state = mPendingPowerState[first];
+
+	// the other source in the same direction runs along; the source is remembered so
+	// that a power hook wake queued with CC's own wake still runs the external path
+	bool take[2] = { false, false };
+	if (state != (unsigned long)-1)
+	{
+		take[first] = true;
+		unsigned long other = mPendingPowerState[!first];
+		take[!first] = other != (unsigned long)-1 && (other == kPowerStateSleep) == (state == kPowerStateSleep);
+	}
+
+	UInt32 count = 0;
+	for (int i = 0; i < 2; i++)
+	{
+		if (!take[i])
+			continue;
+		if (mPendingAcks[i])
+			acks[count++] = mPendingAcks[i];
+		mPendingPowerState[i] = -1;
+		mPendingAcks[i] = NULL;
+	}
+	// whatever is left runs next
+	mPendingExternalFirst = first == 0;
+
+	if (powerStateOrdinal)
+		*powerStateOrdinal = state;
+	if (internal)
+		*internal = take[0];
+	if (external)
+		*external = take[1];
+
+	return count;
+}
+
+/******************************************************************************
+ * CodecCommander::onPowerAction - run queued power transitions on the workloop
+ ******************************************************************************/
+void CodecCommander::onPowerAction()
+{
+	IOLockLock(mPowerLock);
+	for (;;)
+	{
+		unsigned long powerStateOrdinal;
+		bool internal, external;
+		IOService* acks[2];
+		UInt32 count = dequeuePowerState(&powerStateOrdinal, &internal, &external, acks);
+		if (powerStateOrdinal == (unsigned long)-1)
+			break;
+		IOLockUnlock(mPowerLock);
+
+		// same order as synchronous transitions, CC's own first, then the power hook's
+		if (internal)
+			performPowerState(powerStateOrdinal);
+		if (external)
+			performPowerStateExternal(powerStateOrdinal);
+
+		for (UInt32 i = 0; i < count; i++)
+			acks[i]->acknowledgeSetPowerState();
+
+		IOLockLock(mPowerLock);
+	}
+	IOLockUnlock(mPowerLock);
 }
 
 /******************************************************************************
@@ -490,11 +1023,210 @@ IOReturn CodecCommander::setPowerStateExternal(unsigned long powerStateOrdinal,
 UInt32 CodecCommander::executeCommand(UInt32 command)
 {
 	if (mIntelHDA)
-		return mIntelHDA->sendCommand(command);
+		return mIntelHDA->sendCommand(command, kHDALaneClient);
 	
 	return -1;
 }
 
+/******************************************************************************
+ * CodecCommander::executeCommands - Execute a batch of external commands
+ ******************************************************************************/
+UInt32 CodecCommander::executeCommands(const UInt32* commands, size_t count, UInt32* responses, IOReturn* status)
+{
+	if (mIntelHDA)
+		return mIntelHDA->sendCommands(commands, count, responses, status, kHDALaneClient);
+	
+	for (size_t i = 0; i < count; i++)
+	{
+		responses[i] = -1;
+		status[i] = kIOReturnNotReady;
+	}
+	return 0;
+}
+
+/******************************************************************************
+ * CodecCommander::setTraceEnabled - Start/stop recording verbs into the trace
+ ******************************************************************************/
+IOReturn CodecCommander::setTraceEnabled(bool enable, UInt32* position)
+{
+	if (!mIntelHDA)
+		return kIOReturnNotReady;
+	
+	if (!mIntelHDA->setTraceEnabled(enable))
+		return kIOReturnNoMemory;
+	
+	*position = mIntelHDA->getTracePosition();
+	return kIOReturnSuccess;
+}
+
+/******************************************************************************
+ * CodecCommander::readTrace - Copy trace records from position onwards
+ ******************************************************************************/
+IOReturn CodecCommander::readTrace(UInt32* position, CodecCommanderTraceRecord* records, UInt32 maxCount, UInt32* count, UInt32* lost)
+{
+	if (!mIntelHDA)
+		return kIOReturnNotReady;
+	
+	*position = mIntelHDA->readTrace(*position, records, maxCount, count, lost);
+	return kIOReturnSuccess;
+}
+
+/******************************************************************************
+ * CodecCommander::dumpCodec - Snapshot of all nodes for the user client
+ ******************************************************************************/
+static const UInt16 kDumpVerbs[kDumpVerbCount] =
+{
+	0xA00, 0xC00, 0xD00, 0xF01, 0xF03, 0xF04, 0xF05, 0xF06, 0xF07, 0xF08, 0xF09, 0xF0A,
+	0xF0C, 0xF0D, 0xF0E, 0xF0F, 0xF15, 0xF16, 0xF17, 0xF18, 0xF19, 0xF1A, 0xF1C, 0xF20
+};
+
+size_t CodecCommander::dumpCodec(CodecCommanderDump* dump, size_t size)
+{
+	if (!mIntelHDA)
+		return 0;
+	
+	UInt64 start = getMicroseconds();
+	UInt8 audioRoot = mIntelHDA->getAudioRoot();
+	UInt8 startNode = mIntelHDA->getStartingNode();
+	UInt8 nodeCount = mIntelHDA->getTotalNodes();
+	int records = nodeCount + 2;
+	size_t needed = sizeof(CodecCommanderDump) + records * sizeof(CodecCommanderDumpNode);
+	
+	if (records > kClientDumpMaxNodes || needed > size)
+		return 0;
+	
+	bzero(dump, needed);
+	dump->Version = kClientDumpVersion;
+	dump->Size = (UInt32)needed;
+	dump->CodecAddress = mIntelHDA->getCodecAddress();
+	dump->AudioRoot = audioRoot;
+	dump->StartNode = startNode;
+	dump->NodeCount = nodeCount;
+	
+	dump->Nodes[0].Node = 0;
+	dump->Nodes[1].Node = audioRoot;
+	for (int i = 0; i < nodeCount; i++)
+		dump->Nodes[i + 2].Node = startNode + i;
+	
+	// First batch: every parameter and GET verb of every node. Second batch: up to 64
+	// long form connection list responses and the amp values of each widget
+	const int perNode = kClientDumpParameters + kDumpVerbCount;
+	const int perWidget = 64 + 2 * kClientDumpMaxAmpInputs + 2;
+	size_t bufferSize = records * (perNode > perWidget ? perNode : perWidget) * sizeof(UInt32);
+	UInt32* verbs = (UInt32*)IOMalloc(bufferSize);
+	if (!verbs)
+		return 0;
+	
+	UInt32 count = 0;
+	for (int i = 0; i < records; i++)
+	{
+		for (int parameter = 0; parameter < kClientDumpParameters; parameter++)
+			verbs[count++] = HDA_COMMAND(dump->Nodes[i].Node, HDA_VERB_GET_PARAM, parameter);
+		for (int verb = 0; verb < kDumpVerbCount; verb++)
+			verbs[count++] = HDA_COMMAND(dump->Nodes[i].Node, kDumpVerbs[verb], HDA_PARM_NULL);
+	}
+	
+	mIntelHDA->sendCommands(verbs, count, verbs, NULL, kHDALaneDiagnostic);
+	
+	count = 0;
+	for (int i = 0; i < records; i++)
+	{
+		memcpy(dump->Nodes[i].Parameters, verbs + count, sizeof(dump->Nodes[i].Parameters));
+		count += kClientDumpParameters;
+		memcpy(dump->Nodes[i].Verbs, verbs + count, sizeof(dump->Nodes[i].Verbs));
+		count += kDumpVerbCount;
+	}
+	
+	// Second batch, as far as the capabilities read above say they exist
+	count = 0;
+	for (int i = 2; i < records; i++)
+	{
+		CodecCommanderDumpNode* node = &dump->Nodes[i];
+		UInt32 caps = node->Parameters[HDA_PARM_WIDGETCAP];
+		UInt32 connList = node->Parameters[HDA_PARM_CONNLIST_LEN];
+		
+		if (caps == (UInt32)-1)
+			continue;
+		
+		if (HDA_WCAP_HAS_CONN_LIST(caps))
+		{
+			UInt32 perResponse = HDA_CONNLIST_IS_LONG_FORM(connList) ? 2 : 4;
+			for (UInt32 entry = 0; entry < HDA_CONNLIST_LENGTH(connList); entry += perResponse)
+				verbs[count++] = HDA_COMMAND(node->Node, HDA_VERB_GET_CONN_LIST, entry);
+		}
+		
+		if (HDA_WCAP_HAS_IN_AMP(caps))
+		{
+			node->AmpInCount = HDA_CONNLIST_LENGTH(connList);
+			if (node->AmpInCount > kClientDumpMaxAmpInputs)
+				node->AmpInCount = kClientDumpMaxAmpInputs;
+			if (!node->AmpInCount)
+				node->AmpInCount = 1;
+			
+			for (int index = 0; index < node->AmpInCount; index++)
+			{
+				verbs[count++] = HDA_COMMAND_LONG(node->Node, HDA_VERB_GET_AMP_GAIN, HDA_PARM_AMP_GAIN_GET(index, 1, 0));
+				verbs[count++] = HDA_COMMAND_LONG(node->Node, HDA_VERB_GET_AMP_GAIN, HDA_PARM_AMP_GAIN_GET(index, 0, 0));
+			}
+		}
+		
+		if (HDA_WCAP_HAS_OUT_AMP(caps))
+		{
+			verbs[count++] = HDA_COMMAND_LONG(node->Node, HDA_VERB_GET_AMP_GAIN, HDA_PARM_AMP_GAIN_GET(0, 1, 1));
+			verbs[count++] = HDA_COMMAND_LONG(node->Node, HDA_VERB_GET_AMP_GAIN, HDA_PARM_AMP_GAIN_GET(0, 0, 1));
+		}
+	}
+	
+	mIntelHDA->sendCommands(verbs, count, verbs, NULL, kHDALaneDiagnostic);
+	
+	count = 0;
+	for (int i = 2; i < records; i++)
+	{
+		CodecCommanderDumpNode* node = &dump->Nodes[i];
+		UInt32 caps = node->Parameters[HDA_PARM_WIDGETCAP];
+		UInt32 connList = node->Parameters[HDA_PARM_CONNLIST_LEN];
+		
+		if (caps == (UInt32)-1)
+			continue;
+		
+		if (HDA_WCAP_HAS_CONN_LIST(caps))
+		{
+			UInt8 length = HDA_CONNLIST_LENGTH(connList);
+			bool longForm = HDA_CONNLIST_IS_LONG_FORM(connList);
+			UInt16 total = CodecTopology::parseConnections(verbs + count, length, longForm, NULL);
+			UInt8* connections = total ? (UInt8*)IOMalloc(total) : NULL;
+			
+			if (connections)
+			{
+				CodecTopology::parseConnections(verbs + count, length, longForm, connections);
+				node->ConnectionCount = total < kClientDumpMaxConnections ? total : kClientDumpMaxConnections;
+				memcpy(node->Connections, connections, node->ConnectionCount);
+				IOFree(connections, total);
+			}
+			count += (length + (longForm ? 1 : 3)) / (longForm ? 2 : 4);
+		}
+		
+		for (int index = 0; index < node->AmpInCount; index++)
+		{
+			node->AmpIn[index][0] = verbs[count++];
+			node->AmpIn[index][1] = verbs[count++];
+		}
+		
+		if (HDA_WCAP_HAS_OUT_AMP(caps))
+		{
+			node->AmpOut[0] = verbs[count++];
+			node->AmpOut[1] = verbs[count++];
+		}
+	}
+	
+	IOFree(verbs, bufferSize);
+	
+	dump->Elapsed = (UInt32)(getMicroseconds() - start);
+	DebugLog("Codec dump: %d nodes in %d us\n", records, dump->Elapsed);
+	
+	return needed;
+}
+
 /******************************************************************************
  * CodecCommander::getPowerState - Get a textual description for a IOAudioDevicePowerState
  ******************************************************************************/
@@ -613,7 +1345,7 @@ IOReturn CodecCommanderPowerHook::setPowerState(unsigned long powerStateOrdinal,
 	DebugLog("PowerHook: setPowerState %ld\n", powerStateOrdinal);
 
 	if (mCodecCommander)
-		return mCodecCommander->setPowerStateExternal(powerStateOrdinal, policyMaker);
+		return mCodecCommander->setPowerStateExternal(powerStateOrdinal, this);
 
 	return IOPMAckImplied;
 }
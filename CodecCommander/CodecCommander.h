@@ -25,6 +25,7 @@
 #include "Common.h"
 #include "Configuration.h"
 #include "IntelHDA.h"
+#include "ClientInterface.h"
 
 /* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
 
@@ -37,21 +38,6 @@ enum
 	kPowerStateCount
 };
 
-// Track audio codec state transitions
-enum CodecCommanderState
-{
-	kStateSleep,
-	kStateWake,
-	kStateInit
-};
-
-// External client methods
-enum
-{
-	kClientExecuteVerb = 0,
-	kClientNumMethods
-};
-
 class CodecCommander : public IOService
 {
     typedef IOService super;
@@ -66,12 +52,21 @@ public:
 	
     // workloop parameters
     void onTimerAction();
+	void onInterrupt(IOInterruptEventSource* source, int count);
+	void onPowerAction();
+	static bool interruptFilter(OSObject* owner, IOFilterInterruptEventSource* source);
     
     // power management event
     virtual IOReturn setPowerState(unsigned long powerStateOrdinal, IOService *policyMaker);
-	IOReturn setPowerStateExternal(unsigned long powerStateOrdinal, IOService *policyMaker);
+	IOReturn setPowerStateExternal(unsigned long powerStateOrdinal, IOService *powerHook);
+	// power change notification from the audio device (replaces polling)
+	virtual IOReturn powerStateDidChangeTo(IOPMPowerFlags capabilities, unsigned long stateNumber, IOService* whatDevice);
 	
 	UInt32 executeCommand(UInt32 command);
+	UInt32 executeCommands(const UInt32* commands, size_t count, UInt32* responses, IOReturn* status);
+	size_t dumpCodec(CodecCommanderDump* dump, size_t size);
+	IOReturn setTraceEnabled(bool enable, UInt32* position);
+	IOReturn readTrace(UInt32* position, CodecCommanderTraceRecord* records, UInt32 maxCount, UInt32* count, UInt32* lost);
 
 private:
 	IOService* mProvider = NULL;
@@ -84,19 +79,58 @@ private:
 	
 	IOWorkLoop* mWorkLoop = NULL;
 	IOTimerEventSource* mTimer = NULL;
+	IOCommandGate* mCommandGate = NULL;
+	IOFilterInterruptEventSource* mInterruptSource = NULL;
+	bool mPowerInterest = false;
+
+	// Asynchronous power transitions: at most one queued transition per source
+	// (setPowerState, setPowerStateExternal), run in the order they were queued,
+	// and the service waiting for acknowledgeSetPowerState once each completes
+	IOTimerEventSource* mPowerTimer = NULL;
+	IOLock* mPowerLock = NULL;
+	unsigned long mPendingPowerState[2] = { (unsigned long)-1, (unsigned long)-1 };
+	IOService* mPendingAcks[2] = { NULL, NULL };
+	// source queued first, runs first
+	bool mPendingExternalFirst = false;
 	
-	// Define variables for EAPD state updating
-	OSArray* mEAPDCapableNodes = NULL;
+	// Define variables for EAPD state updating (owned by the codec topology)
+	const UInt8* mEAPDCapableNodes = NULL;
+	UInt8 mEAPDCapableNodeCount = 0;
 	
 	bool mEAPDPoweredDown, mColdBoot;
+
+	// Where time goes during sleep/wake transitions
+	PhaseProfiler mProfiler;
+	CodecCommanderState mTransition = kStateInit;
+
+	// Send Delay learned from codec readiness (ms, 0 if not known yet)
+	UInt32 mLearnedSendDelay = 0;
 		
 	void handleStateChange(IOAudioDevicePowerState newState);
+
+	// codec work of a power transition (from setPowerState or the power hook)
+	void performPowerState(unsigned long powerStateOrdinal);
+	void performPowerStateExternal(unsigned long powerStateOrdinal);
+	IOReturn queuePowerState(unsigned long powerStateOrdinal, bool external, IOService* ackTarget);
+	void cancelPendingPowerState();
+	UInt32 dequeuePowerState(unsigned long* powerStateOrdinal, bool* internal, bool* external, IOService** acks);
+
+	// compare audio device power state against last known state
+	void checkPowerState();
+
+	// jack sense through unsolicited responses
+	bool setupUnsolicitedEvents();
+	void enableJackSense();
+	void handleUnsolicitedResponse(UInt32 response);
 	
 	// parse codec power state from ioreg
 	void parseCodecPowerState();
 	
-	// set the state of EAPD on outputs
-	bool setEAPD(UInt8 logicLevel);
+	// wait until the codec can take verbs (Send Delay or learned delay)
+	void waitForCodec();
+
+	// set the state of EAPD on outputs (wait: Send Delay first, for a codec just powered up)
+	bool setEAPD(UInt8 logicLevel, bool wait = true);
 	
 	// reset codec
 	void performCodecReset();
@@ -104,6 +138,13 @@ private:
 	// execute configured custom commands
 	void customCommands(CodecCommanderState newState);
 
+	// publish command path statistics in the IORegistry
+	void publishStatistics();
+
+	// Profile the outermost transition and mark it in the verb trace
+	void beginTransition(CodecCommanderState state);
+	bool endTransition();
+
 	IOAudioDevice* getAudioDevice();
 	
 	static const char* getPowerState(IOAudioDevicePowerState powerState);
@@ -142,6 +183,17 @@ private:
 	task_t mTask;
 	SInt32 mOpenCount;
 
+	// Shared submission/completion rings, mapped on demand and drained on our own
+	// workloop so the client keeps queueing while verbs execute
+	IOBufferMemoryDescriptor* mRings = NULL;
+	IOLock* mRingLock = NULL;
+	IOWorkLoop* mDrainLoop = NULL;
+	IOTimerEventSource* mDrainTimer = NULL;
+	IOReturn mRingError = kIOReturnSuccess;
+
+	void onDrainRings();
+	IOReturn drainRings();
+
 	static const IOExternalMethodDispatch sMethods[kClientNumMethods];
 
 public:
@@ -152,6 +204,7 @@ public:
 	/* IOUserClient overrides */
 	virtual bool initWithTask(task_t owningTask, void * securityID, UInt32 type, OSDictionary* properties);
 	virtual IOReturn clientClose(void);
+	virtual IOReturn clientMemoryForType(UInt32 type, IOOptionBits* options, IOMemoryDescriptor** memory);
 
 	virtual IOReturn externalMethod(uint32_t selector, IOExternalMethodArguments *arguments, IOExternalMethodDispatch* dispatch = 0,
 									OSObject* target = 0, void* reference = 0);
@@ -159,5 +212,10 @@ public:
 
 	/* External methods */
 	static IOReturn executeVerb(CodecCommander* target, void* reference, IOExternalMethodArguments* arguments);
+	static IOReturn executeVerbs(CodecCommander* target, void* reference, IOExternalMethodArguments* arguments);
+	static IOReturn dumpCodec(CodecCommander* target, void* reference, IOExternalMethodArguments* arguments);
+	static IOReturn ringDoorbell(CodecCommanderClient* target, void* reference, IOExternalMethodArguments* arguments);
+	static IOReturn traceControl(CodecCommander* target, void* reference, IOExternalMethodArguments* arguments);
+	static IOReturn traceDrain(CodecCommander* target, void* reference, IOExternalMethodArguments* arguments);
 };
 #endif // __CodecCommander__
\ No newline at end of file
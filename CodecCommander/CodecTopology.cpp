@@ -0,0 +1,320 @@
+/*
+ *  Released under "The GNU General Public License (GPL-2.0)"
+ *
+ *  This program is free software; you can redistribute it and/or modify it
+ *  under the terms of the GNU General Public License as published by the
+ *  Free Software Foundation; either version 2 of the License, or (at your
+ *  option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ *  or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ *  for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ *
+ */
+
+#include "CodecTopology.h"
+#include "IntelHDA.h"
+
+// Capabilities read for every node in the first pass
+enum
+{
+	kCapWidget,
+	kCapPin,
+	kCapAmpIn,
+	kCapAmpOut,
+	kCapConnListLength,
+	kCapConfigDefault,
+	kCapVerbsPerNode
+};
+
+CodecTopology::~CodecTopology()
+{
+	if (mNodeArena)
+		IOFree(mNodeArena, mNodeArenaSize);
+	if (mConnections)
+		IOFree(mConnections, mConnectionTotal);
+}
+
+bool CodecTopology::build(IntelHDA* intelHDA)
+{
+	UInt64 start = getMicroseconds();
+
+	UInt16 audioRoot = intelHDA->getAudioRoot();
+	mStartNode = intelHDA->getStartingNode();
+	mNodeCount = intelHDA->getTotalNodes();
+	if (!mNodeCount)
+		return false;
+
+	// 32-bit arrays first to keep them aligned
+	mNodeArenaSize = mNodeCount * (6 * sizeof(UInt32) + sizeof(UInt16) + sizeof(UInt8));
+	mNodeArena = IOMalloc(mNodeArenaSize);
+	if (!mNodeArena)
+		return false;
+	bzero(mNodeArena, mNodeArenaSize);
+
+	mWidgetCaps = (UInt32*)mNodeArena;
+	mPinCaps = mWidgetCaps + mNodeCount;
+	mAmpInCaps = mPinCaps + mNodeCount;
+	mAmpOutCaps = mAmpInCaps + mNodeCount;
+	mConfigDefault = mAmpOutCaps + mNodeCount;
+	mConnectionStart = mConfigDefault + mNodeCount;
+	mConnectionCount = (UInt16*)(mConnectionStart + mNodeCount);
+	mEAPDPins = (UInt8*)(mConnectionCount + mNodeCount);
+
+	// Read capabilities of every widget (plus the function group amp defaults) in one batch
+	UInt32 count = mNodeCount * kCapVerbsPerNode + 2;
+	UInt32* verbs = (UInt32*)IOMalloc(count * sizeof(UInt32));
+	if (!verbs)
+		return false;
+
+	for (int i = 0; i < mNodeCount; i++)
+	{
+		UInt8 node = mStartNode + i;
+		UInt32* nodeVerbs = verbs + i * kCapVerbsPerNode;
+		nodeVerbs[kCapWidget] = HDA_COMMAND(node, HDA_VERB_GET_PARAM, HDA_PARM_WIDGETCAP);
+		nodeVerbs[kCapPin] = HDA_COMMAND(node, HDA_VERB_GET_PARAM, HDA_PARM_PINCAP);
+		nodeVerbs[kCapAmpIn] = HDA_COMMAND(node, HDA_VERB_GET_PARAM, HDA_PARM_AMP_IN_CAP);
+		nodeVerbs[kCapAmpOut] = HDA_COMMAND(node, HDA_VERB_GET_PARAM, HDA_PARM_AMP_OUT_CAP);
+		nodeVerbs[kCapConnListLength] = HDA_COMMAND(node, HDA_VERB_GET_PARAM, HDA_PARM_CONNLIST_LEN);
+		nodeVerbs[kCapConfigDefault] = HDA_COMMAND(node, HDA_VERB_GET_CONFIG_DEFAULT, HDA_PARM_NULL);
+	}
+	verbs[count - 2] = HDA_COMMAND(audioRoot, HDA_VERB_GET_PARAM, HDA_PARM_AMP_IN_CAP);
+	verbs[count - 1] = HDA_COMMAND(audioRoot, HDA_VERB_GET_PARAM, HDA_PARM_AMP_OUT_CAP);
+
+	intelHDA->sendCommands(verbs, count, verbs);
+
+	// failed reads are treated as absent capabilities
+	for (UInt32 i = 0; i < count; i++)
+		if (verbs[i] == (UInt32)-1)
+			verbs[i] = 0;
+
+	UInt32 defaultAmpIn = verbs[count - 2];
+	UInt32 defaultAmpOut = verbs[count - 1];
+
+	for (int i = 0; i < mNodeCount; i++)
+	{
+		UInt32* responses = verbs + i * kCapVerbsPerNode;
+		mWidgetCaps[i] = responses[kCapWidget];
+		mPinCaps[i] = responses[kCapPin];
+		mConfigDefault[i] = responses[kCapConfigDefault];
+
+		// widgets without amp override use the function group amp capabilities
+		bool ampOverride = HDA_WCAP_HAS_AMP_OVERRIDE(mWidgetCaps[i]);
+		mAmpInCaps[i] = ampOverride ? responses[kCapAmpIn] : defaultAmpIn;
+		mAmpOutCaps[i] = ampOverride ? responses[kCapAmpOut] : defaultAmpOut;
+
+		// connection list length is kept in the count array until the lists are read
+		mConnectionCount[i] = HDA_WCAP_HAS_CONN_LIST(mWidgetCaps[i]) ? (UInt8)responses[kCapConnListLength] : 0;
+
+		if (HDA_PINCAP_IS_EAPD_CAPABLE(mPinCaps[i]))
+			mEAPDPins[mEAPDPinCount++] = mStartNode + i;
+	}
+
+	IOFree(verbs, count * sizeof(UInt32));
+
+	bool result = readConnections(intelHDA);
+	mBuildTime = (UInt32)(getMicroseconds() - start);
+
+	DebugLog("CodecTopology: %d nodes, %d connections, %d bytes, built in %d us\n",
+			 mNodeCount, mConnectionTotal, (int)getMemoryFootprint(), mBuildTime);
+
+	return result;
+}
+
+UInt16 CodecTopology::parseConnections(const UInt32* responses, UInt8 length, bool longForm, UInt8* connections)
+{
+	int perResponse = longForm ? 2 : 4;
+	int width = longForm ? 16 : 8;
+	UInt32 rangeFlag = longForm ? 0x8000 : 0x80;
+	UInt32 mask = rangeFlag - 1;
+
+	UInt16 count = 0;
+	UInt32 previous = 0;
+	for (int i = 0; i < length; i++)
+	{
+		UInt32 entry = (responses[i / perResponse] >> ((i % perResponse) * width)) & ((1U << width) - 1);
+		UInt32 node = entry & mask;
+
+		// a range entry lists every node between the previous entry and this one
+		UInt32 first = (entry & rangeFlag) && previous && previous < node ? previous + 1 : node;
+		for (UInt32 n = first; n <= node && n <= 0xFF; n++)
+		{
+			if (connections)
+				connections[count] = n;
+			count++;
+		}
+		previous = node;
+	}
+	return count;
+}
+
+bool CodecTopology::readConnections(IntelHDA* intelHDA)
+{
+	// one GET_CONN_LIST returns 4 short form or 2 long form entries
+	UInt32 count = 0;
+	for (int i = 0; i < mNodeCount; i++)
+	{
+		UInt8 length = HDA_CONNLIST_LENGTH(mConnectionCount[i]);
+		int perResponse = HDA_CONNLIST_IS_LONG_FORM(mConnectionCount[i]) ? 2 : 4;
+		count += (length + perResponse - 1) / perResponse;
+	}
+
+	UInt32* verbs = count ? (UInt32*)IOMalloc(count * sizeof(UInt32)) : NULL;
+	if (!verbs)
+	{
+		bzero(mConnectionCount, mNodeCount * sizeof(UInt16));
+		return count == 0;
+	}
+
+	UInt32 verb = 0;
+	for (int i = 0; i < mNodeCount; i++)
+	{
+		UInt8 length = HDA_CONNLIST_LENGTH(mConnectionCount[i]);
+		int perResponse = HDA_CONNLIST_IS_LONG_FORM(mConnectionCount[i]) ? 2 : 4;
+		for (int entry = 0; entry < length; entry += perResponse)
+			verbs[verb++] = HDA_COMMAND(mStartNode + i, HDA_VERB_GET_CONN_LIST, entry);
+	}
+
+	intelHDA->sendCommands(verbs, count, verbs);
+
+	// first pass sizes the expanded lists, second pass stores them
+	UInt32 total = 0;
+	verb = 0;
+	for (int i = 0; i < mNodeCount; i++)
+	{
+		UInt8 length = HDA_CONNLIST_LENGTH(mConnectionCount[i]);
+		bool longForm = HDA_CONNLIST_IS_LONG_FORM(mConnectionCount[i]);
+		total += parseConnections(verbs + verb, length, longForm, NULL);
+		verb += (length + (longForm ? 1 : 3)) / (longForm ? 2 : 4);
+	}
+
+	mConnections = total ? (UInt8*)IOMalloc(total) : NULL;
+	if (mConnections)
+		mConnectionTotal = total;
+
+	UInt32 offset = 0;
+	verb = 0;
+	for (int i = 0; i < mNodeCount; i++)
+	{
+		UInt8 length = HDA_CONNLIST_LENGTH(mConnectionCount[i]);
+		bool longForm = HDA_CONNLIST_IS_LONG_FORM(mConnectionCount[i]);
+		UInt16 parsed = mConnections ? parseConnections(verbs + verb, length, longForm, mConnections + offset) : 0;
+		verb += (length + (longForm ? 1 : 3)) / (longForm ? 2 : 4);
+
+		mConnectionStart[i] = offset;
+		mConnectionCount[i] = parsed;
+		offset += parsed;
+	}
+
+	IOFree(verbs, count * sizeof(UInt32));
+	return total == 0 || mConnections != NULL;
+}
+
+OSDictionary* CodecTopology::createDictionary()
+{
+	OSDictionary* dict = OSDictionary::withCapacity(4);
+	if (!dict)
+		return NULL;
+
+	const struct { const char* key; UInt32 value; } values[] =
+	{
+		{ "Nodes", mNodeCount },
+		{ "Connections", mConnectionTotal },
+		{ "Memory Footprint", (UInt32)getMemoryFootprint() },
+		{ "Build Time", mBuildTime },
+	};
+
+	for (unsigned i = 0; i < sizeof(values) / sizeof(values[0]); i++)
+	{
+		if (OSNumber* num = OSNumber::withNumber(values[i].value, 32))
+		{
+			dict->setObject(values[i].key, num);
+			num->release();
+		}
+	}
+
+	return dict;
+}
+
+UInt8 CodecTopology::getWidgetType(UInt8 node)
+{
+	return HDA_WIDGET_TYPE(getWidgetCaps(node));
+}
+
+const UInt8* CodecTopology::getConnections(UInt8 node, UInt16* count)
+{
+	*count = 0;
+	if (!isValid(node) || !mConnections)
+		return NULL;
+
+	*count = mConnectionCount[index(node)];
+	return *count ? mConnections + mConnectionStart[index(node)] : NULL;
+}
+
+UInt8 CodecTopology::getJackPins(UInt8* nodes, UInt8 maxNodes)
+{
+	UInt8 count = 0;
+	for (int i = 0; i < mNodeCount && count < maxNodes; i++)
+	{
+		if (HDA_WIDGET_TYPE(mWidgetCaps[i]) != HDA_WIDGET_TYPE_PIN)
+			continue;
+
+		UInt8 connectivity = HDA_CONFIG_CONNECTIVITY(mConfigDefault[i]);
+		if (connectivity == HDA_CONFIG_CONN_JACK || connectivity == HDA_CONFIG_CONN_BOTH)
+			nodes[count++] = mStartNode + i;
+	}
+	return count;
+}
+
+UInt8 CodecTopology::findPath(UInt8 from, UInt8 to, UInt8* path, UInt8 maxLength)
+{
+	if (!isValid(from) || !isValid(to) || !maxLength)
+		return 0;
+
+	// breadth-first search upstream from the destination, next[] points back downstream
+	UInt8 next[256];
+	UInt8 queue[256];
+	bool visited[256];
+	bzero(visited, sizeof(visited));
+
+	int head = 0, tail = 0;
+	queue[tail++] = to;
+	visited[to] = true;
+	next[to] = to;
+
+	while (head < tail && !visited[from])
+	{
+		UInt8 node = queue[head++];
+		UInt16 count;
+		const UInt8* inputs = getConnections(node, &count);
+		for (int i = 0; i < count; i++)
+		{
+			UInt8 input = inputs[i];
+			if (visited[input] || !isValid(input))
+				continue;
+
+			visited[input] = true;
+			next[input] = node;
+			queue[tail++] = input;
+		}
+	}
+
+	if (!visited[from])
+		return 0;
+
+	UInt8 length = 0;
+	for (UInt8 node = from; length < maxLength; node = next[node])
+	{
+		path[length++] = node;
+		if (node == to)
+			return length;
+	}
+
+	// path did not fit
+	return 0;
+}
@@ -0,0 +1,101 @@
+/*
+ *  Released under "The GNU General Public License (GPL-2.0)"
+ *
+ *  This program is free software; you can redistribute it and/or modify it
+ *  under the terms of the GNU General Public License as published by the
+ *  Free Software Foundation; either version 2 of the License, or (at your
+ *  option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ *  or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ *  for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ *
+ */
+
+#ifndef CodecCommander_CodecTopology_h
+#define CodecCommander_CodecTopology_h
+
+#include "Common.h"
+
+class IntelHDA;
+
+// Widget graph of the audio function group, read once from the codec.
+// All per-node data lives in flat arrays indexed by (node - starting node).
+class CodecTopology
+{
+	UInt8 mStartNode = 0;
+	UInt8 mNodeCount = 0;
+
+	// Per-node arrays, carved out of a single allocation
+	void* mNodeArena = NULL;
+	size_t mNodeArenaSize = 0;
+	UInt32* mWidgetCaps = NULL;
+	UInt32* mPinCaps = NULL;
+	UInt32* mAmpInCaps = NULL;
+	UInt32* mAmpOutCaps = NULL;
+	UInt32* mConfigDefault = NULL;
+	UInt32* mConnectionStart = NULL;
+	UInt16* mConnectionCount = NULL;
+	UInt8* mEAPDPins = NULL;
+	UInt8 mEAPDPinCount = 0;
+
+	// Connection lists of all nodes, back to back. Ranges make a list longer than its
+	// 127 entries (up to 255 nodes per range), so neither a count nor the total fits a byte
+	UInt8* mConnections = NULL;
+	UInt32 mConnectionTotal = 0;
+
+	UInt32 mBuildTime = 0;
+
+	inline bool isValid(UInt8 node) { return node >= mStartNode && node - mStartNode < mNodeCount; }
+	inline int index(UInt8 node) { return node - mStartNode; }
+
+	bool readConnections(IntelHDA* intelHDA);
+
+public:
+	CodecTopology() { }
+	~CodecTopology();
+
+	// Enumerate all widgets (a handful of verb batches)
+	bool build(IntelHDA* intelHDA);
+
+	UInt8 getStartingNode() { return mStartNode; }
+	UInt8 getTotalNodes() { return mNodeCount; }
+
+	UInt32 getWidgetCaps(UInt8 node) { return isValid(node) ? mWidgetCaps[index(node)] : 0; }
+	UInt8 getWidgetType(UInt8 node);
+	UInt32 getPinCaps(UInt8 node) { return isValid(node) ? mPinCaps[index(node)] : 0; }
+	UInt32 getAmpInCaps(UInt8 node) { return isValid(node) ? mAmpInCaps[index(node)] : 0; }
+	UInt32 getAmpOutCaps(UInt8 node) { return isValid(node) ? mAmpOutCaps[index(node)] : 0; }
+	UInt32 getConfigDefault(UInt8 node) { return isValid(node) ? mConfigDefault[index(node)] : 0; }
+
+	// Input connections of a node (NULL if none)
+	const UInt8* getConnections(UInt8 node, UInt16* count);
+
+	// Expand GET_CONN_LIST responses into node ids (ranges included), returns number of
+	// nodes, connections may be NULL to only count them
+	static UInt16 parseConnections(const UInt32* responses, UInt8 length, bool longForm, UInt8* connections);
+
+	// Nodes whose pin capabilities report EAPD
+	const UInt8* getEAPDCapablePins(UInt8* count) { *count = mEAPDPinCount; return mEAPDPins; }
+
+	// Pin complexes configured as jacks, returns number of nodes stored
+	UInt8 getJackPins(UInt8* nodes, UInt8 maxNodes);
+
+	// Signal path from one widget to another (e.g. DAC to pin) following connection
+	// lists, returns number of nodes stored in path (starting with from), 0 if none
+	UInt8 findPath(UInt8 from, UInt8 to, UInt8* path, UInt8 maxLength);
+
+	// Bytes used by the model and time (in us) it took to read it
+	size_t getMemoryFootprint() { return sizeof(*this) + mNodeArenaSize + mConnectionTotal; }
+	UInt32 getBuildTime() { return mBuildTime; }
+
+	// Summary for publishing in the IORegistry (caller releases)
+	OSDictionary* createDictionary();
+};
+
+#endif
@@ -30,9 +30,11 @@
 #include <IOKit/IOService.h>
 #include <IOKit/IOWorkLoop.h>
 #include <IOKit/IOTimerEventSource.h>
+#include <IOKit/IOFilterInterruptEventSource.h>
 #include <IOKit/IODeviceTreeSupport.h>
 #include <IOKit/IOCommandGate.h>
 #include <IOKit/IOUserClient.h>
+#include <IOKit/IOBufferMemoryDescriptor.h>
 #include <IOKit/audio/IOAudioDevice.h>
 #include <IOKit/pci/IOPCIDevice.h>
 
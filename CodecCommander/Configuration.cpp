@@ -31,6 +31,15 @@
 #define kUpdateNodes                "Update Nodes"
 #define kSleepNodes                 "Sleep Nodes"
 #define kSendDelay                  "Send Delay"
+#define kAdaptiveSendDelay          "Adaptive Send Delay"
+#define kPinReadinessCheck          "Pin Readiness Check"
+
+// Command transport: CORB/RIRB rings instead of immediate command registers
+#define kUseDMACommands             "Use DMA Commands"
+#define kCommandTimeout             "Command Timeout"
+
+// Finish power transitions on the workloop instead of the power management thread
+#define kAsyncPowerTransitions      "Asynchronous Power Transitions"
 
 // Workloop required and Workloop timer aka update interval, ms
 #define kCheckInfinitely            "Check Infinitely"
@@ -92,6 +101,14 @@ bool Configuration::getBoolValue(OSDictionary *dict, const char *key, bool defVa
     return result;
 }
 
+bool Configuration::getBoolValue(OSObject *obj, bool defValue)
+{
+    bool result = defValue;
+    if (OSBoolean* bl = OSDynamicCast(OSBoolean, obj))
+        result = bl->getValue();
+    return result;
+}
+
 UInt32 Configuration::getIntegerValue(OSDictionary *dict, const char *key, UInt32 defValue)
 {
     UInt32 result = defValue;
@@ -110,30 +127,102 @@ UInt32 Configuration::getIntegerValue(OSObject *obj, UInt32 defValue)
     return result;
 }
 
+UInt32 Configuration::parseCustomCommand(OSObject* obj, UInt32* commands)
+{
+    if (UInt32 commandBits = getIntegerValue(obj, 0))
+    {
+        if (commands)
+            commands[0] = commandBits;
+        return 1;
+    }
+
+    OSData* data = OSDynamicCast(OSData, obj);
+    if (!data)
+        return 0;
+
+    UInt32 count = data->getLength() / sizeof(UInt32);
+    if (commands)
+    {
+        // byte reverse here, so the author of Info.pist doesn't have to...
+        const UInt8* bytes = (const UInt8*)data->getBytesNoCopy();
+        for (UInt32 i = 0; i < count; i++)
+        {
+            commands[i] = bytes[0]<<24 | bytes[1]<<16 | bytes[2]<<8 | bytes[3];
+            bytes += sizeof(UInt32);
+        }
+    }
+    return count;
+}
+
+bool Configuration::loadCustomCommands(OSArray* list)
+{
+    static const char* const stateKeys[kStateCount] = { kCommandOnSleep, kCommandOnWake, kCommandOnInit };
+    UInt32 total = 0;
+
+    // size the verbs of each state first (a command for several states is copied into each)
+    for (int state = 0; state < kStateCount; state++)
+    {
+        mCustomCommandOffset[state] = total;
+        for (unsigned i = 0; i < list->getCount(); i++)
+        {
+            OSDictionary* dict = OSDynamicCast(OSDictionary, list->getObject(i));
+            if (dict && getBoolValue(dict, stateKeys[state], false))
+                mCustomCommandCount[state] += parseCustomCommand(dict->getObject(kCustomCommand), NULL);
+        }
+        total += mCustomCommandCount[state];
+    }
+    if (!total)
+        return true;
+
+    mCustomCommandsSize = total * sizeof(UInt32);
+    mCustomCommands = (UInt32*)IOMalloc(mCustomCommandsSize);
+    if (!mCustomCommands)
+    {
+        bzero(mCustomCommandCount, sizeof(mCustomCommandCount));
+        mCustomCommandsSize = 0;
+        return false;
+    }
+
+    for (int state = 0; state < kStateCount; state++)
+    {
+        UInt32* commands = mCustomCommands + mCustomCommandOffset[state];
+        for (unsigned i = 0; i < list->getCount(); i++)
+        {
+            OSDictionary* dict = OSDynamicCast(OSDictionary, list->getObject(i));
+            if (dict && getBoolValue(dict, stateKeys[state], false))
+                commands += parseCustomCommand(dict->getObject(kCustomCommand), commands);
+        }
+    }
+    return true;
+}
+
+// At most five probes of Codec Profile, once per codec at start. Each probe is a keyed
+// dictionary lookup, so a larger profile list barely shows (ConfigurationSynthetic5000 in
+// Benchmarks) and a table sorted at build time would not win anything measurable.
 OSDictionary* Configuration::locateConfiguration(OSDictionary* profiles, UInt32 codecVendorId, UInt32 subsystemId)
 {
     UInt16 vendor = codecVendorId >> 16;
     UInt16 codec = codecVendorId & 0xFFFF;
     OSObject* obj;
 
-    // check vendor_codec_HDA_full-subsystem first
+    // check vendor_codec_HDA_full-subsystem first, the shorter keys are prefixes of it
     char codecLookup[sizeof("vvvv_cccc_HDA_xxxx_dddd")];
     snprintf(codecLookup, sizeof(codecLookup), "%04x_%04x_HDA_%04x_%04x", vendor, codec, subsystemId >> 16, subsystemId & 0xFFFF);
     obj = profiles->getObject(codecLookup);
     if (!obj)
     {
         // check vendor_codec_HDA_vendorsubid next
-        snprintf(codecLookup, sizeof(codecLookup), "%04x_%04x_HDA_%04x", vendor, codec, subsystemId >> 16);
+        codecLookup[sizeof("vvvv_cccc_HDA_xxxx") - 1] = 0;
         obj = profiles->getObject(codecLookup);
         if (!obj)
         {
             // check vendor_codec next
-            snprintf(codecLookup, sizeof(codecLookup), "%04x_%04x", vendor, codec);
+            codecLookup[sizeof("vvvv_cccc") - 1] = 0;
             obj = profiles->getObject(codecLookup);
             if (!obj)
             {
                 // not found, check for vendor override (used for Intel HDMI)
-                snprintf(codecLookup, sizeof(codecLookup), "%04x", vendor);
+                codecLookup[sizeof("vvvv") - 1] = 0;
                 obj = profiles->getObject(codecLookup);
             }
         }
@@ -149,15 +238,20 @@ OSDictionary* Configuration::locateConfiguration(OSDictionary* profiles, UInt32
     return dict;
 }
 
-OSDictionary* Configuration::loadConfiguration(OSDictionary* profiles, UInt32 codecVendorId, UInt32 subsystemId)
+OSObject* Configuration::Profile::getObject(const char* key) const
+{
+    // a key in the codec profile replaces the one in Default, as merging them would
+    OSObject* obj = NULL;
+    if (Codec)
+        obj = Codec->getObject(key);
+    if (!obj && Default)
+        obj = Default->getObject(key);
+    return obj;
+}
+
+#ifdef DEBUG
+OSDictionary* Configuration::loadConfiguration(OSDictionary* defaultProfile, OSDictionary* codecProfile)
 {
-    OSDictionary* defaultProfile = NULL;
-    OSDictionary* codecProfile = NULL;
-    if (profiles)
-    {
-        defaultProfile = OSDynamicCast(OSDictionary, profiles->getObject(kDefault));
-        codecProfile = locateConfiguration(profiles, codecVendorId, subsystemId);
-    }
     OSDictionary* result = NULL;
 
     if (defaultProfile)
@@ -180,100 +274,67 @@ OSDictionary* Configuration::loadConfiguration(OSDictionary* profiles, UInt32 co
 
     return result;
 }
+#endif
 
 Configuration::Configuration(OSObject* codecProfiles, UInt32 codecVendorId, UInt32 hdaSubsystemId)
 {
     OSDictionary* list = OSDynamicCast(OSDictionary, codecProfiles);
 
-    // Retrieve platform profile configuration
-    OSDictionary* config = loadConfiguration(list, codecVendorId, hdaSubsystemId);
-#ifdef DEBUG
-    mMergedConfig = config;
-    if (mMergedConfig)
-        mMergedConfig->retain();
-#endif
-
-    mCustomCommands = OSArray::withCapacity(0);
-    if (!mCustomCommands)
+    // Retrieve platform profile configuration, read in place on top of Default
+    Profile config = { NULL, NULL };
+    if (list)
     {
-        OSSafeRelease(config);
-        return;
+        config.Default = OSDynamicCast(OSDictionary, list->getObject(kDefault));
+        config.Codec = locateConfiguration(list, codecVendorId, hdaSubsystemId);
     }
+#ifdef DEBUG
+    // merged copy only for inspection in the IORegistry
+    mMergedConfig = loadConfiguration(config.Default, config.Codec);
+#endif
 
     // if Disable is set in the profile, no more config is gathered, start will fail
-    mDisable = getBoolValue(config, kDisable, false);
+    mDisable = getBoolValue(config.getObject(kDisable), false);
     if (mDisable)
-    {
-        OSSafeRelease(config);
         return;
-    }
 
     // Get delay for sending the verb
-    mSendDelay = getIntegerValue(config, kSendDelay, 300);
+    mSendDelay = getIntegerValue(config.getObject(kSendDelay), 300);
+
+    // Determine if the delay is learned from codec readiness, Send Delay is then the upper bound (Defaults to false)
+    mAdaptiveSendDelay = getBoolValue(config.getObject(kAdaptiveSendDelay), false);
+    mPinReadinessCheck = getBoolValue(config.getObject(kPinReadinessCheck), true);
 
     // Determine if perform reset is requested (Defaults to true)
-    mPerformReset = getBoolValue(config, kPerformReset, true);
-    mPerformResetOnExternalWake = getBoolValue(config, kPerformResetOnExternalWake, true);
+    mPerformReset = getBoolValue(config.getObject(kPerformReset), true);
+    mPerformResetOnExternalWake = getBoolValue(config.getObject(kPerformResetOnExternalWake), true);
 
     // Determine if perform reset is requested (Defaults to true)
-    mPerformResetOnEAPDFail = getBoolValue(config, kPerformResetOnEAPDFail, true);
+    mPerformResetOnEAPDFail = getBoolValue(config.getObject(kPerformResetOnEAPDFail), true);
 
     // Determine if update to EAPD nodes is requested (Defaults to true)
-    mUpdateNodes = getBoolValue(config, kUpdateNodes, true);
-    mSleepNodes = getBoolValue(config, kSleepNodes, true);
+    mUpdateNodes = getBoolValue(config.getObject(kUpdateNodes), true);
+    mSleepNodes = getBoolValue(config.getObject(kSleepNodes), true);
+
+    // Determine if verbs should be sent through CORB/RIRB (Defaults to false)
+    mUseDMACommands = getBoolValue(config.getObject(kUseDMACommands), false);
+
+    // Get deadline for a single verb to complete, ms
+    mCommandTimeout = getIntegerValue(config.getObject(kCommandTimeout), 10);
+
+    // Determine if power transitions complete asynchronously (Defaults to false)
+    mAsyncPowerTransitions = getBoolValue(config.getObject(kAsyncPowerTransitions), false);
 
     // Determine if infinite check is needed (for 10.9 and up)
-    mCheckInfinite = getBoolValue(config, kCheckInfinitely, false);
-    mCheckInterval = getIntegerValue(config, kCheckInterval, 1000);
+    mCheckInfinite = getBoolValue(config.getObject(kCheckInfinitely), false);
+    mCheckInterval = getIntegerValue(config.getObject(kCheckInterval), 1000);
 
-    // Parse custom commands
-    if (OSArray* list = OSDynamicCast(OSArray, config->getObject(kCustomCommands)))
+    // Parse custom commands into one table per state
+    if (OSArray* list = OSDynamicCast(OSArray, config.getObject(kCustomCommands)))
     {
-        OSCollectionIterator* iterator = OSCollectionIterator::withCollection(list);
-        if (!iterator) return;
-        while (OSDictionary* dict = OSDynamicCast(OSDictionary, iterator->getNextObject()))
-        {
-            OSObject* obj = dict->getObject(kCustomCommand);
-            OSData* commandData = NULL;
-            CustomCommand* customCommand;
-
-            if (UInt32 commandBits = getIntegerValue(obj, 0))
-            {
-                commandData = OSData::withCapacity(sizeof(CustomCommand)+sizeof(UInt32));
-                commandData->appendByte(0, commandData->getCapacity());
-                customCommand = (CustomCommand*)commandData->getBytesNoCopy();
-                customCommand->CommandCount = 1;
-                customCommand->Commands[0] = commandBits;
-            }
-            else if (OSData* data = OSDynamicCast(OSData, obj))
-            {
-                unsigned length = data->getLength();
-                commandData = OSData::withCapacity(sizeof(CustomCommand)+length);
-                commandData->appendByte(0, commandData->getCapacity());
-                customCommand = (CustomCommand*)commandData->getBytesNoCopy();
-                customCommand->CommandCount = length / sizeof(customCommand->Commands[0]);
-                // byte reverse here, so the author of Info.pist doesn't have to...
-                UInt8* bytes = (UInt8*)data->getBytesNoCopy();
-                for (int i = 0; i < customCommand->CommandCount; i++)
-                {
-                    customCommand->Commands[i] = bytes[0]<<24 | bytes[1]<<16 | bytes[2]<<8 | bytes[3];
-                    bytes += sizeof(UInt32);
-                }
-            }
-            if (commandData)
-            {
-                customCommand->OnInit = getBoolValue(dict, kCommandOnInit, false);
-                customCommand->OnSleep = getBoolValue(dict, kCommandOnSleep, false);
-                customCommand->OnWake = getBoolValue(dict, kCommandOnWake, false);
-                mCustomCommands->setObject(commandData);
-                commandData->release();
-            }
-        }
-        iterator->release();
+        if (!loadCustomCommands(list))
+            AlwaysLog("Not enough memory for custom commands, they will not be sent.\n");
     }
 
-    OSSafeRelease(config);
-
     // Dump parsed configuration
     DebugLog("Configuration\n");
     DebugLog("...Check Infinite: %s\n", mCheckInfinite ? "true" : "false");
@@ -282,29 +343,23 @@ Configuration::Configuration(OSObject* codecProfiles, UInt32 codecVendorId, UInt
     DebugLog("...Perform Reset on External Wake: %s\n", mPerformResetOnExternalWake ? "true" : "false");
     DebugLog("...Perform Reset on EAPD Fail: %s\n", mPerformResetOnEAPDFail ? "true" : "false");
     DebugLog("...Send Delay: %d\n", mSendDelay);
+    DebugLog("...Adaptive Send Delay: %s\n", mAdaptiveSendDelay ? "true" : "false");
+    DebugLog("...Pin Readiness Check: %s\n", mPinReadinessCheck ? "true" : "false");
     DebugLog("...Update Nodes: %s\n", mUpdateNodes ? "true" : "false");
     DebugLog("...Sleep Nodes: %s\n", mSleepNodes ? "true" : "false");
+    DebugLog("...Use DMA Commands: %s\n", mUseDMACommands ? "true" : "false");
+    DebugLog("...Command Timeout: %d\n", mCommandTimeout);
+    DebugLog("...Asynchronous Power Transitions: %s\n", mAsyncPowerTransitions ? "true" : "false");
+    DebugLog("...Custom Commands: %d/%d/%d verbs on init/sleep/wake, %d bytes\n", mCustomCommandCount[kStateInit],
+             mCustomCommandCount[kStateSleep], mCustomCommandCount[kStateWake], mCustomCommandsSize);
 
 #ifdef DEBUG
-    if (OSCollectionIterator* iterator = OSCollectionIterator::withCollection(mCustomCommands))
+    static const char* stateNames[kStateCount] = { "OnSleep", "OnWake", "OnInit" };
+    for (int state = 0; state < kStateCount; state++)
     {
-        while (OSData* data = OSDynamicCast(OSData, iterator->getNextObject()))
-        {
-            CustomCommand* customCommand = (CustomCommand*)data->getBytesNoCopy();
-            DebugLog("Custom Command\n");
-            if (customCommand->CommandCount == 1)
-                DebugLog("...Command: 0x%08x\n", customCommand->Commands[0]);
-            if (customCommand->CommandCount == 2)
-                DebugLog("...Commands(%d): 0x%08x 0x%08x\n", customCommand->CommandCount, customCommand->Commands[0], customCommand->Commands[1]);
-            if (customCommand->CommandCount == 3)
-                DebugLog("...Commands(%d): 0x%08x 0x%08x 0x%08x\n", customCommand->CommandCount, customCommand->Commands[0], customCommand->Commands[1], customCommand->Commands[2]);
-            if (customCommand->CommandCount == 3)
-                DebugLog("...Commands(%d): 0x%08x 0x%08x 0x%08x ...\n", customCommand->CommandCount, customCommand->Commands[0], customCommand->Commands[1], customCommand->Commands[2]);
-            DebugLog("...OnInit: %s\n", customCommand->OnInit ? "true" : "false");
-            DebugLog("...OnWake: %s\n", customCommand->OnWake ? "true" : "false");
-            DebugLog("...OnSleep: %s\n", customCommand->OnSleep ? "true" : "false");
-        }
-        iterator->release();
+        const UInt32* commands = mCustomCommands + mCustomCommandOffset[state];
+        for (UInt32 i = 0; i < mCustomCommandCount[state]; i++)
+            DebugLog("...%s Command: 0x%08x\n", stateNames[state], commands[i]);
     }
 #endif
 }
@@ -314,6 +369,7 @@ Configuration::~Configuration()
 #ifdef DEBUG
     OSSafeRelease(mMergedConfig);
 #endif
-    OSSafeRelease(mCustomCommands);
+    if (mCustomCommands)
+        IOFree(mCustomCommands, mCustomCommandsSize);
 }
 
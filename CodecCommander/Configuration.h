@@ -22,18 +22,23 @@
 
 #include "Common.h"
 
-typedef struct
+// Track audio codec state transitions
+enum CodecCommanderState
 {
-    bool OnInit;    // Execute command on initialization
-    bool OnSleep;   // Execute command on sleep
-    bool OnWake;    // Execute command on wake
-    UInt32 CommandCount;
-    UInt32 Commands[0]; // 32-bit verb to execute (Codec Address will be filled in)
-} CustomCommand;
+    kStateSleep,
+    kStateWake,
+    kStateInit,
+    kStateCount
+};
 
 class Configuration
 {
-    OSArray* mCustomCommands;
+    // Custom commands of all states in one allocation: the verbs of each state back to back
+    // (32-bit verbs, Codec Address will be filled in)
+    UInt32* mCustomCommands = NULL;
+    UInt32 mCustomCommandsSize = 0;
+    UInt32 mCustomCommandOffset[kStateCount] = { };
+    UInt32 mCustomCommandCount[kStateCount] = { };
     
     bool mCheckInfinite;
     UInt16 mCheckInterval;
@@ -42,14 +47,31 @@ class Configuration
     bool mPerformResetOnEAPDFail;
     bool mUpdateNodes, mSleepNodes;
     UInt16 mSendDelay;
+    bool mAdaptiveSendDelay, mPinReadinessCheck;
+    bool mUseDMACommands;
+    UInt16 mCommandTimeout;
+    bool mAsyncPowerTransitions;
     bool mDisable;
 
+    // Codec profile with the Default profile underneath
+    struct Profile
+    {
+        OSDictionary* Codec;
+        OSDictionary* Default;
+        OSObject* getObject(const char* key) const;
+    };
+
     static UInt32 parseInteger(const char* str);
     static OSDictionary* locateConfiguration(OSDictionary* profiles, UInt32 codecVendorId, UInt32 hdaSubsystemId);
-    static OSDictionary* loadConfiguration(OSDictionary* profiles, UInt32 codecVendorId, UInt32 hdaSubsystemId);
+#ifdef DEBUG
+    static OSDictionary* loadConfiguration(OSDictionary* defaultProfile, OSDictionary* codecProfile);
+#endif
     static bool getBoolValue(OSDictionary* dict, const char* key, bool defValue);
+    static bool getBoolValue(OSObject* obj, bool defValue);
     static UInt32 getIntegerValue(OSDictionary* dict, const char* key, UInt32 defValue);
     static UInt32 getIntegerValue(OSObject* obj, UInt32 defValue);
+    static UInt32 parseCustomCommand(OSObject* obj, UInt32* commands);
+    bool loadCustomCommands(OSArray* list);
 
 public:
     inline bool getUpdateNodes() { return mUpdateNodes; };
@@ -58,9 +80,17 @@ public:
     inline bool getPerformResetOnExternalWake() { return mPerformResetOnExternalWake; }
     inline bool getPerformResetOnEAPDFail() { return mPerformResetOnEAPDFail; }
     inline UInt16 getSendDelay() { return mSendDelay; };
+    inline bool getAdaptiveSendDelay() { return mAdaptiveSendDelay; }
+    inline bool getPinReadinessCheck() { return mPinReadinessCheck; }
     inline bool getCheckInfinite() { return mCheckInfinite; };
     inline UInt16 getCheckInterval() { return mCheckInterval; };
-    inline OSArray* getCustomCommands() { return mCustomCommands; };
+    // Verbs to send on entering state (count 0 if there are none), read only once loaded so
+    // any thread may send them; the responses are the caller's
+    inline const UInt32* getCustomCommands(CodecCommanderState state, UInt32* count)
+        { *count = mCustomCommandCount[state]; return mCustomCommands + mCustomCommandOffset[state]; }
+    inline bool getUseDMACommands() { return mUseDMACommands; }
+    inline UInt16 getCommandTimeout() { return mCommandTimeout; }
+    inline bool getAsyncPowerTransitions() { return mAsyncPowerTransitions; }
     inline bool getDisable() { return mDisable; }
 
     // Constructor
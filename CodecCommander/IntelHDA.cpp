@@ -18,10 +18,46 @@
  */
 
 #include "IntelHDA.h"
+#include "CodecTopology.h"
 
 #define kIntelVendorID              0x8086
 #define kIntelRegTCSEL              0x44
 
+// CORB (4 bytes/entry) and RIRB (8 bytes/entry) share one page, both 128-byte aligned
+#define kHDARingBufferSize          4096
+#define kHDARirbOffset              1024
+
+// A verb completes in about two link frames (2 x 20.8us), poll tightly for that long
+// and back off gradually afterwards
+#define kHDAFrameSpinUS             42
+#define kHDAPollMinDelayUS          1
+#define kHDAPollMaxDelayUS          100
+
+// Parameters 0x00-0x13 are read-only capabilities, a full codec fits in one page
+#define kHDAParamCacheEntries       512
+#define kHDAParamCacheLimit         (kHDAParamCacheEntries * 3 / 4)
+#define kHDAParamCacheMaxParameter  0x13
+
+// Cache misses are collected and sent in chunks of this size
+#define kHDASubmitChunk             64
+
+// Codec must be ready within 200ms after reset, poll its power state until then
+#define kHDAResetReadyUS            220000
+#define kHDAResetPollUS             1000
+#define kHDAReadyMaxPins            32
+
+// Client lane rate limit: client verbs may keep the link busy for this share (percent) of
+// the time on average, bursts may run ahead by up to the burst window
+#define kHDAClientLinkShare         50
+#define kHDAClientBurstUS           10000
+
+// Consecutive timeouts before verbs to the codec (or a single node) fail fast
+#define kHDACodecBreakerThreshold   3
+#define kHDANodeBreakerThreshold    2
+
+// A node that stopped answering gets one verb through per interval to see if it is back
+#define kHDANodeRetryMS             1000
+
 static IOPCIDevice* getPCIDevice(IORegistryEntry* registryEntry)
 {
     IOPCIDevice* result = NULL;
@@ -67,6 +103,20 @@ IntelHDA::IntelHDA(IOService* provider, HDACommandMode commandMode)
 
 IntelHDA::~IntelHDA()
 {
+    delete mTopology;
+    shutdownDMA();
+
+    if (mRingLock)
+        IOLockFree(mRingLock);
+    if (mInterruptLock)
+        IOSimpleLockFree(mInterruptLock);
+    if (mSubmitLock)
+        IOLockFree(mSubmitLock);
+
+    if (mParamCache)
+        IOFree(mParamCache, kHDAParamCacheEntries * sizeof(HDA_PARAM_CACHE_ENTRY));
+    if (mTrace)
+        IOFree(mTrace, kClientTraceEntries * sizeof(CodecCommanderTraceRecord));
     OSSafeRelease(mMemoryMap);
 }
 
@@ -95,6 +145,9 @@ bool IntelHDA::initialize()
         return false;
     }
 
+    if (mSubmitLock == NULL && (mSubmitLock = IOLockAlloc()) == NULL)
+        return false;
+
     mDevice->setMemoryEnable(true);
     
     mDeviceMemory = mDevice->getDeviceMemoryWithIndex(0);
@@ -131,10 +184,16 @@ bool IntelHDA::initialize()
                   deviceInfo & 0xFFFF,
                   deviceInfo >> 16);
 
+    if (mCommandMode == DMA && !this->initializeDMA())
+    {
+        AlwaysLog("DMA command mode unavailable, using PIO.\n");
+        mCommandMode = PIO;
+    }
+
     // Note: Must reset the codec here for getVendorId to work.
     //  If the computer is restarted when the codec is in fugue state (D3cold),
     //  it will not respond without the Double Function Group Reset.
-    if (mCodecVendorId == -1 && this->getVendorId() == 0xFFFF)
+    if (mCodecVendorId == (UInt32)-1 && this->getVendorId() == 0xFFFF)
         this->resetCodec();
 
     if (mRegMap->VMAJ == 1 && mRegMap->VMIN == 0 && this->getVendorId() != 0xFFFF)
@@ -182,228 +241,1417 @@ void IntelHDA::resetCodec()
 
     DebugLog("--> resetting codec\n");
 
+    // reset must reach the codec even if it stopped answering (the breaker belongs to
+    // whoever holds the gate)
+    if (!mCommandGate || mCommandGate->runAction(&IntelHDA::closeBreakerAction, this) != kIOReturnSuccess)
+        closeBreakerAction(NULL, this, NULL, NULL, NULL);
+
     UInt16 audioRoot = getAudioRoot();
     this->sendCommand(audioRoot, HDA_VERB_RESET, HDA_PARM_NULL);
     IOSleep(1);
     this->sendCommand(audioRoot, HDA_VERB_RESET, HDA_PARM_NULL);
-    IOSleep(220); // per-HDA spec, device must respond (D0) within 200ms
+
+    // per-HDA spec, device must respond (D0) within 200ms, poll instead of waiting it out
+    UInt64 start = getMicroseconds();
+    bool ready = false;
+
+    while (!ready && getMicroseconds() - start < kHDAResetReadyUS)
+    {
+        IOSleep(1);
+        ready = this->isCodecReady();
+    }
+
+    UInt32 elapsed = (UInt32)(getMicroseconds() - start);
+    mResetLatency.record(elapsed);
+
+    if (ready)
+        DebugLog("--> codec ready %d us after reset\n", elapsed);
+    else
+        AlwaysLog("Codec not ready %d us after reset.\n", elapsed);
+
+    // parameters are re-read from the freshly initialized codec
+    this->invalidateParameterCache();
 
     // forcefully set power state to D3
     this->sendCommand(audioRoot, HDA_VERB_SET_PSTATE, HDA_PARM_PS_D3_HOT);
     DebugLog("--> hda codec power restored\n");
 }
 
-void IntelHDA::applyIntelTCSEL()
+static UInt16 selectRingSize(UInt8 capability, UInt8* size)
 {
-    if (mDevice && mDevice->configRead16(kIOPCIConfigVendorID) == kIntelVendorID)
+    if (capability & HDA_RING_SZCAP_256)
     {
-        /* Clear bits 0-2 of PCI register TCSEL (at offset 0x44)
-         * TCSEL == Traffic Class Select Register, which sets PCI express QOS
-         * Ensuring these bits are 0 clears playback static on some HD Audio
-         * codecs.
-         * The PCI register TCSEL is defined in the Intel manuals.
-         */
-        UInt8 value = mDevice->configRead8(kIntelRegTCSEL);
-        UInt8 newValue = value & ~0x07;
-        if (newValue != value)
-        {
-            mDevice->configWrite8(kIntelRegTCSEL, newValue);
-            DebugLog("Intel TCSEL: 0x%02x -> 0x%02x\n", value, newValue);
-        }
+        *size = HDA_RING_SIZE_256;
+        return 256;
+    }
+    if (capability & HDA_RING_SZCAP_16)
+    {
+        *size = HDA_RING_SIZE_16;
+        return 16;
     }
+    *size = HDA_RING_SIZE_2;
+    return 2;
 }
 
-UInt16 IntelHDA::getVendorId()
+bool IntelHDA::initializeDMA()
 {
-    if (mCodecVendorId == -1)
-        mCodecVendorId = this->sendCommand(0, HDA_VERB_GET_PARAM, HDA_PARM_VENDOR);
-    
-    return mCodecVendorId >> 16;
-}
+    DebugLog("IntelHDA::initializeDMA\n");
 
-UInt16 IntelHDA::getDeviceId()
-{
-    if (mCodecVendorId == -1)
-        mCodecVendorId = this->sendCommand(0, HDA_VERB_GET_PARAM, HDA_PARM_VENDOR);
-    
-    return mCodecVendorId & 0xFFFF;
-}
+    // Once the audio driver is running the rings belong to it, never take them over
+    if (mRegMap->CORBRUN || mRegMap->RINTCNT_RIRBDMAEN)
+    {
+        AlwaysLog("CORB/RIRB already in use by another driver.\n");
+        return false;
+    }
 
-UInt16 IntelHDA::getAudioRoot()
-{
-    if (mAudioRoot == (UInt16)-1)
+    // Serializes verb submission against draining unsolicited responses
+    if (mRingLock == NULL && (mRingLock = IOLockAlloc()) == NULL)
+        return false;
+    if (mInterruptLock == NULL && (mInterruptLock = IOSimpleLockAlloc()) == NULL)
+        return false;
+
+    UInt8 corbSize, rirbSize;
+    mCorbEntries = selectRingSize(mRegMap->CORBSZCAP, &corbSize);
+    mRirbEntries = selectRingSize(mRegMap->RIRBSIZE_RIRBSZCAP, &rirbSize);
+
+    // Rings must be physically contiguous, 128-byte aligned and reachable by the controller
+    mach_vm_address_t physicalMask = mRegMap->GCAP_64OK ? 0xFFFFFFFFFFFFF000ULL : 0x00000000FFFFF000ULL;
+    mRingMemory = IOBufferMemoryDescriptor::inTaskWithPhysicalMask(kernel_task, kIODirectionInOut | kIOMemoryPhysicallyContiguous,
+                                                                   kHDARingBufferSize, physicalMask);
+    if (mRingMemory == NULL || mRingMemory->prepare() != kIOReturnSuccess)
     {
-        UInt32 nodes = this->sendCommand(0, HDA_VERB_GET_PARAM, HDA_PARM_NODECOUNT);
-        if (nodes != -1)
-        {
-            UInt16 start = nodes & 0xFF;
-            UInt16 end = start + ((nodes & 0xFF0000) >> 16);
-            for (UInt16 node = start; node < end; node++)
-            {
-                UInt32 type = this->sendCommand(node, HDA_VERB_GET_PARAM, HDA_PARM_FUNCGRP);
-                if ((type & 0xFF) == HDA_TYPE_AFG)
-                {
-                    DebugLog("getAudioRoot found audio root = 0x%02x\n", node);
-                    mAudioRoot = node;
-                    break;
-                }
-            }
-        }
-        if (mAudioRoot == (UInt16)-1)
-        {
-            DebugLog("getAudioRoot failed to find audio root... using default root of 1\n");
-            mAudioRoot = 1;
-        }
+        AlwaysLog("Failed to allocate CORB/RIRB memory.\n");
+        OSSafeReleaseNULL(mRingMemory);
+        return false;
     }
-    return mAudioRoot;
+
+    UInt8* ringBytes = (UInt8*)mRingMemory->getBytesNoCopy();
+    bzero(ringBytes, kHDARingBufferSize);
+    mRingPhysical = mRingMemory->getPhysicalAddress();
+    mCorb = (volatile UInt32*)ringBytes;
+    mRirb = (volatile HDA_RIRB_ENTRY*)(ringBytes + kHDARirbOffset);
+
+    DebugLog("CORB/RIRB @ 0x%08llx, %d/%d entries\n", (UInt64)mRingPhysical, mCorbEntries, mRirbEntries);
+
+    mDevice->setBusMasterEnable(true);
+
+    // Program the CORB
+    mRegMap->CORBLBASE = (UInt32)mRingPhysical;
+    mRegMap->CORBUBASE = (UInt32)((UInt64)mRingPhysical >> 32);
+    mRegMap->CORBSIZE = corbSize;
+
+    // Reset the CORB read pointer, the reset bit must read back set before it is cleared
+    mRegMap->CORBRPRST = 1;
+    for (int i = 0; i < 1000 && !mRegMap->CORBRPRST; i++)
+        ::IODelay(10);
+    mRegMap->CORBRPRST = 0;
+    for (int i = 0; i < 1000 && mRegMap->CORBRPRST; i++)
+        ::IODelay(10);
+
+    if (mRegMap->CORBRPRST)
+    {
+        AlwaysLog("Timed out resetting CORB read pointer.\n");
+        shutdownDMA();
+        return false;
+    }
+
+    mRegMap->CORBWP = 0;
+    mCorbWritePointer = 0;
+
+    // Program the RIRB
+    mRegMap->RIRBLBASE = (UInt32)(mRingPhysical + kHDARirbOffset);
+    mRegMap->RIRBUBASE = (UInt32)((UInt64)(mRingPhysical + kHDARirbOffset) >> 32);
+    mRegMap->RIRBSIZE = rirbSize;
+    mRegMap->RIRBWPRST = 1;
+    mRegMap->RINTCNT = 1;
+    mRirbReadPointer = 0;
+    mRirbLate = 0;
+
+    // Start both DMA engines
+    mRegMap->RINTCNT_RIRBDMAEN = 1;
+    mRegMap->CORBRUN = 1;
+
+    return true;
 }
 
-UInt8 IntelHDA::getTotalNodes()
+void IntelHDA::shutdownDMA()
 {
-    if (mNodes == -1)
+    if (mRingMemory == NULL)
+        return;
+
+    // Only stop the engines if nobody re-programmed the controller behind our back
+    if (ownsCommandRings())
     {
-        UInt16 audioRoot = getAudioRoot();
-        mNodes = this->sendCommand(audioRoot, HDA_VERB_GET_PARAM, HDA_PARM_NODECOUNT);
-        // in the case of an invalid response, use zero
-        if (mNodes == -1) mNodes = 0;
+        disableUnsolicitedResponses();
+        mRegMap->CORBRUN = 0;
+        mRegMap->RINTCNT_RIRBDMAEN = 0;
     }
-    return mNodes & 0x0000FF;
+
+    // an interrupt filter already running on another CPU finishes with the ring first
+    IOInterruptState interruptState = IOSimpleLockLockDisableInterrupt(mInterruptLock);
+    mUnsolicitedEnabled = false;
+    mCorb = NULL;
+    mRirb = NULL;
+    IOSimpleLockUnlockEnableInterrupt(mInterruptLock, interruptState);
+
+    mRingMemory->complete();
+    OSSafeReleaseNULL(mRingMemory);
+    mRingPhysical = 0;
 }
 
-UInt8 IntelHDA::getStartingNode()
+bool IntelHDA::ownsCommandRings()
+{
+    return mRingMemory != NULL &&
+           mRegMap->CORBLBASE == (UInt32)mRingPhysical &&
+           mRegMap->CORBRUN && mRegMap->RINTCNT_RIRBDMAEN;
+}
+
+void IntelHDA::queueUnsolicited(UInt32 response)
 {
-    if (mNodes == -1)
+    UInt32 next = (mUnsolicitedTail + 1) % kHDAUnsolicitedQueueSize;
+    if (next == mUnsolicitedHead)
     {
-        UInt16 audioRoot = getAudioRoot();
-        mNodes = this->sendCommand(audioRoot, HDA_VERB_GET_PARAM, HDA_PARM_NODECOUNT);
-        // in the case of an invalid response, use zero
-        if (mNodes == -1) mNodes = 0;
+        mUnsolicitedDropped++;
+        return;
     }
-    return (mNodes & 0xFF0000) >> 16;
+
+    mUnsolicited[mUnsolicitedTail] = response;
+    mUnsolicitedTail = next;
 }
 
-UInt32 IntelHDA::getSubsystemId()
+void IntelHDA::collectUnsolicited()
 {
-    if (mCodecSubsystemId == -1)
+    // Anything else still in the RIRB is a late response to a timed out submission
+    UInt16 writePointer = mRegMap->RIRBWP;
+    while (mRirbReadPointer != writePointer)
     {
-        UInt16 audioRoot = getAudioRoot();
-        mCodecSubsystemId = this->sendCommand(audioRoot, HDA_VERB_GET_SUBSYSTEM_ID, HDA_PARM_NULL);
-        // in the case of an invalid response, use zero
-        if (mCodecSubsystemId == -1) mCodecSubsystemId = 0;
+        mRirbReadPointer = (mRirbReadPointer + 1) % mRirbEntries;
+
+        UInt32 responseEx = mRirb[mRirbReadPointer].ResponseEx;
+        if (HDA_RIRB_EX_CODEC(responseEx) != (mCodecAddress & 0xF))
+            continue;
+        if (HDA_RIRB_EX_IS_UNSOL(responseEx))
+            queueUnsolicited(mRirb[mRirbReadPointer].Response);
+        else if (mRirbLate)
+            mRirbLate--;
     }
-    return mCodecSubsystemId;
 }
 
-UInt32 IntelHDA::getPCISubId()
+bool IntelHDA::enableUnsolicitedResponses()
 {
-    UInt32 result = mDevice->configRead32(kIOPCIConfigSubSystemVendorID);
-    // flip words to be consistent with other 32-bit identifiers
-    return ((result & 0xFFFF) << 16) | result >> 16;
+    if (mCommandMode != DMA || !ownsCommandRings())
+        return false;
+
+    mUnsolicitedHead = mUnsolicitedTail = 0;
+    mUnsolicitedEnabled = true;
+
+    // Accept unsolicited responses and raise an interrupt for every RIRB write
+    mRegMap->GCTL_UNSOL = 1;
+    mRegMap->RINTCNT_RINTCTL = 1;
+    mRegMap->INTCTL_CIE = 1;
+    mRegMap->INTCTL_GIE = 1;
+
+    return true;
 }
 
-UInt32 IntelHDA::sendCommand(UInt8 nodeId, UInt16 verb, UInt8 payload)
+void IntelHDA::disableUnsolicitedResponses()
 {
-    DebugLog("SendCommand: node 0x%02x, verb 0x%06x, payload 0x%02x.\n", nodeId, verb, payload);
-    return this->sendCommand((nodeId & 0xFF) << 20 | (verb & 0xFFF) << 8 | payload);
+    if (!mUnsolicitedEnabled)
+        return;
+
+    mRegMap->RINTCNT_RINTCTL = 0;
+    mRegMap->INTCTL_CIE = 0;
+    mRegMap->GCTL_UNSOL = 0;
+    mUnsolicitedEnabled = false;
 }
 
-UInt32 IntelHDA::sendCommand(UInt8 nodeId, UInt8 verb, UInt16 payload)
+bool IntelHDA::acknowledgeInterrupt()
 {
-    DebugLog("SendCommand: node 0x%02x, verb 0x%02x, payload 0x%04x.\n", nodeId, verb, payload);
-    return this->sendCommand((nodeId & 0xFF) << 20 | (verb & 0xF) << 16 | payload);
+    // primary interrupt context, shutdownDMA may be freeing the ring on another CPU
+    if (mInterruptLock == NULL)
+        return false;
+
+    IOSimpleLockLock(mInterruptLock);
+    bool unsolicited = false;
+
+    if (mUnsolicitedEnabled && mRirb != NULL && (mRegMap->RIRBSTS & HDA_RIRBSTS_RINTFL))
+    {
+        // write 1 to clear, only RINTFL (a read-modify-write would clear RIRBOIS as well)
+        mRegMap->RIRBSTS = HDA_RIRBSTS_RINTFL;
+
+        unsolicited = mUnsolicitedHead != mUnsolicitedTail;
+
+        // Peek only, the ring is consumed under the lock by getUnsolicitedResponses/executeDMA
+        for (UInt16 readPointer = mRirbReadPointer, writePointer = mRegMap->RIRBWP; !unsolicited && readPointer != writePointer; )
+        {
+            readPointer = (readPointer + 1) % mRirbEntries;
+            unsolicited = HDA_RIRB_EX_IS_UNSOL(mRirb[readPointer].ResponseEx);
+        }
+    }
+
+    IOSimpleLockUnlock(mInterruptLock);
+    return unsolicited;
 }
 
-UInt32 IntelHDA::sendCommand(UInt32 command)
+UInt32 IntelHDA::getUnsolicitedResponses(UInt32* responses, UInt32 maxCount)
 {
-    UInt32 fullCommand = (mCodecAddress & 0xF) << 28 | (command & 0x0FFFFFFF);
-    
-    if (mDeviceMemory == NULL)
-        return -1;
-    
-    DebugLog("SendCommand: (w) --> 0x%08x\n", fullCommand);
-  
-    UInt32 response = -1;
-    
-    switch (mCommandMode)
+    UInt32 count = 0;
+
+    if (!mUnsolicitedEnabled)
+        return 0;
+
+    IOLockLock(mRingLock);
+
+    if (ownsCommandRings())
+        collectUnsolicited();
+
+    while (count < maxCount && mUnsolicitedHead != mUnsolicitedTail)
     {
-        case PIO:
-            response = this->executePIO(fullCommand);
-            break;
-        case DMA:
-            AlwaysLog("Unsupported command mode DMA requested.\n");
-            response = -1;
-            break;
-        default:
-            response = -1;
-            break;
+        responses[count++] = mUnsolicited[mUnsolicitedHead];
+        mUnsolicitedHead = (mUnsolicitedHead + 1) % kHDAUnsolicitedQueueSize;
     }
-    
-    DebugLog("SendCommand: (r) <-- 0x%08x\n", response);
-    
-    return response;
+
+    IOLockUnlock(mRingLock);
+
+    return count;
 }
 
-UInt32 IntelHDA::executePIO(UInt32 command)
+bool IntelHDA::setCommandMode(HDACommandMode commandMode)
 {
-    UInt16 status;
-    
-    status = 0x1; // Busy status
-    
-    for (int i = 0; i < 1000; i++)
+    if (commandMode == mCommandMode)
+        return true;
+
+    if (commandMode == DMA)
     {
-        status = mRegMap->ICS;
-        
-        if (!HDA_ICS_IS_BUSY(status))
-            break;
-        
-        ::IODelay(100);
+        if (mRegMap == NULL || !this->initializeDMA())
+        {
+            AlwaysLog("DMA command mode unavailable, using PIO.\n");
+            return false;
+        }
     }
-    
-    // HDA controller was not ready to receive PIO commands
-    if (HDA_ICS_IS_BUSY(status))
+    else
+        shutdownDMA();
+
+    mCommandMode = commandMode;
+    return true;
+}
+
+bool IntelHDA::recordResult(UInt32 command, UInt32 response)
+{
+    UInt8 node = command >> 20 & 0xFF;
+
+    if (response != (UInt32)-1)
     {
-        DebugLog("ExecutePIO timed out waiting for ICS readiness.\n");
-        return -1;
+        mCodecTimeouts = 0;
+        mNodeTimeouts[node] = 0;
+        return true;
     }
-    
-    //DEBUG_LOG("IntelHDA::ExecutePIO ICB bit clear.\n");
-    
-    // Queue the verb for the HDA controller
-    mRegMap->ICW = command;
-    
-    status = 0x1; // Busy status
-    mRegMap->ICS = status;
-    
-    //DEBUG_LOG("IntelHDA::ExecutePIO Wrote verb and set ICB bit.\n");
-    
-    // Wait for HDA controller to return with a response
-    for (int i = 0; i < 1000; i++)
+
+    // a codec still initializing is not failing
+    if (mPolling)
+        return false;
+
+    // the retry interval of a node starts when it trips
+    if (mNodeTimeouts[node] < 0xFF && ++mNodeTimeouts[node] == kHDANodeBreakerThreshold)
+        mNodeRetry[node] = (UInt32)(getMicroseconds() / 1000);
+
+    if (++mCodecTimeouts >= kHDACodecBreakerThreshold && !mBreakerOpen)
     {
-        status = mRegMap->ICS;
-        
-        if (!HDA_ICS_IS_BUSY(status))
-            break;
-        
-        ::IODelay(100);
+        AlwaysLog("Codec not responding, failing further verbs until it answers again.\n");
+        mBreakerOpen = true;
+        mBreakerTrips++;
     }
-    
-    // Store the result validity while IRV is cleared
-    bool validResult = HDA_ICS_IS_VALID(status);
-    
-    UInt32 response;
-    
-    if (validResult)
-        response = mRegMap->IRR;
-    
-    // Reset IRV
-    status = 0x02; // Valid, Non-busy status
-    mRegMap->ICS = status;
-    
-    if (!validResult)
+
+    return false;
+}
+
+bool IntelHDA::probeCodec()
+{
+    // Half-open: let one cheap verb through (bypassing the parameter cache and the
+    // timeout accounting), only an answer closes the breaker
+    UInt32 command = (mCodecAddress & 0xF) << 28 | HDA_COMMAND(0, HDA_VERB_GET_PARAM, HDA_PARM_VENDOR);
+    UInt32 response = -1;
+    UInt64 start = getMicroseconds();
+    UInt8 transport = kTraceTransportPIO;
+
+    if (mCommandMode == DMA)
     {
-        DebugLog("ExecutePIO Invalid result received.\n");
-        return -1;
+        IOLockLock(mRingLock);
+        this->executeDMA(&command, &response, 1);
+        IOLockUnlock(mRingLock);
+        transport = kTraceTransportDMA;
     }
-    
-    return response;
-}
\ No newline at end of file
+    else if (mCommandMode == PIO)
+        response = this->executePIO(command);
+
+    traceCommand(command, response, (UInt32)(getMicroseconds() - start), transport,
+                 response != (UInt32)-1 ? kTraceStatusOK : kTraceStatusTimeout);
+
+    if (response == (UInt32)-1)
+        return false;
+
+    DebugLog("Codec answered probe, closing breaker.\n");
+    closeBreaker();
+    return true;
+}
+
+bool IntelHDA::isCodecResponsive()
+{
+    if (!mBreakerOpen)
+        return true;
+
+    // Submitted like any power verb, the submission path probes the codec under the gate
+    // before sending anything while the breaker is open
+    UInt32 command = HDA_COMMAND(0, HDA_VERB_GET_PARAM, HDA_PARM_VENDOR);
+    this->sendCommands(&command, 1, &command, NULL, kHDALanePower);
+
+    return !mBreakerOpen;
+}
+
+bool IntelHDA::isCodecReady(const UInt8* pins, UInt8 pinCount)
+{
+    UInt32 commands[1 + kHDAReadyMaxPins];
+    UInt32 count = 0;
+
+    commands[count++] = HDA_COMMAND(getAudioRoot(), HDA_VERB_GET_PSTATE, HDA_PARM_NULL);
+    for (int i = 0; i < pinCount && i < kHDAReadyMaxPins; i++)
+        commands[count++] = HDA_COMMAND(pins[i], HDA_VERB_EAPDBTL_GET, HDA_PARM_NULL);
+
+    // no answer is expected while the codec initializes, so the timeouts of the poll do not
+    // trip the breakers (an open breaker is probed once per poll and closes when it answers)
+    return this->submitCommands(commands, commands, count, kHDAResetPollUS, kHDALanePower, true) == count &&
+           HDA_PSTATE_ACT(commands[0]) == HDA_PSTATE_SET(commands[0]);
+}
+
+bool IntelHDA::isNodeAvailable(UInt8 node)
+{
+    if (mNodeTimeouts[node] < kHDANodeBreakerThreshold)
+        return true;
+
+    // Half-open: the verb goes through once per interval, an answer clears the count
+    UInt32 now = (UInt32)(getMicroseconds() / 1000);
+    if (now - mNodeRetry[node] < kHDANodeRetryMS)
+        return false;
+
+    mNodeRetry[node] = now;
+    return true;
+}
+
+void IntelHDA::resetNodeBreakers()
+{
+    // the counters belong to whoever holds the gate
+    if (!mCommandGate || mCommandGate->runAction(&IntelHDA::clearNodeTimeouts, this) != kIOReturnSuccess)
+        clearNodeTimeouts(NULL, this, NULL, NULL, NULL);
+}
+
+IOReturn IntelHDA::clearNodeTimeouts(OSObject* owner, void* intelHDA, void*, void*, void*)
+{
+    IntelHDA* self = (IntelHDA*)intelHDA;
+    bzero(self->mNodeTimeouts, sizeof(self->mNodeTimeouts));
+    return kIOReturnSuccess;
+}
+
+IOReturn IntelHDA::closeBreakerAction(OSObject* owner, void* intelHDA, void*, void*, void*)
+{
+    IntelHDA* self = (IntelHDA*)intelHDA;
+
+    // also excludes submitters draining without the gate
+    IOLockLock(self->mSubmitLock);
+    self->closeBreaker();
+    IOLockUnlock(self->mSubmitLock);
+    return kIOReturnSuccess;
+}
+
+void IntelHDA::closeBreaker()
+{
+    mBreakerOpen = false;
+    mCodecTimeouts = 0;
+    bzero(mNodeTimeouts, sizeof(mNodeTimeouts));
+}
+
+static inline UInt32 getParameterTag(UInt32 command)
+{
+    // Only GET_PARAM of a read-only capability is memoized
+    if (((command >> 8) & 0xFFF) != HDA_VERB_GET_PARAM || (command & 0xFF) > kHDAParamCacheMaxParameter)
+        return 0;
+
+    return 0x10000 | (command >> 12 & 0xFF00) | (command & 0xFF);
+}
+
+static inline UInt32 getParameterSlot(UInt32 tag)
+{
+    return (tag * 0x9E3779B1) >> 23 & (kHDAParamCacheEntries - 1);
+}
+
+bool IntelHDA::lookupParameter(UInt32 command, UInt32* response)
+{
+    UInt32 tag = getParameterTag(command);
+    if (!tag)
+        return false;
+
+    if (mParamCache)
+    {
+        for (UInt32 slot = getParameterSlot(tag); mParamCache[slot].Tag; slot = (slot + 1) & (kHDAParamCacheEntries - 1))
+        {
+            if (mParamCache[slot].Tag == tag)
+            {
+                *response = mParamCache[slot].Response;
+                mParamCacheHits++;
+                return true;
+            }
+        }
+    }
+
+    mParamCacheMisses++;
+    return false;
+}
+
+void IntelHDA::storeParameter(UInt32 command, UInt32 response)
+{
+    UInt32 tag = getParameterTag(command);
+    if (!tag || response == (UInt32)-1 || mParamCacheCount >= kHDAParamCacheLimit)
+        return;
+
+    if (!mParamCache)
+    {
+        mParamCache = (HDA_PARAM_CACHE_ENTRY*)IOMalloc(kHDAParamCacheEntries * sizeof(HDA_PARAM_CACHE_ENTRY));
+        if (!mParamCache)
+            return;
+        bzero(mParamCache, kHDAParamCacheEntries * sizeof(HDA_PARAM_CACHE_ENTRY));
+    }
+
+    UInt32 slot = getParameterSlot(tag);
+    while (mParamCache[slot].Tag && mParamCache[slot].Tag != tag)
+        slot = (slot + 1) & (kHDAParamCacheEntries - 1);
+
+    if (!mParamCache[slot].Tag)
+        mParamCacheCount++;
+
+    mParamCache[slot].Tag = tag;
+    mParamCache[slot].Response = response;
+}
+
+void IntelHDA::invalidateParameterCache()
+{
+    if (mParamCache)
+        bzero(mParamCache, kHDAParamCacheEntries * sizeof(HDA_PARAM_CACHE_ENTRY));
+    mParamCacheCount = 0;
+}
+
+OSDictionary* IntelHDA::createStatistics()
+{
+    static const char* transportNames[kHDACommandModeCount] = { "PIO", "DMA" };
+
+    OSDictionary* dict = OSDictionary::withCapacity(kHDACommandModeCount);
+    if (!dict)
+        return NULL;
+
+    for (int mode = 0; mode < kHDACommandModeCount; mode++)
+    {
+        OSDictionary* latency = mLatency[mode].createDictionary();
+        if (!latency)
+            continue;
+
+        if (OSNumber* num = OSNumber::withNumber(mTimeouts[mode], 32))
+        {
+            latency->setObject("Timeouts", num);
+            num->release();
+        }
+        dict->setObject(transportNames[mode], latency);
+        latency->release();
+    }
+
+    if (OSDictionary* cache = OSDictionary::withCapacity(3))
+    {
+        const UInt32 values[] = { mParamCacheHits, mParamCacheMisses, mParamCacheCount };
+        const char* keys[] = { "Hits", "Misses", "Entries" };
+        for (int i = 0; i < 3; i++)
+        {
+            if (OSNumber* num = OSNumber::withNumber(values[i], 32))
+            {
+                cache->setObject(keys[i], num);
+                num->release();
+            }
+        }
+        dict->setObject("Parameter Cache", cache);
+        cache->release();
+    }
+
+    static const char* laneNames[kHDALaneCount] = { "Power", "Custom", "Client", "Diagnostic" };
+
+    if (OSDictionary* lanes = OSDictionary::withCapacity(kHDALaneCount + 1))
+    {
+        for (int lane = 0; lane < kHDALaneCount; lane++)
+        {
+            OSDictionary* entry = mLaneWait[lane].createDictionary();
+            if (!entry)
+                continue;
+
+            const UInt32 values[] = { mLaneVerbs[lane], mLaneDepth[lane], mLaneMaxDepth[lane] };
+            const char* keys[] = { "Verbs", "Depth", "Max Depth" };
+            for (int i = 0; i < 3; i++)
+            {
+                if (OSNumber* num = OSNumber::withNumber(values[i], 32))
+                {
+                    entry->setObject(keys[i], num);
+                    num->release();
+                }
+            }
+            lanes->setObject(laneNames[lane], entry);
+            entry->release();
+        }
+        if (OSNumber* num = OSNumber::withNumber(mClientThrottled, 32))
+        {
+            lanes->setObject("Client Throttled", num);
+            num->release();
+        }
+        dict->setObject("Lanes", lanes);
+        lanes->release();
+    }
+
+    if (mResetLatency.getCount())
+    {
+        if (OSDictionary* reset = mResetLatency.createDictionary())
+        {
+            dict->setObject("Reset", reset);
+            reset->release();
+        }
+    }
+
+    if (OSDictionary* breaker = OSDictionary::withCapacity(3))
+    {
+        breaker->setObject("Open", mBreakerOpen ? kOSBooleanTrue : kOSBooleanFalse);
+        if (OSNumber* num = OSNumber::withNumber(mBreakerTrips, 32))
+        {
+            breaker->setObject("Trips", num);
+            num->release();
+        }
+        if (OSNumber* num = OSNumber::withNumber(mShortCircuited, 32))
+        {
+            breaker->setObject("Short Circuited", num);
+            num->release();
+        }
+        dict->setObject("Breaker", breaker);
+        breaker->release();
+    }
+
+    if (mUnsolicitedEnabled)
+    {
+        if (OSNumber* num = OSNumber::withNumber(mUnsolicitedDropped, 32))
+        {
+            dict->setObject("Unsolicited Dropped", num);
+            num->release();
+        }
+    }
+
+    if (mTopology)
+    {
+        if (OSDictionary* topology = mTopology->createDictionary())
+        {
+            dict->setObject("Topology", topology);
+            topology->release();
+        }
+    }
+
+    return dict;
+}
+
+void IntelHDA::applyIntelTCSEL()
+{
+    if (mDevice && mDevice->configRead16(kIOPCIConfigVendorID) == kIntelVendorID)
+    {
+        /* Clear bits 0-2 of PCI register TCSEL (at offset 0x44)
+         * TCSEL == Traffic Class Select Register, which sets PCI express QOS
+         * Ensuring these bits are 0 clears playback static on some HD Audio
+         * codecs.
+         * The PCI register TCSEL is defined in the Intel manuals.
+         */
+        UInt8 value = mDevice->configRead8(kIntelRegTCSEL);
+        UInt8 newValue = value & ~0x07;
+        if (newValue != value)
+        {
+            mDevice->configWrite8(kIntelRegTCSEL, newValue);
+            DebugLog("Intel TCSEL: 0x%02x -> 0x%02x\n", value, newValue);
+        }
+    }
+}
+
+UInt16 IntelHDA::getVendorId()
+{
+    if (mCodecVendorId == (UInt32)-1)
+        mCodecVendorId = this->sendCommand(0, HDA_VERB_GET_PARAM, HDA_PARM_VENDOR);
+    
+    return mCodecVendorId >> 16;
+}
+
+UInt16 IntelHDA::getDeviceId()
+{
+    if (mCodecVendorId == (UInt32)-1)
+        mCodecVendorId = this->sendCommand(0, HDA_VERB_GET_PARAM, HDA_PARM_VENDOR);
+    
+    return mCodecVendorId & 0xFFFF;
+}
+
+UInt16 IntelHDA::getAudioRoot()
+{
+    if (mAudioRoot == (UInt16)-1)
+    {
+        UInt32 nodes = this->sendCommand(0, HDA_VERB_GET_PARAM, HDA_PARM_NODECOUNT);
+        if (nodes != (UInt32)-1)
+        {
+            UInt16 start = nodes & 0xFF;
+            UInt16 count = (nodes & 0xFF0000) >> 16;
+            UInt32* types = count ? (UInt32*)IOMalloc(count * sizeof(UInt32)) : NULL;
+            if (types)
+            {
+                for (UInt16 i = 0; i < count; i++)
+                    types[i] = HDA_COMMAND(start + i, HDA_VERB_GET_PARAM, HDA_PARM_FUNCGRP);
+
+                this->sendCommands(types, count, types);
+
+                for (UInt16 i = 0; i < count; i++)
+                {
+                    if (types[i] != (UInt32)-1 && (types[i] & 0xFF) == HDA_TYPE_AFG)
+                    {
+                        DebugLog("getAudioRoot found audio root = 0x%02x\n", start + i);
+                        mAudioRoot = start + i;
+                        break;
+                    }
+                }
+                IOFree(types, count * sizeof(UInt32));
+            }
+        }
+        if (mAudioRoot == (UInt16)-1)
+        {
+            DebugLog("getAudioRoot failed to find audio root... using default root of 1\n");
+            mAudioRoot = 1;
+        }
+    }
+    return mAudioRoot;
+}
+
+UInt8 IntelHDA::getTotalNodes()
+{
+    if (mNodes == (UInt32)-1)
+    {
+        UInt16 audioRoot = getAudioRoot();
+        mNodes = this->sendCommand(audioRoot, HDA_VERB_GET_PARAM, HDA_PARM_NODECOUNT);
+        // in the case of an invalid response, use zero
+        if (mNodes == (UInt32)-1) mNodes = 0;
+    }
+    return mNodes & 0x0000FF;
+}
+
+UInt8 IntelHDA::getStartingNode()
+{
+    if (mNodes == (UInt32)-1)
+    {
+        UInt16 audioRoot = getAudioRoot();
+        mNodes = this->sendCommand(audioRoot, HDA_VERB_GET_PARAM, HDA_PARM_NODECOUNT);
+        // in the case of an invalid response, use zero
+        if (mNodes == (UInt32)-1) mNodes = 0;
+    }
+    return (mNodes & 0xFF0000) >> 16;
+}
+
+CodecTopology* IntelHDA::getTopology()
+{
+    if (mTopology == NULL)
+    {
+        mTopology = new CodecTopology;
+        if (mTopology && !mTopology->build(this))
+        {
+            DebugLog("getTopology failed to enumerate widgets\n");
+            delete mTopology;
+            mTopology = NULL;
+        }
+    }
+    return mTopology;
+}
+
+UInt32 IntelHDA::getSubsystemId()
+{
+    if (mCodecSubsystemId == (UInt32)-1)
+    {
+        UInt16 audioRoot = getAudioRoot();
+        mCodecSubsystemId = this->sendCommand(audioRoot, HDA_VERB_GET_SUBSYSTEM_ID, HDA_PARM_NULL);
+        // in the case of an invalid response, use zero
+        if (mCodecSubsystemId == (UInt32)-1) mCodecSubsystemId = 0;
+    }
+    return mCodecSubsystemId;
+}
+
+UInt32 IntelHDA::getPCISubId()
+{
+    UInt32 result = mDevice->configRead32(kIOPCIConfigSubSystemVendorID);
+    // flip words to be consistent with other 32-bit identifiers
+    return ((result & 0xFFFF) << 16) | result >> 16;
+}
+
+UInt32 IntelHDA::sendCommand(UInt8 nodeId, UInt16 verb, UInt8 payload)
+{
+    DebugLog("SendCommand: node 0x%02x, verb 0x%06x, payload 0x%02x.\n", nodeId, verb, payload);
+    return this->sendCommand(HDA_COMMAND(nodeId, verb, payload));
+}
+
+UInt32 IntelHDA::sendCommand(UInt8 nodeId, UInt8 verb, UInt16 payload)
+{
+    DebugLog("SendCommand: node 0x%02x, verb 0x%02x, payload 0x%04x.\n", nodeId, verb, payload);
+    return this->sendCommand(HDA_COMMAND_LONG(nodeId, verb, payload));
+}
+
+UInt32 IntelHDA::sendCommand(UInt32 command, HDACommandLane lane)
+{
+    if (mDeviceMemory == NULL)
+        return -1;
+    
+    DebugLog("SendCommand: (w) --> 0x%08x\n", (mCodecAddress & 0xF) << 28 | (command & 0x0FFFFFFF));
+  
+    UInt32 response = -1;
+    this->submitCommands(&command, &response, 1, 0, lane);
+    
+    DebugLog("SendCommand: (r) <-- 0x%08x\n", response);
+    
+    return response;
+}
+
+UInt32 IntelHDA::sendCommands(const UInt32* commands, size_t count, UInt32* responses, IOReturn* status, HDACommandLane lane)
+{
+    if (mDeviceMemory == NULL)
+    {
+        for (size_t i = 0; i < count; i++)
+        {
+            responses[i] = -1;
+            if (status) status[i] = kIOReturnNotReady;
+        }
+        return 0;
+    }
+
+    DebugLog("SendCommands: %d verbs\n", (int)count);
+
+    UInt32 completed = this->submitCommands(commands, responses, count, 0, lane);
+
+    if (status)
+    {
+        for (size_t i = 0; i < count; i++)
+            status[i] = responses[i] != (UInt32)-1 ? kIOReturnSuccess : kIOReturnTimeout;
+    }
+
+    DebugLog("SendCommands: %d of %d verbs completed\n", completed, (int)count);
+
+    return completed;
+}
+
+UInt32 IntelHDA::submitCommands(const UInt32* commands, UInt32* responses, size_t count, UInt32 timeout, HDACommandLane lane,
+                                bool poll)
+{
+    if (lane == kHDALaneClient)
+        throttleClient();
+
+    HDACommandRequest request;
+    request.Commands = commands;
+    request.Responses = responses;
+    request.Count = count;
+    request.Position = 0;
+    request.Lane = lane;
+    request.Timeout = timeout ? timeout : mDefaultTimeout;
+    request.Completed = 0;
+    request.Submitted = getMicroseconds();
+    request.Started = false;
+    request.Probed = false;
+    request.Poll = poll;
+    request.Done = false;
+
+    // Push onto the submission list (multiple producers, no lock)
+    HDACommandRequest* head;
+    do
+    {
+        head = mSubmissions;
+        request.Next = head;
+    } while (!OSCompareAndSwapPtr(head, &request, (void* volatile*)&mSubmissions));
+
+    // Whoever holds the gate executes queued requests by priority until its own one
+    // is done, or until it completed another one so that submitter can return first
+    while (!request.Done)
+    {
+        if (!mCommandGate || mCommandGate->runAction(&IntelHDA::drainSubmissions, this, &request) != kIOReturnSuccess)
+            drainSubmissions(NULL, this, &request, NULL, NULL);
+    }
+
+    return request.Completed;
+}
+
+void IntelHDA::throttleClient()
+{
+    // Client verbs already executed pushed the virtual clock ahead, wait once it
+    // runs further ahead of real time than the burst allowance
+    UInt64 now = getMicroseconds();
+    UInt64 clock = mClientClock;
+
+    if (clock > now + kHDAClientBurstUS)
+    {
+        mClientThrottled++;
+        IOSleep((UInt32)((clock - now - kHDAClientBurstUS + 999) / 1000));
+    }
+}
+
+void IntelHDA::collectSubmissions()
+{
+    // Take the whole list, it is in reverse order of submission
+    HDACommandRequest* list;
+    do
+    {
+        list = mSubmissions;
+    } while (list && !OSCompareAndSwapPtr(list, NULL, (void* volatile*)&mSubmissions));
+
+    HDACommandRequest* pending = NULL;
+    while (list)
+    {
+        HDACommandRequest* next = list->Next;
+        list->Next = pending;
+        pending = list;
+        list = next;
+    }
+
+    // Append to the lanes in submission order
+    while (pending)
+    {
+        HDACommandRequest* next = pending->Next;
+        HDACommandLane lane = pending->Lane;
+
+        pending->Next = NULL;
+        if (mLaneTail[lane])
+            mLaneTail[lane]->Next = pending;
+        else
+            mLaneHead[lane] = pending;
+        mLaneTail[lane] = pending;
+
+        if (++mLaneDepth[lane] > mLaneMaxDepth[lane])
+            mLaneMaxDepth[lane] = mLaneDepth[lane];
+
+        pending = next;
+    }
+}
+
+HDACommandRequest* IntelHDA::nextRequest()
+{
+    for (int lane = 0; lane < kHDALaneCount; lane++)
+    {
+        if (HDACommandRequest* request = mLaneHead[lane])
+        {
+            mLaneHead[lane] = request->Next;
+            if (!mLaneHead[lane])
+                mLaneTail[lane] = NULL;
+            mLaneDepth[lane]--;
+            return request;
+        }
+    }
+    return NULL;
+}
+
+IOReturn IntelHDA::drainSubmissions(OSObject* owner, void* intelHDA, void* submitter, void*, void*)
+{
+    IntelHDA* self = (IntelHDA*)intelHDA;
+    HDACommandRequest* own = (HDACommandRequest*)submitter;
+
+    // uncontended behind the gate, but submitters without it (before setCommandGate, or
+    // while it is removed) would otherwise drive the lanes and the link concurrently
+    IOLockLock(self->mSubmitLock);
+    self->collectSubmissions();
+
+    while (!own->Done)
+    {
+        HDACommandRequest* request = self->nextRequest();
+        if (!request)
+            break;
+
+        HDACommandLane lane = request->Lane;
+
+        if (!request->Started)
+        {
+            self->mLaneWait[lane].record((UInt32)(getMicroseconds() - request->Submitted));
+            request->Started = true;
+        }
+
+        // Power transitions run to completion, everything else gives way between
+        // chunks so newly arrived higher lanes go first
+        size_t slice = request->Count - request->Position;
+        if (lane != kHDALanePower && slice > kHDASubmitChunk)
+            slice = kHDASubmitChunk;
+
+        // with the breaker open a request probes the codec once, not once per slice
+        bool probe = !request->Probed;
+        if (self->mBreakerOpen)
+            request->Probed = true;
+
+        self->mCommandTimeout = request->Timeout;
+        self->mTraceLane = lane;
+        self->mPolling = request->Poll;
+        UInt64 start = getMicroseconds();
+        request->Completed += self->processCommands(request->Commands + request->Position,
+                                                    request->Responses + request->Position, slice, probe);
+        self->mCommandTimeout = self->mDefaultTimeout;
+        self->mPolling = false;
+        request->Position += slice;
+        self->mLaneVerbs[lane] += slice;
+
+        // charge the link time of client verbs to the rate limit clock after the fact, so a
+        // single large batch runs at link speed and only the following submissions are held
+        // back (cached parameters cost next to nothing)
+        if (lane == kHDALaneClient)
+        {
+            UInt64 now = getMicroseconds();
+            self->mClientClock = (self->mClientClock > now ? self->mClientClock : now) +
+                                 (now - start) * 100 / kHDAClientLinkShare;
+        }
+
+        if (request->Position < request->Count)
+        {
+            // back to the end of its lane, requests in the same lane take turns
+            request->Next = NULL;
+            if (self->mLaneTail[lane])
+                self->mLaneTail[lane]->Next = request;
+            else
+                self->mLaneHead[lane] = request;
+            self->mLaneTail[lane] = request;
+            self->mLaneDepth[lane]++;
+        }
+        else
+        {
+            // the submitter may return as soon as Done is set
+            OSMemoryBarrier();
+            request->Done = true;
+
+            // hand the gate over to the waiting submitter
+            if (request != own)
+                break;
+        }
+
+        self->collectSubmissions();
+    }
+    IOLockUnlock(self->mSubmitLock);
+
+    return kIOReturnSuccess;
+}
+
+UInt32 IntelHDA::processCommands(const UInt32* commands, UInt32* responses, size_t count, bool probe)
+{
+    UInt32 pending[kHDASubmitChunk];
+    UInt32 results[kHDASubmitChunk];
+    UInt32 slots[kHDASubmitChunk];
+    UInt32 completed = 0;
+    size_t i = 0;
+
+    // While the breaker is open a single probe decides whether anything is sent at all
+    if (mBreakerOpen && (!probe || !this->probeCodec()))
+    {
+        for (i = 0; i < count; i++)
+        {
+            UInt32 command = (mCodecAddress & 0xF) << 28 | (commands[i] & 0x0FFFFFFF);
+
+            if (this->lookupParameter(command, &responses[i]))
+            {
+                completed++;
+                traceCommand(command, responses[i], 0, kTraceTransportCache, kTraceStatusOK);
+            }
+            else
+            {
+                responses[i] = -1;
+                mShortCircuited++;
+                traceCommand(command, -1, 0, kTraceTransportNone, kTraceStatusShortCircuited);
+            }
+        }
+        return completed;
+    }
+
+    while (i < count)
+    {
+        // Answer memoized parameters directly and collect the rest. Each command is
+        // read before its response slot is written, so responses may alias commands.
+        UInt32 queued = 0;
+        for (; i < count && queued < kHDASubmitChunk; i++)
+        {
+            UInt32 command = (mCodecAddress & 0xF) << 28 | (commands[i] & 0x0FFFFFFF);
+
+            if (this->lookupParameter(command, &responses[i]))
+            {
+                completed++;
+                traceCommand(command, responses[i], 0, kTraceTransportCache, kTraceStatusOK);
+                continue;
+            }
+
+            // Node (or by now the whole codec) known not to answer
+            if (mBreakerOpen || !this->isNodeAvailable(command >> 20 & 0xFF))
+            {
+                responses[i] = -1;
+                mShortCircuited++;
+                traceCommand(command, -1, 0, kTraceTransportNone, kTraceStatusShortCircuited);
+                continue;
+            }
+
+            pending[queued] = command;
+            slots[queued++] = (UInt32)i;
+        }
+
+        if (!queued)
+            break;
+
+        completed += this->executeCommands(pending, results, queued);
+
+        for (UInt32 j = 0; j < queued; j++)
+        {
+            responses[slots[j]] = results[j];
+            this->storeParameter(pending[j], results[j]);
+        }
+    }
+
+    return completed;
+}
+
+UInt32 IntelHDA::executeCommands(const UInt32* commands, UInt32* responses, UInt32 count)
+{
+    UInt32 completed = 0;
+
+    switch (mCommandMode)
+    {
+        case PIO:
+            for (UInt32 i = 0; i < count; i++)
+            {
+                // stop waiting out timeouts once the breaker trips
+                if (mBreakerOpen)
+                {
+                    responses[i] = -1;
+                    mShortCircuited++;
+                    traceCommand(commands[i], -1, 0, kTraceTransportNone, kTraceStatusShortCircuited);
+                    continue;
+                }
+
+                UInt64 start = mTraceEnabled ? getMicroseconds() : 0;
+                responses[i] = this->executePIO(commands[i]);
+                if (this->recordResult(commands[i], responses[i]))
+                    completed++;
+                if (mTraceEnabled)
+                    traceCommand(commands[i], responses[i], (UInt32)(getMicroseconds() - start), kTraceTransportPIO,
+                                 responses[i] != (UInt32)-1 ? kTraceStatusOK : kTraceStatusTimeout);
+            }
+            break;
+        case DMA:
+        {
+            UInt32 latencies[kHDASubmitChunk] = { };
+            UInt32* traced = mTraceEnabled && count <= kHDASubmitChunk ? latencies : NULL;
+
+            IOLockLock(mRingLock);
+            this->executeDMA(commands, responses, count, traced);
+            IOLockUnlock(mRingLock);
+
+            // executeDMA falls back to PIO when the audio driver took the rings
+            UInt8 transport = mCommandMode == DMA ? kTraceTransportDMA : kTraceTransportPIO;
+            for (UInt32 i = 0; i < count; i++)
+            {
+                if (this->recordResult(commands[i], responses[i]))
+                    completed++;
+                if (traced)
+                    traceCommand(commands[i], responses[i], latencies[i], transport,
+                                 responses[i] != (UInt32)-1 ? kTraceStatusOK : kTraceStatusTimeout);
+            }
+            break;
+        }
+        default:
+            for (UInt32 i = 0; i < count; i++)
+                responses[i] = -1;
+            break;
+    }
+
+    return completed;
+}
+
+bool IntelHDA::isCommandReady()
+{
+    return !HDA_ICS_IS_BUSY(mRegMap->ICS);
+}
+
+bool IntelHDA::isResponseReady()
+{
+    return mRegMap->RIRBWP != mRirbReadPointer;
+}
+
+bool IntelHDA::waitFor(bool (IntelHDA::*condition)(), UInt64 deadline)
+{
+    UInt32 delay = kHDAPollMinDelayUS;
+    UInt32 waited = 0;
+
+    while (!(this->*condition)())
+    {
+        if (getMicroseconds() >= deadline)
+            return (this->*condition)();
+
+        ::IODelay(delay);
+        waited += delay;
+
+        if (waited >= kHDAFrameSpinUS && delay < kHDAPollMaxDelayUS)
+            delay = delay * 2 < kHDAPollMaxDelayUS ? delay * 2 : kHDAPollMaxDelayUS;
+    }
+
+    return true;
+}
+
+UInt32 IntelHDA::executePIO(UInt32 command)
+{
+    UInt16 status;
+    UInt64 start = getMicroseconds();
+    UInt64 deadline = start + mCommandTimeout;
+    
+    // HDA controller was not ready to receive PIO commands
+    if (!waitFor(&IntelHDA::isCommandReady, deadline))
+    {
+        DebugLog("ExecutePIO timed out waiting for ICS readiness.\n");
+        mTimeouts[PIO]++;
+        return -1;
+    }
+    
+    //DEBUG_LOG("IntelHDA::ExecutePIO ICB bit clear.\n");
+    
+    // Queue the verb for the HDA controller
+    mRegMap->ICW = command;
+    
+    status = 0x1; // Busy status
+    mRegMap->ICS = status;
+    
+    //DEBUG_LOG("IntelHDA::ExecutePIO Wrote verb and set ICB bit.\n");
+    
+    // Wait for HDA controller to return with a response
+    if (!waitFor(&IntelHDA::isCommandReady, deadline))
+        mTimeouts[PIO]++;
+
+    status = mRegMap->ICS;
+    
+    // Store the result validity while IRV is cleared
+    bool validResult = HDA_ICS_IS_VALID(status);
+    
+    UInt32 response;
+    
+    if (validResult)
+        response = mRegMap->IRR;
+    
+    // Reset IRV
+    status = 0x02; // Valid, Non-busy status
+    mRegMap->ICS = status;
+    
+    if (!validResult)
+    {
+        DebugLog("ExecutePIO Invalid result received.\n");
+        return -1;
+    }
+    
+    mLatency[PIO].record((UInt32)(getMicroseconds() - start));
+    
+    return response;
+}
+
+UInt32 IntelHDA::executeDMA(const UInt32* commands, UInt32* responses, UInt32 count, UInt32* latencies)
+{
+    UInt32 completed = 0;
+
+    // The audio driver (re)initialized the controller and now owns the rings
+    if (!ownsCommandRings())
+    {
+        AlwaysLog("Lost ownership of CORB/RIRB, reverting to PIO command mode.\n");
+        shutdownDMA();
+        mCommandMode = PIO;
+
+        // executePIO keeps the PIO latency, the caller records the results
+        for (UInt32 i = 0; i < count; i++)
+        {
+            UInt64 start = getMicroseconds();
+            if ((responses[i] = this->executePIO(commands[i])) != (UInt32)-1)
+                completed++;
+            if (latencies)
+                latencies[i] = (UInt32)(getMicroseconds() - start);
+        }
+
+        return completed;
+    }
+
+    // Keep unsolicited responses that arrived since the last submission, and give
+    // late responses of a timed out submission one more timeout to show up, so they
+    // are not taken for responses to this one
+    collectUnsolicited();
+    if (mRirbLate)
+    {
+        UInt64 deadline = getMicroseconds() + mCommandTimeout;
+        while (mRirbLate && waitFor(&IntelHDA::isResponseReady, deadline))
+            collectUnsolicited();
+
+        if (mRirbLate)
+            DebugLog("ExecuteDMA gave up on %d late RIRB responses.\n", mRirbLate);
+        mRirbLate = 0;
+    }
+
+    UInt32 index = 0;
+    while (index < count)
+    {
+        // Queue as many verbs as both rings can hold, then move the write pointer once
+        // (a chunk is queued before any of its responses are stored, so they may alias)
+        UInt32 chunk = count - index;
+        if (chunk > (UInt32)(mCorbEntries - 1))
+            chunk = mCorbEntries - 1;
+        if (chunk > (UInt32)(mRirbEntries - 1))
+            chunk = mRirbEntries - 1;
+
+        for (UInt32 i = 0; i < chunk; i++)
+        {
+            mCorbWritePointer = (mCorbWritePointer + 1) % mCorbEntries;
+            mCorb[mCorbWritePointer] = commands[index + i];
+        }
+
+        OSSynchronizeIO();
+        mRegMap->CORBWP = mCorbWritePointer;
+
+        UInt64 start = getMicroseconds();
+        UInt64 deadline = start + mCommandTimeout;
+
+        // Responses from a single codec arrive in submission order, each one is
+        // charged the time since the previous one (so a chunk adds up to its wall time)
+        UInt32 received = 0;
+        UInt64 previous = start;
+        while (received < chunk)
+        {
+            if (!waitFor(&IntelHDA::isResponseReady, deadline))
+                break;
+
+            UInt64 now = getMicroseconds();
+
+            while (received < chunk && mRirbReadPointer != mRegMap->RIRBWP)
+            {
+                mRirbReadPointer = (mRirbReadPointer + 1) % mRirbEntries;
+
+                UInt32 response = mRirb[mRirbReadPointer].Response;
+                UInt32 responseEx = mRirb[mRirbReadPointer].ResponseEx;
+
+                // Skip responses from other codecs, unsolicited ones are handed to the interrupt handler
+                if (HDA_RIRB_EX_CODEC(responseEx) != (mCodecAddress & 0xF))
+                    continue;
+                if (HDA_RIRB_EX_IS_UNSOL(responseEx))
+                {
+                    queueUnsolicited(response);
+                    continue;
+                }
+
+                UInt32 latency = (UInt32)(now - previous);
+                previous = now;
+
+                if (latencies)
+                    latencies[index + received] = latency;
+                responses[index + received++] = response;
+                mLatency[DMA].record(latency);
+                completed++;
+
+                // every response extends the deadline for the next one
+                deadline = getMicroseconds() + mCommandTimeout;
+            }
+        }
+
+        if (received < chunk)
+        {
+            DebugLog("ExecuteDMA timed out waiting for RIRB response.\n");
+            mTimeouts[DMA]++;
+
+            // responses that still arrive belong to this chunk, not the next submission
+            mRirbLate = chunk - received;
+
+            for (UInt32 i = index + received; i < count; i++)
+                responses[i] = -1;
+
+            return completed;
+        }
+
+        index += chunk;
+    }
+
+    return completed;
+}
+
+void IntelHDA::traceCommand(UInt32 command, UInt32 response, UInt32 latency, UInt8 transport, UInt8 status)
+{
+    CodecCommanderTraceRecord* trace = mTrace;
+    if (!mTraceEnabled || !trace)
+        return;
+
+    // Claim a position, clear the sequence while the record is rewritten so readers
+    // can tell a torn record from a complete one
+    UInt32 position = (UInt32)OSIncrementAtomic(&mTraceHead);
+    CodecCommanderTraceRecord* record = &trace[position % kClientTraceEntries];
+
+    record->Sequence = 0;
+    OSMemoryBarrier();
+    record->Command = command;
+    record->Response = response;
+    record->Latency = latency;
+    record->Timestamp = getMicroseconds();
+    record->Lane = mTraceLane;
+    record->Transport = transport;
+    record->Status = status;
+    OSMemoryBarrier();
+    record->Sequence = position + 1;
+}
+
+bool IntelHDA::setTraceEnabled(bool enable)
+{
+    if (enable && !mTrace)
+    {
+        size_t size = kClientTraceEntries * sizeof(CodecCommanderTraceRecord);
+        CodecCommanderTraceRecord* trace = (CodecCommanderTraceRecord*)IOMalloc(size);
+        if (!trace)
+            return false;
+
+        bzero(trace, size);
+        if (!OSCompareAndSwapPtr(NULL, trace, (void* volatile*)&mTrace))
+            IOFree(trace, size);
+    }
+
+    DebugLog("Verb trace %s\n", enable ? "enabled" : "disabled");
+    mTraceEnabled = enable;
+    return true;
+}
+
+UInt32 IntelHDA::readTrace(UInt32 position, CodecCommanderTraceRecord* records, UInt32 maxCount, UInt32* count, UInt32* lost)
+{
+    UInt32 head = (UInt32)mTraceHead;
+    *count = 0;
+    *lost = 0;
+
+    if (!mTrace)
+        return head;
+
+    // Older records have been overwritten already
+    if (head - position > kClientTraceEntries)
+    {
+        *lost = head - position - kClientTraceEntries;
+        position = head - kClientTraceEntries;
+    }
+
+    for (; position != head && *count < maxCount; position++)
+    {
+        CodecCommanderTraceRecord* record = &mTrace[position % kClientTraceEntries];
+        UInt32 sequence = record->Sequence;
+
+        // still being written, stop here and pick it up next time
+        if ((SInt32)(sequence - (position + 1)) < 0)
+            break;
+
+        OSMemoryBarrier();
+        records[*count] = *record;
+        OSMemoryBarrier();
+
+        // overwritten by a newer record meanwhile
+        if (sequence != position + 1 || record->Sequence != sequence)
+        {
+            (*lost)++;
+            continue;
+        }
+
+        (*count)++;
+    }
+
+    return position;
+}
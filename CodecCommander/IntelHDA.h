@@ -21,6 +21,8 @@
 #define CodecCommander_IntelHDA_h
 
 #include "Common.h"
+#include "Statistics.h"
+#include "ClientInterface.h"
 
 // Intel HDA Verbs
 #define HDA_VERB_GET_PARAM		(UInt16)0xF00	// Get Parameter
@@ -30,9 +32,13 @@
 #define HDA_VERB_EAPDBTL_SET	(UInt16)0x70C	// EAPD/BTL Enable Set
 #define HDA_VERB_RESET			(UInt16)0x7FF	// Function Reset Execute
 #define HDA_VERB_GET_SUBSYSTEM_ID	(UInt16)0xF20	// Get codec subsystem ID
+#define HDA_VERB_GET_CONN_LIST	(UInt16)0xF02	// Get Connection List Entry
+#define HDA_VERB_GET_CONFIG_DEFAULT	(UInt16)0xF1C	// Get Configuration Default
+#define HDA_VERB_GET_PIN_SENSE	(UInt16)0xF09	// Get Pin Sense
+#define HDA_VERB_SET_UNSOL_ENABLE	(UInt16)0x708	// Set Unsolicited Response Enable
 
 #define HDA_VERB_SET_AMP_GAIN	(UInt8)0x3		// Set Amp Gain / Mute
-#define HDA_VERB_GET_AMP_GAIN	(Uint8)0xB		// Get Amp Gain / Mute
+#define HDA_VERB_GET_AMP_GAIN	(UInt8)0xB		// Get Amp Gain / Mute
 
 #define HDA_PARM_NULL		(UInt8)0x00	// Empty or NULL payload
 
@@ -40,8 +46,12 @@
 #define HDA_PARM_REVISION	(UInt8)0x02	// Revision ID
 #define HDA_PARM_NODECOUNT	(UInt8)0x04	// Subordinate Node Count
 #define HDA_PARM_FUNCGRP	(UInt8)0x05	// Function Group Type
+#define HDA_PARM_WIDGETCAP	(UInt8)0x09	// Audio Widget Capabilities
 #define HDA_PARM_PINCAP		(UInt8)0x0C	// Pin Capabilities
+#define HDA_PARM_AMP_IN_CAP	(UInt8)0x0D	// Input Amplifier Capabilities
+#define HDA_PARM_CONNLIST_LEN	(UInt8)0x0E	// Connection List Length
 #define HDA_PARM_PWRSTS		(UInt8)0x0F	// Supported Power States
+#define HDA_PARM_AMP_OUT_CAP	(UInt8)0x12	// Output Amplifier Capabilities
 
 #define HDA_PARM_PS_D0		(UInt8)0x00 // Powerstate D0: Fully on
 #define HDA_PARM_PS_D1		(UInt8)0x01 // Powerstate D1
@@ -51,6 +61,14 @@
 
 #define HDA_TYPE_AFG	1	// return from PARM_FUNCGRP is 1 for Audio
 
+// Build a raw command from node, 12-bit verb and 8-bit payload
+#define HDA_COMMAND(nodeId, verb, payload) \
+	(UInt32)(((nodeId) & 0xFF) << 20 | ((verb) & 0xFFF) << 8 | ((payload) & 0xFF))
+
+// Build a raw command from node, 4-bit verb and 16-bit payload
+#define HDA_COMMAND_LONG(nodeId, verb, payload) \
+	(UInt32)(((nodeId) & 0xFF) << 20 | ((verb) & 0xF) << 16 | ((payload) & 0xFFFF))
+
 // Dynamic payload parameters
 #define HDA_PARM_AMP_GAIN_GET(Index, Left, Output) \
 	(UInt16)((Output & 0x1) << 15 | (Left & 0x01) << 13 | Index & 0xF) // Get Amp gain / mute
@@ -68,14 +86,72 @@
 // Determine if this Pin widget capabilities is marked EAPD capable
 #define HDA_PINCAP_IS_EAPD_CAPABLE(capabilities) ((capabilities) & (1<<16))
 
+// Power state response (PS-Set requested, PS-Act reached)
+#define HDA_PSTATE_SET(response) ((response) & 0xF)
+#define HDA_PSTATE_ACT(response) (((response) >> 4) & 0xF)
+
+// Determine if this Pin widget can detect jack presence
+#define HDA_PINCAP_IS_PRESENCE_DETECT(capabilities) ((capabilities) & (1<<2))
+
+// Pin sense response and unsolicited response tags
+#define HDA_PIN_SENSE_IS_PRESENT(response) ((response) & (1<<31))
+#define HDA_UNSOL_ENABLE(tag) (0x80 | ((tag) & 0x3F))
+#define HDA_UNSOL_TAG(response) (((response) >> 26) & 0x3F)
+
+// Audio widget capabilities
+#define HDA_WIDGET_TYPE(capabilities) (((capabilities) >> 20) & 0xF)
+#define HDA_WCAP_HAS_IN_AMP(capabilities) ((capabilities) & (1<<1))
+#define HDA_WCAP_HAS_OUT_AMP(capabilities) ((capabilities) & (1<<2))
+#define HDA_WCAP_HAS_AMP_OVERRIDE(capabilities) ((capabilities) & (1<<3))
+#define HDA_WCAP_HAS_CONN_LIST(capabilities) ((capabilities) & (1<<8))
+#define HDA_WCAP_IS_UNSOL_CAPABLE(capabilities) ((capabilities) & (1<<7))
+
+#define HDA_WIDGET_TYPE_OUTPUT		0x0	// Audio Output (DAC)
+#define HDA_WIDGET_TYPE_INPUT		0x1	// Audio Input (ADC)
+#define HDA_WIDGET_TYPE_MIXER		0x2	// Audio Mixer
+#define HDA_WIDGET_TYPE_SELECTOR	0x3	// Audio Selector
+#define HDA_WIDGET_TYPE_PIN			0x4	// Pin Complex
+#define HDA_WIDGET_TYPE_POWER		0x5	// Power Widget
+#define HDA_WIDGET_TYPE_VOLUME_KNOB	0x6	// Volume Knob
+#define HDA_WIDGET_TYPE_BEEP		0x7	// Beep Generator
+#define HDA_WIDGET_TYPE_VENDOR		0xF	// Vendor Defined
+
+// Connection list length response
+#define HDA_CONNLIST_LENGTH(response) ((response) & 0x7F)
+#define HDA_CONNLIST_IS_LONG_FORM(response) ((response) & (1<<7))
+
+// Port connectivity of a pin configuration default
+#define HDA_CONFIG_CONNECTIVITY(config) (((config) >> 30) & 0x3)
+#define HDA_CONFIG_CONN_JACK	0x0	// Jack
+#define HDA_CONFIG_CONN_NONE	0x1	// No physical connection
+#define HDA_CONFIG_CONN_FIXED	0x2	// Fixed function device
+#define HDA_CONFIG_CONN_BOTH	0x3	// Jack and internal device
+
+// CORB/RIRB ring sizes (CORBSIZE/RIRBSIZE encoding and capability bits)
+#define HDA_RING_SIZE_2			0x0		// 2 entries
+#define HDA_RING_SIZE_16		0x1		// 16 entries
+#define HDA_RING_SIZE_256		0x2		// 256 entries
+#define HDA_RING_SZCAP_16		(1<<1)	// 16 entries supported
+#define HDA_RING_SZCAP_256		(1<<2)	// 256 entries supported
+
+// RIRB Status bits (RIRBSTS)
+#define HDA_RIRBSTS_RINTFL		(1<<0)	// Response Interrupt
+#define HDA_RIRBSTS_RIRBOIS		(1<<2)	// Response Overrun Interrupt Status
+
+// Response Extended field of a RIRB entry
+#define HDA_RIRB_EX_CODEC(responseEx) ((responseEx) & 0xF)
+#define HDA_RIRB_EX_IS_UNSOL(responseEx) ((responseEx) & (1<<4))
+
 typedef struct __attribute__((packed))
 {
+	// Note: bit fields are allocated starting with the least significant bit
+
 	// 00h: GCAP – Global Capabilities
-	volatile UInt16 GCAP_OSS		: 4;		// Number of Output Streams Supported
-	volatile UInt16 GCAP_ISS		: 4;		// Number of Input Streams Supported
-	volatile UInt16 GCAP_BSS		: 5;		// Number of Bidirectional Streams Supported
-	volatile UInt16 GCAP_NSDO		: 2;		// Number of Serial Data Out Signals
 	volatile UInt16 GCAP_64OK		: 1;		// 64 Bit Address Supported
+	volatile UInt16 GCAP_NSDO		: 2;		// Number of Serial Data Out Signals
+	volatile UInt16 GCAP_BSS		: 5;		// Number of Bidirectional Streams Supported
+	volatile UInt16 GCAP_ISS		: 4;		// Number of Input Streams Supported
+	volatile UInt16 GCAP_OSS		: 4;		// Number of Output Streams Supported
 	// 02h: VMIN – Minor Version
 	volatile UInt8  VMIN;						// Minor Version
 	// 03h: VMAJ – Major Version
@@ -85,21 +161,21 @@ typedef struct __attribute__((packed))
 	// 06h: INPAY – Input Payload Capability
 	volatile UInt16 INPAY;						// Input Payload Capability
 	// 08h: GCTL – Global Control
-	UInt32							: 23;		// Reserved
-	volatile UInt32 GCTL_UNSOL		: 1;		// Accept Unsolicited Response Enable
-	UInt32							: 6;		// Reserved
-	volatile UInt32 GCTL_FCNTRL		: 1;		// Flush Control
 	volatile UInt32 GCTL_CRST		: 1;		// Controller Reset
+	volatile UInt32 GCTL_FCNTRL		: 1;		// Flush Control
+	UInt32							: 6;		// Reserved
+	volatile UInt32 GCTL_UNSOL		: 1;		// Accept Unsolicited Response Enable
+	UInt32							: 23;		// Reserved
 	// 0Ch: WAKEEN – Wake Enable
-	UInt16							: 1;		// Reserved
 	volatile UInt16 WAKEEN_SDIWEN	: 15;		// SDIN Wake Enable Flags
-	// 0Eh: STATESTS – State Change Status
 	UInt16							: 1;		// Reserved
+	// 0Eh: STATESTS – State Change Status
 	volatile UInt16 STATESTS_SDIWAKE: 15;		// SDIN State Change Status Flags
+	UInt16							: 1;		// Reserved
 	// 10h: GSTS – Global Status
-	UInt16							: 14;		// Reserved
-	volatile UInt16 GSTS_FSTS		: 1;		// Flush Status
 	UInt16							: 1;		// Reserved
+	volatile UInt16 GSTS_FSTS		: 1;		// Flush Status
+	UInt16							: 14;		// Reserved
 	
 	UInt32							: 32;		// Spacer
 	UInt16							: 16;		// Spacer
@@ -112,13 +188,13 @@ typedef struct __attribute__((packed))
 	UInt32							: 32;		// Spacer
 	
 	// 20h: INTCTL – Interrupt Control
-	volatile UInt32 INTCTL_GIE		: 1;		// Global Interrupt Enable
-	volatile UInt32 INTCTL_CIE		: 1;		// Controller Interrupt Enable
 	volatile UInt32 INTCTL_SIE		: 30;		// Stream Interrupt Enable
+	volatile UInt32 INTCTL_CIE		: 1;		// Controller Interrupt Enable
+	volatile UInt32 INTCTL_GIE		: 1;		// Global Interrupt Enable
 	// 24h: INTSTS – Interrupt Status
-	volatile UInt32 INTSTS_GIS		: 1;		// Global Interrupt Status
-	volatile UInt32 INTSTS_CIS		: 1;		// Controller Interrupt Status
 	volatile UInt32 INTSTS_SIS		: 30;		// Stream Interrupt Status
+	volatile UInt32 INTSTS_CIS		: 1;		// Controller Interrupt Status
+	volatile UInt32 INTSTS_GIS		: 1;		// Global Interrupt Status
 	
 	UInt32							: 32;		// Spacer
 	UInt32							: 32;		// Spacer
@@ -127,8 +203,8 @@ typedef struct __attribute__((packed))
 	volatile UInt32 WALL_CLOCK_COUNTER;			// Wall Clock Counter
 	UInt32							: 32;		// Spacer
 	// 38h: SSYNC – Stream Synchronization
-	UInt32							: 2;		// Reserved
 	volatile UInt32 SSYNC			: 30;		// Stream Synchronization Bits
+	UInt32							: 2;		// Reserved
 	
 	UInt32							: 32;		// Spacer
 	
@@ -137,23 +213,23 @@ typedef struct __attribute__((packed))
 	// 44h: CORB Upper Base Address
 	volatile UInt32 CORBUBASE;		// CORB Upper Base Address
 	// 48h: CORBWP – CORB Write Pointer
-	UInt16							: 8;		// Reserved
 	volatile UInt16 CORBWP			: 8;		// CORB Write Pointer
+	UInt16							: 8;		// Reserved
 	// 4Ah: CORBRP – CORB Read Pointer
-	volatile UInt16 CORBRPRST		: 1;		// CORB Read Pointer Reset
-	UInt16							: 7;		// Reserved
 	volatile UInt16 CORBRP			: 8;		// CORB Read Pointer
+	UInt16							: 7;		// Reserved
+	volatile UInt16 CORBRPRST		: 1;		// CORB Read Pointer Reset
 	// 4Ch: CORBCTL – CORB Control
-	UInt8							: 6;		// Reserved
-	volatile UInt8 CORBRUN			: 1;		// Enable CORB DMA Engine
 	volatile UInt8 CMEIE			: 1;		// CORB Memory Error Interrupt Enable
+	volatile UInt8 CORBRUN			: 1;		// Enable CORB DMA Engine
+	UInt8							: 6;		// Reserved
 	// 4Dh: CORBSTS – CORB Status
-	UInt8							: 7;		// Reserved
 	volatile UInt8 CMEI				: 1;		// CORB Memory Error Indication
+	UInt8							: 7;		// Reserved
 	// 4Eh: CORBSIZE – CORB Size
-	volatile UInt8 CORBSZCAP		: 4;		// CORB Size Capability
-	UInt8							: 2;		// Reserved
 	volatile UInt8 CORBSIZE			: 2;		// CORB Size
+	UInt8							: 2;		// Reserved
+	volatile UInt8 CORBSZCAP		: 4;		// CORB Size Capability
 	
 	UInt8							: 8;		// Spacer
 	
@@ -162,26 +238,23 @@ typedef struct __attribute__((packed))
 	// 54h: RIRBUBASE – RIRB Upper Base Address
 	volatile UInt32 RIRBUBASE;					// RIRB Upper Base Address
 	// 58h: RIRBWP – RIRB Write Pointer
-	volatile UInt16 RIRBWPRST		: 1;		// RIRB Write Pointer Reset
-	UInt16							: 7;		// Reserved
 	volatile UInt16 RIRBWP			: 8;		// RIRB Write Pointer
+	UInt16							: 7;		// Reserved
+	volatile UInt16 RIRBWPRST		: 1;		// RIRB Write Pointer Reset
 	// 5Ah: RINTCNT – Response Interrupt Count
-	UInt16							: 8;
 	volatile UInt16 RINTCNT			: 8;		// N Response Interrupt Count
+	UInt16							: 8;
 	// 5Ch: RIRBCTL – RIRB Control
-	UInt8							: 5;		// Reserved
-	volatile UInt8 RINTCNT_RIRBOIC	: 1;		// Response Overrun Interrupt Control
-	volatile UInt8 RINTCNT_RIRBDMAEN: 1;		// RIRB DMA Enable
 	volatile UInt8 RINTCNT_RINTCTL	: 1;		// Response Interrupt Control
-	// 5Dh: RIRBSTS – RIRB Status
+	volatile UInt8 RINTCNT_RIRBDMAEN: 1;		// RIRB DMA Enable
+	volatile UInt8 RINTCNT_RIRBOIC	: 1;		// Response Overrun Interrupt Control
 	UInt8							: 5;		// Reserved
-	volatile UInt8 RIRBSTS_RIRBOIS	: 1;		// Response Overrun Interrupt Status
-	UInt8							: 1;		// Reserved
-	volatile UInt8 RIRBSTS_RINTFL	: 1;		// Response Interrupt
+	// 5Dh: RIRBSTS – RIRB Status (write 1 to clear, written as a whole byte)
+	volatile UInt8 RIRBSTS;						// RIRB Status
 	// 5Eh: RIRBSIZE – RIRB Size
-	volatile UInt8 RIRBSIZE_RIRBSZCAP: 4;		// RIRB Size Capability
-	UInt8							: 2;		// Reserved
 	volatile UInt8 RIRBSIZE			: 2;		// RIRB Size
+	UInt8							: 2;		// Reserved
+	volatile UInt8 RIRBSIZE_RIRBSZCAP: 4;		// RIRB Size Capability
 	
 	UInt8							: 8;		// Spacer
 	
@@ -193,21 +266,24 @@ typedef struct __attribute__((packed))
 	union
 	{
 		volatile UInt16 ICS;					// Immediate Command Status
-		UInt16							: 8;	// Reserved
-		volatile UInt16 ICS_IRRADD		: 4;	// Immediate Response Result Address
-		volatile UInt16 ICS_IRRUNSOL	: 1;	// Immediate Response Result Unsolicited
-		volatile UInt16 ICS_ICV			: 1;	// Immediate Command Version
-		volatile UInt16 ICS_IRV			: 1;	// Immediate Result Valid
-		volatile UInt16 ICS_ICB			: 1;	// Immediate Command Busy
+		struct __attribute__((packed))
+		{
+			volatile UInt16 ICS_ICB		: 1;	// Immediate Command Busy
+			volatile UInt16 ICS_IRV		: 1;	// Immediate Result Valid
+			volatile UInt16 ICS_ICV		: 1;	// Immediate Command Version
+			volatile UInt16 ICS_IRRUNSOL: 1;	// Immediate Response Result Unsolicited
+			volatile UInt16 ICS_IRRADD	: 4;	// Immediate Response Result Address
+			UInt16						: 8;	// Reserved
+		};
 	};
 
 	UInt32							: 32;		// Spacer
 	UInt16							: 16;		// Spacer
 	
 	// 70h: DPLBASE – DMA Position Lower Base Address
-	volatile UInt32 DPLBASE_ADDR	: 25;		// DMA Position Lower Base Address
-	UInt32							: 6;
 	volatile UInt32 DPLBASE_ENBL	: 1;		// DMA Position Buffer Enable
+	UInt32							: 6;
+	volatile UInt32 DPLBASE_ADDR	: 25;		// DMA Position Lower Base Address
 	// 74h: DPUBASE – DMA Position Upper Base Address
 	volatile UInt32 DPUBASE;					// DMA Position Upper Base Address
 } HDA_REG, *pHDA_REG;
@@ -229,12 +305,60 @@ struct HDA_GCAP_EXT : HDA_GCAP
 	UInt8 MajorVersion;	
 };
 
+// RIRB entry as written by the controller
+struct HDA_RIRB_ENTRY
+{
+	UInt32 Response;
+	UInt32 ResponseEx;
+};
+
+// Memoized GET_PARAM response (Tag of 0 marks an empty slot)
+struct HDA_PARAM_CACHE_ENTRY
+{
+	UInt32 Tag;
+	UInt32 Response;
+};
+
+// Depth of the unsolicited response queue (one entry is kept free)
+#define kHDAUnsolicitedQueueSize	16
+
+// Priority of a verb submission, lower lanes are preempted between chunks of verbs
+enum HDACommandLane
+{
+	kHDALanePower,		// power transitions (EAPD, reset, readiness)
+	kHDALaneCustom,		// configured custom commands
+	kHDALaneClient,		// user clients (hda-verb), rate limited
+	kHDALaneDiagnostic,	// codec dumps built in the kext for a client, not rate limited
+	kHDALaneCount
+};
+
+// Verb batch waiting for the command gate, lives on the submitter's stack
+struct HDACommandRequest
+{
+	HDACommandRequest* Next;
+	const UInt32* Commands;
+	UInt32* Responses;
+	size_t Count;
+	size_t Position;
+	HDACommandLane Lane;
+	UInt32 Timeout;
+	UInt32 Completed;
+	UInt64 Submitted;
+	bool Started;
+	bool Probed;		// probed the codec with the breaker open, fail fast from then on
+	bool Poll;			// readiness poll, timeouts are expected and not held against the codec
+	volatile bool Done;
+};
+
 enum HDACommandMode
 {
 	PIO,
-	DMA	
+	DMA,
+	kHDACommandModeCount
 };
 
+class CodecTopology;
+
 class IntelHDA
 {
 	IOPCIDevice* mDevice = NULL;
@@ -243,6 +367,27 @@ class IntelHDA
 	
 	pHDA_REG mRegMap = NULL;
 
+	// CORB/RIRB command rings (DMA command mode)
+	IOBufferMemoryDescriptor* mRingMemory = NULL;
+	IOPhysicalAddress mRingPhysical = 0;
+	volatile UInt32* mCorb = NULL;
+	volatile HDA_RIRB_ENTRY* mRirb = NULL;
+	UInt16 mCorbEntries = 0;
+	UInt16 mRirbEntries = 0;
+	UInt16 mCorbWritePointer = 0;
+	UInt16 mRirbReadPointer = 0;
+	UInt32 mRirbLate = 0;		// responses still owed by a timed out submission
+	IOLock* mRingLock = NULL;
+	// Taken by the interrupt filter, the RIRB is only freed after it is dropped under it
+	IOSimpleLock* mInterruptLock = NULL;
+
+	// Unsolicited responses collected from the RIRB, drained by the interrupt handler
+	UInt32 mUnsolicited[kHDAUnsolicitedQueueSize];
+	volatile UInt32 mUnsolicitedHead = 0;
+	volatile UInt32 mUnsolicitedTail = 0;
+	UInt32 mUnsolicitedDropped = 0;
+	bool mUnsolicitedEnabled = false;
+
 	// Initialized in constructor
 	HDACommandMode mCommandMode;
 	UInt32 mCodecVendorId;
@@ -253,6 +398,61 @@ class IntelHDA
 	// Read-once parameters
 	UInt32 mNodes = -1;
 	UInt16 mAudioRoot = -1;
+
+	// Widget graph, enumerated on first use
+	CodecTopology* mTopology = NULL;
+
+	// Per-verb completion deadline
+	UInt32 mCommandTimeout = 10000;
+	UInt32 mDefaultTimeout = 10000;
+
+	// Submissions from any thread are pushed here (lock free) and executed in
+	// order by whichever submitter holds the command gate
+	HDACommandRequest* volatile mSubmissions = NULL;
+	IOCommandGate* mCommandGate = NULL;
+	// Held while draining, stands in for the gate when there is none (not set yet, removed)
+	IOLock* mSubmitLock = NULL;
+
+	// Requests taken from the submission list, per lane in order (gate held)
+	HDACommandRequest* mLaneHead[kHDALaneCount] = { };
+	HDACommandRequest* mLaneTail[kHDALaneCount] = { };
+	UInt32 mLaneDepth[kHDALaneCount] = { };
+	UInt32 mLaneMaxDepth[kHDALaneCount] = { };
+	UInt32 mLaneVerbs[kHDALaneCount] = { };
+	LatencyHistogram mLaneWait[kHDALaneCount];
+
+	// Client lane rate limit (virtual clock of the next verb, us)
+	volatile UInt64 mClientClock = 0;
+	UInt32 mClientThrottled = 0;
+
+	// Verb latency per transport
+	LatencyHistogram mLatency[kHDACommandModeCount];
+	UInt32 mTimeouts[kHDACommandModeCount] = { };
+
+	// Time from function group reset until the codec is ready again
+	LatencyHistogram mResetLatency;
+
+	// Read-only GET_PARAM responses, allocated on first use
+	HDA_PARAM_CACHE_ENTRY* mParamCache = NULL;
+	UInt32 mParamCacheCount = 0;
+	UInt32 mParamCacheHits = 0;
+	UInt32 mParamCacheMisses = 0;
+
+	// Circuit breaker, fails verbs fast while the codec (or a node) does not respond
+	UInt8 mNodeTimeouts[256] = { };
+	UInt32 mNodeRetry[256] = { };	// ms, last verb let through to a failing node
+	UInt32 mCodecTimeouts = 0;
+	bool mBreakerOpen = false;
+	UInt32 mBreakerTrips = 0;
+	UInt32 mShortCircuited = 0;
+	bool mPolling = false;			// executing a readiness poll (gate held)
+
+	// Verb trace ring, allocated on first enable and kept until destruction so that
+	// writers never race with a free. Positions are claimed atomically (wait free).
+	CodecCommanderTraceRecord* volatile mTrace = NULL;
+	volatile SInt32 mTraceHead = 0;
+	bool mTraceEnabled = false;
+	UInt8 mTraceLane = kHDALanePower;
 	
 public:
 	// Constructor
@@ -270,10 +470,60 @@ public:
 	UInt32 sendCommand(UInt8 nodeId, UInt8 verb, UInt16 payload);
 
 	// Send a raw command (verb and payload combined)
-	UInt32 sendCommand(UInt32 command);
+	UInt32 sendCommand(UInt32 command, HDACommandLane lane = kHDALanePower);
+
+	// Send a batch of raw commands, returns number of valid responses
+	// (responses may alias commands, status is optional)
+	UInt32 sendCommands(const UInt32* commands, size_t count, UInt32* responses, IOReturn* status = NULL,
+						HDACommandLane lane = kHDALanePower);
 
 	void resetCodec();
 
+	// Forget memoized parameters (codec was reset or lost power)
+	void invalidateParameterCache();
+
+	// True once the function group reached its power state and all given pins answer
+	// (short verb timeout, meant for polling while the codec initializes)
+	bool isCodecReady(const UInt8* pins = NULL, UInt8 pinCount = 0);
+
+	// Give nodes that stopped answering a fresh chance (start of a power transition)
+	void resetNodeBreakers();
+
+	// False if the codec stopped answering (costs a single probe verb while the breaker is open)
+	bool isCodecResponsive();
+
+	// Switch between immediate command (PIO) and CORB/RIRB (DMA) transport
+	bool setCommandMode(HDACommandMode commandMode);
+	HDACommandMode getCommandMode() { return mCommandMode; }
+
+	// Unsolicited responses through the RIRB interrupt (DMA command mode only)
+	IOPCIDevice* getDevice() { return mDevice; }
+	bool enableUnsolicitedResponses();
+	void disableUnsolicitedResponses();
+	// Primary interrupt context: acknowledge RIRB interrupt, true if an unsolicited response is pending
+	bool acknowledgeInterrupt();
+	// Returns number of unsolicited responses copied out
+	UInt32 getUnsolicitedResponses(UInt32* responses, UInt32 maxCount);
+
+	// Deadline (in ms) for a verb to complete before it is considered lost
+	void setCommandTimeout(UInt32 milliseconds) { mCommandTimeout = mDefaultTimeout = milliseconds * 1000; }
+
+	// Serialize all verbs through this gate (NULL executes on the calling thread)
+	void setCommandGate(IOCommandGate* commandGate) { mCommandGate = commandGate; }
+
+	// Verb trace: enable returns false if the ring cannot be allocated. readTrace copies
+	// complete records from position on and returns the next position, lost counts
+	// records that were overwritten before they could be read.
+	bool setTraceEnabled(bool enable);
+	UInt32 getTracePosition() { return (UInt32)mTraceHead; }
+	UInt32 readTrace(UInt32 position, CodecCommanderTraceRecord* records, UInt32 maxCount, UInt32* count, UInt32* lost);
+	// Mark the begin/end of a transition so traces can be split per transition
+	void traceMarker(UInt32 marker, UInt32 transition)
+		{ traceCommand(marker, transition, 0, kTraceTransportNone, kTraceStatusMarker); }
+
+	// Latency statistics for publishing in the IORegistry (caller releases)
+	OSDictionary* createStatistics();
+
 	UInt32 getCodecVendorId() { return mCodecVendorId; }
 	UInt8 getCodecAddress() { return mCodecAddress; }
 	UInt8 getCodecGroupType() { return mCodecGroupType; }
@@ -285,10 +535,43 @@ public:
 
 	UInt8 getTotalNodes();
 	UInt8 getStartingNode();
+	UInt16 getAudioRoot();
+
+	// Read-once widget graph of the audio function group (NULL on failure)
+	CodecTopology* getTopology();
 
 private:
+	UInt32 submitCommands(const UInt32* commands, UInt32* responses, size_t count, UInt32 timeout = 0,
+						  HDACommandLane lane = kHDALanePower, bool poll = false);
+	static IOReturn drainSubmissions(OSObject* owner, void* intelHDA, void* submitter, void*, void*);
+	static IOReturn clearNodeTimeouts(OSObject* owner, void* intelHDA, void*, void*, void*);
+	static IOReturn closeBreakerAction(OSObject* owner, void* intelHDA, void*, void*, void*);
+	void collectSubmissions();
+	HDACommandRequest* nextRequest();
+	void throttleClient();
+	UInt32 processCommands(const UInt32* commands, UInt32* responses, size_t count, bool probe = true);
+	UInt32 executeCommands(const UInt32* commands, UInt32* responses, UInt32 count);
 	UInt32 executePIO(UInt32 command);
-	UInt16 getAudioRoot();
+	UInt32 executeDMA(const UInt32* commands, UInt32* responses, UInt32 count, UInt32* latencies = NULL);
+	void traceCommand(UInt32 command, UInt32 response, UInt32 latency, UInt8 transport, UInt8 status);
+
+	bool isCommandReady();
+	bool isResponseReady();
+	bool waitFor(bool (IntelHDA::*condition)(), UInt64 deadline);
+
+	bool initializeDMA();
+	void shutdownDMA();
+	bool ownsCommandRings();
+	void collectUnsolicited();
+	void queueUnsolicited(UInt32 response);
+
+	bool recordResult(UInt32 command, UInt32 response);
+	bool probeCodec();
+	bool isNodeAvailable(UInt8 node);
+	void closeBreaker();
+
+	bool lookupParameter(UInt32 command, UInt32* response);
+	void storeParameter(UInt32 command, UInt32 response);
 };
 
 
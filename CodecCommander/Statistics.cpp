@@ -0,0 +1,236 @@
+/*
+ *  Released under "The GNU General Public License (GPL-2.0)"
+ *
+ *  This program is free software; you can redistribute it and/or modify it
+ *  under the terms of the GNU General Public License as published by the
+ *  Free Software Foundation; either version 2 of the License, or (at your
+ *  option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ *  or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ *  for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ *
+ */
+
+#include "Statistics.h"
+
+static void setNumber(OSDictionary* dict, const char* key, UInt64 value)
+{
+	OSNumber* num = OSNumber::withNumber(value, 64);
+	if (num)
+	{
+		dict->setObject(key, num);
+		num->release();
+	}
+}
+
+void LatencyHistogram::reset()
+{
+	bzero(mBuckets, sizeof(mBuckets));
+	mCount = 0;
+	mMin = -1;
+	mMax = 0;
+	mTotal = 0;
+}
+
+void LatencyHistogram::record(UInt32 microseconds)
+{
+	int bucket = 0;
+	while (bucket < kLatencyBuckets - 1 && microseconds >= (1U << bucket))
+		bucket++;
+
+	mBuckets[bucket]++;
+	mCount++;
+	mTotal += microseconds;
+	if (microseconds < mMin) mMin = microseconds;
+	if (microseconds > mMax) mMax = microseconds;
+}
+
+UInt32 LatencyHistogram::getPercentile(UInt32 percent)
+{
+	if (!mCount)
+		return 0;
+
+	UInt64 target = ((UInt64)mCount * percent + 99) / 100;
+	UInt64 seen = 0;
+	for (int bucket = 0; bucket < kLatencyBuckets; bucket++)
+	{
+		seen += mBuckets[bucket];
+		if (seen >= target)
+			return bucket < kLatencyBuckets - 1 ? (1U << bucket) : mMax;
+	}
+	return mMax;
+}
+
+OSDictionary* LatencyHistogram::createDictionary()
+{
+	OSDictionary* dict = OSDictionary::withCapacity(7);
+	if (!dict)
+		return NULL;
+
+	setNumber(dict, "Count", mCount);
+	setNumber(dict, "Min", getMin());
+	setNumber(dict, "Max", getMax());
+	setNumber(dict, "Average", getAverage());
+	setNumber(dict, "P50", getPercentile(50));
+	setNumber(dict, "P99", getPercentile(99));
+
+	// only publish buckets up to the last one in use
+	int used = kLatencyBuckets;
+	while (used > 0 && !mBuckets[used - 1])
+		used--;
+
+	if (OSArray* buckets = OSArray::withCapacity(used))
+	{
+		for (int bucket = 0; bucket < used; bucket++)
+		{
+			if (OSNumber* num = OSNumber::withNumber(mBuckets[bucket], 32))
+			{
+				buckets->setObject(num);
+				num->release();
+			}
+		}
+		dict->setObject("Buckets", buckets);
+		buckets->release();
+	}
+
+	return dict;
+}
+
+static const char* phaseNames[kPhaseCount] =
+{
+	"Send Delay",
+	"Reset",
+	"EAPD",
+	"Custom Commands",
+	"TCSEL"
+};
+
+bool PhaseProfiler::beginTransition(const char* name)
+{
+	if (!mLock)
+		return false;
+
+	IOLockLock(mLock);
+	bool outermost = !mDepth++;
+	if (outermost)
+	{
+		Transition* transition = &mHistory[mNext];
+		bzero(transition, sizeof(*transition));
+		transition->Name = name;
+		transition->Start = getMicroseconds();
+	}
+	IOLockUnlock(mLock);
+	return outermost;
+}
+
+bool PhaseProfiler::endTransition()
+{
+	if (!mLock)
+		return false;
+
+	IOLockLock(mLock);
+	bool outermost = mDepth && !--mDepth;
+	if (outermost)
+	{
+		Transition* transition = &mHistory[mNext];
+		transition->Total = (UInt32)(getMicroseconds() - transition->Start);
+
+		// phases that were skipped (i.e. no EAPD pins) would only drag Min and Average down
+		mTotal.record(transition->Total);
+		for (int phase = 0; phase < kPhaseCount; phase++)
+			if (transition->Ran & (1 << phase))
+				mPhases[phase].record(transition->Phases[phase]);
+
+		mNext = (mNext + 1) % kProfilerHistory;
+		if (mCount < kProfilerHistory)
+			mCount++;
+	}
+	IOLockUnlock(mLock);
+	return outermost;
+}
+
+void PhaseProfiler::record(TransitionPhase phase, UInt64 start)
+{
+	if (!mLock)
+		return;
+
+	UInt32 elapsed = (UInt32)(getMicroseconds() - start);
+
+	IOLockLock(mLock);
+	if (mDepth)
+	{
+		mHistory[mNext].Phases[phase] += elapsed;
+		mHistory[mNext].Ran |= 1 << phase;
+	}
+	IOLockUnlock(mLock);
+}
+
+OSDictionary* PhaseProfiler::createDictionary()
+{
+	if (!mLock)
+		return NULL;
+
+	OSDictionary* dict = OSDictionary::withCapacity(3);
+	if (!dict)
+		return NULL;
+
+	IOLockLock(mLock);
+
+	if (OSDictionary* total = mTotal.createDictionary())
+	{
+		dict->setObject("Total", total);
+		total->release();
+	}
+
+	if (OSDictionary* phases = OSDictionary::withCapacity(kPhaseCount))
+	{
+		for (int phase = 0; phase < kPhaseCount; phase++)
+		{
+			if (OSDictionary* histogram = mPhases[phase].createDictionary())
+			{
+				phases->setObject(phaseNames[phase], histogram);
+				histogram->release();
+			}
+		}
+		dict->setObject("Phases", phases);
+		phases->release();
+	}
+
+	// most recent first
+	if (OSArray* recent = OSArray::withCapacity(mCount))
+	{
+		for (UInt32 i = 1; i <= mCount; i++)
+		{
+			Transition* transition = &mHistory[(mNext + kProfilerHistory - i) % kProfilerHistory];
+
+			OSDictionary* entry = OSDictionary::withCapacity(2 + kPhaseCount);
+			if (!entry)
+				continue;
+
+			if (OSString* name = OSString::withCString(transition->Name))
+			{
+				entry->setObject("Transition", name);
+				name->release();
+			}
+			setNumber(entry, "Start", transition->Start);
+			setNumber(entry, "Total", transition->Total);
+			for (int phase = 0; phase < kPhaseCount; phase++)
+				if (transition->Ran & (1 << phase))
+					setNumber(entry, phaseNames[phase], transition->Phases[phase]);
+
+			recent->setObject(entry);
+			entry->release();
+		}
+		dict->setObject("Recent", recent);
+		recent->release();
+	}
+
+	IOLockUnlock(mLock);
+	return dict;
+}
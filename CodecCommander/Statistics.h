@@ -0,0 +1,117 @@
+/*
+ *  Released under "The GNU General Public License (GPL-2.0)"
+ *
+ *  This program is free software; you can redistribute it and/or modify it
+ *  under the terms of the GNU General Public License as published by the
+ *  Free Software Foundation; either version 2 of the License, or (at your
+ *  option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ *  or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ *  for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ *
+ */
+
+#ifndef CodecCommander_Statistics_h
+#define CodecCommander_Statistics_h
+
+#include "Common.h"
+#include <kern/clock.h>
+
+// Monotonic time in microseconds
+static inline UInt64 getMicroseconds()
+{
+	UInt64 uptime, nanoseconds;
+	clock_get_uptime(&uptime);
+	absolutetime_to_nanoseconds(uptime, &nanoseconds);
+	return nanoseconds / 1000;
+}
+
+// Bucket i holds samples of less than 2^i microseconds (last bucket is open ended)
+#define kLatencyBuckets		20
+
+class LatencyHistogram
+{
+	UInt32 mBuckets[kLatencyBuckets];
+	UInt32 mCount;
+	UInt32 mMin;
+	UInt32 mMax;
+	UInt64 mTotal;
+
+public:
+	LatencyHistogram() { reset(); }
+
+	void reset();
+	void record(UInt32 microseconds);
+
+	UInt32 getCount() { return mCount; }
+	UInt32 getMin() { return mCount ? mMin : 0; }
+	UInt32 getMax() { return mMax; }
+	UInt32 getAverage() { return mCount ? (UInt32)(mTotal / mCount) : 0; }
+
+	// Upper bound (in microseconds) of the bucket containing the given percentile
+	UInt32 getPercentile(UInt32 percent);
+
+	// Summary for publishing in the IORegistry (caller releases)
+	OSDictionary* createDictionary();
+};
+
+// Phases of a sleep/wake transition
+enum TransitionPhase
+{
+	kPhaseSendDelay,
+	kPhaseReset,
+	kPhaseEAPD,
+	kPhaseCustomCommands,
+	kPhaseTCSEL,
+	kPhaseCount
+};
+
+// Number of transitions kept in detail
+#define kProfilerHistory	8
+
+// Time spent per phase of each transition (nested begin/end pairs count as one transition)
+class PhaseProfiler
+{
+	struct Transition
+	{
+		const char* Name;
+		UInt64 Start;
+		UInt32 Total;
+		UInt32 Ran;		// bit per phase that ran
+		UInt32 Phases[kPhaseCount];
+	};
+
+	Transition mHistory[kProfilerHistory];
+	UInt32 mNext = 0;
+	UInt32 mCount = 0;
+	UInt32 mDepth = 0;
+
+	LatencyHistogram mPhases[kPhaseCount];
+	LatencyHistogram mTotal;
+
+	// the PM thread and the workloop timer both run transitions
+	IOLock* mLock;
+
+public:
+	PhaseProfiler() { mLock = IOLockAlloc(); }
+	~PhaseProfiler() { if (mLock) IOLockFree(mLock); }
+
+	// True if this opened the outermost transition
+	bool beginTransition(const char* name);
+	// True if this closed the outermost transition
+	bool endTransition();
+
+	// Add the time since start to a phase of the running transition (ignored outside one)
+	void record(TransitionPhase phase, UInt64 start);
+
+	// Per-phase summary and recent transitions for publishing in the IORegistry (caller releases)
+	OSDictionary* createDictionary();
+};
+
+#endif
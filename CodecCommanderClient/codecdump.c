@@ -0,0 +1,552 @@
+/*
+ *  Released under "The GNU General Public License (GPL-2.0)"
+ *
+ *  This program is free software; you can redistribute it and/or modify it
+ *  under the terms of the GNU General Public License as published by the
+ *  Free Software Foundation; either version 2 of the License, or (at your
+ *  option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ *  or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ *  for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ *
+ */
+
+/*
+ * Text layout follows sound/pci/hda/hda_proc.c of the Linux kernel, so dumps can be
+ * compared with (and fed to tools written for) /proc/asound/cardN/codec#N.
+ */
+
+#include "codecdump.h"
+
+#define PARAM(n, p)     ((n)->Parameters[p])
+#define VERB(n, v)      ((n)->Verbs[v])
+
+/* parameters */
+#define PAR_VENDOR_ID       0x00
+#define PAR_REV_ID          0x02
+#define PAR_FUNCTION_TYPE   0x05
+#define PAR_WIDGET_CAP      0x09
+#define PAR_PCM             0x0a
+#define PAR_STREAM          0x0b
+#define PAR_PIN_CAP         0x0c
+#define PAR_AMP_IN_CAP      0x0d
+#define PAR_POWER_STATE     0x0f
+#define PAR_PROC_CAP        0x10
+#define PAR_GPIO_CAP        0x11
+#define PAR_AMP_OUT_CAP     0x12
+#define PAR_VOL_KNB_CAP     0x13
+
+/* widget capabilities */
+#define WCAP_STEREO         (1 << 0)
+#define WCAP_IN_AMP         (1 << 1)
+#define WCAP_OUT_AMP        (1 << 2)
+#define WCAP_AMP_OVRD       (1 << 3)
+#define WCAP_FORMAT_OVRD    (1 << 4)
+#define WCAP_STRIPE         (1 << 5)
+#define WCAP_PROC_WID       (1 << 6)
+#define WCAP_UNSOL_CAP      (1 << 7)
+#define WCAP_CONN_LIST      (1 << 8)
+#define WCAP_DIGITAL        (1 << 9)
+#define WCAP_POWER          (1 << 10)
+#define WCAP_LR_SWAP        (1 << 11)
+#define WCAP_CP_CAPS        (1 << 12)
+#define WCAP_CHANNELS(c)    (((((c) >> 13) & 0x7) << 1 | ((c) & 1)) + 1)
+#define WCAP_DELAY(c)       (((c) >> 16) & 0xf)
+#define WCAP_TYPE(c)        (((c) >> 20) & 0xf)
+
+enum { WID_AUD_OUT, WID_AUD_IN, WID_AUD_MIX, WID_AUD_SEL, WID_PIN, WID_POWER, WID_VOL_KNB, WID_BEEP };
+
+/* pin capabilities */
+#define PINCAP_IMP_SENSE    (1 << 0)
+#define PINCAP_TRIG_REQ     (1 << 1)
+#define PINCAP_PRES_DETECT  (1 << 2)
+#define PINCAP_HP_DRV       (1 << 3)
+#define PINCAP_OUT          (1 << 4)
+#define PINCAP_IN           (1 << 5)
+#define PINCAP_BALANCE      (1 << 6)
+#define PINCAP_HDMI         (1 << 7)
+#define PINCAP_VREF(c)      (((c) >> 8) & 0x37)
+#define PINCAP_EAPD         (1 << 16)
+#define PINCAP_DP           (1 << 24)
+
+static const struct { unsigned short id; const char *name; } vendors[] =
+{
+    { 0x1002, "ATI" },
+    { 0x1013, "Cirrus Logic" },
+    { 0x1057, "Motorola" },
+    { 0x1095, "Silicon Image" },
+    { 0x10de, "Nvidia" },
+    { 0x10ec, "Realtek" },
+    { 0x1102, "Creative" },
+    { 0x1106, "VIA" },
+    { 0x111d, "IDT" },
+    { 0x11c1, "LSI" },
+    { 0x11d4, "Analog Devices" },
+    { 0x13f6, "C-Media" },
+    { 0x14f1, "Conexant" },
+    { 0x17e8, "Chrontel" },
+    { 0x1854, "LG" },
+    { 0x1aec, "Wolfson Microelectronics" },
+    { 0x434d, "C-Media" },
+    { 0x8086, "Intel" },
+    { 0x8384, "SigmaTel" },
+};
+
+static const char *widget_type_name(unsigned int type)
+{
+    static const char *names[16] =
+    {
+        "Audio Output", "Audio Input", "Audio Mixer", "Audio Selector", "Pin Complex",
+        "Power Widget", "Volume Knob Widget", "Beep Generator Widget",
+        [15] = "Vendor Defined Widget",
+    };
+    
+    return names[type & 0xf] ? names[type & 0xf] : "Unknown Widget";
+}
+
+static void print_codec_name(FILE *out, UInt32 vendorId)
+{
+    for (size_t i = 0; i < sizeof(vendors) / sizeof(vendors[0]); i++)
+    {
+        if (vendors[i].id == vendorId >> 16)
+        {
+            fprintf(out, "Codec: %s ID %x\n", vendors[i].name, vendorId & 0xffff);
+            return;
+        }
+    }
+    
+    fprintf(out, "Codec: Generic %04x ID %x\n", vendorId >> 16, vendorId & 0xffff);
+}
+
+static void print_amp_caps(FILE *out, UInt32 caps)
+{
+    if (!caps || caps == (UInt32)-1)
+    {
+        fprintf(out, "N/A\n");
+        return;
+    }
+    
+    fprintf(out, "ofs=0x%02x, nsteps=0x%02x, stepsize=0x%02x, mute=%x\n",
+            caps & 0x7f, (caps >> 8) & 0x7f, (caps >> 16) & 0x7f, (caps >> 31) & 0x1);
+}
+
+static void print_amp_vals(FILE *out, const UInt8 (*vals)[2], int count, int stereo)
+{
+    for (int i = 0; i < count; i++)
+    {
+        if (stereo)
+            fprintf(out, " [0x%02x 0x%02x]", vals[i][0], vals[i][1]);
+        else
+            fprintf(out, " [0x%02x]", vals[i][1]);
+    }
+    
+    fprintf(out, "\n");
+}
+
+static void print_pcm_caps(FILE *out, UInt32 pcm, UInt32 stream)
+{
+    static const unsigned int rates[] = { 8000, 11025, 16000, 22050, 32000, 44100, 48000, 88200, 96000, 176400, 192000, 384000 };
+    static const unsigned int bits[] = { 8, 16, 20, 24, 32 };
+    
+    if (pcm == (UInt32)-1 || stream == (UInt32)-1)
+    {
+        fprintf(out, "N/A\n");
+        return;
+    }
+    
+    fprintf(out, "    rates [0x%x]:", pcm & 0xfff);
+    for (unsigned int i = 0; i < sizeof(rates) / sizeof(rates[0]); i++)
+        if (pcm & (1 << i))
+            fprintf(out, " %d", rates[i]);
+    fprintf(out, "\n");
+    
+    fprintf(out, "    bits [0x%x]:", (pcm >> 16) & 0xff);
+    for (unsigned int i = 0; i < sizeof(bits) / sizeof(bits[0]); i++)
+        if (pcm & (1 << (16 + i)))
+            fprintf(out, " %d", bits[i]);
+    fprintf(out, "\n");
+    
+    fprintf(out, "    formats [0x%x]:", stream & 0xf);
+    if (stream & 0x1)
+        fprintf(out, " PCM");
+    if (stream & 0x2)
+        fprintf(out, " FLOAT");
+    if (stream & 0x4)
+        fprintf(out, " AC3");
+    fprintf(out, "\n");
+}
+
+static const char *power_state_name(unsigned int state)
+{
+    static const char *names[] = { "D0", "D1", "D2", "D3", "D3cold" };
+    
+    return state < sizeof(names) / sizeof(names[0]) ? names[state] : "UNKNOWN";
+}
+
+static void print_power_state(FILE *out, const CodecCommanderDumpNode *node)
+{
+    static const struct { int bit; const char *name; } states[] =
+    {
+        { 0, "D0" }, { 1, "D1" }, { 2, "D2" }, { 3, "D3" }, { 4, "D3cold" },
+        { 29, "S3D3cold" }, { 30, "CLKSTOP" }, { 31, "EPSS" },
+    };
+    UInt32 sup = PARAM(node, PAR_POWER_STATE);
+    UInt32 pwr = VERB(node, kDumpPowerState);
+    
+    if (sup != (UInt32)-1)
+    {
+        fprintf(out, "  Power states: ");
+        for (unsigned int i = 0; i < sizeof(states) / sizeof(states[0]); i++)
+            if (sup & (1U << states[i].bit))
+                fprintf(out, " %s", states[i].name);
+        fprintf(out, "\n");
+    }
+    
+    fprintf(out, "  Power: setting=%s, actual=%s", power_state_name(pwr & 0xf), power_state_name((pwr >> 4) & 0xf));
+    if (pwr & (1 << 8))
+        fprintf(out, ", Error");
+    if (pwr & (1 << 9))
+        fprintf(out, ", Clock-stop-OK");
+    if (pwr & (1 << 10))
+        fprintf(out, ", Setting-reset");
+    fprintf(out, "\n");
+}
+
+static void print_gpio(FILE *out, const CodecCommanderDumpNode *afg)
+{
+    UInt32 gpio = PARAM(afg, PAR_GPIO_CAP);
+    int max = gpio & 0xff;
+    
+    fprintf(out, "GPIO: io=%d, o=%d, i=%d, unsolicited=%d, wake=%d\n",
+            max, (gpio >> 8) & 0xff, (gpio >> 16) & 0xff, (gpio >> 30) & 1, (gpio >> 31) & 1);
+    
+    if (!max || max > 8)
+        return;
+    
+    for (int i = 0; i < max; i++)
+        fprintf(out, "  IO[%d]: enable=%d, dir=%d, wake=%d, sticky=%d, data=%d, unsol=%d\n", i,
+                (VERB(afg, kDumpGPIOMask) >> i) & 1, (VERB(afg, kDumpGPIODirection) >> i) & 1,
+                (VERB(afg, kDumpGPIOWakeMask) >> i) & 1, (VERB(afg, kDumpGPIOSticky) >> i) & 1,
+                (VERB(afg, kDumpGPIOData) >> i) & 1, (VERB(afg, kDumpGPIOUnsolicited) >> i) & 1);
+}
+
+static const char *jack_type(UInt32 cfg)
+{
+    static const char *names[16] =
+    {
+        "Line Out", "Speaker", "HP Out", "CD", "SPDIF Out", "Digital Out", "Modem Line", "Modem Hand",
+        "Line In", "Aux", "Mic", "Telephony", "SPDIF In", "Digital In", "Reserved", "Other",
+    };
+    
+    return names[(cfg >> 20) & 0xf];
+}
+
+static const char *jack_connectivity(UInt32 cfg)
+{
+    static const char *names[4] = { "Ext", "Int", "Sep", "Oth" };
+    
+    return names[(cfg >> 28) & 0x3];
+}
+
+static const char *jack_location(UInt32 cfg)
+{
+    static const char *bases[7] = { "N/A", "Rear", "Front", "Left", "Right", "Top", "Bottom" };
+    static const unsigned char specials_idx[] = { 0x07, 0x08, 0x17, 0x18, 0x19, 0x37, 0x38 };
+    static const char *specials[] = { "Rear Panel", "Drive Bar", "Riser", "HDMI", "ATAPI", "Mobile-In", "Mobile-Out" };
+    unsigned int location = (cfg >> 24) & 0x3f;
+    
+    if ((location & 0x0f) < 7)
+        return bases[location & 0x0f];
+    
+    for (unsigned int i = 0; i < sizeof(specials_idx); i++)
+        if (location == specials_idx[i])
+            return specials[i];
+    
+    return "UNKNOWN";
+}
+
+static const char *jack_connection(UInt32 cfg)
+{
+    static const char *names[16] =
+    {
+        "Unknown", "1/8", "1/4", "ATAPI", "RCA", "Optical", "Digital", "Analog",
+        "DIN", "XLR", "RJ11", "Comb", NULL, NULL, NULL, "Other",
+    };
+    const char *name = names[(cfg >> 16) & 0xf];
+    
+    return name ? name : "UNKNOWN";
+}
+
+static const char *jack_color(UInt32 cfg)
+{
+    static const char *names[16] =
+    {
+        "Unknown", "Black", "Grey", "Blue", "Green", "Red", "Orange", "Yellow",
+        "Purple", "Pink", NULL, NULL, NULL, NULL, "White", "Other",
+    };
+    const char *name = names[(cfg >> 12) & 0xf];
+    
+    return name ? name : "UNKNOWN";
+}
+
+static void print_pin(FILE *out, const CodecCommanderDumpNode *node)
+{
+    static const char *jack_conns[4] = { "Jack", "N/A", "Fixed", "Both" };
+    UInt32 caps = PARAM(node, PAR_PIN_CAP);
+    UInt32 cfg = VERB(node, kDumpConfigDefault);
+    UInt32 ctls = VERB(node, kDumpPinControl);
+    
+    fprintf(out, "  Pincap 0x%08x:", caps);
+    if (caps & PINCAP_IN)
+        fprintf(out, " IN");
+    if (caps & PINCAP_OUT)
+        fprintf(out, " OUT");
+    if (caps & PINCAP_HP_DRV)
+        fprintf(out, " HP");
+    if (caps & PINCAP_EAPD)
+        fprintf(out, " EAPD");
+    if (caps & PINCAP_PRES_DETECT)
+        fprintf(out, " Detect");
+    if (caps & PINCAP_BALANCE)
+        fprintf(out, " Balanced");
+    if (caps & PINCAP_HDMI)
+        fprintf(out, (caps & PINCAP_DP) ? " DP" : " HDMI");
+    if (caps & PINCAP_TRIG_REQ)
+        fprintf(out, " Trigger");
+    if (caps & PINCAP_IMP_SENSE)
+        fprintf(out, " ImpSense");
+    fprintf(out, "\n");
+    
+    if (PINCAP_VREF(caps))
+    {
+        unsigned int vref = PINCAP_VREF(caps);
+        
+        fprintf(out, "    Vref caps:");
+        if (vref & 0x01)
+            fprintf(out, " HIZ");
+        if (vref & 0x02)
+            fprintf(out, " 50");
+        if (vref & 0x04)
+            fprintf(out, " GRD");
+        if (vref & 0x10)
+            fprintf(out, " 80");
+        if (vref & 0x20)
+            fprintf(out, " 100");
+        fprintf(out, "\n");
+    }
+    
+    if (caps & PINCAP_EAPD)
+    {
+        UInt32 eapd = VERB(node, kDumpEAPD);
+        
+        fprintf(out, "  EAPD 0x%x:", eapd);
+        if (eapd & 0x1)
+            fprintf(out, " BALANCED");
+        if (eapd & 0x2)
+            fprintf(out, " EAPD");
+        if (eapd & 0x4)
+            fprintf(out, " R/L");
+        fprintf(out, "\n");
+    }
+    
+    fprintf(out, "  Pin Default 0x%08x: [%s] %s at %s %s\n", cfg, jack_conns[(cfg >> 30) & 0x3],
+            jack_type(cfg), jack_connectivity(cfg), jack_location(cfg));
+    fprintf(out, "    Conn = %s, Color = %s\n", jack_connection(cfg), jack_color(cfg));
+    fprintf(out, "    DefAssociation = 0x%x, Sequence = 0x%x\n", (cfg >> 4) & 0xf, cfg & 0xf);
+    if (cfg & (1 << 8))
+        fprintf(out, "    Misc = NO_PRESENCE\n");
+    
+    fprintf(out, "  Pin-ctls: 0x%02x:", ctls & 0xff);
+    if (ctls & 0x20)
+        fprintf(out, " IN");
+    if (ctls & 0x40)
+        fprintf(out, " OUT");
+    if (ctls & 0x80)
+        fprintf(out, " HP");
+    if (PINCAP_VREF(caps))
+    {
+        switch (ctls & 0x7)
+        {
+            case 1: fprintf(out, " VREF_50"); break;
+            case 2: fprintf(out, " VREF_GRD"); break;
+            case 4: fprintf(out, " VREF_80"); break;
+            case 5: fprintf(out, " VREF_100"); break;
+        }
+    }
+    fprintf(out, "\n");
+}
+
+static void print_audio_io(FILE *out, const CodecCommanderDumpNode *node, unsigned int type)
+{
+    UInt32 conv = VERB(node, kDumpConverter);
+    
+    fprintf(out, "  Converter: stream=%d, channel=%d\n", (conv >> 4) & 0xf, conv & 0xf);
+    
+    if (type == WID_AUD_IN && (conv & 0xf) == 0)
+        fprintf(out, "  SDI-Select: %d\n", VERB(node, kDumpSDISelect) & 0xf);
+}
+
+static void print_digital_conv(FILE *out, const CodecCommanderDumpNode *node)
+{
+    UInt32 digi1 = VERB(node, kDumpDigital1);
+    unsigned char digi2 = digi1 >> 8;
+    unsigned char digi3 = digi1 >> 16;
+    static const char *flags[8] = { " Enabled", " Validity", " ValidityCfg", " Preemphasis", " Non-Copyright", " Non-Audio", " Pro", " GenLevel" };
+    
+    fprintf(out, "  Digital:");
+    for (int i = 0; i < 8; i++)
+        if (digi1 & (1 << i))
+            fprintf(out, "%s", flags[i]);
+    if (digi3 & 0x80)
+        fprintf(out, " KAE");
+    fprintf(out, "\n");
+    fprintf(out, "  Digital category: 0x%x\n", digi2 & 0x7f);
+    fprintf(out, "  IEC Coding Type: 0x%x\n", digi3 & 0xf);
+}
+
+static void print_node(FILE *out, const CodecCommanderDumpNode *node, const CodecCommanderDumpNode *afg)
+{
+    UInt32 caps = PARAM(node, PAR_WIDGET_CAP);
+    unsigned int type = WCAP_TYPE(caps);
+    
+    fprintf(out, "Node 0x%02x [%s] wcaps 0x%x:", node->Node, widget_type_name(type), caps);
+    if (caps & WCAP_STEREO)
+    {
+        if (WCAP_CHANNELS(caps) == 2)
+            fprintf(out, " Stereo");
+        else
+            fprintf(out, " %d-Channels", WCAP_CHANNELS(caps));
+    }
+    else
+        fprintf(out, " Mono");
+    if (caps & WCAP_DIGITAL)
+        fprintf(out, " Digital");
+    if (caps & WCAP_IN_AMP)
+        fprintf(out, " Amp-In");
+    if (caps & WCAP_OUT_AMP)
+        fprintf(out, " Amp-Out");
+    if (caps & WCAP_STRIPE)
+        fprintf(out, " Stripe");
+    if (caps & WCAP_LR_SWAP)
+        fprintf(out, " R/L");
+    if (caps & WCAP_CP_CAPS)
+        fprintf(out, " CP");
+    fprintf(out, "\n");
+    
+    // without an override the function group defaults apply
+    const CodecCommanderDumpNode *ampCaps = (caps & WCAP_AMP_OVRD) ? node : afg;
+    
+    if (caps & WCAP_IN_AMP)
+    {
+        int count = type == WID_PIN ? 1 : (node->ConnectionCount < node->AmpInCount ? node->ConnectionCount : node->AmpInCount);
+        
+        fprintf(out, "  Amp-In caps: ");
+        print_amp_caps(out, PARAM(ampCaps, PAR_AMP_IN_CAP));
+        fprintf(out, "  Amp-In vals: ");
+        print_amp_vals(out, node->AmpIn, count, caps & WCAP_STEREO);
+    }
+    
+    if (caps & WCAP_OUT_AMP)
+    {
+        const UInt8 (*vals)[2] = (const UInt8 (*)[2])node->AmpOut;
+        
+        fprintf(out, "  Amp-Out caps: ");
+        print_amp_caps(out, PARAM(ampCaps, PAR_AMP_OUT_CAP));
+        fprintf(out, "  Amp-Out vals: ");
+        print_amp_vals(out, vals, 1, caps & WCAP_STEREO);
+    }
+    
+    switch (type)
+    {
+        case WID_PIN:
+            print_pin(out, node);
+            break;
+        case WID_VOL_KNB:
+            fprintf(out, "  Volume-Knob: delta=%d, steps=%d, direct=%d, val=%d\n",
+                    (PARAM(node, PAR_VOL_KNB_CAP) >> 7) & 1, PARAM(node, PAR_VOL_KNB_CAP) & 0x7f,
+                    (VERB(node, kDumpVolumeKnob) >> 7) & 1, VERB(node, kDumpVolumeKnob) & 0x7f);
+            break;
+        case WID_AUD_OUT:
+        case WID_AUD_IN:
+            print_audio_io(out, node, type);
+            if (caps & WCAP_DIGITAL)
+                print_digital_conv(out, node);
+            if (caps & WCAP_FORMAT_OVRD)
+            {
+                fprintf(out, "  PCM:\n");
+                print_pcm_caps(out, PARAM(node, PAR_PCM), PARAM(node, PAR_STREAM));
+            }
+            break;
+    }
+    
+    if (caps & WCAP_UNSOL_CAP)
+        fprintf(out, "  Unsolicited: tag=%02x, enabled=%d\n", VERB(node, kDumpUnsolicited) & 0x3f, (VERB(node, kDumpUnsolicited) >> 7) & 1);
+    
+    if (caps & WCAP_POWER)
+        print_power_state(out, node);
+    
+    if (WCAP_DELAY(caps))
+        fprintf(out, "  Delay: %d samples\n", WCAP_DELAY(caps));
+    
+    if (caps & WCAP_CONN_LIST)
+    {
+        int current = -1;
+        
+        if (type != WID_AUD_MIX && type != WID_VOL_KNB)
+            current = VERB(node, kDumpConnectSelect) & 0xff;
+        
+        fprintf(out, "  Connection: %d\n", node->ConnectionCount);
+        if (node->ConnectionCount)
+        {
+            fprintf(out, "    ");
+            for (int i = 0; i < node->ConnectionCount; i++)
+                fprintf(out, " 0x%02x%s", node->Connections[i], i == current ? "*" : "");
+            fprintf(out, "\n");
+        }
+    }
+    
+    if (caps & WCAP_PROC_WID)
+        fprintf(out, "  Processing caps: benign=%d, ncoeff=%d\n", PARAM(node, PAR_PROC_CAP) & 1, (PARAM(node, PAR_PROC_CAP) >> 8) & 0xff);
+}
+
+void print_codec_dump(FILE *out, const CodecCommanderDump *dump)
+{
+    const CodecCommanderDumpNode *root = &dump->Nodes[0];
+    const CodecCommanderDumpNode *afg = &dump->Nodes[1];
+    UInt32 function = PARAM(afg, PAR_FUNCTION_TYPE);
+    
+    print_codec_name(out, PARAM(root, PAR_VENDOR_ID));
+    fprintf(out, "Address: %d\n", dump->CodecAddress);
+    fprintf(out, "AFG Function Id: 0x%x (unsol %u)\n", function & 0xff, (function >> 8) & 1);
+    fprintf(out, "Vendor Id: 0x%08x\n", PARAM(root, PAR_VENDOR_ID));
+    fprintf(out, "Subsystem Id: 0x%08x\n", VERB(afg, kDumpSubsystemId));
+    fprintf(out, "Revision Id: 0x%x\n", PARAM(root, PAR_REV_ID));
+    fprintf(out, "No Modem Function Group found\n");
+    
+    fprintf(out, "Default PCM:\n");
+    print_pcm_caps(out, PARAM(afg, PAR_PCM), PARAM(afg, PAR_STREAM));
+    fprintf(out, "Default Amp-In caps: ");
+    print_amp_caps(out, PARAM(afg, PAR_AMP_IN_CAP));
+    fprintf(out, "Default Amp-Out caps: ");
+    print_amp_caps(out, PARAM(afg, PAR_AMP_OUT_CAP));
+    
+    fprintf(out, "State of AFG node 0x%02x:\n", dump->AudioRoot);
+    print_power_state(out, afg);
+    
+    if (!dump->NodeCount)
+    {
+        fprintf(out, "Invalid AFG subtree\n");
+        return;
+    }
+    
+    print_gpio(out, afg);
+    
+    for (int i = 0; i < dump->NodeCount; i++)
+        print_node(out, &dump->Nodes[i + 2], afg);
+}
@@ -22,15 +22,18 @@
 #include <ctype.h>
 #include <stdlib.h>
 #include <unistd.h>
+#include <signal.h>
+#include <sys/time.h>
 #include <IOKit/IOKitLib.h>
 
 #include <CoreFoundation/CoreFoundation.h>
 #include "hdaverb.h"
+#include "../CodecCommander/ClientInterface.h"
+#include "codecdump.h"
+#include "tracefile.h"
 
-static UInt32 execute_command(UInt32 command, UInt32 vendorId, UInt32 codecAddress, UInt32 functionGroup)
+static int open_service(io_connect_t* dataPort)
 {
-    io_connect_t dataPort;
-    
     CFMutableDictionaryRef dict = IOServiceMatching("CodecCommander");
 
     //REVIEW_REHABMAN: These extra filters don't work anyway...
@@ -48,26 +51,38 @@ static UInt32 execute_command(UInt32 command, UInt32 vendorId, UInt32 codecAddre
     if (!service)
     {
         printf("Could not locate CodecCommander kext, ensure it is loaded.\n");
-        return -1;
+        return 0;
     }
     
     // Create a connection to the IOService object
-    kern_return_t kr = IOServiceOpen(service, mach_task_self(), 0, &dataPort);
+    kern_return_t kr = IOServiceOpen(service, mach_task_self(), 0, dataPort);
     
     IOObjectRelease(service);
     
     if (kr != kIOReturnSuccess)
     {
         printf("Failed to open CodecCommander service: %08x.\n", kr);
-        return -1;
+        return 0;
     }
     
+    return 1;
+}
+
+static UInt32 execute_command(UInt32 command)
+{
+    io_connect_t dataPort;
+    
+    if (!open_service(&dataPort))
+        return -1;
+    
     IOItemCount inputCount = 1;
     IOItemCount outputCount = 1;
     UInt64 input = command;
     UInt64 output;
     
-    kr = IOConnectCallScalarMethod(dataPort, 0, &input, inputCount, &output, &outputCount);
+    kern_return_t kr = IOConnectCallScalarMethod(dataPort, kClientExecuteVerb, &input, inputCount, &output, &outputCount);
+    
+    IOServiceClose(dataPort);
     
     if (kr != kIOReturnSuccess)
         return -1;
@@ -75,6 +90,303 @@ static UInt32 execute_command(UInt32 command, UInt32 vendorId, UInt32 codecAddre
     return (UInt32)output;
 }
 
+/* execute up to kClientMaxVerbs commands with one call on an open connection */
+static int execute_batch(io_connect_t dataPort, const UInt32* commands, size_t count, CodecCommanderVerbResult* results)
+{
+    size_t outputSize = count * sizeof(CodecCommanderVerbResult);
+    kern_return_t kr = IOConnectCallStructMethod(dataPort, kClientExecuteVerbs, commands, count * sizeof(UInt32), results, &outputSize);
+    
+    if (kr != kIOReturnSuccess)
+    {
+        printf("Failed to execute commands: %08x.\n", kr);
+        return 0;
+    }
+    
+    return 1;
+}
+
+/* execute all commands over one connection, the kext runs each batch as a whole */
+static int execute_commands(const UInt32* commands, size_t count, CodecCommanderVerbResult* results)
+{
+    io_connect_t dataPort;
+    int ok = 1;
+    
+    if (!open_service(&dataPort))
+        return 0;
+    
+    for (size_t i = 0; ok && i < count; i += kClientMaxVerbs)
+        ok = execute_batch(dataPort, commands + i, count - i < kClientMaxVerbs ? count - i : kClientMaxVerbs, results + i);
+    
+    IOServiceClose(dataPort);
+    
+    return ok;
+}
+
+/* fetch a snapshot of every node in one call and print it in Linux codec#N format */
+static int dump_codec(void)
+{
+    io_connect_t dataPort;
+    size_t size = sizeof(CodecCommanderDump) + kClientDumpMaxNodes * sizeof(CodecCommanderDumpNode);
+    CodecCommanderDump* dump = malloc(size);
+    
+    if (!dump || !open_service(&dataPort))
+    {
+        free(dump);
+        return 0;
+    }
+    
+    kern_return_t kr = IOConnectCallStructMethod(dataPort, kClientDumpCodec, NULL, 0, dump, &size);
+    
+    IOServiceClose(dataPort);
+    
+    if (kr != kIOReturnSuccess || size < sizeof(CodecCommanderDump) || dump->Version != kClientDumpVersion ||
+        dump->Size > size || dump->Size < sizeof(CodecCommanderDump) + (dump->NodeCount + 2) * sizeof(CodecCommanderDumpNode))
+    {
+        printf("Failed to dump codec: %08x.\n", kr);
+        free(dump);
+        return 0;
+    }
+    
+    print_codec_dump(stdout, dump);
+    fprintf(stderr, "%d nodes dumped in %u us\n", dump->NodeCount + 2, dump->Elapsed);
+    
+    free(dump);
+    return 1;
+}
+
+static void usage(void);
+static long parse_value(char *str, struct strtbl *tbl, long max, const char *what);
+
+static volatile sig_atomic_t trace_stop;
+
+static void stop_trace(int signal)
+{
+    trace_stop = 1;
+}
+
+/* hda-verb trace on|off|dump|follow, record file, dump|csv file, report file [baseline [percent]] */
+static int trace_command(int argc, char **argv)
+{
+    const char *action = argv[0];
+    io_connect_t dataPort;
+    kern_return_t kr = kIOReturnSuccess;
+    int follow = !strcmp(action, "follow"), dump = !strcmp(action, "dump");
+    FILE *file = NULL;
+    UInt64 recorded = 0, lost = 0;
+    
+    // offline decoding of recorded traces
+    int report = !strcmp(action, "report"), csv = !strcmp(action, "csv");
+    if (((dump || csv) && argc == 2) || (report && argc >= 2 && argc <= 4))
+    {
+        size_t count = 0, baselineCount = 0;
+        UInt32 fileLost = 0, baselineLost = 0;
+        int threshold = argc == 4 ? (int)parse_value(argv[3], NULL, 1000, "percent") : kTraceDefaultThreshold;
+        CodecCommanderTraceRecord *records = read_trace_file(argv[1], &count, &fileLost);
+        CodecCommanderTraceRecord *baseline = argc >= 3 ? read_trace_file(argv[2], &baselineCount, &baselineLost) : NULL;
+        int ok = records && (argc == 2 || baseline) && threshold >= 0;
+        
+        if (ok && fileLost)
+            fprintf(stderr, "%s: %u records lost while recording\n", argv[1], fileLost);
+        if (ok && dump)
+            print_trace(stdout, records, count);
+        else if (ok && csv)
+            ok = write_transitions_csv(stdout, records, count);
+        else if (ok)
+        {
+            // exit status tells scripts whether the change made transitions costlier
+            int regressions = report_trace(stdout, records, count, baseline, baselineCount, baseline ? threshold : -1);
+            
+            if (regressions > 0)
+                fprintf(stderr, "%d transition type(s) regressed beyond %d%%\n", regressions, threshold);
+            ok = !regressions;
+        }
+        
+        free(records);
+        free(baseline);
+        return ok;
+    }
+    
+    if (!strcmp(action, "record") && argc == 2)
+    {
+        if (!(file = fopen(argv[1], "wb")) || !write_trace_header(file, 0, 0))
+        {
+            fprintf(stderr, "cannot write %s\n", argv[1]);
+            if (file)
+                fclose(file);
+            return 0;
+        }
+        follow = 1;
+    }
+    else if (argc != 1 || (!follow && !dump && strcmp(action, "on") && strcmp(action, "off")))
+    {
+        usage();
+        return 0;
+    }
+    
+    CodecCommanderTraceRecord *records = malloc(kClientTraceEntries * sizeof(CodecCommanderTraceRecord));
+    
+    if (!records || !open_service(&dataPort))
+    {
+        free(records);
+        if (file)
+            fclose(file);
+        return 0;
+    }
+    
+    UInt64 input = 0, output[2] = { 0, 0 };
+    UInt32 outputCount = 1;
+    
+    // on/off just flip recording, follow/record turn it on and start at the current head
+    if (!dump)
+    {
+        input = strcmp(action, "off") != 0;
+        kr = IOConnectCallScalarMethod(dataPort, kClientTraceControl, &input, 1, output, &outputCount);
+    }
+    
+    if (kr == kIOReturnSuccess && (follow || dump))
+    {
+        // a dump starts at the oldest record still held, older ones are not reported as lost
+        int warn = follow;
+        
+        signal(SIGINT, stop_trace);
+        signal(SIGTERM, stop_trace);
+        
+        while (!trace_stop)
+        {
+            size_t size = kClientTraceEntries * sizeof(CodecCommanderTraceRecord);
+            
+            input = output[0];
+            outputCount = 2;
+            kr = IOConnectCallMethod(dataPort, kClientTraceDrain, &input, 1, NULL, 0, output, &outputCount, records, &size);
+            
+            if (kr != kIOReturnSuccess)
+                break;
+            
+            size_t count = size / sizeof(CodecCommanderTraceRecord);
+            
+            if (warn && output[1])
+            {
+                fprintf(stderr, "%llu records lost\n", (unsigned long long)output[1]);
+                lost += output[1];
+            }
+            warn = 1;
+            
+            if (file)
+            {
+                if (fwrite(records, sizeof(CodecCommanderTraceRecord), count, file) != count)
+                {
+                    fprintf(stderr, "cannot write %s\n", argv[1]);
+                    break;
+                }
+                recorded += count;
+            }
+            else
+            {
+                print_trace(stdout, records, count);
+                fflush(stdout);
+            }
+            
+            // poll once the ring is drained
+            if (follow && count < kClientTraceEntries)
+                usleep(100000);
+            else if (!follow && !count)
+                break;
+        }
+    }
+    
+    IOServiceClose(dataPort);
+    free(records);
+    
+    if (file)
+    {
+        if (!write_trace_header(file, recorded, (UInt32)lost))
+            fprintf(stderr, "cannot write %s\n", argv[1]);
+        else
+            fprintf(stderr, "%llu records written to %s\n", (unsigned long long)recorded, argv[1]);
+        fclose(file);
+    }
+    
+    if (kr != kIOReturnSuccess)
+    {
+        printf("Failed to %s trace: %08x.\n", action, kr);
+        return 0;
+    }
+    
+    return 1;
+}
+
+/* wait between polls of the completion ring while it has nothing new */
+#define RING_POLL_US    50
+
+/* stream the commands (repeated) through the shared memory rings, results of the last round are kept */
+static int execute_ring(const UInt32* commands, int count, long repeat, CodecCommanderVerbResult* results)
+{
+    io_connect_t dataPort;
+    mach_vm_address_t address = 0;
+    mach_vm_size_t size = 0;
+    
+    if (!open_service(&dataPort))
+        return 0;
+    
+    kern_return_t kr = IOConnectMapMemory64(dataPort, kClientMemoryRings, mach_task_self(), &address, &size, kIOMapAnywhere);
+    
+    if (kr != kIOReturnSuccess || size < sizeof(CodecCommanderRings))
+    {
+        printf("Failed to map CodecCommander rings: %08x.\n", kr);
+        IOServiceClose(dataPort);
+        return 0;
+    }
+    
+    CodecCommanderRings* rings = (CodecCommanderRings*)address;
+    UInt32 start = rings->Completed, read = start;
+    UInt32 total = (UInt32)(count * repeat), queued = 0;
+    struct timeval begin, end;
+    
+    gettimeofday(&begin, NULL);
+    
+    while (kr == kIOReturnSuccess && read - start < total)
+    {
+        while (queued < total && CCRingFree(rings, read))
+            CCRingPush(rings, commands[queued++ % count]);
+        
+        // only the transition from idle needs a doorbell, it returns before the verbs run
+        if (CCRingClaim(rings))
+            kr = IOConnectCallScalarMethod(dataPort, kClientRingDoorbell, NULL, 0, NULL, NULL);
+        
+        UInt32 completed = rings->Completed;
+        
+        // nothing to queue or collect, give the kext a moment
+        if (read == completed && (queued == total || !CCRingFree(rings, read)))
+            usleep(RING_POLL_US);
+        
+        while (read != completed)
+        {
+            __sync_synchronize();
+            results[(read - start) % count] = rings->Results[read % kClientRingEntries];
+            read++;
+        }
+    }
+    
+    gettimeofday(&end, NULL);
+    
+    IOConnectUnmapMemory64(dataPort, kClientMemoryRings, mach_task_self(), address);
+    IOServiceClose(dataPort);
+    
+    if (kr != kIOReturnSuccess)
+    {
+        printf("Failed to drain CodecCommander rings: %08x.\n", kr);
+        return 0;
+    }
+    
+    if (repeat > 1)
+    {
+        double seconds = (end.tv_sec - begin.tv_sec) + (end.tv_usec - begin.tv_usec) / 1e6;
+        fprintf(stderr, "%u verbs in %.3f s (%.0f verbs/s)\n", total, seconds, seconds > 0 ? total / seconds : 0);
+    }
+    
+    return 1;
+}
+
 static void list_keys(struct strtbl *tbl, int one_per_line)
 {
     int c = 0;
@@ -144,9 +456,20 @@ static void strtoupper(char *str)
 static void usage(void)
 {
     fprintf(stderr, "hda-verb for CodecCommander (based on alsa-tools hda-verb)\n");
-    fprintf(stderr, "usage: hda-verb [option] nid verb param\n");
+    fprintf(stderr, "usage: hda-verb [option] nid verb param [nid verb param ...]\n");
+    fprintf(stderr, "       hda-verb trace on|off|dump|follow\n");
+    fprintf(stderr, "       hda-verb trace record file | dump file | csv file | report file [baseline [percent]]\n");
     fprintf(stderr, "   -l      List known verbs and parameters\n");
     fprintf(stderr, "   -L      List known verbs and parameters (one per line)\n");
+    fprintf(stderr, "   -r      Send verbs through the shared memory rings\n");
+    fprintf(stderr, "   -n N    Repeat the verbs N times through the rings and report throughput\n");
+    fprintf(stderr, "   -d      Dump all codec nodes (like Linux /proc/asound/cardN/codec#N)\n");
+    fprintf(stderr, "   -f file Run the queries in file (- for stdin), one \"nid[-nid] verb param [count]\" per line\n");
+    fprintf(stderr, "Several nid/verb/param triples are executed as one batch.\n");
+    fprintf(stderr, "trace on/off starts/stops recording every verb in the kext, dump prints what was recorded\n");
+    fprintf(stderr, "and follow keeps printing new verbs until interrupted. record saves new verbs to a file\n");
+    fprintf(stderr, "until interrupted, report lists verbs, link and wall time of each sleep/wake in it and\n");
+    fprintf(stderr, "fails if a transition needs more verbs or percent (default %d) more time than in baseline.\n", kTraceDefaultThreshold);
 }
 
 static void list_verbs(int one_per_line)
@@ -157,13 +480,166 @@ static void list_verbs(int one_per_line)
     list_keys(hda_params, one_per_line);
 }
 
-int main(int argc, char **argv)
+/* parse a nid, verb or parameter, by name from the table or as a number */
+static long parse_value(char *str, struct strtbl *tbl, long max, const char *what)
+{
+    long value;
+    
+    if (tbl && !isdigit(*str))
+    {
+        strtoupper(str);
+        return lookup_str(tbl, str);
+    }
+    
+    value = strtol(str, NULL, 0);
+    
+    if (value < 0 || value > max)
+    {
+        fprintf(stderr, "invalid %s %s\n", what, str);
+        return -1;
+    }
+    
+    return value;
+}
+
+/* parse one nid/verb/param triple into a command */
+static int parse_verb(char **p, UInt32 *command)
 {
     long nid, verb, param;
-    int c;
-    char **p;
     
-    while ((c = getopt(argc, argv, "lL")) >= 0)
+    if ((nid = parse_value(p[0], NULL, 0xff, "nid")) < 0 ||
+        (verb = parse_value(p[1], hda_verbs, 0xfff, "verb")) < 0 ||
+        (param = parse_value(p[2], hda_params, 0xffff, "param")) < 0)
+        return 0;
+    
+    printf("nid = 0x%lx, verb = 0x%lx, param = 0x%lx\n",
+            nid, verb, param);
+    
+    *command = (UInt32)HDA_VERB(nid, verb, param);
+    return 1;
+}
+
+struct script_verb
+{
+    UInt8 nid;
+    UInt16 verb;
+    UInt16 param;
+};
+
+/*
+ * Run a script, one query per line:
+ *     nid[-nid] verb param [count]
+ * A nid range queries every node in it, count repeats the query, # starts a comment.
+ * Everything is sent as batches over one connection, results are printed one per line as
+ *     nid verb param response status
+ */
+static int run_script(FILE *file, const char *name)
+{
+    char line[256];
+    int number = 0;
+    size_t count = 0, capacity = 0;
+    struct script_verb *verbs = NULL;
+    UInt32 *commands = NULL;
+    
+    while (fgets(line, sizeof(line), file))
+    {
+        char *field[5], *next = line;
+        int fields = 0;
+        
+        number++;
+        
+        if (strchr(line, '#'))
+            *strchr(line, '#') = 0;
+        
+        while (fields < 5 && (field[fields] = strtok(next, " \t\r\n")))
+        {
+            fields++;
+            next = NULL;
+        }
+        
+        if (!fields)
+            continue;
+        
+        if (fields < 3 || fields > 4)
+        {
+            fprintf(stderr, "%s:%d: expected nid verb param [count]\n", name, number);
+            goto fail;
+        }
+        
+        // nid or nid range, the second nid starts after the first digit
+        char *last = strchr(field[0] + 1, '-');
+        if (last)
+            *last++ = 0;
+        
+        long first = parse_value(field[0], NULL, 0xff, "nid");
+        long final = last ? parse_value(last, NULL, 0xff, "nid") : first;
+        long verb = parse_value(field[1], hda_verbs, 0xfff, "verb");
+        long param = parse_value(field[2], hda_params, 0xffff, "param");
+        long repeat = fields > 3 ? strtol(field[3], NULL, 0) : 1;
+        
+        if (first < 0 || final < first || verb < 0 || param < 0 || repeat < 1 || repeat > kClientMaxVerbs)
+        {
+            fprintf(stderr, "%s:%d: invalid query\n", name, number);
+            goto fail;
+        }
+        
+        for (long nid = first; nid <= final; nid++)
+        {
+            for (long i = 0; i < repeat; i++)
+            {
+                if (count == capacity)
+                {
+                    capacity = capacity ? capacity * 2 : 256;
+                    verbs = reallocf(verbs, capacity * sizeof(*verbs));
+                    commands = reallocf(commands, capacity * sizeof(*commands));
+                    
+                    if (!verbs || !commands)
+                    {
+                        fprintf(stderr, "out of memory\n");
+                        goto fail;
+                    }
+                }
+                
+                verbs[count].nid = nid;
+                verbs[count].verb = verb;
+                verbs[count].param = param;
+                commands[count++] = (UInt32)HDA_VERB(nid, verb, param);
+            }
+        }
+    }
+    
+    CodecCommanderVerbResult *results = malloc(count * sizeof(CodecCommanderVerbResult) + 1);
+    
+    if (!results || !execute_commands(commands, count, results))
+    {
+        free(results);
+        goto fail;
+    }
+    
+    for (size_t i = 0; i < count; i++)
+        printf("0x%02x 0x%03x 0x%04x 0x%08x 0x%08x\n", verbs[i].nid, verbs[i].verb, verbs[i].param,
+               results[i].Response, results[i].Status);
+    
+    free(results);
+    free(verbs);
+    free(commands);
+    return 1;
+    
+fail:
+    free(verbs);
+    free(commands);
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    int c, ring = 0;
+    long repeat = 1;
+    
+    if (argc >= 3 && !strcmp(argv[1], "trace"))
+        return trace_command(argc - 2, argv + 2) ? 0 : 1;
+    
+    while ((c = getopt(argc, argv, "lLdrn:f:")) >= 0)
     {
         switch (c)
         {
@@ -173,70 +649,79 @@ int main(int argc, char **argv)
             case 'L':
                 list_verbs(1);
                 return 0;
+            case 'd':
+                return dump_codec() ? 0 : 1;
+            case 'r':
+                ring = 1;
+                break;
+            case 'f':
+            {
+                FILE *file = strcmp(optarg, "-") ? fopen(optarg, "r") : stdin;
+                
+                if (!file)
+                {
+                    fprintf(stderr, "cannot open %s\n", optarg);
+                    return 1;
+                }
+                
+                int ok = run_script(file, optarg);
+                
+                if (file != stdin)
+                    fclose(file);
+                
+                return ok ? 0 : 1;
+            }
+            case 'n':
+                repeat = strtol(optarg, NULL, 0);
+                ring = 1;
+                
+                if (repeat < 1 || repeat > 0x7fffffff / kClientMaxVerbs)
+                {
+                    fprintf(stderr, "invalid repeat count %s\n", optarg);
+                    return 1;
+                }
+                break;
             default:
                 usage();
                 return 1;
         }
     }
     
-    if (argc - optind < 3)
+    int count = (argc - optind) / 3;
+    
+    if (!count || (argc - optind) % 3 || count > kClientMaxVerbs)
     {
         usage();
         return 1;
     }
     
-    p = argv + optind;
-    nid = strtol(*p, NULL, 0);
-    if (nid < 0 || nid > 0xff) {
-        fprintf(stderr, "invalid nid %s\n", *p);
-        return 1;
-    }
+    UInt32 command;
     
-    p++;
-    if (!isdigit(**p))
+    if (count == 1 && !ring)
     {
-        strtoupper(*p);
-        verb = lookup_str(hda_verbs, *p);
-        
-        if (verb < 0)
+        if (!parse_verb(argv + optind, &command))
             return 1;
-    }
-    else
-    {
-        verb = strtol(*p, NULL, 0);
         
-        if (verb < 0 || verb > 0xfff)
-        {
-            fprintf(stderr, "invalid verb %s\n", *p);
-            return 1;
-        }
+        // Execute command
+        printf("command 0x%08x --> result = 0x%08x\n", command, execute_command(command));
+        return 0;
     }
     
-    p++;
-    if (!isdigit(**p))
-    {
-        strtoupper(*p);
-        param = lookup_str(hda_params, *p);
-        if (param < 0)
-            return 1;
-    }
-    else
-    {
-        param = strtol(*p, NULL, 0);
-        
-        if (param < 0 || param > 0xffff)
-        {
-            fprintf(stderr, "invalid param %s\n", *p);
-            return 1;
-        }
-    }
+    UInt32* commands = malloc(count * sizeof(UInt32));
+    CodecCommanderVerbResult* results = malloc(count * sizeof(CodecCommanderVerbResult));
+    int ok = commands && results;
     
-    printf("nid = 0x%lx, verb = 0x%lx, param = 0x%lx\n",
-            nid, verb, param);
+    for (int i = 0; ok && i < count; i++)
+        ok = parse_verb(argv + optind + 3 * i, &commands[i]);
     
-    UInt32 command = (UInt32)HDA_VERB(nid, verb, param);
+    // Execute all commands in a single call, or stream them through the rings
+    if (ok)
+        ok = ring ? execute_ring(commands, count, repeat, results) : execute_commands(commands, count, results);
     
-    // Execute command
-    printf("command 0x%08x --> result = 0x%08x\n", command, execute_command(command, 0x10ec0668, 0x0, 0x01));
-    return 0;
+    for (int i = 0; ok && i < count; i++)
+        printf("command 0x%08x --> result = 0x%08x\n", commands[i], results[i].Response);
+    
+    free(commands);
+    free(results);
+    return ok ? 0 : 1;
 }
@@ -0,0 +1,323 @@
+/*
+ *  Released under "The GNU General Public License (GPL-2.0)"
+ *
+ *  This program is free software; you can redistribute it and/or modify it
+ *  under the terms of the GNU General Public License as published by the
+ *  Free Software Foundation; either version 2 of the License, or (at your
+ *  option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ *  or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ *  for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ *
+ */
+
+/*
+ * Transitions are delimited by the begin/end markers the kext records around
+ * init, sleep and wake. Only verbs of the power and custom command lanes count
+ * towards a transition, hda-verb traffic (and codec dumps) in between is left out.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "tracefile.h"
+
+static const char *trace_lanes[] = { "power", "custom", "client", "diag" };
+static const char *trace_transports[] = { "pio", "dma", "cache", "-" };
+static const char *trace_status[] = { "ok", "timeout", "skipped", "marker" };
+static const char *trace_transitions[] = { "Sleep", "Wake", "Init" };
+
+#define TRACE_NAME(tbl, i)  ((i) < sizeof(tbl) / sizeof(tbl[0]) ? tbl[i] : "?")
+#define TRANSITION_TYPES    (sizeof(trace_transitions) / sizeof(trace_transitions[0]))
+
+typedef struct
+{
+    UInt32 Transition;
+    UInt64 Start;
+    UInt64 Wall;
+    UInt64 Link;        /* sum of verb latencies */
+    UInt32 Verbs;       /* sent to the codec */
+    UInt32 Cached;
+    UInt32 Skipped;
+    UInt32 Timeouts;
+} trace_transition;
+
+typedef struct
+{
+    UInt32 Count;
+    UInt64 Wall, Link, Verbs;
+    UInt64 Median, Max;     /* wall */
+} trace_summary;
+
+void print_trace(FILE *out, const CodecCommanderTraceRecord *records, size_t count)
+{
+    for (size_t i = 0; i < count; i++)
+    {
+        const CodecCommanderTraceRecord *r = &records[i];
+        unsigned long long seconds = r->Timestamp / 1000000, us = r->Timestamp % 1000000;
+        
+        if (r->Status == kTraceStatusMarker)
+        {
+            fprintf(out, "%12llu.%06llu ---- %s %s\n", seconds, us, TRACE_NAME(trace_transitions, r->Response),
+                    r->Command == kTraceMarkerBegin ? "begin" : "end");
+            continue;
+        }
+        
+        UInt32 verb = r->Command >> 8 & 0xfff, param = r->Command & 0xff;
+        
+        // 4-bit verbs carry a 16-bit payload
+        if ((verb & 0xf00) != 0xf00 && (verb & 0xf00) != 0x700)
+        {
+            verb >>= 8;
+            param = r->Command & 0xffff;
+        }
+        
+        fprintf(out, "%12llu.%06llu %-6s %-5s nid 0x%02x verb 0x%03x param 0x%04x --> 0x%08x %6u us %s\n",
+                seconds, us, TRACE_NAME(trace_lanes, r->Lane), TRACE_NAME(trace_transports, r->Transport),
+                r->Command >> 20 & 0xff, verb, param, r->Response, r->Latency, TRACE_NAME(trace_status, r->Status));
+    }
+}
+
+int write_trace_header(FILE *file, UInt64 count, UInt32 lost)
+{
+    CodecCommanderTraceFile header = { kTraceFileMagic, kTraceFileVersion, sizeof(CodecCommanderTraceRecord), lost, count };
+    
+    return !fseek(file, 0, SEEK_SET) && fwrite(&header, sizeof(header), 1, file) == 1;
+}
+
+CodecCommanderTraceRecord *read_trace_file(const char *name, size_t *count, UInt32 *lost)
+{
+    CodecCommanderTraceFile header;
+    CodecCommanderTraceRecord *records = NULL;
+    FILE *file = fopen(name, "rb");
+    
+    if (!file)
+    {
+        fprintf(stderr, "cannot open %s\n", name);
+        return NULL;
+    }
+    
+    if (fread(&header, sizeof(header), 1, file) != 1 || header.Magic != kTraceFileMagic ||
+        header.Version != kTraceFileVersion || header.RecordSize != sizeof(CodecCommanderTraceRecord))
+        fprintf(stderr, "%s is not a trace file\n", name);
+    else if (!(records = malloc(header.Count ? header.Count * sizeof(CodecCommanderTraceRecord) : 1)) ||
+             fread(records, sizeof(CodecCommanderTraceRecord), header.Count, file) != header.Count)
+    {
+        fprintf(stderr, "%s is truncated\n", name);
+        free(records);
+        records = NULL;
+    }
+    else
+    {
+        *count = header.Count;
+        *lost = header.Lost;
+    }
+    
+    fclose(file);
+    return records;
+}
+
+/* split into transitions, returns how many were complete */
+static size_t collect_transitions(const CodecCommanderTraceRecord *records, size_t count, trace_transition *transitions)
+{
+    trace_transition *current = NULL;
+    size_t found = 0;
+    
+    for (size_t i = 0; i < count; i++)
+    {
+        const CodecCommanderTraceRecord *r = &records[i];
+        
+        if (r->Status == kTraceStatusMarker)
+        {
+            if (r->Command == kTraceMarkerBegin)
+            {
+                // an unterminated transition (records lost) is dropped
+                current = &transitions[found];
+                memset(current, 0, sizeof(*current));
+                current->Transition = r->Response;
+                current->Start = r->Timestamp;
+            }
+            else if (current && current->Transition == r->Response)
+            {
+                current->Wall = r->Timestamp - current->Start;
+                current = NULL;
+                found++;
+            }
+            continue;
+        }
+        
+        if (!current || r->Lane == kTraceLaneClient || r->Lane == kTraceLaneDiagnostic)
+            continue;
+        
+        switch (r->Transport)
+        {
+            case kTraceTransportCache:
+                current->Cached++;
+                break;
+            case kTraceTransportNone:
+                current->Skipped++;
+                break;
+            default:
+                current->Verbs++;
+                current->Link += r->Latency;
+                if (r->Status == kTraceStatusTimeout)
+                    current->Timeouts++;
+                break;
+        }
+    }
+    
+    return found;
+}
+
+static trace_transition *load_transitions(const CodecCommanderTraceRecord *records, size_t count, size_t *found)
+{
+    // markers come in pairs, so there are never more transitions than half the records
+    trace_transition *transitions = malloc((count / 2 + 1) * sizeof(trace_transition));
+    
+    *found = transitions ? collect_transitions(records, count, transitions) : 0;
+    return transitions;
+}
+
+static int compare_wall(const void *a, const void *b)
+{
+    UInt64 x = *(const UInt64 *)a, y = *(const UInt64 *)b;
+    
+    return x < y ? -1 : x > y;
+}
+
+static void summarize(const trace_transition *transitions, size_t count, trace_summary *summary)
+{
+    UInt64 *walls = malloc((count + 1) * sizeof(UInt64));
+    
+    memset(summary, 0, TRANSITION_TYPES * sizeof(trace_summary));
+    
+    for (size_t type = 0; type < TRANSITION_TYPES; type++)
+    {
+        trace_summary *s = &summary[type];
+        
+        for (size_t i = 0; i < count; i++)
+        {
+            if (transitions[i].Transition != type)
+                continue;
+            
+            if (walls)
+                walls[s->Count] = transitions[i].Wall;
+            s->Count++;
+            s->Wall += transitions[i].Wall;
+            s->Link += transitions[i].Link;
+            s->Verbs += transitions[i].Verbs;
+        }
+        
+        // spread of the wall time, one slow wake hides in an average
+        if (walls && s->Count)
+        {
+            qsort(walls, s->Count, sizeof(UInt64), compare_wall);
+            s->Median = walls[s->Count / 2];
+            s->Max = walls[s->Count - 1];
+        }
+    }
+    
+    free(walls);
+}
+
+/* true if the average exceeds the baseline average by more than threshold percent */
+static int regressed(UInt64 value, UInt64 base, int threshold)
+{
+    return threshold >= 0 && value * 100 > base * (100 + threshold);
+}
+
+int report_trace(FILE *out, const CodecCommanderTraceRecord *records, size_t count,
+                 const CodecCommanderTraceRecord *baseline, size_t baselineCount, int threshold)
+{
+    size_t found = 0, baseFound = 0;
+    trace_transition *transitions = load_transitions(records, count, &found);
+    trace_transition *baseTransitions = load_transitions(baseline, baseline ? baselineCount : 0, &baseFound);
+    trace_summary summary[TRANSITION_TYPES], baseSummary[TRANSITION_TYPES];
+    int regressions = 0;
+    
+    if (!transitions || !baseTransitions)
+    {
+        free(transitions);
+        free(baseTransitions);
+        return -1;
+    }
+    
+    fprintf(out, "transition              start  verbs cached skipped timeouts    link us    wall us\n");
+    for (size_t i = 0; i < found; i++)
+    {
+        const trace_transition *t = &transitions[i];
+        
+        fprintf(out, "%-10s %12llu.%03llu %6u %6u %7u %8u %10llu %10llu\n", TRACE_NAME(trace_transitions, t->Transition),
+                (unsigned long long)(t->Start / 1000000), (unsigned long long)(t->Start % 1000000 / 1000),
+                t->Verbs, t->Cached, t->Skipped, t->Timeouts, (unsigned long long)t->Link, (unsigned long long)t->Wall);
+    }
+    
+    summarize(transitions, found, summary);
+    summarize(baseTransitions, baseFound, baseSummary);
+    
+    fprintf(out, "\naverage    count  verbs    link us    wall us  median us     max us%s\n", baseline ? "   (vs baseline)" : "");
+    for (size_t type = 0; type < TRANSITION_TYPES; type++)
+    {
+        const trace_summary *s = &summary[type], *b = &baseSummary[type];
+        
+        if (!s->Count)
+            continue;
+        
+        UInt64 verbs = s->Verbs / s->Count, link = s->Link / s->Count, wall = s->Wall / s->Count;
+        
+        fprintf(out, "%-10s %5u %6llu %10llu %10llu %10llu %10llu", trace_transitions[type], s->Count,
+                (unsigned long long)verbs, (unsigned long long)link, (unsigned long long)wall,
+                (unsigned long long)s->Median, (unsigned long long)s->Max);
+        
+        // flag what a change added to each transition
+        if (b->Count)
+        {
+            UInt64 baseVerbs = b->Verbs / b->Count, baseLink = b->Link / b->Count, baseWall = b->Wall / b->Count;
+            
+            fprintf(out, "   verbs %+lld link %+lld us wall %+lld us", (long long)verbs - (long long)baseVerbs,
+                    (long long)link - (long long)baseLink, (long long)wall - (long long)baseWall);
+            
+            // any added verb counts, times only beyond the threshold as they vary between runs
+            if (threshold >= 0 && (verbs > baseVerbs || regressed(link, baseLink, threshold) || regressed(wall, baseWall, threshold)))
+            {
+                fprintf(out, "   REGRESSION");
+                regressions++;
+            }
+        }
+        else if (baseline)
+            fprintf(out, "   not in baseline");
+        
+        fprintf(out, "\n");
+    }
+    
+    free(transitions);
+    free(baseTransitions);
+    return regressions;
+}
+
+int write_transitions_csv(FILE *out, const CodecCommanderTraceRecord *records, size_t count)
+{
+    size_t found = 0;
+    trace_transition *transitions = load_transitions(records, count, &found);
+    
+    if (!transitions)
+        return 0;
+    
+    fprintf(out, "transition,start_us,verbs,cached,skipped,timeouts,link_us,wall_us\n");
+    for (size_t i = 0; i < found; i++)
+    {
+        const trace_transition *t = &transitions[i];
+        
+        fprintf(out, "%s,%llu,%u,%u,%u,%u,%llu,%llu\n", TRACE_NAME(trace_transitions, t->Transition),
+                (unsigned long long)t->Start, t->Verbs, t->Cached, t->Skipped, t->Timeouts,
+                (unsigned long long)t->Link, (unsigned long long)t->Wall);
+    }
+    
+    free(transitions);
+    return 1;
+}
@@ -0,0 +1,66 @@
+/*
+ *  Released under "The GNU General Public License (GPL-2.0)"
+ *
+ *  This program is free software; you can redistribute it and/or modify it
+ *  under the terms of the GNU General Public License as published by the
+ *  Free Software Foundation; either version 2 of the License, or (at your
+ *  option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ *  or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ *  for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ *
+ */
+
+#ifndef CodecCommanderClient_tracefile_h
+#define CodecCommanderClient_tracefile_h
+
+#include <stdio.h>
+#include <IOKit/IOKitLib.h>
+#include "../CodecCommander/ClientInterface.h"
+
+/*
+ * Trace file: this header followed by Count CodecCommanderTraceRecords as drained
+ * from the kext, in host byte order.
+ */
+#define kTraceFileMagic     0x52544343  /* "CCTR" */
+#define kTraceFileVersion   1
+
+/* percent a transition may take longer than in the baseline before a report fails */
+#define kTraceDefaultThreshold  10
+
+typedef struct
+{
+    UInt32 Magic;
+    UInt32 Version;
+    UInt32 RecordSize;  /* sizeof(CodecCommanderTraceRecord) */
+    UInt32 Lost;        /* records overwritten in the kext before they were drained */
+    UInt64 Count;
+} CodecCommanderTraceFile;
+
+/* decode records one per line */
+void print_trace(FILE *out, const CodecCommanderTraceRecord *records, size_t count);
+
+/* (re)write the header at the start of file */
+int write_trace_header(FILE *file, UInt64 count, UInt32 lost);
+
+/* load a whole trace file (caller frees), NULL if it is not one */
+CodecCommanderTraceRecord *read_trace_file(const char *name, size_t *count, UInt32 *lost);
+
+/*
+ * verbs, link time and wall time of every transition, compared with a baseline trace if given.
+ * Returns the number of transition types that send more verbs or take more than threshold
+ * percent longer than in the baseline (threshold < 0 disables the check), -1 if out of memory.
+ */
+int report_trace(FILE *out, const CodecCommanderTraceRecord *records, size_t count,
+                 const CodecCommanderTraceRecord *baseline, size_t baselineCount, int threshold);
+
+/* one comma separated line per transition for scripts and spreadsheets */
+int write_transitions_csv(FILE *out, const CodecCommanderTraceRecord *records, size_t count);
+
+#endif
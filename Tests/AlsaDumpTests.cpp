@@ -0,0 +1,495 @@
+/*
+ *  Released under "The GNU General Public License (GPL-2.0)"
+ *
+ *  This program is free software; you can redistribute it and/or modify it
+ *  under the terms of the GNU General Public License as published by the
+ *  Free Software Foundation; either version 2 of the License, or (at your
+ *  option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ *  or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ *  for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ *
+ */
+
+#include "Harness.h"
+#include "FakeDriver.h"
+#include "AlsaDump.h"
+#include <chrono>
+#include <mutex>
+#include <string>
+
+extern "C" {
+#include "codecdump.h"
+}
+
+#define DATA(file) HOST_SOURCE_DIR "/Tests/Data/" file
+
+static const char* kDumps[] =
+{
+	"ALC269.txt", "ALC269VB-1028_04d9.txt", "ALC283.txt", "ALC292.txt",
+	"ALC668.txt", "ALC892-1458_a002.txt", "ALC1150.txt",
+};
+
+static bool readFile(const char* path, std::string* text)
+{
+	FILE* file = fopen(path, "r");
+	if (!file)
+		return false;
+
+	char buffer[16384];
+	size_t length;
+	while ((length = fread(buffer, 1, sizeof(buffer), file)) > 0)
+		text->append(buffer, length);
+	fclose(file);
+	return true;
+}
+
+static FakeCodec* parseText(const char* text, size_t length, size_t piece)
+{
+	AlsaDumpParser parser;
+	for (size_t offset = 0; offset < length; offset += piece)
+		parser.parse(text + offset, length - offset < piece ? length - offset : piece);
+	return parser.finish();
+}
+
+// Connection list as the codec expands it, ranges resolved
+static std::vector<UInt16> expandConnections(const FakeWidget& widget)
+{
+	UInt16 rangeFlag = widget.LongForm ? 0x8000 : 0x80;
+	std::vector<UInt16> expanded;
+
+	for (size_t i = 0; i < widget.Connections.size(); i++)
+	{
+		UInt16 entry = widget.Connections[i];
+		if ((entry & rangeFlag) && !expanded.empty())
+		{
+			for (UInt16 node = expanded.back() + 1; node <= (entry & ~rangeFlag); node++)
+				expanded.push_back(node);
+		}
+		else
+			expanded.push_back(entry & ~rangeFlag);
+	}
+	return expanded;
+}
+
+// Everything a dump carries of a node: parameters, verb state and connections. A gap in the
+// node range answers like a node without capabilities, which is how dumps list it.
+static void expectSameWidget(UInt8 node, FakeWidget* expected, FakeWidget* actual)
+{
+	static FakeWidget none = FakeWidget();
+	if (!expected)
+		expected = &none;
+	if (!actual)
+		actual = &none;
+
+	for (int parameter = 0; parameter < kFakeParamCount; parameter++)
+		if (expected->Params[parameter] != actual->Params[parameter])
+			EXPECT_EQ(node << 8 | parameter, 0);
+	EXPECT_EQ(expected->ConfigDefault, actual->ConfigDefault);
+	EXPECT_TRUE(expandConnections(*expected) == expandConnections(*actual));
+
+	const FakeWidgetState& state = expected->State;
+	EXPECT_EQ(state.PowerState, actual->State.PowerState);
+	EXPECT_EQ(state.PinControl, actual->State.PinControl);
+	EXPECT_EQ(state.Eapd, actual->State.Eapd);
+	EXPECT_EQ(state.Unsolicited, actual->State.Unsolicited);
+	EXPECT_EQ(state.ConnectionSelect, actual->State.ConnectionSelect);
+	EXPECT_EQ(state.AmpOut[0], actual->State.AmpOut[0]);
+	EXPECT_EQ(state.AmpOut[1], actual->State.AmpOut[1]);
+	for (int index = 0; index < 16; index++)
+	{
+		EXPECT_EQ(state.AmpIn[index][0], actual->State.AmpIn[index][0]);
+		EXPECT_EQ(state.AmpIn[index][1], actual->State.AmpIn[index][1]);
+	}
+}
+
+static void expectSameCodec(FakeCodec* expected, FakeCodec* actual)
+{
+	EXPECT_EQ(expected->getVendorId(), actual->getVendorId());
+	EXPECT_EQ(expected->getSubsystemId(), actual->getSubsystemId());
+	EXPECT_EQ(expected->getRevisionId(), actual->getRevisionId());
+	for (int node = 1; node < 256; node++)
+		expectSameWidget(node, expected->getWidget(node), actual->getWidget(node));
+}
+
+// Parsing
+
+TEST(ParsesCodecAndWidgets)
+{
+	FakeCodec* codec = AlsaDumpParser::parseFile(DATA("ALC283.txt"));
+	ASSERT_TRUE(codec != NULL);
+
+	EXPECT_EQ(0x10ec0283, codec->getVendorId());
+	EXPECT_EQ(0x1028062c, codec->getSubsystemId());
+	EXPECT_EQ(0x100003, codec->getRevisionId());
+
+	// function group: type with unsolicited, default PCM, power states, GPIO
+	FakeWidget* group = codec->getFunctionGroup();
+	EXPECT_EQ(0x101, group->Params[0x05]);
+	EXPECT_EQ(0x000e0560, group->Params[0x0A]);
+	EXPECT_EQ(0x1, group->Params[0x0B]);
+	EXPECT_EQ(0xe000001f, group->Params[0x0F]);
+	EXPECT_EQ(0x40000002, group->Params[0x11]);
+
+	// converter with amp override, amp values are [left right]
+	FakeWidget* dac = codec->getWidget(0x02);
+	ASSERT_TRUE(dac != NULL);
+	EXPECT_EQ(0x41d, dac->Params[0x09]);
+	EXPECT_EQ(0x00025757, dac->Params[0x12]);
+	EXPECT_EQ(0x00060, dac->Params[0x0A] & 0xFFFF);
+	EXPECT_EQ(0x57, dac->State.AmpOut[1]);
+	EXPECT_EQ(0x50, dac->State.AmpOut[0]);
+	EXPECT_TRUE(codec->getWidget(0x04) == NULL);
+
+	// speaker: pin caps, EAPD, config default; the In-driver list is not a second list
+	FakeWidget* speaker = codec->getWidget(0x14);
+	ASSERT_TRUE(speaker != NULL);
+	EXPECT_EQ(0x00010014, speaker->Params[0x0C]);
+	EXPECT_EQ(0x02, speaker->State.Eapd);
+	EXPECT_EQ(0x90170110, speaker->ConfigDefault);
+	EXPECT_EQ(0x40, speaker->State.PinControl);
+	EXPECT_EQ(2, speaker->Connections.size());
+	EXPECT_EQ(0x0c, speaker->Connections[0]);
+
+	// headphone: selected input and unsolicited tag
+	FakeWidget* headphone = codec->getWidget(0x21);
+	ASSERT_TRUE(headphone != NULL);
+	EXPECT_EQ(1, headphone->State.ConnectionSelect);
+	EXPECT_EQ(0x80 | 0x21, headphone->State.Unsolicited);
+	EXPECT_EQ(0xc0, headphone->State.PinControl);
+
+	FakeWidget* mixer = codec->getWidget(0x0b);
+	ASSERT_TRUE(mixer != NULL);
+	EXPECT_EQ(5, mixer->Connections.size());
+	EXPECT_EQ(0x80, mixer->State.AmpIn[4][0]);
+	EXPECT_EQ(0x80, mixer->State.AmpIn[4][1]);
+	EXPECT_FALSE(mixer->LongForm);
+
+	// Realtek vendor widget: processing caps and the coefficient at the current index
+	FakeWidget* vendor = codec->getWidget(0x20);
+	ASSERT_TRUE(vendor != NULL);
+	EXPECT_EQ(0x1700, vendor->Params[0x10]);
+	EXPECT_EQ(0x1a, vendor->State.CoefIndex);
+	ASSERT_TRUE(vendor->Coefficients.size() > 0x1a);
+	EXPECT_EQ(0x8000, vendor->Coefficients[0x1a]);
+
+	// the model answers as the codec would
+	UInt32 response = 0;
+	EXPECT_TRUE(codec->execute(HDA_COMMAND(0x0b, HDA_VERB_GET_PARAM, HDA_PARM_CONNLIST_LEN), 0, &response));
+	EXPECT_EQ(5, response);
+	EXPECT_TRUE(codec->execute(HDA_COMMAND(0x14, HDA_VERB_GET_CONFIG_DEFAULT, HDA_PARM_NULL), 0, &response));
+	EXPECT_EQ(0x90170110, response);
+	EXPECT_TRUE(codec->execute(HDA_COMMAND(0x01, HDA_VERB_GET_SUBSYSTEM_ID, HDA_PARM_NULL), 0, &response));
+	EXPECT_EQ(0x1028062c, response);
+
+	delete codec;
+}
+
+TEST(PiecesOfAnySizeGiveTheSameModel)
+{
+	std::string text;
+	ASSERT_TRUE(readFile(DATA("ALC1150.txt"), &text));
+
+	FakeCodec* whole = parseText(text.data(), text.size(), text.size());
+	ASSERT_TRUE(whole != NULL);
+
+	// lines split anywhere, also within numbers and between \r and \n
+	std::string crlf;
+	for (size_t i = 0; i < text.size(); i++)
+		crlf += text[i] == '\n' ? "\r\n" : std::string(1, text[i]);
+
+	static const size_t pieces[] = { 1, 2, 3, 7, 64, 4093 };
+	for (size_t i = 0; i < sizeof(pieces) / sizeof(pieces[0]); i++)
+	{
+		FakeCodec* codec = parseText(text.data(), text.size(), pieces[i]);
+		ASSERT_TRUE(codec != NULL);
+		expectSameCodec(whole, codec);
+		delete codec;
+
+		codec = parseText(crlf.data(), crlf.size(), pieces[i]);
+		ASSERT_TRUE(codec != NULL);
+		expectSameCodec(whole, codec);
+		delete codec;
+	}
+
+	// no newline after the last line
+	FakeCodec* unterminated = parseText(text.data(), text.size() - 1, 5);
+	ASSERT_TRUE(unterminated != NULL);
+	expectSameCodec(whole, unterminated);
+	delete unterminated;
+
+	delete whole;
+}
+
+TEST(OnlyTheFirstCodecOfAMultiCodecDump)
+{
+	std::string text, hdmi = "Codec: Intel Haswell HDMI\nAddress: 3\nAFG Function Id: 0x1 (unsol 0)\n"
+		"Vendor Id: 0x80862807\nSubsystem Id: 0x80860101\nState of AFG node 0x01:\n"
+		"Node 0x05 [Pin Complex] wcaps 0x40778d: 8-Channels Digital Amp-Out CP\n";
+	ASSERT_TRUE(readFile(DATA("ALC269.txt"), &text));
+
+	FakeCodec* codec = parseText((text + hdmi).data(), text.size() + hdmi.size(), 4096);
+	ASSERT_TRUE(codec != NULL);
+	EXPECT_EQ(0x10ec0269, codec->getVendorId());
+	EXPECT_EQ(0x411111f0, codec->getWidget(0x1b)->ConfigDefault);
+	EXPECT_TRUE(codec->getWidget(0x05) == NULL);
+	delete codec;
+}
+
+TEST(NotADumpGivesNoModel)
+{
+	static const char* texts[] =
+	{
+		"",
+		"lspci output\nwithout any codec\n",
+		// a codec whose audio function group is not at node 0x01
+		"Codec: Generic\nVendor Id: 0x11d41984\nState of AFG node 0x02:\nNode 0x03 [Audio Output] wcaps 0x41d: Stereo\n",
+		// a function group without the codec's vendor
+		"State of AFG node 0x01:\nNode 0x02 [Audio Output] wcaps 0x41d: Stereo\n",
+	};
+
+	for (size_t i = 0; i < sizeof(texts) / sizeof(texts[0]); i++)
+		EXPECT_TRUE(parseText(texts[i], strlen(texts[i]), 16) == NULL);
+	EXPECT_TRUE(AlsaDumpParser::parseFile(DATA("missing.txt")) == NULL);
+}
+
+TEST(RoundTripThroughCodecDump)
+{
+	Driver driver(createProfile(true));
+	ASSERT_TRUE(driver.Started);
+
+	// a few values that differ from their neighbours
+	driver.Codec->getWidget(0x02)->State.AmpOut[1] = 0x57;
+	driver.Codec->getWidget(0x02)->State.AmpOut[0] = 0x2a;
+	driver.Codec->getWidget(0x0b)->State.AmpIn[3][1] = 0x80;
+	driver.Codec->getWidget(0x15)->State.ConnectionSelect = 1;
+
+	// kext snapshot, printed like /proc/asound by hda-verb, parsed back
+	size_t size = sizeof(CodecCommanderDump) + kClientDumpMaxNodes * sizeof(CodecCommanderDumpNode);
+	CodecCommanderDump* dump = (CodecCommanderDump*)malloc(size);
+	ASSERT_TRUE(driver.Commander->dumpCodec(dump, size) > 0);
+
+	char* text = NULL;
+	size_t length = 0;
+	FILE* out = open_memstream(&text, &length);
+	print_codec_dump(out, dump);
+	fclose(out);
+	free(dump);
+
+	FakeCodec* codec = parseText(text, length, 512);
+	free(text);
+	ASSERT_TRUE(codec != NULL);
+	expectSameCodec(driver.Codec, codec);
+	delete codec;
+}
+
+// Shipped profiles
+
+// Codec Profile of the CodecCommander personality in the kext's Info.plist
+static OSDictionary* loadCodecProfiles()
+{
+	std::string text;
+	if (!readFile(HOST_SOURCE_DIR "/CodecCommander/CodecCommander-Info.plist", &text))
+		return NULL;
+
+	OSDictionary* plist = OSDynamicCast(OSDictionary, OSUnserializeXML(text.c_str()));
+	if (!plist)
+		return NULL;
+
+	OSDictionary* personalities = OSDynamicCast(OSDictionary, plist->getObject("IOKitPersonalities"));
+	OSDictionary* personality = personalities ? OSDynamicCast(OSDictionary, personalities->getObject("CodecCommander")) : NULL;
+	OSDictionary* profiles = personality ? OSDynamicCast(OSDictionary, personality->getObject(kCodecProfile)) : NULL;
+	if (profiles)
+		profiles->retain();
+	plist->release();
+	return profiles;
+}
+
+struct VerbLog
+{
+	std::mutex Lock;
+	std::vector<UInt32> Verbs;
+
+	static void hook(void* context, UInt32 command)
+	{
+		VerbLog* log = (VerbLog*)context;
+		std::lock_guard<std::mutex> guard(log->Lock);
+		log->Verbs.push_back(command & 0x0FFFFFFF);
+	}
+
+	// verbs since position, with the verb (and payload) bits of pattern under mask
+	int count(size_t position, UInt32 pattern, UInt32 mask = 0x0FFFFFFF)
+	{
+		std::lock_guard<std::mutex> guard(Lock);
+		int found = 0;
+		for (size_t i = position; i < Verbs.size(); i++)
+			if ((Verbs[i] & mask) == pattern)
+				found++;
+		return found;
+	}
+
+	size_t position()
+	{
+		std::lock_guard<std::mutex> guard(Lock);
+		return Verbs.size();
+	}
+};
+
+// What the profile of each dumped codec family does at wake and sleep
+struct ProfileCase
+{
+	const char* Dump;
+	UInt32 Wake[2];
+	UInt32 Sleep[1];
+	bool UpdateNodes;
+	bool SleepNodes;
+};
+
+static const ProfileCase kProfileCases[] =
+{
+	{ "ALC269.txt", { 0x01570883 }, { }, true, true },
+	{ "ALC269VB-1028_04d9.txt", { 0x02170883 }, { }, true, false },
+	{ "ALC283.txt", { 0x01970725, 0x02170883 }, { }, true, false },
+	{ "ALC292.txt", { 0x01a70724 }, { }, true, true },
+	{ "ALC668.txt", { 0x01570883, 0x01b70720 }, { }, true, true },
+	{ "ALC892-1458_a002.txt", { }, { }, false, false },
+	{ "ALC1150.txt", { 0x02050007, 0x02047cb0 }, { 0x02050007 }, false, false },
+};
+
+static void expectCommands(VerbLog* log, size_t position, const UInt32* commands, int count)
+{
+	for (int i = 0; i < count; i++)
+		if (commands[i])
+			EXPECT_EQ(commands[i], log->count(position, commands[i]) ? commands[i] : 0);
+}
+
+// Pins with EAPD in their pin caps, those at value unless it is -1
+static int countEAPD(FakeCodec* codec, int value = -1)
+{
+	int pins = 0;
+	for (int node = 2; node < 256; node++)
+	{
+		FakeWidget* widget = codec->getWidget(node);
+		if (widget && HDA_PINCAP_IS_EAPD_CAPABLE(widget->Params[0x0C]) && (value < 0 || widget->State.Eapd == value))
+			pins++;
+	}
+	return pins;
+}
+
+// CodecCommander's own power state and the power hook, both change with the system
+static void setPowerState(Driver* driver, unsigned long state)
+{
+	driver->Commander->setPowerState(state, driver->Commander);
+	EXPECT_TRUE(hostWaitIdle());
+	driver->Commander->setPowerStateExternal(state, driver->Commander);
+	EXPECT_TRUE(hostWaitIdle());
+}
+
+TEST(ShippedProfilesOnDumpedCodecs)
+{
+	for (size_t i = 0; i < sizeof(kProfileCases) / sizeof(kProfileCases[0]); i++)
+	{
+		const ProfileCase& test = kProfileCases[i];
+		std::string path = std::string(HOST_SOURCE_DIR "/Tests/Data/") + test.Dump;
+		fprintf(stderr, "  %s\n", test.Dump);
+
+		FakeCodec* codec = AlsaDumpParser::parseFile(path.c_str());
+		ASSERT_TRUE(codec != NULL);
+		OSDictionary* profiles = loadCodecProfiles();
+		ASSERT_TRUE(profiles != NULL);
+
+		int eapdPins = countEAPD(codec);
+		EXPECT_TRUE(eapdPins > 0);
+
+		VerbLog log;
+		{
+			Driver driver(codec, profiles);
+			ASSERT_TRUE(driver.Started);
+			driver.HDA->setVerbHook(VerbLog::hook, &log);
+
+			// wake
+			size_t position = log.position();
+			setPowerState(&driver, kPowerStateNormal);
+			expectCommands(&log, position, test.Wake, 2);
+			EXPECT_EQ(test.UpdateNodes ? eapdPins : 0, log.count(position, 0x0070C02, 0x000FFFFF));
+			if (test.UpdateNodes)
+				EXPECT_EQ(eapdPins, countEAPD(codec, 0x02));
+
+			// sleep
+			position = log.position();
+			setPowerState(&driver, kPowerStateSleep);
+			expectCommands(&log, position, test.Sleep, 1);
+			EXPECT_EQ(test.SleepNodes ? eapdPins : 0, log.count(position, 0x0070C00, 0x000FFFFF));
+			EXPECT_EQ(test.SleepNodes ? eapdPins : 0, countEAPD(codec, 0x00));
+
+			// and back
+			position = log.position();
+			setPowerState(&driver, kPowerStateNormal);
+			expectCommands(&log, position, test.Wake, 2);
+			EXPECT_EQ(test.UpdateNodes ? eapdPins : 0, log.count(position, 0x0070C02, 0x000FFFFF));
+
+			driver.HDA->setVerbHook(NULL, NULL);
+		}
+	}
+}
+
+TEST(InitCommandsReachTheDumpedCodec)
+{
+	OSDictionary* profiles = loadCodecProfiles();
+	ASSERT_TRUE(profiles != NULL);
+
+	// ALC283: pin control of 0x19 and the unsolicited tag of 0x21 come from the profile
+	Driver alc283(AlsaDumpParser::parseFile(DATA("ALC283.txt")), profiles);
+	ASSERT_TRUE(alc283.Started);
+	EXPECT_EQ(0x25, alc283.Codec->getWidget(0x19)->State.PinControl);
+
+	// ALC1150: processing coefficient 7 of the vendor widget
+	profiles = loadCodecProfiles();
+	ASSERT_TRUE(profiles != NULL);
+	Driver alc1150(AlsaDumpParser::parseFile(DATA("ALC1150.txt")), profiles);
+	ASSERT_TRUE(alc1150.Started);
+	FakeWidget* vendor = alc1150.Codec->getWidget(0x20);
+	ASSERT_TRUE(vendor->Coefficients.size() > 7);
+	EXPECT_EQ(0x7cb0, vendor->Coefficients[7]);
+	EXPECT_EQ(8, vendor->State.CoefIndex);
+}
+
+// Corpus
+
+TEST(ParsesCorpusQuickly)
+{
+	const int copies = 100;
+	std::vector<std::string> corpus;
+	for (size_t i = 0; i < sizeof(kDumps) / sizeof(kDumps[0]); i++)
+	{
+		std::string text;
+		ASSERT_TRUE(readFile((std::string(HOST_SOURCE_DIR "/Tests/Data/") + kDumps[i]).c_str(), &text));
+		corpus.push_back(text);
+	}
+
+	// wall clock, the shim's clock only moves when the kext waits
+	auto start = std::chrono::steady_clock::now();
+	size_t bytes = 0, nodes = 0;
+	for (int copy = 0; copy < copies; copy++)
+	{
+		for (size_t i = 0; i < corpus.size(); i++)
+		{
+			FakeCodec* codec = parseText(corpus[i].data(), corpus[i].size(), 16384);
+			ASSERT_TRUE(codec != NULL);
+			nodes += codec->getFunctionGroup()->Params[0x05] ? 1 : 0;
+			bytes += corpus[i].size();
+			delete codec;
+		}
+	}
+	double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+	fprintf(stderr, "  %zu dumps (%zu KB) in %.1f ms\n", nodes, bytes / 1024, seconds * 1000);
+	EXPECT_EQ(copies * corpus.size(), nodes);
+	EXPECT_TRUE(seconds < 1.0);
+}
@@ -0,0 +1,764 @@
+/*
+ *  Released under "The GNU General Public License (GPL-2.0)"
+ *
+ *  This program is free software; you can redistribute it and/or modify it
+ *  under the terms of the GNU General Public License as published by the
+ *  Free Software Foundation; either version 2 of the License, or (at your
+ *  option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ *  or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ *  for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ *
+ */
+
+// Benchmarks of the command path, profile parsing and power transitions on the fake
+// controller. Verbs and link time (the shim's virtual clock) are the same on every host,
+// wall time is this machine's. Batches (SendCommands<size>) give the time per verb, to
+// hold against the single verbs of SendCommand. Results are written as CSV; against a baseline file of the
+// same format a benchmark fails when it sends more verbs or takes longer than the threshold.
+//
+//	Benchmarks [-o results.csv] [-b baseline.csv] [-t percent] [filter]
+
+#include "FakeDriver.h"
+#include <algorithm>
+#include <chrono>
+#include <string>
+#include <vector>
+#include <sched.h>
+#include <unistd.h>
+
+// percent a benchmark may take longer than in the baseline, as hda-verb trace report
+#define kBenchmarkThreshold		10
+
+#define kCommandRuns			2000
+#define kBatchRuns				200
+#define kConfigurationRuns		2000
+#define kTransitionRuns			20
+#define kCustomCommandCount		64
+#define kClientRuns				5
+#define kClientVerbs			4096	// per run, four ring fills
+#define kClientBatch			64
+
+// verbs per sendCommands, up to several DMA ring fills
+static const size_t kBatchSizes[] = { 8, 64, 512 };
+
+// link frames ICS stays busy after an immediate command
+static const UInt32 kBusyFrames[] = { 2, 10, 48 };
+
+static int sFailures;
+
+static void benchmarkFailed(const char* name, const char* what)
+{
+	fprintf(stderr, "%s: %s\n", name, what);
+	sFailures++;
+}
+
+// Percentiles of one benchmark, link time in microseconds and wall time in nanoseconds
+struct Result
+{
+	std::string Name;
+	UInt32 Runs;
+	UInt64 Verbs;				// per run
+	UInt64 Link[3];				// P50, P99, Max
+	UInt64 Wall[3];
+};
+
+// Times the runs of a benchmark in both clocks
+class Runs
+{
+	std::vector<UInt64> mLink, mWall;
+	UInt64 mVerbs = 0;
+	UInt64 mLinkStart = 0;
+	UInt32 mPer;
+	std::chrono::steady_clock::time_point mWallStart;
+
+	// upper end of the sample at percent, as LatencyHistogram counts
+	static void percentiles(std::vector<UInt64>* samples, UInt64* result)
+	{
+		std::sort(samples->begin(), samples->end());
+		size_t count = samples->size();
+		result[0] = count ? (*samples)[(count * 50 + 99) / 100 - 1] : 0;
+		result[1] = count ? (*samples)[(count * 99 + 99) / 100 - 1] : 0;
+		result[2] = count ? samples->back() : 0;
+	}
+
+public:
+	// times are divided by per, i.e. the verbs of a batch for the cost of each
+	Runs(UInt32 per = 1) : mPer(per) { }
+
+	void begin()
+	{
+		mLinkStart = hostGetTime();
+		mWallStart = std::chrono::steady_clock::now();
+	}
+
+	// link is the virtual time since begin unless given (i.e. one phase of the run)
+	void end(UInt64 verbs, UInt64 link = -1)
+	{
+		std::chrono::nanoseconds wall = std::chrono::steady_clock::now() - mWallStart;
+		mWall.push_back(wall.count() / mPer);
+		mLink.push_back((link != (UInt64)-1 ? link : hostGetTime() - mLinkStart) / mPer);
+		mVerbs += verbs;
+	}
+
+	Result finish(const char* name)
+	{
+		Result result;
+		result.Name = name;
+		result.Runs = (UInt32)mWall.size();
+		result.Verbs = result.Runs ? mVerbs / result.Runs : 0;
+		percentiles(&mLink, result.Link);
+		percentiles(&mWall, result.Wall);
+		return result;
+	}
+};
+
+// Number at a path of nested dictionaries in a property, 0 if there is none
+static UInt64 getNumber(IORegistryEntry* entry, const char* property, const char* key, const char* key2 = NULL,
+						const char* key3 = NULL)
+{
+	OSObject* object = entry->getProperty(property);
+	const char* keys[] = { key, key2, key3 };
+	for (int i = 0; i < 3 && keys[i]; i++)
+	{
+		OSDictionary* dict = OSDynamicCast(OSDictionary, object);
+		object = dict ? dict->getObject(keys[i]) : NULL;
+	}
+	OSNumber* number = OSDynamicCast(OSNumber, object);
+	return number ? number->unsigned64BitValue() : 0;
+}
+
+// Time of a phase in the last transition CodecCommander published
+static UInt64 getLastPhase(CodecCommander* commander, const char* phase)
+{
+	OSDictionary* profile = OSDynamicCast(OSDictionary, commander->getProperty("Transition Profile"));
+	OSArray* recent = profile ? OSDynamicCast(OSArray, profile->getObject("Recent")) : NULL;
+	OSDictionary* last = recent && recent->getCount() ? OSDynamicCast(OSDictionary, recent->getObject(0)) : NULL;
+	OSNumber* number = last ? OSDynamicCast(OSNumber, last->getObject(phase)) : NULL;
+	return number ? number->unsigned64BitValue() : 0;
+}
+
+static void setNumber(OSDictionary* dict, const char* key, UInt32 value)
+{
+	OSNumber* number = OSNumber::withNumber(value, 32);
+	dict->setObject(key, number);
+	number->release();
+}
+
+// Command path
+
+// frames: how long ICS stays busy after an immediate command
+static void sendCommand(HDACommandMode mode, const char* name, std::vector<Result>* results, UInt32 frames = 1)
+{
+	FakeCodec* codec = FakeCodec::createALC269();
+	FakeHDA* hda = new FakeHDA(codec);
+	IntelHDA* engine = new IntelHDA(hda->getCodecNub(), mode);
+
+	if (engine->initialize() && engine->getCommandMode() == mode)
+	{
+		hda->setImmediateFrames(frames);
+
+		// Get Config Default is not memoized, every one goes over the link
+		Runs runs;
+		for (int i = 0; i < kCommandRuns; i++)
+		{
+			UInt32 verbs = codec->getVerbCount();
+			runs.begin();
+			engine->sendCommand(0x14 + i % 8, HDA_VERB_GET_CONFIG_DEFAULT, HDA_PARM_NULL);
+			runs.end(codec->getVerbCount() - verbs);
+		}
+		results->push_back(runs.finish(name));
+	}
+	else
+		benchmarkFailed(name, "engine did not initialize");
+
+	delete engine;
+	delete hda;
+	delete codec;
+}
+
+static void sendCommandPIO(std::vector<Result>* results)
+{
+	sendCommand(PIO, "SendCommandPIO", results);
+}
+
+static void sendCommandDMA(std::vector<Result>* results)
+{
+	sendCommand(DMA, "SendCommandDMA", results);
+}
+
+// How close polling ICS follows a controller that is slower to complete immediate commands
+static void sendCommandBusy(std::vector<Result>* results)
+{
+	for (UInt32 frames : kBusyFrames)
+	{
+		char name[32];
+		snprintf(name, sizeof(name), "SendCommandPIOBusy%u", frames);
+		sendCommand(PIO, name, results, frames);
+	}
+}
+
+// Per verb cost of a batch through sendCommands, against the single verbs above
+static void sendCommands(HDACommandMode mode, const char* transport, std::vector<Result>* results)
+{
+	FakeCodec* codec = FakeCodec::createALC269();
+	FakeHDA* hda = new FakeHDA(codec);
+	IntelHDA* engine = new IntelHDA(hda->getCodecNub(), mode);
+
+	if (engine->initialize() && engine->getCommandMode() == mode)
+	{
+		for (size_t size : kBatchSizes)
+		{
+			std::vector<UInt32> commands(size), responses(size);
+			for (size_t i = 0; i < size; i++)
+				commands[i] = HDA_COMMAND(0x14 + i % 8, HDA_VERB_GET_CONFIG_DEFAULT, HDA_PARM_NULL);
+
+			Runs runs((UInt32)size);
+			for (int i = 0; i < kBatchRuns; i++)
+			{
+				UInt32 verbs = codec->getVerbCount();
+				runs.begin();
+				engine->sendCommands(commands.data(), size, responses.data());
+				runs.end(codec->getVerbCount() - verbs);
+			}
+
+			char name[32];
+			snprintf(name, sizeof(name), "SendCommands%zu%s", size, transport);
+			results->push_back(runs.finish(name));
+		}
+	}
+	else
+		benchmarkFailed(transport, "engine did not initialize");
+
+	delete engine;
+	delete hda;
+	delete codec;
+}
+
+static void sendCommandsPIO(std::vector<Result>* results)
+{
+	sendCommands(PIO, "PIO", results);
+}
+
+static void sendCommandsDMA(std::vector<Result>* results)
+{
+	sendCommands(DMA, "DMA", results);
+}
+
+// Configuration
+
+struct CodecKey
+{
+	UInt32 VendorId;
+	UInt32 SubsystemId;
+};
+
+// Configuration of each codec in turn, each run one lookup and parse
+static void parseConfiguration(OSDictionary* profiles, const std::vector<CodecKey>& codecs, const char* name,
+							   std::vector<Result>* results)
+{
+	Runs runs;
+	for (int i = 0; i < kConfigurationRuns; i++)
+	{
+		const CodecKey& codec = codecs[i % codecs.size()];
+		runs.begin();
+		Configuration* configuration = new Configuration(profiles, codec.VendorId, codec.SubsystemId);
+		delete configuration;
+		runs.end(0);
+	}
+	results->push_back(runs.finish(name));
+}
+
+static std::string readText(const char* path)
+{
+	std::string text;
+	if (FILE* file = fopen(path, "r"))
+	{
+		char buffer[16384];
+		size_t length;
+		while ((length = fread(buffer, 1, sizeof(buffer), file)) > 0)
+			text.append(buffer, length);
+		fclose(file);
+	}
+	return text;
+}
+
+static void configurationShipped(std::vector<Result>* results)
+{
+	std::string text = readText(HOST_SOURCE_DIR "/CodecCommander/CodecCommander-Info.plist");
+	OSDictionary* plist = OSDynamicCast(OSDictionary, OSUnserializeXML(text.c_str()));
+	OSDictionary* personalities = plist ? OSDynamicCast(OSDictionary, plist->getObject("IOKitPersonalities")) : NULL;
+	OSDictionary* personality = personalities ? OSDynamicCast(OSDictionary, personalities->getObject("CodecCommander")) : NULL;
+	OSDictionary* profiles = personality ? OSDynamicCast(OSDictionary, personality->getObject(kCodecProfile)) : NULL;
+	if (!profiles)
+	{
+		benchmarkFailed("ConfigurationShipped", "no Codec Profile in CodecCommander-Info.plist");
+		OSSafeReleaseNULL(plist);
+		return;
+	}
+
+	// every codec with a profile, looked up by the key it is found under, and one without
+	std::vector<CodecKey> codecs;
+	const char* key;
+	for (unsigned i = 0; profiles->hostGetObject(i, &key); i++)
+	{
+		unsigned vendor, codec, subVendor = 0, subDevice = 0;
+		if (sscanf(key, "%4x_%4x_HDA_%4x_%4x", &vendor, &codec, &subVendor, &subDevice) >= 2)
+			codecs.push_back({ vendor << 16 | codec, subVendor << 16 | subDevice });
+	}
+	codecs.push_back({ 0x11d41984, 0x10280000 });
+
+	parseConfiguration(profiles, codecs, "ConfigurationShipped", results);
+	plist->release();
+}
+
+// Codec Profile tree with count profiles of four verbs each, all with a subsystem
+static OSDictionary* createProfiles(UInt32 count, std::vector<CodecKey>* codecs)
+{
+	OSDictionary* profiles = OSDictionary::withCapacity(count + 1);
+	OSDictionary* defaults = createProfile(false);
+	setNumber(defaults, "Send Delay", 300);
+	profiles->setObject("Default", defaults);
+	defaults->release();
+
+	for (UInt32 i = 0; i < count; i++)
+	{
+		UInt32 vendorId = 0x10ec0200 + i % 0x100, subsystemId = 0x10250000 + i / 0x100;
+		char key[sizeof("vvvv_cccc_HDA_xxxx_dddd")];
+		snprintf(key, sizeof(key), "%04x_%04x_HDA_%04x_%04x", vendorId >> 16, vendorId & 0xFFFF,
+				 subsystemId >> 16, subsystemId & 0xFFFF);
+
+		OSDictionary* profile = OSDictionary::withCapacity(4);
+		setNumber(profile, "Send Delay", 10 + i % 300);
+		profile->setObject("Sleep Nodes", i & 1 ? kOSBooleanTrue : kOSBooleanFalse);
+		OSArray* list = OSArray::withCapacity(4);
+		for (UInt32 command = 0; command < 4; command++)
+		{
+			OSDictionary* entry = OSDictionary::withCapacity(2);
+			setNumber(entry, "Command", 0x01470700 + command);
+			entry->setObject(command & 1 ? "On Wake" : "On Init", kOSBooleanTrue);
+			list->setObject(entry);
+			entry->release();
+		}
+		profile->setObject("Custom Commands", list);
+		list->release();
+		profiles->setObject(key, profile);
+		profile->release();
+
+		codecs->push_back({ vendorId, subsystemId });
+	}
+
+	// and a codec without a profile of its own
+	codecs->push_back({ 0x11d41984, 0x10280000 });
+	return profiles;
+}
+
+static void configurationSynthetic(UInt32 count, const char* name, std::vector<Result>* results)
+{
+	std::vector<CodecKey> codecs;
+	OSDictionary* profiles = createProfiles(count, &codecs);
+
+	// spread the lookups over the whole tree
+	std::vector<CodecKey> order;
+	for (size_t i = 0; i < codecs.size(); i++)
+		order.push_back(codecs[i * 7919 % codecs.size()]);
+
+	parseConfiguration(profiles, order, name, results);
+	profiles->release();
+}
+
+static void configurationSynthetic100(std::vector<Result>* results)
+{
+	configurationSynthetic(100, "ConfigurationSynthetic100", results);
+}
+
+static void configurationSynthetic5000(std::vector<Result>* results)
+{
+	configurationSynthetic(5000, "ConfigurationSynthetic5000", results);
+}
+
+// Custom commands
+
+static UInt64 getCustomVerbs(CodecCommander* commander)
+{
+	return getNumber(commander, "Command Statistics", "Lanes", "Custom", "Verbs");
+}
+
+static void customCommands(std::vector<Result>* results)
+{
+	// custom commands are all the transitions do: no reset, no EAPD, no jack sense
+	OSDictionary* profile = createProfile(false);
+	profile->setObject("Perform Reset", kOSBooleanFalse);
+	profile->setObject("Perform Reset on External Wake", kOSBooleanFalse);
+	profile->setObject("Update Nodes", kOSBooleanFalse);
+
+	// coefficient writes to the vendor widget, a set for each state
+	static const char* states[] = { "On Init", "On Sleep", "On Wake" };
+	OSArray* list = OSArray::withCapacity(3 * kCustomCommandCount);
+	for (int state = 0; state < 3; state++)
+	{
+		for (UInt32 i = 0; i < kCustomCommandCount; i++)
+		{
+			OSDictionary* entry = OSDictionary::withCapacity(2);
+			setNumber(entry, "Command", 0x02040000 | state << 8 | i);
+			entry->setObject(states[state], kOSBooleanTrue);
+			list->setObject(entry);
+			entry->release();
+		}
+	}
+	profile->setObject("Custom Commands", list);
+	list->release();
+
+	// init set: a driver start per run, the wall time is all of start
+	Runs init;
+	for (int i = 0; i < kTransitionRuns; i++)
+	{
+		profile->retain();
+		init.begin();
+		Driver driver(profile);
+		init.end(getCustomVerbs(driver.Commander), getLastPhase(driver.Commander, "Custom Commands"));
+		if (!driver.Started)
+		{
+			benchmarkFailed("CustomCommandsInit", "driver did not start");
+			break;
+		}
+	}
+	results->push_back(init.finish("CustomCommandsInit"));
+
+	// sleep and wake sets, the wall time is the whole transition
+	Runs sleep, wake;
+	Driver driver(profile);
+	if (!driver.Started)
+	{
+		benchmarkFailed("CustomCommands", "driver did not start");
+		return;
+	}
+	driver.Commander->setPowerState(kPowerStateNormal, driver.Commander);
+	for (int i = 0; i < kTransitionRuns; i++)
+	{
+		UInt64 verbs = getCustomVerbs(driver.Commander);
+		sleep.begin();
+		driver.Commander->setPowerState(kPowerStateSleep, driver.Commander);
+		sleep.end(getCustomVerbs(driver.Commander) - verbs, getLastPhase(driver.Commander, "Custom Commands"));
+
+		verbs = getCustomVerbs(driver.Commander);
+		wake.begin();
+		driver.Commander->setPowerState(kPowerStateNormal, driver.Commander);
+		wake.end(getCustomVerbs(driver.Commander) - verbs, getLastPhase(driver.Commander, "Custom Commands"));
+	}
+	results->push_back(sleep.finish("CustomCommandsSleep"));
+	results->push_back(wake.finish("CustomCommandsWake"));
+}
+
+// Power transitions
+
+static void sleepWake(bool useDMA, const char* name, std::vector<Result>* results)
+{
+	// Default profile: Send Delay, codec reset on wake, EAPD on the ALC269's pins
+	Driver driver(createProfile(useDMA));
+	if (!driver.Started)
+	{
+		benchmarkFailed(name, "driver did not start");
+		return;
+	}
+	driver.Commander->setPowerState(kPowerStateNormal, driver.Commander);
+	hostWaitIdle();
+
+	Runs runs;
+	for (int i = 0; i < kTransitionRuns; i++)
+	{
+		UInt32 verbs = driver.Codec->getVerbCount();
+		runs.begin();
+		driver.Commander->setPowerState(kPowerStateSleep, driver.Commander);
+		driver.Commander->setPowerState(kPowerStateNormal, driver.Commander);
+		runs.end(driver.Codec->getVerbCount() - verbs);
+
+		// jack sense is enabled again on the workloop, outside of the transition
+		hostWaitIdle();
+	}
+	results->push_back(runs.finish(name));
+}
+
+static void sleepWakePIO(std::vector<Result>* results)
+{
+	sleepWake(false, "SleepWakePIO", results);
+}
+
+static void sleepWakeDMA(std::vector<Result>* results)
+{
+	sleepWake(true, "SleepWakeDMA", results);
+}
+
+// User client: verbs per externalMethod call against the shared rings
+
+static void clientVerbs(std::vector<Result>* results)
+{
+	Session session;
+	if (!session.Opened)
+	{
+		benchmarkFailed("Client", "user client did not open");
+		return;
+	}
+
+	// one call per verb
+	Runs single(kClientVerbs);
+	for (int run = 0; run < kClientRuns; run++)
+	{
+		UInt32 verbs = session.Codec->getVerbCount();
+		single.begin();
+		for (int i = 0; i < kClientVerbs; i++)
+		{
+			UInt64 input = HDA_COMMAND(0x14 + i % 8, HDA_VERB_GET_CONFIG_DEFAULT, HDA_PARM_NULL), output;
+			IOExternalMethodArguments arguments = { };
+			arguments.scalarInput = &input;
+			arguments.scalarInputCount = 1;
+			arguments.scalarOutput = &output;
+			arguments.scalarOutputCount = 1;
+			session.call(kClientExecuteVerb, &arguments);
+		}
+		single.end(session.Codec->getVerbCount() - verbs);
+	}
+	results->push_back(single.finish("ClientExecuteVerb"));
+
+	// one call per batch
+	UInt32 commands[kClientBatch];
+	CodecCommanderVerbResult responses[kClientBatch];
+	for (int i = 0; i < kClientBatch; i++)
+		commands[i] = HDA_COMMAND(0x14 + i % 8, HDA_VERB_GET_CONFIG_DEFAULT, HDA_PARM_NULL);
+	Runs batches(kClientVerbs);
+	for (int run = 0; run < kClientRuns; run++)
+	{
+		UInt32 verbs = session.Codec->getVerbCount();
+		batches.begin();
+		for (int i = 0; i < kClientVerbs / kClientBatch; i++)
+		{
+			IOExternalMethodArguments arguments = { };
+			arguments.structureInput = commands;
+			arguments.structureInputSize = sizeof(commands);
+			arguments.structureOutput = responses;
+			arguments.structureOutputSize = sizeof(responses);
+			session.call(kClientExecuteVerbs, &arguments);
+		}
+		batches.end(session.Codec->getVerbCount() - verbs);
+	}
+	char name[32];
+	snprintf(name, sizeof(name), "ClientExecuteVerbs%d", kClientBatch);
+	results->push_back(batches.finish(name));
+
+	// streamed through the rings: kept full, a doorbell only when the drainer went idle
+	IOMemoryDescriptor* memory = NULL;
+	IOOptionBits options = 0;
+	if (session.Client->clientMemoryForType(kClientMemoryRings, &options, &memory) != kIOReturnSuccess)
+	{
+		benchmarkFailed("ClientRings", "rings not mapped");
+		return;
+	}
+	CodecCommanderRings* rings = (CodecCommanderRings*)((IOBufferMemoryDescriptor*)memory)->getBytesNoCopy();
+	Runs streamed(kClientVerbs);
+	UInt32 doorbells = 0;
+	for (int run = 0; run < kClientRuns; run++)
+	{
+		UInt32 verbs = session.Codec->getVerbCount();
+		UInt32 target = rings->Submitted + kClientVerbs;
+		auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+		streamed.begin();
+		while (rings->Completed != target)
+		{
+			while (rings->Submitted != target && CCRingFree(rings, rings->Completed))
+				CCRingPush(rings, HDA_COMMAND(0x14 + rings->Submitted % 8, HDA_VERB_GET_CONFIG_DEFAULT, HDA_PARM_NULL));
+			if (CCRingClaim(rings))
+			{
+				session.ringDoorbell();
+				doorbells++;
+			}
+			else if (std::chrono::steady_clock::now() > deadline)
+			{
+				benchmarkFailed("ClientRings", "rings not drained");
+				break;
+			}
+			else
+				sched_yield();
+		}
+		streamed.end(session.Codec->getVerbCount() - verbs);
+	}
+	results->push_back(streamed.finish("ClientRings"));
+	memory->release();
+	hostWaitIdle();
+}
+
+static const struct
+{
+	const char* Name;
+	void (*Run)(std::vector<Result>* results);
+} kBenchmarks[] =
+{
+	{ "SendCommandPIO", sendCommandPIO },
+	{ "SendCommandDMA", sendCommandDMA },
+	{ "SendCommandPIOBusy", sendCommandBusy },
+	{ "SendCommandsPIO", sendCommandsPIO },
+	{ "SendCommandsDMA", sendCommandsDMA },
+	{ "ConfigurationShipped", configurationShipped },
+	{ "ConfigurationSynthetic100", configurationSynthetic100 },
+	{ "ConfigurationSynthetic5000", configurationSynthetic5000 },
+	{ "CustomCommands", customCommands },
+	{ "Client", clientVerbs },
+	{ "SleepWakePIO", sleepWakePIO },
+	{ "SleepWakeDMA", sleepWakeDMA },
+};
+
+// Results file
+
+static const char* kResultHeader = "benchmark,runs,verbs,link_p50_us,link_p99_us,link_max_us,wall_p50_ns,wall_p99_ns,wall_max_ns";
+
+static void writeResult(FILE* out, const Result& result)
+{
+	fprintf(out, "%s,%u,%llu,%llu,%llu,%llu,%llu,%llu,%llu\n", result.Name.c_str(), result.Runs,
+			(unsigned long long)result.Verbs, (unsigned long long)result.Link[0], (unsigned long long)result.Link[1],
+			(unsigned long long)result.Link[2], (unsigned long long)result.Wall[0], (unsigned long long)result.Wall[1],
+			(unsigned long long)result.Wall[2]);
+}
+
+static bool readResults(const char* path, std::vector<Result>* results)
+{
+	FILE* file = fopen(path, "r");
+	if (!file)
+		return false;
+
+	char line[512], name[128];
+	while (fgets(line, sizeof(line), file))
+	{
+		Result result;
+		unsigned long long values[7];
+		if (sscanf(line, "%127[^,],%u,%llu,%llu,%llu,%llu,%llu,%llu,%llu", name, &result.Runs, &values[0], &values[1],
+				   &values[2], &values[3], &values[4], &values[5], &values[6]) != 9)
+			continue;
+
+		result.Name = name;
+		result.Verbs = values[0];
+		for (int i = 0; i < 3; i++)
+		{
+			result.Link[i] = values[1 + i];
+			result.Wall[i] = values[4 + i];
+		}
+		results->push_back(result);
+	}
+	fclose(file);
+	return true;
+}
+
+// true if value exceeds a (known) baseline value by more than threshold percent
+static bool regressed(UInt64 value, UInt64 base, int threshold)
+{
+	return base && value * 100 > base * (100 + threshold);
+}
+
+// Any added verb counts; link time only beyond the threshold, and wall time only if the
+// baseline has it (it is recorded on the same machine, the shipped one has none)
+static bool compareResult(const Result& result, const Result& base, int threshold)
+{
+	bool failed = false;
+	if (result.Verbs > base.Verbs)
+	{
+		fprintf(stderr, "%s: %llu verbs per run, %llu in the baseline\n", result.Name.c_str(),
+				(unsigned long long)result.Verbs, (unsigned long long)base.Verbs);
+		failed = true;
+	}
+
+	static const char* percentiles[] = { "P50", "P99" };
+	for (int i = 0; i < 2; i++)
+	{
+		if (regressed(result.Link[i], base.Link[i], threshold))
+		{
+			fprintf(stderr, "%s: link %s %llu us, %llu us in the baseline\n", result.Name.c_str(), percentiles[i],
+					(unsigned long long)result.Link[i], (unsigned long long)base.Link[i]);
+			failed = true;
+		}
+		if (regressed(result.Wall[i], base.Wall[i], threshold))
+		{
+			fprintf(stderr, "%s: wall %s %llu ns, %llu ns in the baseline\n", result.Name.c_str(), percentiles[i],
+					(unsigned long long)result.Wall[i], (unsigned long long)base.Wall[i]);
+			failed = true;
+		}
+	}
+	return failed;
+}
+
+int main(int argc, char** argv)
+{
+	const char* output = NULL;
+	const char* baselinePath = NULL;
+	int threshold = kBenchmarkThreshold;
+	int option;
+
+	while ((option = getopt(argc, argv, "o:b:t:")) != -1)
+	{
+		switch (option)
+		{
+			case 'o': output = optarg; break;
+			case 'b': baselinePath = optarg; break;
+			case 't': threshold = atoi(optarg); break;
+			default:
+				fprintf(stderr, "usage: %s [-o results.csv] [-b baseline.csv] [-t percent] [filter]\n", argv[0]);
+				return 2;
+		}
+	}
+	const char* filter = optind < argc ? argv[optind] : NULL;
+
+	std::vector<Result> baseline;
+	if (baselinePath && !readResults(baselinePath, &baseline))
+	{
+		fprintf(stderr, "cannot read baseline %s\n", baselinePath);
+		return 2;
+	}
+
+	std::vector<Result> results;
+	for (size_t i = 0; i < sizeof(kBenchmarks) / sizeof(kBenchmarks[0]); i++)
+		if (!filter || strstr(kBenchmarks[i].Name, filter))
+			kBenchmarks[i].Run(&results);
+
+	printf("%-28s %5s %6s %10s %10s %10s %10s\n", "benchmark", "runs", "verbs", "link P50", "link P99", "wall P50", "wall P99");
+	int regressions = 0;
+	for (size_t i = 0; i < results.size(); i++)
+	{
+		const Result& result = results[i];
+		printf("%-28s %5u %6llu %7llu us %7llu us %7llu us %7llu us", result.Name.c_str(), result.Runs,
+			   (unsigned long long)result.Verbs, (unsigned long long)result.Link[0], (unsigned long long)result.Link[1],
+			   (unsigned long long)result.Wall[0] / 1000, (unsigned long long)result.Wall[1] / 1000);
+
+		const Result* base = NULL;
+		for (size_t j = 0; j < baseline.size() && !base; j++)
+			if (baseline[j].Name == result.Name)
+				base = &baseline[j];
+
+		if (base && compareResult(result, *base, threshold))
+		{
+			printf("   REGRESSION");
+			regressions++;
+		}
+		else if (baselinePath && !base)
+			printf("   not in baseline");
+		printf("\n");
+	}
+
+	if (output)
+	{
+		FILE* out = fopen(output, "w");
+		if (!out)
+		{
+			fprintf(stderr, "cannot write %s\n", output);
+			return 2;
+		}
+		fprintf(out, "%s\n", kResultHeader);
+		for (size_t i = 0; i < results.size(); i++)
+			writeResult(out, results[i]);
+		fclose(out);
+	}
+
+	return regressions || sFailures ? 1 : 0;
+}
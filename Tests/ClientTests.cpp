@@ -0,0 +1,157 @@
+/*
+ *  Released under "The GNU General Public License (GPL-2.0)"
+ *
+ *  This program is free software; you can redistribute it and/or modify it
+ *  under the terms of the GNU General Public License as published by the
+ *  Free Software Foundation; either version 2 of the License, or (at your
+ *  option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ *  or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ *  for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ *
+ */
+
+#include "Harness.h"
+#include "FakeDriver.h"
+
+// Verbs one at a time and in batches
+
+TEST(ExecuteVerb)
+{
+	Session session;
+	ASSERT_TRUE(session.Opened);
+
+	UInt64 input = HDA_COMMAND(0x14, HDA_VERB_GET_CONFIG_DEFAULT, HDA_PARM_NULL), output = 0;
+	IOExternalMethodArguments arguments = { };
+	arguments.scalarInput = &input;
+	arguments.scalarInputCount = 1;
+	arguments.scalarOutput = &output;
+	arguments.scalarOutputCount = 1;
+	EXPECT_EQ(kIOReturnSuccess, session.call(kClientExecuteVerb, &arguments));
+	EXPECT_EQ(0x90170110, output);
+}
+
+TEST(ExecuteVerbsReportsStatusPerVerb)
+{
+	// one verb at a time, so a node that never answers fails only its own verbs
+	Session session(false);
+	ASSERT_TRUE(session.Opened);
+
+	session.Codec->setSilentNode(0x19, true);
+
+	UInt32 verbs[3] =
+	{
+		HDA_COMMAND(0x15, HDA_VERB_GET_CONFIG_DEFAULT, HDA_PARM_NULL),
+		HDA_COMMAND(0x19, HDA_VERB_GET_CONFIG_DEFAULT, HDA_PARM_NULL),
+		HDA_COMMAND(0x18, HDA_VERB_GET_CONFIG_DEFAULT, HDA_PARM_NULL)
+	};
+	CodecCommanderVerbResult results[3];
+	IOExternalMethodArguments arguments = { };
+	arguments.structureInput = verbs;
+	arguments.structureInputSize = sizeof(verbs);
+	arguments.structureOutput = results;
+	arguments.structureOutputSize = sizeof(results);
+	EXPECT_EQ(kIOReturnSuccess, session.call(kClientExecuteVerbs, &arguments));
+	EXPECT_EQ(sizeof(results), arguments.structureOutputSize);
+
+	EXPECT_EQ(0x0221101f, results[0].Response);
+	EXPECT_EQ(kIOReturnSuccess, results[0].Status);
+	EXPECT_EQ((UInt32)-1, results[1].Response);
+	EXPECT_TRUE(results[1].Status != kIOReturnSuccess);
+	EXPECT_EQ(0x02a11030, results[2].Response);
+	EXPECT_EQ(kIOReturnSuccess, results[2].Status);
+}
+
+// Shared submission and completion rings
+
+TEST(DoorbellNeedsMappedRings)
+{
+	Session session;
+	ASSERT_TRUE(session.Opened);
+
+	EXPECT_EQ(kIOReturnNotReady, session.ringDoorbell());
+}
+
+TEST(RingsDrainInOrderAcrossWrap)
+{
+	Session session;
+	ASSERT_TRUE(session.Opened);
+
+	IOMemoryDescriptor* memory = NULL;
+	IOOptionBits options = 0;
+	ASSERT_TRUE(session.Client->clientMemoryForType(kClientMemoryRings, &options, &memory) == kIOReturnSuccess);
+	CodecCommanderRings* rings = (CodecCommanderRings*)((IOBufferMemoryDescriptor*)memory)->getBytesNoCopy();
+
+	// more verbs than the ring holds, the client refills it as results are read
+	const UInt32 total = kClientRingEntries * 2 + 100;
+	UInt32 read = 0, pushed = 0, doorbells = 0;
+	bool ordered = true;
+	while (read < total)
+	{
+		while (pushed < total && CCRingFree(rings, read))
+		{
+			UInt8 node = 0x12 + pushed % 13;
+			CCRingPush(rings, HDA_COMMAND(node, HDA_VERB_GET_CONFIG_DEFAULT, HDA_PARM_NULL));
+			pushed++;
+		}
+		if (CCRingClaim(rings))
+		{
+			EXPECT_EQ(kIOReturnSuccess, session.ringDoorbell());
+			doorbells++;
+		}
+
+		EXPECT_TRUE(hostWaitIdle());
+		for (; read != rings->Completed; read++)
+		{
+			FakeWidget* widget = session.Codec->getWidget(0x12 + read % 13);
+			CodecCommanderVerbResult* result = &rings->Results[read % kClientRingEntries];
+			if (result->Response != (widget ? widget->ConfigDefault : 0) || result->Status != kIOReturnSuccess)
+				ordered = false;
+		}
+	}
+
+	EXPECT_TRUE(ordered);
+	EXPECT_EQ(total, rings->Completed);
+	EXPECT_EQ(0, rings->Busy);
+	EXPECT_TRUE(doorbells >= 3);
+
+	memory->release();
+}
+
+TEST(CorruptRingIndicesReportedByNextDoorbell)
+{
+	Session session;
+	ASSERT_TRUE(session.Opened);
+
+	IOMemoryDescriptor* memory = NULL;
+	IOOptionBits options = 0;
+	ASSERT_TRUE(session.Client->clientMemoryForType(kClientMemoryRings, &options, &memory) == kIOReturnSuccess);
+	CodecCommanderRings* rings = (CodecCommanderRings*)((IOBufferMemoryDescriptor*)memory)->getBytesNoCopy();
+
+	// more pending than the ring can hold
+	rings->Submitted = kClientRingEntries + 1;
+	ASSERT_TRUE(CCRingClaim(rings));
+	EXPECT_EQ(kIOReturnSuccess, session.ringDoorbell());
+	EXPECT_TRUE(hostWaitIdle());
+
+	EXPECT_EQ(0, rings->Completed);
+	EXPECT_EQ(0, rings->Busy);
+	EXPECT_EQ(kIOReturnBadArgument, session.ringDoorbell());
+
+	// usable again once the client fixed its indices
+	rings->Submitted = 0;
+	CCRingPush(rings, HDA_COMMAND(0x14, HDA_VERB_EAPDBTL_GET, HDA_PARM_NULL));
+	ASSERT_TRUE(CCRingClaim(rings));
+	EXPECT_EQ(kIOReturnSuccess, session.ringDoorbell());
+	EXPECT_TRUE(hostWaitIdle());
+	EXPECT_EQ(1, rings->Completed);
+	EXPECT_EQ(0x02, rings->Results[0].Response);
+
+	memory->release();
+}
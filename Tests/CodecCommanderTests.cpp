@@ -0,0 +1,544 @@
+/*
+ *  Released under "The GNU General Public License (GPL-2.0)"
+ *
+ *  This program is free software; you can redistribute it and/or modify it
+ *  under the terms of the GNU General Public License as published by the
+ *  Free Software Foundation; either version 2 of the License, or (at your
+ *  option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ *  or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ *  for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ *
+ */
+
+#include "Harness.h"
+#include "FakeDriver.h"
+#include <condition_variable>
+#include <mutex>
+
+// Jack sense
+
+TEST(JackSenseEnabledOverCommandRings)
+{
+	Driver driver(createProfile(true));
+	ASSERT_TRUE(driver.Started);
+
+	// jacks with presence detect, tagged with their node id
+	EXPECT_EQ(HDA_UNSOL_ENABLE(0x15), driver.Codec->getWidget(0x15)->State.Unsolicited);
+	EXPECT_EQ(HDA_UNSOL_ENABLE(0x18), driver.Codec->getWidget(0x18)->State.Unsolicited);
+	EXPECT_EQ(0, driver.Codec->getWidget(0x14)->State.Unsolicited);
+	EXPECT_EQ(0, driver.Codec->getWidget(0x19)->State.Unsolicited);
+}
+
+TEST(JackSenseNeedsCommandRings)
+{
+	Driver driver(createProfile(false));
+	ASSERT_TRUE(driver.Started);
+
+	EXPECT_EQ(0, driver.Codec->getWidget(0x15)->State.Unsolicited);
+	EXPECT_FALSE(driver.HDA->getRegisters()->GCTL_UNSOL);
+}
+
+TEST(UnplugRestoresEAPDWithoutSendDelay)
+{
+	Driver driver(createProfile(true));
+	ASSERT_TRUE(driver.Started);
+
+	// wake from the cold boot state, EAPD is on
+	EXPECT_EQ(IOPMAckImplied, driver.Commander->setPowerState(kPowerStateNormal, driver.Commander));
+	EXPECT_TRUE(hostWaitIdle());
+	EXPECT_EQ(0x02, driver.Codec->getWidget(0x14)->State.Eapd);
+
+	// the codec drops EAPD of the speaker when the headphones go
+	driver.Codec->getWidget(0x14)->State.Eapd = 0;
+	UInt64 start = hostGetTime();
+	driver.HDA->plug(0x15, false);
+	hostAdvanceTime(100);
+	EXPECT_TRUE(hostWaitIdle());
+
+	EXPECT_EQ(0x02, driver.Codec->getWidget(0x14)->State.Eapd);
+	EXPECT_EQ(0x02, driver.Codec->getWidget(0x15)->State.Eapd);
+	EXPECT_TRUE(hostGetTime() - start < 300 * 1000);
+
+	// plugging in changes nothing
+	driver.Codec->getWidget(0x14)->State.Eapd = 0;
+	driver.HDA->plug(0x15, true);
+	hostAdvanceTime(100);
+	EXPECT_TRUE(hostWaitIdle());
+	EXPECT_EQ(0, driver.Codec->getWidget(0x14)->State.Eapd);
+}
+
+TEST(UnplugIgnoredWhileAsleep)
+{
+	Driver driver(createProfile(true));
+	ASSERT_TRUE(driver.Started);
+
+	// never woken: EAPD stays as the codec has it
+	driver.Codec->getWidget(0x14)->State.Eapd = 0;
+	driver.HDA->plug(0x15, false);
+	hostAdvanceTime(100);
+	EXPECT_TRUE(hostWaitIdle());
+	EXPECT_EQ(0, driver.Codec->getWidget(0x14)->State.Eapd);
+}
+
+// Adaptive Send Delay
+
+// Keeps a pin silent until a point in (virtual) time, checked whenever a verb goes out
+struct SilentUntil
+{
+	FakeCodec* Codec;
+	UInt8 Node;
+	UInt64 Until;
+
+	static void hook(void* context, UInt32 command)
+	{
+		SilentUntil* silent = (SilentUntil*)context;
+		if (hostGetTime() >= silent->Until)
+			silent->Codec->setSilentNode(silent->Node, false);
+	}
+
+	void start(UInt32 milliseconds)
+	{
+		Until = hostGetTime() + milliseconds * 1000;
+		Codec->setSilentNode(Node, true);
+	}
+};
+
+static UInt32 getLearnedSendDelay(Driver* driver)
+{
+	OSNumber* learned = OSDynamicCast(OSNumber, driver->HDA->getCodecNub()->getProperty("Learned Send Delay"));
+	return learned ? learned->unsigned32BitValue() : -1;
+}
+
+static OSDictionary* createAdaptiveProfile()
+{
+	// EAPD with Send Delay (300 ms) as the only work of a transition
+	OSDictionary* profile = createProfile(false);
+	profile->setObject("Adaptive Send Delay", kOSBooleanTrue);
+	profile->setObject("Perform Reset", kOSBooleanFalse);
+	profile->setObject("Perform Reset on External Wake", kOSBooleanFalse);
+	profile->setObject("Perform Reset on EAPD Fail", kOSBooleanFalse);
+	return profile;
+}
+
+TEST(AdaptiveSendDelayLearnsFromPins)
+{
+	Driver driver(createAdaptiveProfile());
+	ASSERT_TRUE(driver.Started);
+
+	// at start the function group answered at once, the pins were not polled yet
+	EXPECT_EQ(10, getLearnedSendDelay(&driver));
+
+	// the speaker pin answers 80 ms into the wake: 1.25 times that plus 10 ms
+	SilentUntil silent = { driver.Codec, 0x14, 0 };
+	driver.HDA->setVerbHook(SilentUntil::hook, &silent);
+	silent.start(80);
+	UInt64 start = hostGetTime();
+	driver.Commander->setPowerState(kPowerStateNormal, driver.Commander);
+	UInt64 elapsed = hostGetTime() - start;
+
+	UInt32 learned = getLearnedSendDelay(&driver);
+	EXPECT_TRUE(learned >= 80 * 5 / 4 + 10 && learned <= 90 * 5 / 4 + 10);
+	EXPECT_EQ(0x02, driver.Codec->getWidget(0x14)->State.Eapd);
+	// and waited out the margin beyond the answer
+	EXPECT_TRUE(elapsed >= learned * 1000 && elapsed < (learned + 10) * 1000);
+
+	// ready at once from now on: a quarter of the way down each time
+	for (int i = 0; i < 3; i++)
+	{
+		UInt32 old = getLearnedSendDelay(&driver);
+		driver.Commander->setPowerState(i & 1 ? kPowerStateNormal : kPowerStateSleep, driver.Commander);
+		EXPECT_EQ((old * 3 + 10) / 4, getLearnedSendDelay(&driver));
+	}
+
+	// never more than Send Delay, also when the pin does not answer at all
+	silent.start(1000);
+	start = hostGetTime();
+	driver.Commander->setPowerState(kPowerStateNormal, driver.Commander);
+	EXPECT_EQ(300, getLearnedSendDelay(&driver));
+	EXPECT_TRUE(hostGetTime() - start < 320 * 1000);
+
+	silent.start(250);
+	driver.Commander->setPowerState(kPowerStateSleep, driver.Commander);
+	EXPECT_EQ(300, getLearnedSendDelay(&driver));
+
+	driver.HDA->setVerbHook(NULL, NULL);
+}
+
+TEST(PinReadinessCheckSkippedAtStart)
+{
+	// the pins are not known before the topology is read, start polls the function group only
+	struct PinPolls
+	{
+		int Count = 0;
+		static void hook(void* context, UInt32 command)
+		{
+			if ((command >> 8 & 0xFFF) == HDA_VERB_EAPDBTL_GET)
+				((PinPolls*)context)->Count++;
+		}
+	};
+	PinPolls polls;
+
+	FakeCodec* codec = FakeCodec::createALC269();
+	FakeHDA* hda = new FakeHDA(codec);
+	hda->setVerbHook(PinPolls::hook, &polls);
+
+	OSDictionary* properties = OSDictionary::withCapacity(1);
+	OSDictionary* profiles = Driver::wrapProfile(createAdaptiveProfile());
+	properties->setObject(kCodecProfile, profiles);
+	profiles->release();
+
+	CodecCommander* commander = new CodecCommander;
+	commander->init(properties);
+	properties->release();
+	commander->attach(hda->getCodecNub());
+	EXPECT_TRUE(commander->start(hda->getCodecNub()));
+	EXPECT_EQ(0, polls.Count);
+
+	// once woken they are
+	commander->setPowerState(kPowerStateNormal, commander);
+	EXPECT_TRUE(polls.Count > 0);
+
+	hda->setVerbHook(NULL, NULL);
+	commander->stop(hda->getCodecNub());
+	commander->detach(hda->getCodecNub());
+	commander->release();
+	delete hda;
+	delete codec;
+}
+
+// Asynchronous power transitions
+
+// Counts EAPD writes and, once armed, holds the next verb (and so the workloop
+// sending it) until released
+struct HoldVerbs
+{
+	std::mutex Lock;
+	std::condition_variable Changed;
+	bool Armed = false, Held = false;
+	UInt32 EAPDOff = 0, EAPDOn = 0;
+
+	static void hook(void* context, UInt32 command)
+	{
+		HoldVerbs* hold = (HoldVerbs*)context;
+		std::unique_lock<std::mutex> lock(hold->Lock);
+		if ((command >> 8 & 0xFFF) == HDA_VERB_EAPDBTL_SET)
+			(command & 0xFF) ? hold->EAPDOn++ : hold->EAPDOff++;
+		if (!hold->Armed)
+			return;
+		hold->Held = true;
+		hold->Changed.notify_all();
+		hold->Changed.wait(lock, [hold] { return !hold->Armed; });
+	}
+
+	bool waitHeld()
+	{
+		std::unique_lock<std::mutex> lock(Lock);
+		return Changed.wait_for(lock, std::chrono::seconds(10), [this] { return Held; });
+	}
+
+	void release()
+	{
+		std::lock_guard<std::mutex> lock(Lock);
+		Armed = Held = false;
+		Changed.notify_all();
+	}
+};
+
+static OSDictionary* createAsyncProfile()
+{
+	// EAPD as the only work of a transition, from either source
+	OSDictionary* profile = createProfile(false);
+	profile->setObject("Asynchronous Power Transitions", kOSBooleanTrue);
+	profile->setObject("Perform Reset", kOSBooleanFalse);
+	profile->setObject("Perform Reset on External Wake", kOSBooleanFalse);
+	return profile;
+}
+
+// Cold boot wake of CC, held on the workloop so that later transitions queue up
+static bool holdFirstWake(Driver* driver, HoldVerbs* hold)
+{
+	driver->HDA->setVerbHook(HoldVerbs::hook, hold);
+	hold->Armed = true;
+	if (driver->Commander->setPowerState(kPowerStateNormal, driver->Commander) != IOPMAckImplied)
+		return false;
+	return hold->waitHeld();
+}
+
+TEST(AsyncSleepQueuedBeforePowerHookWakeStillRuns)
+{
+	Driver driver(createAsyncProfile());
+	ASSERT_TRUE(driver.Started);
+	IOService* powerHook = new IOService;
+	powerHook->init();
+
+	HoldVerbs hold;
+	ASSERT_TRUE(holdFirstWake(&driver, &hold));
+
+	// CC's sleep waits behind the wake, then the power hook wakes (fugue)
+	UInt32 acks = driver.Commander->hostGetPowerAcks();
+	EXPECT_TRUE(driver.Commander->setPowerState(kPowerStateSleep, driver.Commander) != IOPMAckImplied);
+	EXPECT_EQ(IOPMAckImplied, driver.Commander->setPowerStateExternal(kPowerStateNormal, powerHook));
+	EXPECT_EQ(acks, driver.Commander->hostGetPowerAcks());
+	UInt32 on = hold.EAPDOn;
+
+	hold.release();
+	EXPECT_TRUE(hostWaitIdle());
+
+	// neither was dropped: EAPD went off with the sleep, on again with the wake
+	EXPECT_EQ(acks + 1, driver.Commander->hostGetPowerAcks());
+	EXPECT_EQ(0, powerHook->hostGetPowerAcks());
+	EXPECT_TRUE(hold.EAPDOff > 0);
+	EXPECT_TRUE(hold.EAPDOn > on);
+	EXPECT_EQ(0x02, driver.Codec->getWidget(0x14)->State.Eapd);
+
+	driver.HDA->setVerbHook(NULL, NULL);
+	powerHook->release();
+}
+
+TEST(AsyncOppositeRequestsFromOneSourceCollapse)
+{
+	Driver driver(createAsyncProfile());
+	ASSERT_TRUE(driver.Started);
+	IOService* powerHook = new IOService;
+	powerHook->init();
+
+	HoldVerbs hold;
+	ASSERT_TRUE(holdFirstWake(&driver, &hold));
+
+	// sleep then wake from each source, each sleep is released when its wake cancels it
+	UInt32 acks = driver.Commander->hostGetPowerAcks();
+	EXPECT_TRUE(driver.Commander->setPowerState(kPowerStateSleep, driver.Commander) != IOPMAckImplied);
+	EXPECT_TRUE(driver.Commander->setPowerStateExternal(kPowerStateSleep, powerHook) != IOPMAckImplied);
+	EXPECT_EQ(IOPMAckImplied, driver.Commander->setPowerState(kPowerStateNormal, driver.Commander));
+	EXPECT_EQ(acks + 1, driver.Commander->hostGetPowerAcks());
+	EXPECT_EQ(0, powerHook->hostGetPowerAcks());
+	EXPECT_EQ(IOPMAckImplied, driver.Commander->setPowerStateExternal(kPowerStateNormal, powerHook));
+	EXPECT_EQ(1, powerHook->hostGetPowerAcks());
+
+	hold.release();
+	EXPECT_TRUE(hostWaitIdle());
+
+	// none of them ran
+	EXPECT_EQ(0, hold.EAPDOff);
+	EXPECT_EQ(acks + 1, driver.Commander->hostGetPowerAcks());
+	EXPECT_EQ(1, powerHook->hostGetPowerAcks());
+	EXPECT_EQ(0x02, driver.Codec->getWidget(0x14)->State.Eapd);
+
+	driver.HDA->setVerbHook(NULL, NULL);
+	powerHook->release();
+}
+
+TEST(AsyncSleepsFromBothSourcesRunOnceAckedEach)
+{
+	Driver driver(createAsyncProfile());
+	ASSERT_TRUE(driver.Started);
+	IOService* powerHook = new IOService;
+	powerHook->init();
+
+	HoldVerbs hold;
+	ASSERT_TRUE(holdFirstWake(&driver, &hold));
+
+	UInt32 acks = driver.Commander->hostGetPowerAcks();
+	EXPECT_TRUE(driver.Commander->setPowerState(kPowerStateSleep, driver.Commander) != IOPMAckImplied);
+	EXPECT_TRUE(driver.Commander->setPowerStateExternal(kPowerStateSleep, powerHook) != IOPMAckImplied);
+	// asked again while queued: nothing more to wait for
+	EXPECT_EQ(IOPMAckImplied, driver.Commander->setPowerState(kPowerStateSleep, driver.Commander));
+	EXPECT_EQ(acks, driver.Commander->hostGetPowerAcks());
+
+	hold.release();
+	EXPECT_TRUE(hostWaitIdle());
+
+	// one pass over the pins, CC's path powers them down, the power hook's finds them down
+	UInt32 off = hold.EAPDOff;
+	EXPECT_TRUE(off > 0);
+	EXPECT_EQ(acks + 1, driver.Commander->hostGetPowerAcks());
+	EXPECT_EQ(1, powerHook->hostGetPowerAcks());
+	EXPECT_EQ(0, driver.Codec->getWidget(0x14)->State.Eapd);
+
+	// a single sleep writes as many
+	EXPECT_EQ(IOPMAckImplied, driver.Commander->setPowerState(kPowerStateNormal, driver.Commander));
+	EXPECT_TRUE(hostWaitIdle());
+	EXPECT_TRUE(driver.Commander->setPowerState(kPowerStateSleep, driver.Commander) != IOPMAckImplied);
+	EXPECT_TRUE(hostWaitIdle());
+	EXPECT_EQ(off * 2, hold.EAPDOff);
+
+	driver.HDA->setVerbHook(NULL, NULL);
+	powerHook->release();
+}
+
+// Check Infinitely
+
+TEST(AudioDevicePowerChangesFollowedWithSlowPoll)
+{
+	FakeCodec* codec = FakeCodec::createALC269();
+	FakeHDA* hda = new FakeHDA(codec);
+
+	// the audio driver on the codec, found by the first timer tick after wake
+	IOAudioDevice* audioDevice = new IOAudioDevice;
+	audioDevice->init();
+	audioDevice->attach(hda->getCodecNub());
+
+	OSDictionary* profile = createProfile(false);
+	profile->setObject("Check Infinitely", kOSBooleanTrue);
+	OSNumber* interval = OSNumber::withNumber(1000, 32);
+	profile->setObject("Check Interval", interval);
+	interval->release();
+	OSDictionary* properties = OSDictionary::withCapacity(1);
+	OSDictionary* profiles = Driver::wrapProfile(profile);
+	properties->setObject(kCodecProfile, profiles);
+	profiles->release();
+
+	CodecCommander* commander = new CodecCommander;
+	commander->init(properties);
+	properties->release();
+	commander->attach(hda->getCodecNub());
+	EXPECT_TRUE(commander->start(hda->getCodecNub()));
+	commander->setPowerState(kPowerStateNormal, commander);
+	hostAdvanceTime(20000 * 1000);
+	EXPECT_TRUE(hostWaitIdle());
+
+	// power management changes arrive through powerStateDidChangeTo, without waiting
+	FakeWidget* speaker = codec->getWidget(0x14);
+	speaker->State.Eapd = 0;
+	audioDevice->hostSetPowerState(kIOAudioDeviceActive, true);
+	EXPECT_TRUE(hostWaitIdle());
+	EXPECT_EQ(0x02, speaker->State.Eapd);
+
+	audioDevice->hostSetPowerState(kIOAudioDeviceSleep, true);
+	EXPECT_TRUE(hostWaitIdle());
+	EXPECT_EQ(0, speaker->State.Eapd);
+
+	// fugue is not one of them: seen by the slow poll, not at the next Check Interval
+	audioDevice->hostSetPowerState(kIOAudioDeviceActive);
+	hostAdvanceTime(2000 * 1000);
+	EXPECT_TRUE(hostWaitIdle());
+	EXPECT_EQ(0, speaker->State.Eapd);
+	hostAdvanceTime(10000 * 1000);
+	EXPECT_TRUE(hostWaitIdle());
+	EXPECT_EQ(0x02, speaker->State.Eapd);
+
+	commander->stop(hda->getCodecNub());
+	commander->detach(hda->getCodecNub());
+	commander->release();
+	audioDevice->detach(hda->getCodecNub());
+	audioDevice->release();
+	delete hda;
+	delete codec;
+}
+
+// Custom commands
+
+TEST(CustomCommandsBeyondOneBatch)
+{
+	// processing coefficients 0-69 of the vendor widget, the index advances with each write
+	OSDictionary* profile = createProfile(true);
+	OSArray* list = OSArray::withCapacity(71);
+	for (int i = 0; i <= 70; i++)
+	{
+		OSDictionary* dict = OSDictionary::withCapacity(2);
+		OSNumber* command = OSNumber::withNumber(i ? 0x02040000 | i : 0x02050000, 32);
+		dict->setObject("Command", command);
+		dict->setObject("On Init", kOSBooleanTrue);
+		list->setObject(dict);
+		command->release();
+		dict->release();
+	}
+	profile->setObject("Custom Commands", list);
+	list->release();
+
+	Driver driver(profile);
+	ASSERT_TRUE(driver.Started);
+
+	// all of them, in order, over three batches
+	FakeWidget* vendor = driver.Codec->getWidget(0x20);
+	ASSERT_TRUE(vendor->Coefficients.size() == 70);
+	for (int i = 0; i < 70; i++)
+		EXPECT_EQ(i + 1, vendor->Coefficients[i]);
+	EXPECT_EQ(70, vendor->State.CoefIndex);
+}
+
+// Transition profile
+
+// Transition CodecCommander published, most recent first
+static OSDictionary* getTransition(Driver* driver, unsigned int index)
+{
+	OSDictionary* profile = OSDynamicCast(OSDictionary, driver->Commander->getProperty("Transition Profile"));
+	OSArray* recent = profile ? OSDynamicCast(OSArray, profile->getObject("Recent")) : NULL;
+	return recent ? OSDynamicCast(OSDictionary, recent->getObject(index)) : NULL;
+}
+
+static UInt64 getPhase(Driver* driver, unsigned int index, const char* phase)
+{
+	OSDictionary* transition = getTransition(driver, index);
+	OSNumber* number = transition ? OSDynamicCast(OSNumber, transition->getObject(phase)) : NULL;
+	return number ? number->unsigned64BitValue() : (UInt64)-1;
+}
+
+TEST(TransitionPhasesTimedOnTheVirtualClock)
+{
+	OSDictionary* profile = createProfile(true);
+	OSNumber* delay = OSNumber::withNumber(200, 32);
+	profile->setObject("Send Delay", delay);
+	delay->release();
+
+	// init, then wake, sleep and wake
+	Driver driver(profile);
+	ASSERT_TRUE(driver.Started);
+	driver.Commander->setPowerState(kPowerStateNormal, driver.Commander);
+	EXPECT_TRUE(hostWaitIdle());
+	driver.Commander->setPowerState(kPowerStateSleep, driver.Commander);
+	EXPECT_TRUE(hostWaitIdle());
+	driver.Commander->setPowerState(kPowerStateNormal, driver.Commander);
+	EXPECT_TRUE(hostWaitIdle());
+
+	// Send Delay sleeps exactly, EAPD is a verb per pin (0x14, 0x15), a frame each
+	UInt64 frame = kFakeFrameNS / 1000;
+	for (unsigned int i = 0; i < 2; i++)
+	{
+		OSDictionary* transition = getTransition(&driver, i);
+		ASSERT_TRUE(transition != NULL);
+		OSString* name = OSDynamicCast(OSString, transition->getObject("Transition"));
+		ASSERT_TRUE(name != NULL);
+		EXPECT_TRUE(name->isEqualTo(i ? "Sleep" : "Wake"));
+
+		UInt64 sendDelay = getPhase(&driver, i, "Send Delay"), eapd = getPhase(&driver, i, "EAPD");
+		EXPECT_EQ(200000, sendDelay);
+		EXPECT_TRUE(eapd >= 2 * frame && eapd <= 2 * frame + 10);
+		EXPECT_EQ(i ? (UInt64)-1 : 0, getPhase(&driver, i, "TCSEL"));
+
+		// Perform Reset resets the codec on wake from sleep, phases that did not run are left out
+		UInt64 reset = getPhase(&driver, i, "Reset");
+		EXPECT_TRUE(i ? reset == (UInt64)-1 : reset > 0 && reset < 10000);
+		EXPECT_EQ((UInt64)-1, getPhase(&driver, i, "Custom Commands"));
+
+		UInt64 phases = sendDelay + eapd + (i ? 0 : reset), total = getPhase(&driver, i, "Total");
+		EXPECT_TRUE(total >= phases && total <= phases + 100);
+	}
+
+	// a sample per transition that ran the phase, bucketed by its time
+	OSDictionary* summary = OSDynamicCast(OSDictionary, driver.Commander->getProperty("Transition Profile"));
+	ASSERT_TRUE(summary != NULL);
+	EXPECT_EQ(4, hostGetNumber(summary, "Total", "Count"));
+	EXPECT_EQ(4, hostGetNumber(summary, "Phases", "Send Delay", "Count"));
+	EXPECT_EQ(200000, hostGetNumber(summary, "Phases", "Send Delay", "Min"));
+	EXPECT_EQ(200000, hostGetNumber(summary, "Phases", "Send Delay", "Max"));
+	EXPECT_EQ(3, hostGetNumber(summary, "Phases", "EAPD", "Count"));
+	EXPECT_EQ(2, hostGetNumber(summary, "Phases", "TCSEL", "Count"));
+	EXPECT_EQ(1, hostGetNumber(summary, "Phases", "Reset", "Count"));
+	EXPECT_EQ(0, hostGetNumber(summary, "Phases", "Custom Commands", "Count"));
+
+	// 200 ms is in bucket 18 (2^17-2^18 us), the last one in use
+	OSDictionary* phases = OSDynamicCast(OSDictionary, summary->getObject("Phases"));
+	OSDictionary* sendDelay = phases ? OSDynamicCast(OSDictionary, phases->getObject("Send Delay")) : NULL;
+	OSArray* buckets = sendDelay ? OSDynamicCast(OSArray, sendDelay->getObject("Buckets")) : NULL;
+	ASSERT_TRUE(buckets != NULL && buckets->getCount() == 19);
+	OSNumber* samples = OSDynamicCast(OSNumber, buckets->getObject(18));
+	EXPECT_EQ(4, samples ? samples->unsigned32BitValue() : 0);
+}
@@ -0,0 +1,241 @@
+/*
+ *  Released under "The GNU General Public License (GPL-2.0)"
+ *
+ *  This program is free software; you can redistribute it and/or modify it
+ *  under the terms of the GNU General Public License as published by the
+ *  Free Software Foundation; either version 2 of the License, or (at your
+ *  option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ *  or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ *  for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ *
+ */
+
+#include "Harness.h"
+#include "FakeHDA.h"
+#include "CodecTopology.h"
+#include "AlsaDump.h"
+
+// Connection list parsing
+
+TEST(ShortFormListWithRange)
+{
+	// 0x18, 0x19-0x1b (range), 0x1d, 0x0b
+	const UInt32 responses[] = { 0x1d9b1918, 0x0000000b };
+	UInt8 connections[16];
+
+	EXPECT_EQ(6, CodecTopology::parseConnections(responses, 5, false, NULL));
+	ASSERT_TRUE(CodecTopology::parseConnections(responses, 5, false, connections) == 6);
+
+	const UInt8 expected[] = { 0x18, 0x19, 0x1a, 0x1b, 0x1d, 0x0b };
+	for (int i = 0; i < 6; i++)
+		EXPECT_EQ(expected[i], connections[i]);
+}
+
+TEST(LongFormListWithRange)
+{
+	// 0x02, 0x03-0x05 (range), 0x0c
+	const UInt32 responses[] = { 0x80050002, 0x0000000c };
+	UInt8 connections[16];
+
+	ASSERT_TRUE(CodecTopology::parseConnections(responses, 3, true, connections) == 5);
+
+	const UInt8 expected[] = { 0x02, 0x03, 0x04, 0x05, 0x0c };
+	for (int i = 0; i < 5; i++)
+		EXPECT_EQ(expected[i], connections[i]);
+}
+
+TEST(LongFormRangeOverAByteOfNodes)
+{
+	// 0x01, 0x02-0xff (range), 0x02: one node more than a byte counts
+	const UInt32 responses[] = { 0x80ff0001, 0x00000002 };
+	UInt8 connections[256];
+
+	EXPECT_EQ(256, CodecTopology::parseConnections(responses, 3, true, NULL));
+	ASSERT_TRUE(CodecTopology::parseConnections(responses, 3, true, connections) == 256);
+	EXPECT_EQ(0x01, connections[0]);
+	EXPECT_EQ(0x02, connections[1]);
+	EXPECT_EQ(0xff, connections[254]);
+	EXPECT_EQ(0x02, connections[255]);
+}
+
+TEST(RangeWithoutPreviousEntryIsSingleNode)
+{
+	const UInt32 responses[] = { 0x00000098 };
+	UInt8 connections[4];
+
+	ASSERT_TRUE(CodecTopology::parseConnections(responses, 1, false, connections) == 1);
+	EXPECT_EQ(0x18, connections[0]);
+}
+
+// Widget graph read from the codec
+
+static void testTopology(HDACommandMode mode)
+{
+	FakeCodec* codec = FakeCodec::createALC269();
+	FakeHDA* hda = new FakeHDA(codec);
+	IntelHDA* engine = new IntelHDA(hda->getCodecNub(), mode);
+	ASSERT_TRUE(engine->initialize());
+
+	UInt32 verbs = codec->getVerbCount();
+	CodecTopology* topology = engine->getTopology();
+	ASSERT_TRUE(topology != NULL);
+	EXPECT_TRUE(engine->getTopology() == topology);
+
+	EXPECT_EQ(0x02, topology->getStartingNode());
+	EXPECT_EQ(34, topology->getTotalNodes());
+	EXPECT_EQ(HDA_WIDGET_TYPE_PIN, topology->getWidgetType(0x14));
+	EXPECT_EQ(0x0040058d, topology->getWidgetCaps(0x14));
+	EXPECT_EQ(0x00010014, topology->getPinCaps(0x14));
+	EXPECT_EQ(0x00025757, topology->getAmpOutCaps(0x02));
+	EXPECT_EQ(0x02a11030, topology->getConfigDefault(0x18));
+	EXPECT_EQ(0, topology->getWidgetCaps(0x10));
+	EXPECT_EQ(0, topology->getWidgetCaps(0x40));
+
+	// 0x23 lists 0x19-0x1b as a range
+	UInt16 count;
+	const UInt8* connections = topology->getConnections(0x23, &count);
+	ASSERT_TRUE(connections != NULL && count == 7);
+	const UInt8 expected[] = { 0x18, 0x19, 0x1a, 0x1b, 0x1d, 0x0b, 0x12 };
+	for (int i = 0; i < 7; i++)
+		EXPECT_EQ(expected[i], connections[i]);
+	EXPECT_TRUE(topology->getConnections(0x02, &count) == NULL && count == 0);
+
+	UInt8 pins;
+	const UInt8* eapd = topology->getEAPDCapablePins(&pins);
+	ASSERT_TRUE(pins == 2);
+	EXPECT_EQ(0x14, eapd[0]);
+	EXPECT_EQ(0x15, eapd[1]);
+
+	UInt8 jacks[8];
+	ASSERT_TRUE(topology->getJackPins(jacks, 8) == 2);
+	EXPECT_EQ(0x15, jacks[0]);
+	EXPECT_EQ(0x18, jacks[1]);
+
+	UInt8 path[8];
+	ASSERT_TRUE(topology->findPath(0x02, 0x14, path, 8) == 3);
+	EXPECT_EQ(0x02, path[0]);
+	EXPECT_EQ(0x0c, path[1]);
+	EXPECT_EQ(0x14, path[2]);
+	EXPECT_EQ(0, topology->findPath(0x02, 0x14, path, 2));
+	EXPECT_EQ(0, topology->findPath(0x14, 0x02, path, 8));
+
+	// one verb per parameter and node plus the connection lists, read once
+	EXPECT_TRUE(codec->getVerbCount() - verbs < 34 * 8);
+	OSDictionary* statistics = engine->createStatistics();
+	EXPECT_EQ(34, hostGetNumber(statistics, "Topology", "Nodes"));
+	EXPECT_EQ(topology->getMemoryFootprint(), hostGetNumber(statistics, "Topology", "Memory Footprint"));
+	statistics->release();
+
+	delete engine;
+	delete hda;
+	delete codec;
+}
+
+TEST(TopologyOverImmediateCommands)
+{
+	testTopology(PIO);
+}
+
+TEST(TopologyOverCommandRings)
+{
+	testTopology(DMA);
+}
+
+TEST(TopologyWithLongFormRanges)
+{
+	// two selectors listing every node through long form ranges
+	FakeCodec* codec = new FakeCodec(0x10ec0900, 0x1458a182);
+	for (UInt8 node = 0x02; node <= 0x03; node++)
+	{
+		FakeWidget* widget = codec->addWidget(node, 0x0030010b);
+		widget->Connections = { 0x01, 0x80ff, 0x02 };
+		widget->LongForm = true;
+	}
+	codec->setDefaults();
+	FakeHDA* hda = new FakeHDA(codec);
+	IntelHDA* engine = new IntelHDA(hda->getCodecNub(), PIO);
+	ASSERT_TRUE(engine->initialize());
+
+	CodecTopology* topology = engine->getTopology();
+	ASSERT_TRUE(topology != NULL);
+
+	UInt16 count;
+	const UInt8* connections = topology->getConnections(0x03, &count);
+	ASSERT_TRUE(connections != NULL && count == 256);
+	EXPECT_EQ(0x01, connections[0]);
+	EXPECT_EQ(0xff, connections[254]);
+	EXPECT_EQ(0x02, connections[255]);
+
+	OSDictionary* statistics = engine->createStatistics();
+	EXPECT_EQ(512, hostGetNumber(statistics, "Topology", "Connections"));
+	statistics->release();
+
+	delete engine;
+	delete hda;
+	delete codec;
+}
+
+// Largest dumped codec: ALC1150, nodes 0x02-0x26
+
+static void testLargeTopology(HDACommandMode mode, const char* name)
+{
+	FakeCodec* codec = AlsaDumpParser::parseFile(HOST_SOURCE_DIR "/Tests/Data/ALC1150.txt");
+	ASSERT_TRUE(codec != NULL);
+	FakeHDA* hda = new FakeHDA(codec);
+	IntelHDA* engine = new IntelHDA(hda->getCodecNub(), mode);
+	ASSERT_TRUE(engine->initialize());
+
+	CodecTopology* topology = engine->getTopology();
+	ASSERT_TRUE(topology != NULL);
+	EXPECT_EQ(0x02, topology->getStartingNode());
+	EXPECT_EQ(0x25, topology->getTotalNodes());
+
+	UInt32 connections = 0;
+	for (UInt8 node = 0x02; node <= 0x26; node++)
+	{
+		UInt16 count;
+		topology->getConnections(node, &count);
+		connections += count;
+	}
+
+	// six capability words, a connection count and an EAPD slot per node, a byte per connection
+	size_t footprint = topology->getMemoryFootprint(), perNode = 6 * sizeof(UInt32) + sizeof(UInt16) + sizeof(UInt8);
+	EXPECT_EQ(sizeof(CodecTopology) + 0x25 * perNode + connections, footprint);
+	EXPECT_TRUE(footprint < 2048);
+
+	// virtual clock: six capabilities and the connection lists per node, at most two frames per verb
+	UInt32 buildTime = topology->getBuildTime();
+	EXPECT_TRUE(buildTime > 0);
+	EXPECT_TRUE(buildTime < 0x25 * 8 * 42);
+
+	OSDictionary* statistics = engine->createStatistics();
+	EXPECT_EQ(0x25, hostGetNumber(statistics, "Topology", "Nodes"));
+	EXPECT_EQ(connections, hostGetNumber(statistics, "Topology", "Connections"));
+	EXPECT_EQ(footprint, hostGetNumber(statistics, "Topology", "Memory Footprint"));
+	EXPECT_EQ(buildTime, hostGetNumber(statistics, "Topology", "Build Time"));
+	statistics->release();
+
+	fprintf(stderr, "  %s: %d nodes, %u connections, %zu bytes, built in %u us\n",
+			name, topology->getTotalNodes(), connections, footprint, buildTime);
+
+	delete engine;
+	delete hda;
+	delete codec;
+}
+
+TEST(LargeTopologyOverImmediateCommands)
+{
+	testLargeTopology(PIO, "PIO");
+}
+
+TEST(LargeTopologyOverCommandRings)
+{
+	testLargeTopology(DMA, "DMA");
+}
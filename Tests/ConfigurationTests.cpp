@@ -0,0 +1,191 @@
+/*
+ *  Released under "The GNU General Public License (GPL-2.0)"
+ *
+ *  This program is free software; you can redistribute it and/or modify it
+ *  under the terms of the GNU General Public License as published by the
+ *  Free Software Foundation; either version 2 of the License, or (at your
+ *  option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ *  or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ *  for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ *
+ */
+
+#include "Harness.h"
+#include "Configuration.h"
+
+static void setNumber(OSDictionary* dict, const char* key, UInt32 value)
+{
+	OSNumber* number = OSNumber::withNumber(value, 32);
+	dict->setObject(key, number);
+	number->release();
+}
+
+static OSDictionary* addProfile(OSDictionary* profiles, const char* key, UInt16 sendDelay)
+{
+	OSDictionary* profile = OSDictionary::withCapacity(4);
+	setNumber(profile, "Send Delay", sendDelay);
+	profiles->setObject(key, profile);
+	profile->release();
+	return profile;
+}
+
+static OSDictionary* addCommand(OSArray* list, OSObject* command, bool onInit, bool onSleep, bool onWake)
+{
+	OSDictionary* dict = OSDictionary::withCapacity(4);
+	dict->setObject("Command", command);
+	dict->setObject("On Init", onInit ? kOSBooleanTrue : kOSBooleanFalse);
+	dict->setObject("On Sleep", onSleep ? kOSBooleanTrue : kOSBooleanFalse);
+	dict->setObject("On Wake", onWake ? kOSBooleanTrue : kOSBooleanFalse);
+	list->setObject(dict);
+	dict->release();
+	command->release();
+	return dict;
+}
+
+// Profile lookup goes from the longest key to the vendor only key
+
+TEST(ProfileLookupPrefersFullSubsystem)
+{
+	OSDictionary* profiles = OSDictionary::withCapacity(8);
+	addProfile(profiles, "Default", 300);
+	addProfile(profiles, "10ec", 40);
+	addProfile(profiles, "10ec_0269", 30);
+	addProfile(profiles, "10ec_0269_HDA_1025", 20);
+	addProfile(profiles, "10ec_0269_HDA_1025_0775", 10);
+
+	Configuration* exact = new Configuration(profiles, 0x10ec0269, 0x10250775);
+	EXPECT_EQ(10, exact->getSendDelay());
+	delete exact;
+
+	Configuration* vendorSubsystem = new Configuration(profiles, 0x10ec0269, 0x10250776);
+	EXPECT_EQ(20, vendorSubsystem->getSendDelay());
+	delete vendorSubsystem;
+
+	Configuration* codec = new Configuration(profiles, 0x10ec0269, 0x17aa2211);
+	EXPECT_EQ(30, codec->getSendDelay());
+	delete codec;
+
+	Configuration* vendor = new Configuration(profiles, 0x10ec0282, 0x17aa2211);
+	EXPECT_EQ(40, vendor->getSendDelay());
+	delete vendor;
+
+	Configuration* other = new Configuration(profiles, 0x80862882, 0x17aa2211);
+	EXPECT_EQ(300, other->getSendDelay());
+	delete other;
+
+	profiles->release();
+}
+
+TEST(ProfileLookupFollowsStringRedirect)
+{
+	OSDictionary* profiles = OSDictionary::withCapacity(4);
+	addProfile(profiles, "ALC269", 75);
+	OSString* redirect = OSString::withCString("ALC269");
+	profiles->setObject("10ec_0269", redirect);
+	redirect->release();
+
+	Configuration* config = new Configuration(profiles, 0x10ec0269, 0);
+	EXPECT_EQ(75, config->getSendDelay());
+	delete config;
+
+	profiles->release();
+}
+
+TEST(CodecProfileReadOnTopOfDefault)
+{
+	OSDictionary* profiles = OSDictionary::withCapacity(4);
+	OSDictionary* defaults = addProfile(profiles, "Default", 300);
+	defaults->setObject("Use DMA Commands", kOSBooleanTrue);
+	setNumber(defaults, "Command Timeout", 25);
+	OSDictionary* codec = addProfile(profiles, "10ec_0269", 100);
+	codec->setObject("Perform Reset", kOSBooleanFalse);
+
+	Configuration* config = new Configuration(profiles, 0x10ec0269, 0);
+	EXPECT_EQ(100, config->getSendDelay());
+	EXPECT_TRUE(config->getUseDMACommands());
+	EXPECT_EQ(25, config->getCommandTimeout());
+	EXPECT_FALSE(config->getPerformReset());
+	// unset everywhere: built-in default
+	EXPECT_TRUE(config->getUpdateNodes());
+	EXPECT_EQ(1000, config->getCheckInterval());
+
+	// the merged copy shows the same
+	EXPECT_EQ(100, hostGetNumber(config->mMergedConfig, "Send Delay"));
+	EXPECT_EQ(25, hostGetNumber(config->mMergedConfig, "Command Timeout"));
+	delete config;
+
+	profiles->release();
+}
+
+TEST(MissingProfilesUseBuiltInDefaults)
+{
+	Configuration* config = new Configuration(NULL, 0x10ec0269, 0);
+	EXPECT_FALSE(config->getDisable());
+	EXPECT_EQ(300, config->getSendDelay());
+	EXPECT_EQ(10, config->getCommandTimeout());
+	EXPECT_FALSE(config->getUseDMACommands());
+	EXPECT_TRUE(config->getPerformReset());
+
+	UInt32 count;
+	config->getCustomCommands(kStateInit, &count);
+	EXPECT_EQ(0, count);
+	delete config;
+}
+
+TEST(CustomCommandsSplitByState)
+{
+	OSDictionary* profiles = OSDictionary::withCapacity(4);
+	OSDictionary* codec = addProfile(profiles, "10ec_0269", 100);
+	OSArray* list = OSArray::withCapacity(4);
+	codec->setObject("Custom Commands", list);
+	list->release();
+
+	// number, string and data forms; data is big endian, two verbs here
+	static const UInt8 pair[] = { 0x01, 0x47, 0x0c, 0x02, 0x01, 0x57, 0x0c, 0x02 };
+	addCommand(list, OSNumber::withNumber(0x01470700, 32), true, false, true);
+	addCommand(list, OSString::withCString("0x01570740"), false, true, false);
+	addCommand(list, OSData::withBytes(pair, sizeof(pair)), true, true, false);
+	// not a command: skipped
+	addCommand(list, OSString::withCString("none"), true, true, true);
+
+	Configuration* config = new Configuration(profiles, 0x10ec0269, 0);
+	UInt32 count;
+
+	const UInt32* init = config->getCustomCommands(kStateInit, &count);
+	ASSERT_TRUE(count == 3);
+	EXPECT_EQ(0x01470700, init[0]);
+	EXPECT_EQ(0x01470c02, init[1]);
+	EXPECT_EQ(0x01570c02, init[2]);
+
+	const UInt32* sleep = config->getCustomCommands(kStateSleep, &count);
+	ASSERT_TRUE(count == 3);
+	EXPECT_EQ(0x01570740, sleep[0]);
+	EXPECT_EQ(0x01470c02, sleep[1]);
+
+	const UInt32* wake = config->getCustomCommands(kStateWake, &count);
+	ASSERT_TRUE(count == 1);
+	EXPECT_EQ(0x01470700, wake[0]);
+
+	delete config;
+	profiles->release();
+}
+
+TEST(DisabledProfileStopsParsing)
+{
+	OSDictionary* profiles = OSDictionary::withCapacity(4);
+	OSDictionary* codec = addProfile(profiles, "10ec_0269", 100);
+	codec->setObject("Disable", kOSBooleanTrue);
+
+	Configuration* config = new Configuration(profiles, 0x10ec0269, 0);
+	EXPECT_TRUE(config->getDisable());
+	delete config;
+
+	profiles->release();
+}
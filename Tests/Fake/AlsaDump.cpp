@@ -0,0 +1,381 @@
+/*
+ *  Released under "The GNU General Public License (GPL-2.0)"
+ *
+ *  This program is free software; you can redistribute it and/or modify it
+ *  under the terms of the GNU General Public License as published by the
+ *  Free Software Foundation; either version 2 of the License, or (at your
+ *  option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ *  or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ *  for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ *
+ */
+
+#include "AlsaDump.h"
+#include <stdio.h>
+#include <string.h>
+
+#define kWidgetCapsAmpOverride		(1 << 3)
+
+// Moves p behind prefix if the text starts with it
+static bool match(const char*& p, const char* end, const char* prefix)
+{
+	size_t length = strlen(prefix);
+	if ((size_t)(end - p) < length || memcmp(p, prefix, length))
+		return false;
+	p += length;
+	return true;
+}
+
+// Moves p behind the first occurrence of key
+static bool seek(const char*& p, const char* end, const char* key)
+{
+	size_t length = strlen(key);
+	const char* found = (const char*)memmem(p, end - p, key, length);
+	if (!found)
+		return false;
+	p = found + length;
+	return true;
+}
+
+// Number at p, hex with a 0x prefix, p moves behind it
+static UInt32 number(const char*& p, const char* end, int base = 10)
+{
+	if (end - p > 2 && p[0] == '0' && (p[1] == 'x' || p[1] == 'X'))
+	{
+		p += 2;
+		base = 16;
+	}
+
+	UInt32 value = 0;
+	for (; p < end; p++)
+	{
+		int digit;
+		char lower = *p | 0x20;
+		if (*p >= '0' && *p <= '9')
+			digit = *p - '0';
+		else if (base == 16 && lower >= 'a' && lower <= 'f')
+			digit = lower - 'a' + 10;
+		else
+			break;
+		value = value * base + digit;
+	}
+	return value;
+}
+
+// Number behind key=, zero if the line has no such field
+static UInt32 field(const char* p, const char* end, const char* key, int base = 10)
+{
+	return seek(p, end, key) ? number(p, end, base) : 0;
+}
+
+static void skipSpaces(const char*& p, const char* end)
+{
+	while (p < end && (*p == ' ' || *p == '\t'))
+		p++;
+}
+
+// "ofs=0x00, nsteps=0x57, stepsize=0x02, mute=0" or "N/A"
+static UInt32 parseAmpCaps(const char* p, const char* end)
+{
+	return field(p, end, "ofs=") | field(p, end, "nsteps=") << 8 |
+		field(p, end, "stepsize=") << 16 | field(p, end, "mute=") << 31;
+}
+
+// " [0x00 0x00] [0x80 0x80]" (left, right) or " [0x00]" for mono widgets
+static void parseAmpValues(const char* p, const char* end, UInt8 (*values)[2], int count)
+{
+	for (int index = 0; index < count && seek(p, end, "["); index++)
+	{
+		UInt8 left = number(p, end);
+		skipSpaces(p, end);
+		UInt8 right = p < end && *p != ']' ? number(p, end) : left;
+		values[index][1] = left;
+		values[index][0] = right;
+	}
+}
+
+// "D0 D1 D2 D3 CLKSTOP EPSS", the names of hda_proc.c
+static UInt32 parsePowerStates(const char* p, const char* end)
+{
+	static const struct { const char* Name; int Bit; } states[] =
+	{
+		{ "D0", 0 }, { "D1", 1 }, { "D2", 2 }, { "D3", 3 }, { "D3cold", 4 },
+		{ "S3D3cold", 29 }, { "CLKSTOP", 30 }, { "EPSS", 31 },
+	};
+	UInt32 supported = 0;
+
+	while (skipSpaces(p, end), p < end)
+	{
+		const char* token = p;
+		while (p < end && *p != ' ')
+			p++;
+
+		for (size_t i = 0; i < sizeof(states) / sizeof(states[0]); i++)
+			if (strlen(states[i].Name) == (size_t)(p - token) && !memcmp(states[i].Name, token, p - token))
+				supported |= 1U << states[i].Bit;
+	}
+	return supported;
+}
+
+// "setting=D3, actual=D3"
+static UInt8 parsePowerSetting(const char* p, const char* end)
+{
+	if (!seek(p, end, "setting=D"))
+		return 0;
+	UInt8 state = number(p, end);
+	return match(p, end, "cold") ? 4 : state;
+}
+
+AlsaDumpParser::AlsaDumpParser()
+{
+	mCodec = new FakeCodec(0, 0, 0);
+}
+
+AlsaDumpParser::~AlsaDumpParser()
+{
+	delete mCodec;
+}
+
+void AlsaDumpParser::parse(const char* text, size_t length)
+{
+	const char* end = text + length;
+
+	while (text < end)
+	{
+		const char* newline = (const char*)memchr(text, '\n', end - text);
+		if (!newline)
+		{
+			mLine.append(text, end);
+			return;
+		}
+
+		// whole lines are parsed in place, only a line split between pieces is copied
+		if (mLine.empty())
+			parseLine(text, newline);
+		else
+		{
+			mLine.append(text, newline);
+			parseLine(mLine.data(), mLine.data() + mLine.size());
+			mLine.clear();
+		}
+		text = newline + 1;
+	}
+}
+
+void AlsaDumpParser::parseLine(const char* line, const char* end)
+{
+	if (mDone || mFailed || !mCodec)
+		return;
+
+	if (end > line && end[-1] == '\r')
+		end--;
+
+	const char* p = line;
+	skipSpaces(p, end);
+	if (p == end)
+		return;
+
+	if (mConnectionList)
+	{
+		if (mConnectionList > 0)
+			parseConnections(p, end);
+		mConnectionList = 0;
+		return;
+	}
+
+	// indented: state of the function group or of the current node
+	if (p != line)
+	{
+		FakeWidget* widget = mWidget ? mWidget : mCodec->getFunctionGroup();
+
+		if (match(p, end, "rates ["))
+		{
+			if (mPCM)
+				widget->Params[0x0A] = (widget->Params[0x0A] & 0xFFFF0000) | number(p, end);
+		}
+		else if (match(p, end, "bits ["))
+		{
+			if (mPCM)
+				widget->Params[0x0A] = (widget->Params[0x0A] & 0xFFFF) | number(p, end) << 16;
+		}
+		else if (match(p, end, "formats ["))
+		{
+			if (mPCM)
+				widget->Params[0x0B] = number(p, end);
+		}
+		else if (match(p, end, "Power states:"))
+			widget->Params[0x0F] = parsePowerStates(p, end);
+		else if (match(p, end, "Power:"))
+			widget->State.PowerState = parsePowerSetting(p, end);
+		else if (mWidget)
+			parseNodeLine(p, end);
+		return;
+	}
+
+	mPCM = false;
+
+	if (match(p, end, "Node "))
+	{
+		if (!mFunctionGroup)
+			return;
+		UInt8 node = number(p, end, 16);
+		mWidget = mCodec->addWidget(node, field(p, end, "wcaps "));
+	}
+	else if (match(p, end, "Codec:"))
+		mDone = mVendor;
+	else if (match(p, end, "Vendor Id:"))
+	{
+		mDone = mVendor;
+		if (!mDone)
+		{
+			skipSpaces(p, end);
+			mCodec->setVendorId(number(p, end));
+			mVendor = true;
+		}
+	}
+	else if (match(p, end, "Subsystem Id: "))
+		mCodec->setSubsystemId(number(p, end));
+	else if (match(p, end, "Revision Id: "))
+		mCodec->setRevisionId(number(p, end));
+	else if (match(p, end, "AFG Function Id: "))
+	{
+		UInt32 type = number(p, end);
+		mCodec->getFunctionGroup()->Params[0x05] = type | field(p, end, "unsol ") << 8;
+	}
+	else if (match(p, end, "Default PCM:"))
+		mPCM = true;
+	else if (match(p, end, "Default Amp-In caps:"))
+		mCodec->getFunctionGroup()->Params[0x0D] = parseAmpCaps(p, end);
+	else if (match(p, end, "Default Amp-Out caps:"))
+		mCodec->getFunctionGroup()->Params[0x12] = parseAmpCaps(p, end);
+	else if (match(p, end, "State of AFG node "))
+	{
+		// the model has its function group at node 0x01, as every codec CodecCommander supports
+		mFailed = number(p, end) != 0x01;
+		mFunctionGroup = true;
+	}
+	else if (match(p, end, "GPIO: "))
+	{
+		mCodec->getFunctionGroup()->Params[0x11] = field(p, end, "io=") | field(p, end, ", o=") << 8 |
+			field(p, end, ", i=") << 16 | field(p, end, "unsolicited=") << 30 | field(p, end, "wake=") << 31;
+	}
+}
+
+void AlsaDumpParser::parseNodeLine(const char* p, const char* end)
+{
+	FakeWidget* widget = mWidget;
+	FakeWidgetState& state = widget->State;
+	bool ampOverride = widget->Params[0x09] & kWidgetCapsAmpOverride;
+
+	if (match(p, end, "Amp-In caps:"))
+	{
+		// without the override the node inherits (and hda_proc prints) the function group caps
+		if (ampOverride)
+			widget->Params[0x0D] = parseAmpCaps(p, end);
+	}
+	else if (match(p, end, "Amp-Out caps:"))
+	{
+		if (ampOverride)
+			widget->Params[0x12] = parseAmpCaps(p, end);
+	}
+	else if (match(p, end, "Amp-In vals:"))
+		parseAmpValues(p, end, state.AmpIn, 16);
+	else if (match(p, end, "Amp-Out vals:"))
+		parseAmpValues(p, end, &state.AmpOut, 1);
+	else if (match(p, end, "Pincap "))
+		widget->Params[0x0C] = number(p, end);
+	else if (match(p, end, "EAPD "))
+		state.Eapd = number(p, end);
+	else if (match(p, end, "Pin Default "))
+		widget->ConfigDefault = number(p, end);
+	else if (match(p, end, "Pin-ctls: "))
+		state.PinControl = number(p, end);
+	else if (match(p, end, "Unsolicited: "))
+		state.Unsolicited = (field(p, end, "tag=", 16) & 0x3F) | field(p, end, "enabled=") << 7;
+	else if (match(p, end, "Connection: "))
+		mConnectionList = number(p, end) ? 1 : 0;
+	else if (match(p, end, "In-driver Connection: "))
+		mConnectionList = number(p, end) ? -1 : 0;
+	else if (match(p, end, "PCM:"))
+		mPCM = true;
+	else if (match(p, end, "Processing caps: "))
+		widget->Params[0x10] = field(p, end, "benign=") | field(p, end, "ncoeff=") << 8;
+	else if (match(p, end, "Processing Coefficient: "))
+		mCoefficient = number(p, end);
+	else if (match(p, end, "Coefficient Index: "))
+	{
+		// Realtek vendor widgets: the coefficient at the current index
+		state.CoefIndex = number(p, end);
+		if (state.CoefIndex >= widget->Coefficients.size())
+			widget->Coefficients.resize(state.CoefIndex + 1);
+		widget->Coefficients[state.CoefIndex] = mCoefficient;
+	}
+	else if (match(p, end, "Volume-Knob: "))
+		widget->Params[0x13] = field(p, end, "steps=") | field(p, end, "delta=") << 7;
+}
+
+void AlsaDumpParser::parseConnections(const char* p, const char* end)
+{
+	// " 0x0c* 0x0d", expanded (no ranges), * marks the selected input
+	std::vector<UInt16>& connections = mWidget->Connections;
+	connections.clear();
+
+	while (skipSpaces(p, end), p < end)
+	{
+		const char* start = p;
+		UInt16 entry = number(p, end);
+		if (p == start)
+			break;
+
+		if (p < end && *p == '*')
+		{
+			mWidget->State.ConnectionSelect = connections.size();
+			p++;
+		}
+
+		// an entry past 0x7f would be a range in short form
+		if (entry > 0x7F)
+			mWidget->LongForm = true;
+		connections.push_back(entry);
+	}
+}
+
+FakeCodec* AlsaDumpParser::finish()
+{
+	if (!mLine.empty())
+	{
+		parseLine(mLine.data(), mLine.data() + mLine.size());
+		mLine.clear();
+	}
+
+	if (!mCodec || mFailed || !mVendor || !mFunctionGroup)
+		return NULL;
+
+	FakeCodec* codec = mCodec;
+	mCodec = NULL;
+	codec->setDefaults();
+	return codec;
+}
+
+FakeCodec* AlsaDumpParser::parseFile(const char* path)
+{
+	FILE* file = fopen(path, "r");
+	if (!file)
+		return NULL;
+
+	AlsaDumpParser parser;
+	char buffer[16384];
+	size_t length;
+	while ((length = fread(buffer, 1, sizeof(buffer), file)) > 0)
+		parser.parse(buffer, length);
+	fclose(file);
+
+	return parser.finish();
+}
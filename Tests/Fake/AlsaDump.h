@@ -0,0 +1,59 @@
+/*
+ *  Released under "The GNU General Public License (GPL-2.0)"
+ *
+ *  This program is free software; you can redistribute it and/or modify it
+ *  under the terms of the GNU General Public License as published by the
+ *  Free Software Foundation; either version 2 of the License, or (at your
+ *  option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ *  or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ *  for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ *
+ */
+
+#ifndef CodecCommander_AlsaDump_h
+#define CodecCommander_AlsaDump_h
+
+#include "FakeCodec.h"
+#include <string>
+
+// Codec model from the text of /proc/asound/cardN/codec#N (the layout of Linux hda_proc.c,
+// which hda-verb -d writes as well). Text is fed in pieces of any size as it is read, each
+// line is parsed once. Supports one audio function group at node 0x01, modem groups and
+// everything that is not state or a parameter (controls, stream formats) are skipped.
+class AlsaDumpParser
+{
+	FakeCodec* mCodec;
+	FakeWidget* mWidget = NULL;		// node being parsed, NULL while in the function group part
+	std::string mLine;				// partial line carried over from the previous piece
+	bool mVendor = false;			// seen Vendor Id
+	bool mFunctionGroup = false;	// seen the state of the AFG
+	bool mFailed = false;			// not a dump of an audio function group at node 0x01
+	bool mDone = false;				// the next codec of a multi codec dump started
+	bool mPCM = false;				// rates, bits and formats lines follow (function group or node)
+	int mConnectionList = 0;		// 1: the next line lists connections, -1: skip it
+	UInt16 mCoefficient = 0;		// processing coefficient, its index follows on the next line
+
+	void parseLine(const char* line, const char* end);
+	void parseNodeLine(const char* line, const char* end);
+	void parseConnections(const char* line, const char* end);
+
+public:
+	AlsaDumpParser();
+	~AlsaDumpParser();
+
+	void parse(const char* text, size_t length);
+	// Model of the dump (caller deletes), NULL if the text held no audio function group
+	FakeCodec* finish();
+
+	// Whole file at once, NULL if it cannot be read or parsed
+	static FakeCodec* parseFile(const char* path);
+};
+
+#endif
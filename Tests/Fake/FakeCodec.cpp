@@ -0,0 +1,309 @@
+/*
+ *  Released under "The GNU General Public License (GPL-2.0)"
+ *
+ *  This program is free software; you can redistribute it and/or modify it
+ *  under the terms of the GNU General Public License as published by the
+ *  Free Software Foundation; either version 2 of the License, or (at your
+ *  option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ *  or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ *  for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ *
+ */
+
+#include "FakeCodec.h"
+
+FakeCodec::FakeCodec(UInt32 vendorId, UInt32 subsystemId, UInt32 revisionId)
+{
+	mVendorId = vendorId;
+	mSubsystemId = subsystemId;
+	mRevisionId = revisionId;
+
+	FakeWidget* group = addWidget(mFunctionGroup, 0);
+	group->Params[0x05] = 0x00000101;	// audio function group, unsolicited capable
+	group->Params[0x0F] = 0x0000000F;	// D0-D3
+}
+
+FakeWidget* FakeCodec::addWidget(UInt8 node, UInt32 widgetCaps)
+{
+	if (node >= mNodes.size())
+		mNodes.resize(node + 1);
+
+	FakeWidget* widget = &mNodes[node];
+	*widget = FakeWidget();
+	widget->Exists = true;
+	widget->Params[0x09] = widgetCaps;
+	return widget;
+}
+
+void FakeCodec::setDefaults()
+{
+	for (size_t node = 0; node < mNodes.size(); node++)
+		mNodes[node].Defaults = mNodes[node].State;
+}
+
+void FakeCodec::reset(UInt64 now)
+{
+	for (size_t node = 0; node < mNodes.size(); node++)
+		mNodes[node].State = mNodes[node].Defaults;
+
+	mResponding = true;
+	mResetUntil = now + mResetLatency;
+	mResets++;
+}
+
+UInt32 FakeCodec::getParameter(UInt8 node, UInt8 parameter)
+{
+	if (node == 0)
+	{
+		switch (parameter)
+		{
+			case 0x00: return mVendorId;
+			case 0x02: return mRevisionId;
+			case 0x04: return mFunctionGroup << 16 | 1;
+			default: return 0;
+		}
+	}
+
+	FakeWidget* widget = getWidget(node);
+	if (!widget || parameter >= kFakeParamCount)
+		return 0;
+
+	if (node == mFunctionGroup && parameter == 0x04)
+	{
+		// widgets follow the function group, gaps answer with zero capabilities
+		UInt32 start = mFunctionGroup + 1;
+		UInt32 count = mNodes.size() > start ? (UInt32)mNodes.size() - start : 0;
+		return start << 16 | count;
+	}
+
+	if (parameter == 0x0E)
+		return (UInt32)widget->Connections.size() | (widget->LongForm ? 0x80 : 0);
+
+	return widget->Params[parameter];
+}
+
+UInt32 FakeCodec::getConnectionEntries(const FakeWidget& widget, UInt8 index)
+{
+	// 4 short form or 2 long form entries starting at index
+	int perResponse = widget.LongForm ? 2 : 4;
+	int width = widget.LongForm ? 16 : 8;
+	UInt32 response = 0;
+
+	for (int i = 0; i < perResponse && index + i < (int)widget.Connections.size(); i++)
+		response |= (UInt32)widget.Connections[index + i] << (i * width);
+
+	return response;
+}
+
+UInt32 FakeCodec::executeAmp(FakeWidget& widget, UInt8 verb, UInt16 payload)
+{
+	int index = verb == 0xB ? payload & 0xF : (payload >> 8) & 0xF;
+
+	if (verb == 0xB)
+	{
+		int side = payload & 0x2000 ? 1 : 0;
+		return payload & 0x8000 ? widget.State.AmpOut[side] : widget.State.AmpIn[index][side];
+	}
+
+	UInt8 value = payload & 0xFF;
+	for (int side = 0; side < 2; side++)
+	{
+		if (!(payload & (side ? 0x2000 : 0x1000)))
+			continue;
+		if (payload & 0x8000)
+			widget.State.AmpOut[side] = value;
+		if (payload & 0x4000)
+			widget.State.AmpIn[index][side] = value;
+	}
+	return 0;
+}
+
+UInt32 FakeCodec::executeCoefficient(FakeWidget& widget, UInt8 verb, UInt16 payload)
+{
+	UInt16& index = widget.State.CoefIndex;
+
+	switch (verb)
+	{
+		case 0x5:
+			index = payload;
+			return 0;
+		case 0xD:
+			return index;
+		case 0x4:
+			if (index >= widget.Coefficients.size())
+				widget.Coefficients.resize(index + 1);
+			widget.Coefficients[index++] = payload;
+			return 0;
+		case 0xC:
+		{
+			UInt32 value = index < widget.Coefficients.size() ? widget.Coefficients[index] : 0;
+			index++;
+			return value;
+		}
+	}
+	return 0;
+}
+
+bool FakeCodec::execute(UInt32 command, UInt64 now, UInt32* response)
+{
+	UInt8 node = command >> 20 & 0xFF;
+	UInt16 verb = command >> 8 & 0xFFF;
+	UInt8 payload = command & 0xFF;
+	bool reset = verb == 0x7FF && node == mFunctionGroup;
+
+	mVerbs++;
+
+	// a function group reset reaches even a codec that answers nothing else
+	if (!reset && (!mResponding || now < mResetUntil || mSilent[node]))
+		return false;
+
+	UInt32 result = 0;
+	FakeWidget* widget = getWidget(node);
+
+	if ((verb >> 8) != 0x7 && (verb >> 8) != 0xF)
+	{
+		// 4-bit verb with 16-bit payload: amplifiers and processing coefficients
+		UInt8 shortVerb = verb >> 8;
+		if (widget && (shortVerb == 0xB || shortVerb == 0x3))
+			result = executeAmp(*widget, shortVerb, command & 0xFFFF);
+		else if (widget && (shortVerb == 0x4 || shortVerb == 0x5 || shortVerb == 0xC || shortVerb == 0xD))
+			result = executeCoefficient(*widget, shortVerb, command & 0xFFFF);
+	}
+	else if (verb == 0xF00)
+		result = getParameter(node, payload);
+	else if (verb == 0x7FF)
+	{
+		if (reset)
+			this->reset(now);
+	}
+	else if (widget)
+	{
+		FakeWidgetState& state = widget->State;
+		switch (verb)
+		{
+			case 0xF01: result = state.ConnectionSelect; break;
+			case 0x701: state.ConnectionSelect = payload; break;
+			case 0xF02: result = getConnectionEntries(*widget, payload); break;
+			case 0xF05: result = state.PowerState << 4 | state.PowerState; break;
+			case 0x705: state.PowerState = payload & 0xF; break;
+			case 0xF07: result = state.PinControl; break;
+			case 0x707: state.PinControl = payload; break;
+			case 0xF08: result = state.Unsolicited; break;
+			case 0x708: state.Unsolicited = payload; break;
+			case 0xF09: result = widget->Present ? 0x80000000 : 0; break;
+			case 0xF0C: result = state.Eapd; break;
+			case 0x70C: state.Eapd = payload; break;
+			case 0xF1C: result = widget->ConfigDefault; break;
+			case 0x71C: case 0x71D: case 0x71E: case 0x71F:
+			{
+				int shift = (verb - 0x71C) * 8;
+				widget->ConfigDefault = (widget->ConfigDefault & ~(0xFFU << shift)) | (UInt32)payload << shift;
+				break;
+			}
+			case 0xF20:
+				if (node == mFunctionGroup)
+					result = mSubsystemId;
+				break;
+		}
+	}
+
+	// executed, but the response never makes it back
+	if (mDrop)
+	{
+		mDrop--;
+		return false;
+	}
+
+	*response = result;
+	return true;
+}
+
+bool FakeCodec::plug(UInt8 node, bool present, UInt32* unsolicited)
+{
+	FakeWidget* widget = getWidget(node);
+	if (!widget)
+		return false;
+
+	widget->Present = present;
+	if (!(widget->State.Unsolicited & 0x80) || !mResponding)
+		return false;
+
+	*unsolicited = (UInt32)(widget->State.Unsolicited & 0x3F) << 26;
+	return true;
+}
+
+static FakeWidget* addPin(FakeCodec* codec, UInt8 node, UInt32 widgetCaps, UInt32 pinCaps, UInt32 configDefault)
+{
+	FakeWidget* pin = codec->addWidget(node, widgetCaps);
+	pin->Params[0x0C] = pinCaps;
+	pin->ConfigDefault = configDefault;
+	return pin;
+}
+
+FakeCodec* FakeCodec::createALC269()
+{
+	FakeCodec* codec = new FakeCodec(0x10ec0269, 0x1025029b, 0x00100004);
+	FakeWidget* widget;
+
+	// converters
+	for (UInt8 node = 0x02; node <= 0x03; node++)
+	{
+		widget = codec->addWidget(node, 0x0000041d);
+		widget->Params[0x12] = 0x00025757;
+	}
+	for (UInt8 node = 0x08; node <= 0x09; node++)
+	{
+		widget = codec->addWidget(node, 0x0010011b);
+		widget->Params[0x0D] = 0x80051f17;
+		widget->Connections.push_back(node == 0x08 ? 0x23 : 0x22);
+	}
+
+	// mixers, 0x23 lists 0x18-0x1b as a range
+	widget = codec->addWidget(0x0b, 0x0020010b);
+	widget->Params[0x0D] = 0x80051f17;
+	widget->Connections = { 0x18, 0x19, 0x1a, 0x1b, 0x1d };
+	widget = codec->addWidget(0x0c, 0x0020010b);
+	widget->Params[0x0D] = 0x80000000;
+	widget->Connections = { 0x02, 0x0b };
+	widget = codec->addWidget(0x0d, 0x0020010b);
+	widget->Params[0x0D] = 0x80000000;
+	widget->Connections = { 0x03, 0x0b };
+	widget = codec->addWidget(0x22, 0x0020010b);
+	widget->Params[0x0D] = 0x80000000;
+	widget->Connections = { 0x18, 0x19, 0x1a, 0x1b, 0x1d, 0x0b, 0x12 };
+	widget = codec->addWidget(0x23, 0x0020010b);
+	widget->Params[0x0D] = 0x80000000;
+	widget->Connections = { 0x18, 0x80 | 0x1b, 0x1d, 0x0b, 0x12 };
+
+	// pins: speaker and headphone with EAPD, mic jack, internal mic, the rest not connected
+	widget = addPin(codec, 0x12, 0x0040040b, 0x00000020, 0x411111f0);
+	widget = addPin(codec, 0x14, 0x0040058d, 0x00010014, 0x90170110);
+	widget->Params[0x12] = 0x80000000;
+	widget->Connections = { 0x0c, 0x0d };
+	widget->State.Eapd = 0x02;
+	widget = addPin(codec, 0x15, 0x0040058d, 0x0001001c, 0x0221101f);
+	widget->Params[0x12] = 0x80000000;
+	widget->Connections = { 0x0c, 0x0d };
+	widget->State.Eapd = 0x02;
+	widget = addPin(codec, 0x18, 0x0040048b, 0x00003724, 0x02a11030);
+	widget->Params[0x0D] = 0x00270300;
+	widget = addPin(codec, 0x19, 0x0040048b, 0x00003724, 0x99a30920);
+	widget->Params[0x0D] = 0x00270300;
+	addPin(codec, 0x1a, 0x0040048b, 0x00003724, 0x411111f0);
+	addPin(codec, 0x1b, 0x0040048b, 0x00003724, 0x411111f0);
+	addPin(codec, 0x1d, 0x00400400, 0x00000020, 0x411111f0);
+	addPin(codec, 0x1e, 0x00400781, 0x00000010, 0x411111f0);
+
+	// vendor defined processing widget
+	codec->addWidget(0x20, 0x00f00040);
+
+	codec->setDefaults();
+	return codec;
+}
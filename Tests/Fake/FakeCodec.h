@@ -0,0 +1,118 @@
+/*
+ *  Released under "The GNU General Public License (GPL-2.0)"
+ *
+ *  This program is free software; you can redistribute it and/or modify it
+ *  under the terms of the GNU General Public License as published by the
+ *  Free Software Foundation; either version 2 of the License, or (at your
+ *  option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ *  or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ *  for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ *
+ */
+
+#ifndef CodecCommander_FakeCodec_h
+#define CodecCommander_FakeCodec_h
+
+#include "HostKernel.h"
+#include <vector>
+
+// GET_PARAM 0x00-0x13 are kept per node, the connection list length is computed
+#define kFakeParamCount		0x14
+
+// Verb state of a widget, a function group reset restores the defaults
+struct FakeWidgetState
+{
+	UInt8 PowerState;			// PS-Set, PS-Act follows at once
+	UInt8 PinControl;
+	UInt8 Eapd;
+	UInt8 Unsolicited;			// SET_UNSOL_ENABLE payload
+	UInt8 ConnectionSelect;
+	UInt8 AmpOut[2];			// right, left: gain | mute << 7
+	UInt8 AmpIn[16][2];
+	UInt16 CoefIndex;			// processing coefficient index, advances with every access
+};
+
+struct FakeWidget
+{
+	bool Exists;
+	UInt32 Params[kFakeParamCount];
+	UInt32 ConfigDefault;
+	std::vector<UInt16> Connections;	// raw entries, a range has the top bit set (0x80, long form 0x8000)
+	bool LongForm;
+	bool Present;						// jack sense
+	std::vector<UInt16> Coefficients;	// processing coefficients (vendor widgets), grown on write
+	FakeWidgetState State;
+	FakeWidgetState Defaults;
+};
+
+// Codec behind the link: answers verbs from a widget table (root node 0, one audio function group)
+class FakeCodec
+{
+	UInt32 mVendorId;
+	UInt32 mRevisionId;
+	UInt32 mSubsystemId;
+	UInt8 mFunctionGroup = 1;
+	std::vector<FakeWidget> mNodes;
+
+	// fault injection
+	bool mResponding = true;
+	UInt64 mResetLatency = 0;		// ns
+	UInt64 mResetUntil = 0;
+	UInt32 mDrop = 0;
+	bool mSilent[256] = { };
+
+	UInt32 mVerbs = 0;
+	UInt32 mResets = 0;
+
+	UInt32 getParameter(UInt8 node, UInt8 parameter);
+	UInt32 getConnectionEntries(const FakeWidget& widget, UInt8 index);
+	UInt32 executeAmp(FakeWidget& widget, UInt8 verb, UInt16 payload);
+	UInt32 executeCoefficient(FakeWidget& widget, UInt8 verb, UInt16 payload);
+	void reset(UInt64 now);
+
+public:
+	FakeCodec(UInt32 vendorId, UInt32 subsystemId, UInt32 revisionId = 0x00100100);
+
+	// The function group node (created here) and its widgets; node 0 is the root
+	FakeWidget* getFunctionGroup() { return &mNodes[mFunctionGroup]; }
+	FakeWidget* addWidget(UInt8 node, UInt32 widgetCaps);
+	FakeWidget* getWidget(UInt8 node) { return node < mNodes.size() && mNodes[node].Exists ? &mNodes[node] : NULL; }
+	UInt32 getVendorId() { return mVendorId; }
+	void setVendorId(UInt32 vendorId) { mVendorId = vendorId; }
+	UInt32 getSubsystemId() { return mSubsystemId; }
+	UInt32 getRevisionId() { return mRevisionId; }
+	void setSubsystemId(UInt32 subsystemId) { mSubsystemId = subsystemId; }
+	void setRevisionId(UInt32 revisionId) { mRevisionId = revisionId; }
+	// Current verb state becomes the power on default
+	void setDefaults();
+
+	// Execute a verb (codec address bits ignored) at time now (ns), false if there is no response
+	bool execute(UInt32 command, UInt64 now, UInt32* response);
+
+	// Jack (un)plugged, true with the unsolicited response if the pin has it enabled
+	bool plug(UInt8 node, bool present, UInt32* unsolicited);
+
+	// D3cold: nothing is answered until a function group reset
+	void setResponding(bool responding) { mResponding = responding; }
+	// Time after a function group reset until the codec answers again
+	void setResetLatency(UInt32 microseconds) { mResetLatency = (UInt64)microseconds * 1000; }
+	// Verbs to this node are never answered
+	void setSilentNode(UInt8 node, bool silent) { mSilent[node] = silent; }
+	// The next verbs are executed but their responses are lost
+	void dropResponses(UInt32 count) { mDrop = count; }
+
+	UInt32 getVerbCount() { return mVerbs; }
+	UInt32 getResetCount() { return mResets; }
+
+	// Realtek ALC269 as found in many laptops: speaker, headphone and mic jack, internal mic
+	static FakeCodec* createALC269();
+};
+
+#endif
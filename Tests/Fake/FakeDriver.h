@@ -0,0 +1,116 @@
+/*
+ *  Released under "The GNU General Public License (GPL-2.0)"
+ *
+ *  This program is free software; you can redistribute it and/or modify it
+ *  under the terms of the GNU General Public License as published by the
+ *  Free Software Foundation; either version 2 of the License, or (at your
+ *  option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ *  or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ *  for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ *
+ */
+
+#ifndef CodecCommander_FakeDriver_h
+#define CodecCommander_FakeDriver_h
+
+#include "FakeHDA.h"
+#include "CodecCommander.h"
+
+// CodecCommander started on the codec nub of the fake controller
+struct Driver
+{
+	FakeCodec* Codec;
+	FakeHDA* HDA;
+	CodecCommander* Commander;
+	bool Started;
+
+	// an ALC269 with profile as the Default profile
+	Driver(OSDictionary* profile) : Driver(FakeCodec::createALC269(), wrapProfile(profile)) { }
+
+	// codec (deleted with the driver) and a full Codec Profile dictionary, both taken over
+	Driver(FakeCodec* codec, OSDictionary* profiles)
+	{
+		Codec = codec;
+		HDA = new FakeHDA(Codec);
+
+		OSDictionary* properties = OSDictionary::withCapacity(1);
+		properties->setObject(kCodecProfile, profiles);
+		profiles->release();
+
+		Commander = new CodecCommander;
+		Commander->init(properties);
+		properties->release();
+
+		Commander->attach(HDA->getCodecNub());
+		Started = Commander->start(HDA->getCodecNub());
+	}
+
+	~Driver()
+	{
+		if (Started)
+			Commander->stop(HDA->getCodecNub());
+		Commander->detach(HDA->getCodecNub());
+		Commander->release();
+		delete HDA;
+		delete Codec;
+	}
+
+	static OSDictionary* wrapProfile(OSDictionary* profile)
+	{
+		OSDictionary* profiles = OSDictionary::withCapacity(1);
+		profiles->setObject("Default", profile);
+		profile->release();
+		return profiles;
+	}
+};
+
+// Profile with just the transport choice, consumed by Driver
+static inline OSDictionary* createProfile(bool useDMA)
+{
+	OSDictionary* profile = OSDictionary::withCapacity(1);
+	profile->setObject("Use DMA Commands", useDMA ? kOSBooleanTrue : kOSBooleanFalse);
+	return profile;
+}
+
+// User client opened on a started CodecCommander
+struct Session : Driver
+{
+	CodecCommanderClient* Client;
+	bool Opened;
+
+	Session(bool useDMA = true) : Driver(createProfile(useDMA))
+	{
+		Client = new CodecCommanderClient;
+		Opened = Started && Client->initWithTask(NULL, NULL, 0, NULL) && Client->attach(Commander) &&
+				 Client->start(Commander);
+	}
+
+	~Session()
+	{
+		if (Opened)
+			Client->stop(Commander);
+		Client->detach(Commander);
+		Client->release();
+	}
+
+	IOReturn call(UInt32 selector, IOExternalMethodArguments* arguments)
+	{
+		arguments->selector = selector;
+		return Client->externalMethod(selector, arguments);
+	}
+
+	IOReturn ringDoorbell()
+	{
+		IOExternalMethodArguments arguments = { };
+		return call(kClientRingDoorbell, &arguments);
+	}
+};
+
+#endif
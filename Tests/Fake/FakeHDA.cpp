@@ -0,0 +1,366 @@
+/*
+ *  Released under "The GNU General Public License (GPL-2.0)"
+ *
+ *  This program is free software; you can redistribute it and/or modify it
+ *  under the terms of the GNU General Public License as published by the
+ *  Free Software Foundation; either version 2 of the License, or (at your
+ *  option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ *  or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ *  for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ *
+ */
+
+#include "FakeHDA.h"
+#include <stdlib.h>
+
+#define kFakeRegisterSize		0x4000
+#define kFakeRingSize			4096
+#define kFakeRirbOffset			1024
+
+// Reserved bits the controller keeps set, so a write by the driver shows up as a cleared bit
+#define kFakeICSOffset			0x68
+#define kFakeICSSentinel		0x8000
+#define kFakeRIRBSTSOffset		0x5D
+#define kFakeRIRBSTSSentinel	0x80
+#define kFakeRIRBWPOffset		0x58
+
+#define kFakeICSBusy			(1<<0)
+#define kFakeICSValid			(1<<1)
+#define kFakeRINTFL				(1<<0)
+#define kFakeRIRBOIS			(1<<2)
+
+static UInt16 getRingEntries(UInt8 size)
+{
+	return size == HDA_RING_SIZE_256 ? 256 : size == HDA_RING_SIZE_16 ? 16 : 2;
+}
+
+static void* getRingAddress(UInt32 lower, UInt32 upper)
+{
+	return (void*)(uintptr_t)((UInt64)upper << 32 | lower);
+}
+
+static void setNumberProperty(IOService* service, const char* key, UInt32 value)
+{
+	OSNumber* num = OSNumber::withNumber(value, 32);
+	service->setProperty(key, num);
+	num->release();
+}
+
+FakeHDA::FakeHDA(FakeCodec* codec, UInt8 codecAddress)
+{
+	mCodec = codec;
+	mCodecAddress = codecAddress;
+
+	// HDA 1.0 controller, 64-bit capable, both rings up to 256 entries, codec present
+	mRegs = (pHDA_REG)aligned_alloc(4096, kFakeRegisterSize);
+	bzero(mRegs, kFakeRegisterSize);
+	mRegs->GCAP_64OK = 1;
+	mRegs->GCAP_NSDO = 1;
+	mRegs->GCAP_ISS = 4;
+	mRegs->GCAP_OSS = 4;
+	mRegs->VMAJ = 1;
+	mRegs->VMIN = 0;
+	mRegs->GCTL_CRST = 1;
+	mRegs->STATESTS_SDIWAKE = 1 << codecAddress;
+	mRegs->CORBSZCAP = HDA_RING_SZCAP_16 | HDA_RING_SZCAP_256;
+	mRegs->RIRBSIZE_RIRBSZCAP = HDA_RING_SZCAP_16 | HDA_RING_SZCAP_256;
+	*(volatile UInt16*)((UInt8*)mRegs + kFakeICSOffset) = kFakeICSSentinel;
+	*((volatile UInt8*)mRegs + kFakeRIRBSTSOffset) = kFakeRIRBSTSSentinel;
+
+	mDevice = new IOPCIDevice;
+	mDevice->init();
+	mDevice->hostSetName("HDEF");
+	mDevice->configWrite16(kIOPCIConfigVendorID, 0x8086);
+	mDevice->configWrite16(kIOPCIConfigDeviceID, 0x9c20);
+	mDevice->configWrite32(kIOPCIConfigSubSystemVendorID, 0x029b1025);
+	mDevice->configWrite8(0x44, 0x07);		// TCSEL
+	mDevice->hostSetMemory(mRegs, kFakeRegisterSize);
+	static const int interruptTypes[] = { kIOInterruptTypeLevel };
+	mDevice->hostSetInterruptTypes(interruptTypes, 1);
+
+	OSDictionary* properties = OSDictionary::withCapacity(3);
+	mCodecNub = new IOService;
+	mCodecNub->init(properties);
+	properties->release();
+	mCodecNub->hostSetName("IOHDACodecDevice");
+	setNumberProperty(mCodecNub, kCodecVendorID, codec->getVendorId());
+	setNumberProperty(mCodecNub, kCodecAddress, codecAddress);
+	setNumberProperty(mCodecNub, kCodecFuncGroupType, HDA_TYPE_AFG);
+	mCodecNub->attach(mDevice);
+
+	hostSetTickHandler(&FakeHDA::tick, this);
+}
+
+FakeHDA::~FakeHDA()
+{
+	hostSetTickHandler(NULL, NULL);
+
+	// wait out a tick still running on another thread
+	mLock.lock();
+	mLock.unlock();
+
+	mCodecNub->detach(mDevice);
+	mCodecNub->release();
+	mDevice->release();
+	free(mRegs);
+	free(mForeignRings);
+}
+
+void FakeHDA::tick(void* context)
+{
+	FakeHDA* self = (FakeHDA*)context;
+	std::vector<UInt32> delivered;
+	bool interrupt = false;
+
+	self->mLock.lock();
+	self->run(&delivered, &interrupt);
+	void (*hook)(void*, UInt32) = self->mHook;
+	void* hookContext = self->mHookContext;
+	self->mLock.unlock();
+
+	// the interrupt filter and the hooks may well read the clock or send verbs themselves
+	if (interrupt)
+		self->mDevice->hostRaiseInterrupt(0);
+	if (hook)
+	{
+		for (size_t i = 0; i < delivered.size(); i++)
+			hook(hookContext, delivered[i]);
+	}
+}
+
+void FakeHDA::run(std::vector<UInt32>* delivered, bool* interrupt)
+{
+	UInt64 now = hostGetNanoseconds();
+
+	// 24 MHz
+	mRegs->WALL_CLOCK_COUNTER = (UInt32)(now * 3 / 125);
+
+	syncRirbStatus(0);
+	runImmediate(now);
+	runRings(now);
+
+	while (!mLink.empty() && mLink.front().Due <= now)
+	{
+		FakeLinkSlot slot = mLink.front();
+		mLink.pop_front();
+
+		deliver(slot, now, interrupt);
+		if (!slot.Unsolicited)
+			delivered->push_back(slot.Command);
+	}
+}
+
+void FakeHDA::runImmediate(UInt64 now)
+{
+	volatile UInt16* status = (volatile UInt16*)((UInt8*)mRegs + kFakeICSOffset);
+	UInt16 value = *status;
+	if (value & kFakeICSSentinel)
+		return;
+
+	// ICB sends the verb in ICW, IRV is write 1 to clear
+	if ((value & kFakeICSBusy) && !(mImmediateStatus & kFakeICSBusy))
+	{
+		send(mRegs->ICW, true, now);
+		mImmediateStatus = kFakeICSBusy;
+	}
+	if (value & kFakeICSValid)
+		mImmediateStatus &= ~kFakeICSValid;
+
+	*status = mImmediateStatus | kFakeICSSentinel;
+}
+
+void FakeHDA::runRings(UInt64 now)
+{
+	if (mRegs->CORBRPRST)
+	{
+		// reads back set until the driver clears it
+		mCorbReadPointer = 0;
+		mRegs->CORBRP = 0;
+	}
+	else if (mRegs->CORBRUN)
+	{
+		UInt16 entries = getRingEntries(mRegs->CORBSIZE);
+		volatile UInt32* corb = (volatile UInt32*)getRingAddress(mRegs->CORBLBASE, mRegs->CORBUBASE);
+		UInt16 writePointer = mRegs->CORBWP % entries;
+
+		while (mCorbReadPointer != writePointer)
+		{
+			mCorbReadPointer = (mCorbReadPointer + 1) % entries;
+			send(corb[mCorbReadPointer], false, now);
+		}
+		mRegs->CORBRP = mCorbReadPointer;
+	}
+
+	if (mRegs->RIRBWPRST)
+	{
+		// self clearing
+		mRirbWritePointer = 0;
+		mResponseCount = 0;
+		*(volatile UInt16*)((UInt8*)mRegs + kFakeRIRBWPOffset) = 0;
+	}
+}
+
+void FakeHDA::syncRirbStatus(UInt8 set)
+{
+	volatile UInt8* status = (volatile UInt8*)mRegs + kFakeRIRBSTSOffset;
+	UInt8 value;
+
+	// the driver may write at any time (interrupt filter), do not lose its write
+	do
+	{
+		value = *status;
+		if (!(value & kFakeRIRBSTSSentinel))
+		{
+			mLastRirbStatusWrite = value;
+			mRirbStatus &= ~value;
+		}
+		mRirbStatus |= set;
+	} while (!__sync_bool_compare_and_swap(status, value, (UInt8)(mRirbStatus | kFakeRIRBSTSSentinel)));
+}
+
+void FakeHDA::send(UInt32 command, bool immediate, UInt64 now)
+{
+	// the codec answers in order, one verb per frame
+	FakeLinkSlot slot;
+	slot.Due = (now > mLinkFree ? now : mLinkFree) + (immediate ? mImmediateFrames : 1) * kFakeFrameNS + mResponseDelay;
+	slot.Command = command;
+	slot.Immediate = immediate;
+	slot.Unsolicited = false;
+
+	mLinkFree = slot.Due;
+	mLink.push_back(slot);
+}
+
+void FakeHDA::deliver(const FakeLinkSlot& slot, UInt64 now, bool* interrupt)
+{
+	if (slot.Unsolicited)
+	{
+		if (mRegs->GCTL_UNSOL)
+			writeRirb(slot.Command, mCodecAddress | 0x10, interrupt);
+		return;
+	}
+
+	UInt32 response = 0;
+	bool answered = (slot.Command >> 28) == mCodecAddress && mCodec->execute(slot.Command & 0x0FFFFFFF, slot.Due, &response);
+
+	if (slot.Immediate)
+	{
+		// without an answer the command still completes, just without a valid result
+		if (answered)
+			mRegs->IRR = response;
+		mImmediateStatus = answered ? kFakeICSValid : 0;
+		*(volatile UInt16*)((UInt8*)mRegs + kFakeICSOffset) = mImmediateStatus | kFakeICSSentinel;
+	}
+	else if (answered)
+		writeRirb(response, mCodecAddress, interrupt);
+}
+
+void FakeHDA::writeRirb(UInt32 response, UInt32 responseEx, bool* interrupt)
+{
+	if (!mRegs->RINTCNT_RIRBDMAEN)
+		return;
+
+	UInt16 entries = getRingEntries(mRegs->RIRBSIZE);
+	volatile HDA_RIRB_ENTRY* rirb = (volatile HDA_RIRB_ENTRY*)getRingAddress(mRegs->RIRBLBASE, mRegs->RIRBUBASE);
+
+	mRirbWritePointer = (mRirbWritePointer + 1) % entries;
+	rirb[mRirbWritePointer].Response = response;
+	rirb[mRirbWritePointer].ResponseEx = responseEx;
+	__sync_synchronize();
+	mRegs->RIRBWP = mRirbWritePointer;
+
+	UInt32 count = mRegs->RINTCNT ? mRegs->RINTCNT : 256;
+	if (++mResponseCount >= count)
+	{
+		mResponseCount = 0;
+		syncRirbStatus(kFakeRINTFL);
+		if (mRegs->RINTCNT_RINTCTL && mRegs->INTCTL_CIE && mRegs->INTCTL_GIE)
+		{
+			mInterrupts++;
+			*interrupt = true;
+		}
+	}
+}
+
+void FakeHDA::setResponseDelay(UInt32 microseconds)
+{
+	std::lock_guard<std::mutex> lock(mLock);
+	mResponseDelay = (UInt64)microseconds * 1000;
+}
+
+void FakeHDA::setImmediateFrames(UInt32 frames)
+{
+	std::lock_guard<std::mutex> lock(mLock);
+	mImmediateFrames = frames;
+}
+
+void FakeHDA::takeRings()
+{
+	std::lock_guard<std::mutex> lock(mLock);
+
+	if (!mForeignRings)
+		mForeignRings = (UInt8*)aligned_alloc(4096, kFakeRingSize);
+	bzero(mForeignRings, kFakeRingSize);
+
+	UInt64 corb = (uintptr_t)mForeignRings;
+	UInt64 rirb = corb + kFakeRirbOffset;
+	mRegs->CORBLBASE = (UInt32)corb;
+	mRegs->CORBUBASE = (UInt32)(corb >> 32);
+	mRegs->RIRBLBASE = (UInt32)rirb;
+	mRegs->RIRBUBASE = (UInt32)(rirb >> 32);
+	mRegs->CORBWP = 0;
+	mRegs->CORBRP = 0;
+	mCorbReadPointer = 0;
+	*(volatile UInt16*)((UInt8*)mRegs + kFakeRIRBWPOffset) = 0;
+	mRirbWritePointer = 0;
+	mResponseCount = 0;
+	mRegs->CORBRUN = 1;
+	mRegs->RINTCNT_RIRBDMAEN = 1;
+
+	// whatever was in flight is answered into the new rings
+}
+
+void FakeHDA::raiseResponseInterrupt()
+{
+	std::lock_guard<std::mutex> lock(mLock);
+	syncRirbStatus(kFakeRINTFL);
+}
+
+void FakeHDA::injectRirbOverrun()
+{
+	std::lock_guard<std::mutex> lock(mLock);
+	syncRirbStatus(kFakeRIRBOIS);
+}
+
+void FakeHDA::plug(UInt8 node, bool present)
+{
+	std::lock_guard<std::mutex> lock(mLock);
+
+	UInt32 response;
+	if (!mCodec->plug(node, present, &response))
+		return;
+
+	UInt64 now = hostGetNanoseconds();
+	FakeLinkSlot slot;
+	slot.Due = (now > mLinkFree ? now : mLinkFree) + kFakeFrameNS;
+	slot.Command = response;
+	slot.Immediate = false;
+	slot.Unsolicited = true;
+
+	mLinkFree = slot.Due;
+	mLink.push_back(slot);
+}
+
+void FakeHDA::setVerbHook(void (*hook)(void* context, UInt32 command), void* context)
+{
+	std::lock_guard<std::mutex> lock(mLock);
+	mHook = hook;
+	mHookContext = context;
+}
@@ -0,0 +1,107 @@
+/*
+ *  Released under "The GNU General Public License (GPL-2.0)"
+ *
+ *  This program is free software; you can redistribute it and/or modify it
+ *  under the terms of the GNU General Public License as published by the
+ *  Free Software Foundation; either version 2 of the License, or (at your
+ *  option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ *  or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ *  for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ *
+ */
+
+#ifndef CodecCommander_FakeHDA_h
+#define CodecCommander_FakeHDA_h
+
+#include "FakeCodec.h"
+#include "IntelHDA.h"
+#include <deque>
+#include <mutex>
+
+// One link frame at 48 kHz, a verb is answered in the frame after it was sent
+#define kFakeFrameNS		20833
+
+// Verb or unsolicited response on its way back over the link
+struct FakeLinkSlot
+{
+	UInt64 Due;				// ns
+	UInt32 Command;
+	bool Immediate;			// sent through ICW, answered in IRR
+	bool Unsolicited;		// Command holds the response
+};
+
+// HDA controller with a single codec, register by register as IntelHDA sees it through the
+// IOPCIDevice BAR. The controller runs whenever the driver reads the clock or waits.
+class FakeHDA
+{
+	FakeCodec* mCodec;
+	UInt8 mCodecAddress;
+	pHDA_REG mRegs;
+	UInt8* mForeignRings = NULL;	// rings of "the audio driver" after takeRings
+	IOPCIDevice* mDevice;
+	IOService* mCodecNub;
+
+	std::mutex mLock;
+	std::deque<FakeLinkSlot> mLink;
+	UInt64 mLinkFree = 0;			// ns, end of the last scheduled response
+	UInt64 mResponseDelay = 0;		// ns, on top of the frame
+	UInt32 mImmediateFrames = 1;	// until an immediate command completes (ICB clears)
+
+	UInt16 mImmediateStatus = 0;
+	UInt8 mRirbStatus = 0;
+	UInt8 mLastRirbStatusWrite = 0;
+	UInt16 mCorbReadPointer = 0;
+	UInt16 mRirbWritePointer = 0;
+	UInt32 mResponseCount = 0;		// since the last response interrupt
+	UInt32 mInterrupts = 0;
+
+	void (*mHook)(void* context, UInt32 command) = NULL;
+	void* mHookContext = NULL;
+
+	static void tick(void* context);
+	void run(std::vector<UInt32>* delivered, bool* interrupt);
+	void runImmediate(UInt64 now);
+	void runRings(UInt64 now);
+	void syncRirbStatus(UInt8 set);
+	void send(UInt32 command, bool immediate, UInt64 now);
+	void deliver(const FakeLinkSlot& slot, UInt64 now, bool* interrupt);
+	void writeRirb(UInt32 response, UInt32 responseEx, bool* interrupt);
+
+public:
+	FakeHDA(FakeCodec* codec, UInt8 codecAddress = 0);
+	~FakeHDA();
+
+	IOPCIDevice* getDevice() { return mDevice; }
+	// codec nub with the properties AppleHDA publishes, the provider of IntelHDA/CodecCommander
+	IOService* getCodecNub() { return mCodecNub; }
+	pHDA_REG getRegisters() { return mRegs; }
+	FakeCodec* getCodec() { return mCodec; }
+
+	// Extra time the codec takes for each following response (late responses)
+	void setResponseDelay(UInt32 microseconds);
+	// Link frames ICS stays busy after an immediate command was sent (1 by default)
+	void setImmediateFrames(UInt32 frames);
+	// The audio driver re-programs the CORB/RIRB for its own rings
+	void takeRings();
+	// RIRB overrun (RIRBOIS), as if responses had been lost
+	void injectRirbOverrun();
+	// Response interrupt status (RINTFL) set again, as if another response had come in
+	void raiseResponseInterrupt();
+	// Jack sense change, sends an unsolicited response if the pin has them enabled
+	void plug(UInt8 node, bool present);
+	// Called for every verb answered (or not) by the codec, outside of the controller lock
+	void setVerbHook(void (*hook)(void* context, UInt32 command), void* context);
+
+	UInt8 getRirbStatus() { return mRirbStatus; }
+	UInt8 getLastRirbStatusWrite() { return mLastRirbStatusWrite; }
+	UInt32 getInterruptCount() { return mInterrupts; }
+};
+
+#endif
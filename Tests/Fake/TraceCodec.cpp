@@ -0,0 +1,165 @@
+/*
+ *  Released under "The GNU General Public License (GPL-2.0)"
+ *
+ *  This program is free software; you can redistribute it and/or modify it
+ *  under the terms of the GNU General Public License as published by the
+ *  Free Software Foundation; either version 2 of the License, or (at your
+ *  option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ *  or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ *  for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ *
+ */
+
+#include "TraceCodec.h"
+#include <algorithm>
+
+#define kCommandMask		0x0FFFFFFF	// all but the codec address
+
+#define VERB(node, verb)	((UInt32)(node) << 20 | (verb))
+
+void TraceCodecBuilder::add(const CodecCommanderTraceRecord* records, size_t count)
+{
+	for (size_t i = 0; i < count; i++)
+	{
+		const CodecCommanderTraceRecord* r = &records[i];
+		if (r->Status != kTraceStatusOK || r->Transport == kTraceTransportNone)
+			continue;
+
+		UInt32 command = r->Command & kCommandMask;
+		UInt8 node = command >> 20 & 0xFF;
+		mResponses.insert(std::make_pair(command, r->Response));
+		if (r->Transport != kTraceTransportCache)
+			mLatencies.push_back(r->Latency);
+
+		// coefficients are read through an index that advances with every access
+		UInt8 shortVerb = command >> 16 & 0xF;
+		if ((command >> 8 & 0xF00) == 0x700 || (command >> 8 & 0xF00) == 0xF00)
+			continue;
+		auto index = mCoefIndex.find(node);
+		switch (shortVerb)
+		{
+			case 0x5:
+				mCoefIndex[node] = command & 0xFFFF;
+				break;
+			case 0xD:
+				mCoefIndex[node] = r->Response & 0xFFFF;
+				break;
+			case 0x4:
+				if (index != mCoefIndex.end())
+					index->second++;
+				break;
+			case 0xC:
+				if (index != mCoefIndex.end())
+					mCoefficients.insert(std::make_pair((UInt32)node << 16 | index->second++, (UInt16)r->Response));
+				break;
+		}
+	}
+}
+
+bool TraceCodecBuilder::getResponse(UInt32 command, UInt32* response)
+{
+	auto found = mResponses.find(command & kCommandMask);
+	if (found == mResponses.end())
+		return false;
+	*response = found->second;
+	return true;
+}
+
+UInt32 TraceCodecBuilder::getLinkLatency()
+{
+	if (mLatencies.empty())
+		return 0;
+
+	std::vector<UInt32> latencies(mLatencies);
+	std::nth_element(latencies.begin(), latencies.begin() + latencies.size() / 2, latencies.end());
+	return latencies[latencies.size() / 2];
+}
+
+FakeCodec* TraceCodecBuilder::finish()
+{
+	UInt32 vendorId, revisionId = 0x00100100, subsystemId = 0, nodes = 0;
+	if (!getResponse(VERB(0, 0xF0000), &vendorId))
+		return NULL;
+	getResponse(VERB(0, 0xF0002), &revisionId);
+	getResponse(VERB(1, 0xF2000), &subsystemId);
+
+	FakeCodec* codec = new FakeCodec(vendorId, subsystemId, revisionId);
+	FakeWidget* group = codec->getFunctionGroup();
+	for (UInt8 parameter = 0; parameter < kFakeParamCount; parameter++)
+		getResponse(VERB(1, 0xF0000 | parameter), &group->Params[parameter]);
+
+	// widgets the trace read the capabilities of, the rest are gaps
+	if (!getResponse(VERB(1, 0xF0004), &nodes))
+		nodes = 2 << 16 | 0xFE;
+	UInt32 start = nodes >> 16 & 0xFF, end = std::min(start + (nodes & 0xFF), 0x100U);
+	for (UInt32 node = start; node < end; node++)
+	{
+		UInt32 caps, value;
+		if (!getResponse(VERB(node, 0xF0009), &caps))
+			continue;
+
+		FakeWidget* widget = codec->addWidget(node, caps);
+		for (UInt8 parameter = 0; parameter < kFakeParamCount; parameter++)
+			if (parameter != 0x09)
+				getResponse(VERB(node, 0xF0000 | parameter), &widget->Params[parameter]);
+		getResponse(VERB(node, 0xF1C00), &widget->ConfigDefault);
+
+		// 4 short form or 2 long form entries per GET_CONNECTION_LIST, missing ones are 0
+		UInt32 length = widget->Params[0x0E] & 0x7F;
+		widget->LongForm = widget->Params[0x0E] & 0x80;
+		UInt32 perResponse = widget->LongForm ? 2 : 4, width = widget->LongForm ? 16 : 8;
+		for (UInt32 i = 0; i < length; i += perResponse)
+		{
+			UInt32 entries = 0;
+			getResponse(VERB(node, 0xF0200 | i), &entries);
+			for (UInt32 j = 0; j < perResponse && i + j < length; j++)
+				widget->Connections.push_back(entries >> (j * width) & ((1 << width) - 1));
+		}
+
+		FakeWidgetState& state = widget->State;
+		if (getResponse(VERB(node, 0xF0500), &value))
+			state.PowerState = value & 0xF;
+		if (getResponse(VERB(node, 0xF0700), &value))
+			state.PinControl = value;
+		if (getResponse(VERB(node, 0xF0800), &value))
+			state.Unsolicited = value;
+		if (getResponse(VERB(node, 0xF0C00), &value))
+			state.Eapd = value;
+		if (getResponse(VERB(node, 0xF0100), &value))
+			state.ConnectionSelect = value;
+		if (getResponse(VERB(node, 0xF0900), &value))
+			widget->Present = value & 0x80000000;
+
+		// GET_AMP_GAIN_MUTE: output (0x8000) or input index, left (0x2000) or right
+		for (UInt32 side = 0; side < 2; side++)
+		{
+			UInt32 left = side ? 0x2000 : 0;
+			if (getResponse(VERB(node, 0xB8000 | left), &value))
+				state.AmpOut[side] = value;
+			for (UInt32 index = 0; index < 16; index++)
+				if (getResponse(VERB(node, 0xB0000 | left | index), &value))
+					state.AmpIn[index][side] = value;
+		}
+	}
+
+	for (auto& coefficient : mCoefficients)
+	{
+		FakeWidget* widget = codec->getWidget(coefficient.first >> 16);
+		UInt16 index = coefficient.first & 0xFFFF;
+		if (!widget)
+			continue;
+		if (index >= widget->Coefficients.size())
+			widget->Coefficients.resize(index + 1);
+		widget->Coefficients[index] = coefficient.second;
+	}
+
+	codec->setDefaults();
+	return codec;
+}
@@ -0,0 +1,51 @@
+/*
+ *  Released under "The GNU General Public License (GPL-2.0)"
+ *
+ *  This program is free software; you can redistribute it and/or modify it
+ *  under the terms of the GNU General Public License as published by the
+ *  Free Software Foundation; either version 2 of the License, or (at your
+ *  option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ *  or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ *  for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ *
+ */
+
+#ifndef CodecCommander_TraceCodec_h
+#define CodecCommander_TraceCodec_h
+
+#include "FakeCodec.h"
+#include "ClientInterface.h"
+#include <map>
+
+// Codec model from the responses in a verb trace (hda-verb trace record). A codec dump
+// (hda-verb dump) taken while recording describes every node, without one only what CC
+// read during the recorded transitions is known. State is the first response seen for
+// each GET verb, the codec as it was when recording began. Supports one audio function
+// group at node 0x01, like AlsaDumpParser.
+class TraceCodecBuilder
+{
+	std::map<UInt32, UInt32> mResponses;	// first response by command (codec address dropped)
+	std::map<UInt32, UInt16> mCoefficients;	// first value read by node << 16 | index
+	std::map<UInt8, UInt16> mCoefIndex;		// processing coefficient index where it is known
+	std::vector<UInt32> mLatencies;			// us, verbs answered over the link
+
+public:
+	// Records are fed in the order they were recorded, in as many pieces as needed
+	void add(const CodecCommanderTraceRecord* records, size_t count);
+	// Model of the traced codec (caller deletes), NULL if the trace never read the vendor id
+	FakeCodec* finish();
+
+	// First recorded response to a command, false if it was never answered
+	bool getResponse(UInt32 command, UInt32* response);
+	// Median verb latency (us) of the link the trace was recorded on, 0 without verbs
+	UInt32 getLinkLatency();
+};
+
+#endif
@@ -0,0 +1,82 @@
+/*
+ *  Released under "The GNU General Public License (GPL-2.0)"
+ *
+ *  This program is free software; you can redistribute it and/or modify it
+ *  under the terms of the GNU General Public License as published by the
+ *  Free Software Foundation; either version 2 of the License, or (at your
+ *  option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ *  or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ *  for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ *
+ */
+
+#include "Harness.h"
+
+static int sFailures;
+
+HostTest*& hostTests()
+{
+	static HostTest* tests = NULL;
+	return tests;
+}
+
+void hostTestFailed(const char* file, int line, const char* expression)
+{
+	fprintf(stderr, "%s:%d: expected %s\n", file, line, expression);
+	sFailures++;
+}
+
+UInt64 hostGetNumber(OSDictionary* dict, const char* key, const char* key2, const char* key3)
+{
+	const char* keys[] = { key, key2, key3 };
+	OSObject* object = dict;
+
+	for (int i = 0; i < 3 && keys[i]; i++)
+	{
+		OSDictionary* level = OSDynamicCast(OSDictionary, object);
+		object = level ? level->getObject(keys[i]) : NULL;
+	}
+
+	OSNumber* number = OSDynamicCast(OSNumber, object);
+	return number ? number->unsigned64BitValue() : -1;
+}
+
+int main(int argc, char** argv)
+{
+	int failed = 0, run = 0;
+
+	for (HostTest* test = hostTests(); test; test = test->Next)
+	{
+		// optional filter: only tests whose name contains the argument
+		if (argc > 1 && !strstr(test->Name, argv[1]))
+			continue;
+
+		int failures = sFailures;
+		size_t allocated = hostGetAllocated();
+
+		test->Function();
+		run++;
+
+		if (hostGetAllocated() != allocated)
+		{
+			fprintf(stderr, "%s: %zd bytes of IOMalloc not freed\n", test->Name,
+					(ssize_t)(hostGetAllocated() - allocated));
+			sFailures++;
+		}
+
+		bool passed = sFailures == failures;
+		printf("[%s] %s\n", passed ? "  OK  " : " FAIL ", test->Name);
+		if (!passed)
+			failed++;
+	}
+
+	printf("%d of %d tests passed\n", run - failed, run);
+	return failed ? 1 : 0;
+}
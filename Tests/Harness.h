@@ -0,0 +1,80 @@
+/*
+ *  Released under "The GNU General Public License (GPL-2.0)"
+ *
+ *  This program is free software; you can redistribute it and/or modify it
+ *  under the terms of the GNU General Public License as published by the
+ *  Free Software Foundation; either version 2 of the License, or (at your
+ *  option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ *  or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ *  for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ *
+ */
+
+#ifndef CodecCommander_Harness_h
+#define CodecCommander_Harness_h
+
+// Minimal test runner: TEST(name) registers a test, EXPECT_* record a failure and go on,
+// ASSERT_* leave the test. Every test must free what the kext allocated (IOMalloc).
+
+#include "HostKernel.h"
+
+struct HostTest
+{
+	const char* Name;
+	void (*Function)();
+	HostTest* Next;
+};
+
+HostTest*& hostTests();
+void hostTestFailed(const char* file, int line, const char* expression);
+
+struct HostTestRegistration
+{
+	HostTest Test;
+	HostTestRegistration(const char* name, void (*function)())
+	{
+		Test.Name = name;
+		Test.Function = function;
+
+		// keep the order of the source file
+		HostTest** tail = &hostTests();
+		while (*tail)
+			tail = &(*tail)->Next;
+		Test.Next = NULL;
+		*tail = &Test;
+	}
+};
+
+#define TEST(name) \
+	static void name(); \
+	static HostTestRegistration name##Registration(#name, name); \
+	static void name()
+
+#define EXPECT_TRUE(condition) \
+	do { if (!(condition)) hostTestFailed(__FILE__, __LINE__, #condition); } while (0)
+#define EXPECT_FALSE(condition) EXPECT_TRUE(!(condition))
+#define EXPECT_EQ(expected, actual) \
+	do { \
+		unsigned long long _expected = (unsigned long long)(expected), _actual = (unsigned long long)(actual); \
+		if (_expected != _actual) \
+		{ \
+			char _message[256]; \
+			snprintf(_message, sizeof(_message), "%s == %s (0x%llx != 0x%llx)", #expected, #actual, _expected, _actual); \
+			hostTestFailed(__FILE__, __LINE__, _message); \
+		} \
+	} while (0)
+
+#define ASSERT_TRUE(condition) \
+	do { if (!(condition)) { hostTestFailed(__FILE__, __LINE__, #condition); return; } } while (0)
+
+// Number at a path of nested dictionaries, -1 if there is none
+UInt64 hostGetNumber(OSDictionary* dict, const char* key, const char* key2 = NULL, const char* key3 = NULL);
+
+#endif
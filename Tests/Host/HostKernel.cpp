@@ -0,0 +1,1388 @@
+/*
+ *  Released under "The GNU General Public License (GPL-2.0)"
+ *
+ *  This program is free software; you can redistribute it and/or modify it
+ *  under the terms of the GNU General Public License as published by the
+ *  Free Software Foundation; either version 2 of the License, or (at your
+ *  option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ *  or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ *  for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ *
+ */
+
+#include "HostKernel.h"
+
+#include <stdarg.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <cxxabi.h>
+#include <typeinfo>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <chrono>
+#include <map>
+#include <string>
+#include <vector>
+#include <algorithm>
+
+/* kernel */
+
+// Virtual clock (ns), starts one second after "boot" so that no timestamp is 0
+static std::atomic<UInt64> sTime(1000000000ULL);
+static std::atomic<void (*)(void*)> sTickHandler(NULL);
+static std::atomic<void*> sTickContext(NULL);
+static thread_local int sTickDepth = 0;
+static std::atomic<size_t> sAllocated(0);
+
+static void wakeWorkLoops();
+
+static void tick()
+{
+	// the fake hardware may read the clock itself, it is not run recursively
+	void (*handler)(void*) = sTickHandler;
+	if (!handler || sTickDepth)
+		return;
+
+	sTickDepth++;
+	handler(sTickContext);
+	sTickDepth--;
+}
+
+UInt64 hostGetTime()
+{
+	return sTime / 1000;
+}
+
+UInt64 hostGetNanoseconds()
+{
+	return sTime;
+}
+
+void hostAdvanceTime(UInt64 microseconds)
+{
+	sTime += microseconds * 1000;
+	wakeWorkLoops();
+	tick();
+}
+
+void hostSetTickHandler(void (*handler)(void* context), void* context)
+{
+	sTickHandler = NULL;
+	sTickContext = context;
+	sTickHandler = handler;
+}
+
+size_t hostGetAllocated()
+{
+	return sAllocated;
+}
+
+extern "C"
+{
+
+void IOLog(const char* format, ...)
+{
+	static int enabled = -1;
+	if (enabled < 0)
+		enabled = getenv("CC_HOST_LOG") != NULL;
+	if (!enabled)
+		return;
+
+	va_list args;
+	va_start(args, format);
+	vfprintf(stderr, format, args);
+	va_end(args);
+}
+
+void IOSleep(unsigned milliseconds)
+{
+	hostAdvanceTime((UInt64)milliseconds * 1000);
+	std::this_thread::yield();
+}
+
+void IODelay(unsigned microseconds)
+{
+	hostAdvanceTime(microseconds);
+}
+
+void* IOMalloc(size_t size)
+{
+	// the size is kept in front of the block so that IOFree can check it
+	size_t* block = (size_t*)malloc(size + 2 * sizeof(size_t));
+	if (!block)
+		return NULL;
+
+	block[0] = size;
+	sAllocated += size;
+	return block + 2;
+}
+
+void IOFree(void* address, size_t size)
+{
+	if (!address)
+		return;
+
+	size_t* block = (size_t*)address - 2;
+	if (block[0] != size)
+	{
+		fprintf(stderr, "IOFree(%p, %zu) of a block allocated with size %zu\n", address, size, block[0]);
+		abort();
+	}
+
+	sAllocated -= size;
+	free(block);
+}
+
+void clock_get_uptime(UInt64* result)
+{
+	tick();
+	*result = sTime;
+}
+
+void absolutetime_to_nanoseconds(UInt64 abstime, UInt64* result)
+{
+	*result = abstime;
+}
+
+const char* OSKextGetCurrentIdentifier(void)
+{
+	return "org.rehabman.driver.CodecCommander";
+}
+
+UInt32 OSKextGetCurrentLoadTag(void)
+{
+	return 1;
+}
+
+const char* OSKextGetCurrentVersionString(void)
+{
+	return "host";
+}
+
+}
+
+kmod_info_t kmod_info = { "CodecCommander", "host" };
+task_t kernel_task = &kernel_task;
+
+struct IOLock
+{
+	std::mutex Mutex;
+};
+
+IOLock* IOLockAlloc()
+{
+	return new IOLock;
+}
+
+void IOLockFree(IOLock* lock)
+{
+	delete lock;
+}
+
+void IOLockLock(IOLock* lock)
+{
+	lock->Mutex.lock();
+}
+
+void IOLockUnlock(IOLock* lock)
+{
+	lock->Mutex.unlock();
+}
+
+struct IOSimpleLock
+{
+	std::mutex Mutex;
+};
+
+IOSimpleLock* IOSimpleLockAlloc()
+{
+	return new IOSimpleLock;
+}
+
+void IOSimpleLockFree(IOSimpleLock* lock)
+{
+	delete lock;
+}
+
+void IOSimpleLockLock(IOSimpleLock* lock)
+{
+	lock->Mutex.lock();
+}
+
+void IOSimpleLockUnlock(IOSimpleLock* lock)
+{
+	lock->Mutex.unlock();
+}
+
+IOInterruptState IOSimpleLockLockDisableInterrupt(IOSimpleLock* lock)
+{
+	lock->Mutex.lock();
+	return 0;
+}
+
+void IOSimpleLockUnlockEnableInterrupt(IOSimpleLock* lock, IOInterruptState state)
+{
+	lock->Mutex.unlock();
+}
+
+const char* IOFindNameForValue(int value, const IONamedValue* table)
+{
+	for (; table->name; table++)
+		if (table->value == value)
+			return table->name;
+	return "???";
+}
+
+/* libkern */
+
+void OSObject::retain() const
+{
+	__sync_fetch_and_add(&mRetainCount, 1);
+}
+
+void OSObject::release() const
+{
+	if (__sync_sub_and_fetch(&mRetainCount, 1) == 0)
+		const_cast<OSObject*>(this)->free();
+}
+
+void OSObject::free()
+{
+	delete this;
+}
+
+struct HostArray
+{
+	std::vector<OSObject*> Items;
+};
+
+OSArray::OSArray()
+{
+	mItems = new HostArray;
+}
+
+void OSArray::free()
+{
+	flushCollection();
+	delete mItems;
+	OSCollection::free();
+}
+
+OSArray* OSArray::withCapacity(unsigned capacity)
+{
+	OSArray* array = new OSArray;
+	array->mItems->Items.reserve(capacity);
+	return array;
+}
+
+bool OSArray::setObject(const OSMetaClassBase* object)
+{
+	OSObject* item = dynamic_cast<OSObject*>(const_cast<OSMetaClassBase*>(object));
+	if (!item)
+		return false;
+
+	item->retain();
+	mItems->Items.push_back(item);
+	return true;
+}
+
+OSObject* OSArray::getObject(unsigned index) const
+{
+	return index < mItems->Items.size() ? mItems->Items[index] : NULL;
+}
+
+unsigned OSArray::getCount() const
+{
+	return (unsigned)mItems->Items.size();
+}
+
+void OSArray::flushCollection()
+{
+	for (OSObject* item : mItems->Items)
+		item->release();
+	mItems->Items.clear();
+}
+
+struct HostDictionary
+{
+	std::map<std::string, OSObject*> Items;
+};
+
+OSDictionary::OSDictionary()
+{
+	mItems = new HostDictionary;
+}
+
+void OSDictionary::free()
+{
+	flushCollection();
+	delete mItems;
+	OSCollection::free();
+}
+
+OSDictionary* OSDictionary::withCapacity(unsigned capacity)
+{
+	return new OSDictionary;
+}
+
+OSDictionary* OSDictionary::withDictionary(const OSDictionary* dictionary, unsigned capacity)
+{
+	OSDictionary* result = new OSDictionary;
+	result->merge(dictionary);
+	return result;
+}
+
+bool OSDictionary::setObject(const char* key, const OSMetaClassBase* object)
+{
+	OSObject* item = dynamic_cast<OSObject*>(const_cast<OSMetaClassBase*>(object));
+	if (!key || !item)
+		return false;
+
+	item->retain();
+	OSObject*& slot = mItems->Items[key];
+	if (slot)
+		slot->release();
+	slot = item;
+	return true;
+}
+
+bool OSDictionary::setObject(const OSString* key, const OSMetaClassBase* object)
+{
+	return key && setObject(key->getCStringNoCopy(), object);
+}
+
+OSObject* OSDictionary::getObject(const char* key) const
+{
+	if (!key)
+		return NULL;
+
+	auto item = mItems->Items.find(key);
+	return item != mItems->Items.end() ? item->second : NULL;
+}
+
+OSObject* OSDictionary::getObject(const OSString* key) const
+{
+	return key ? getObject(key->getCStringNoCopy()) : NULL;
+}
+
+void OSDictionary::removeObject(const char* key)
+{
+	auto item = mItems->Items.find(key);
+	if (item == mItems->Items.end())
+		return;
+
+	item->second->release();
+	mItems->Items.erase(item);
+}
+
+bool OSDictionary::merge(const OSDictionary* dictionary)
+{
+	if (!dictionary)
+		return false;
+
+	for (auto& item : dictionary->mItems->Items)
+		setObject(item.first.c_str(), item.second);
+	return true;
+}
+
+unsigned OSDictionary::getCount() const
+{
+	return (unsigned)mItems->Items.size();
+}
+
+void OSDictionary::flushCollection()
+{
+	for (auto& item : mItems->Items)
+		item.second->release();
+	mItems->Items.clear();
+}
+
+OSObject* OSDictionary::hostGetObject(unsigned index, const char** key) const
+{
+	auto item = mItems->Items.begin();
+	for (; item != mItems->Items.end() && index; index--)
+		++item;
+	if (item == mItems->Items.end())
+		return NULL;
+
+	*key = item->first.c_str();
+	return item->second;
+}
+
+void OSCollectionIterator::free()
+{
+	if (mCollection)
+		mCollection->release();
+	OSIterator::free();
+}
+
+OSCollectionIterator* OSCollectionIterator::withCollection(const OSCollection* collection)
+{
+	if (!collection)
+		return NULL;
+
+	OSCollectionIterator* iterator = new OSCollectionIterator;
+	collection->retain();
+	iterator->mCollection = collection;
+	return iterator;
+}
+
+OSObject* OSCollectionIterator::getNextObject()
+{
+	const OSArray* array = dynamic_cast<const OSArray*>(mCollection);
+	return array ? array->getObject(mNext++) : NULL;
+}
+
+void OSString::free()
+{
+	::free(mString);
+	OSObject::free();
+}
+
+OSString* OSString::withCString(const char* string)
+{
+	OSString* result = new OSString;
+	result->mString = strdup(string);
+	return result;
+}
+
+const OSSymbol* OSSymbol::withCString(const char* string)
+{
+	OSSymbol* result = new OSSymbol;
+	result->mString = strdup(string);
+	return result;
+}
+
+OSNumber* OSNumber::withNumber(unsigned long long value, unsigned numberOfBits)
+{
+	OSNumber* result = new OSNumber;
+	result->mBits = numberOfBits;
+	result->setValue(value);
+	return result;
+}
+
+void OSNumber::setValue(unsigned long long value)
+{
+	mValue = mBits < 64 ? value & ((1ULL << mBits) - 1) : value;
+}
+
+static OSBoolean sBooleanTrue(true);
+static OSBoolean sBooleanFalse(false);
+OSBoolean* const kOSBooleanTrue = &sBooleanTrue;
+OSBoolean* const kOSBooleanFalse = &sBooleanFalse;
+
+void OSData::free()
+{
+	::free(mBytes);
+	OSObject::free();
+}
+
+OSData* OSData::withBytes(const void* bytes, unsigned length)
+{
+	OSData* result = new OSData;
+	result->mBytes = malloc(length ? length : 1);
+	memcpy(result->mBytes, bytes, length);
+	result->mLength = length;
+	result->mCapacity = length;
+	return result;
+}
+
+OSData* OSData::withCapacity(unsigned capacity)
+{
+	OSData* result = new OSData;
+	result->mBytes = malloc(capacity ? capacity : 1);
+	result->mCapacity = capacity;
+	return result;
+}
+
+bool OSData::appendByte(unsigned char byte, unsigned count)
+{
+	if (mLength + count > mCapacity)
+	{
+		void* bytes = realloc(mBytes, mLength + count);
+		if (!bytes)
+			return false;
+		mBytes = bytes;
+		mCapacity = mLength + count;
+	}
+	memset((char*)mBytes + mLength, byte, count);
+	mLength += count;
+	return true;
+}
+
+/* IORegistryEntry */
+
+const IORegistryPlane* gIOServicePlane = (const IORegistryPlane*)&gIOServicePlane;
+
+// Properties and service plane links of all entries
+static std::recursive_mutex sRegistryLock;
+
+struct HostRegistryEntry
+{
+	std::map<std::string, OSObject*> Properties;
+	IORegistryEntry* Parent = NULL;
+	std::vector<IORegistryEntry*> Children;
+	std::string Name;
+};
+
+IORegistryEntry::IORegistryEntry()
+{
+	mEntry = new HostRegistryEntry;
+}
+
+void IORegistryEntry::free()
+{
+	for (auto& property : mEntry->Properties)
+		property.second->release();
+	for (IORegistryEntry* child : mEntry->Children)
+	{
+		child->mEntry->Parent = NULL;
+		child->release();
+	}
+	delete mEntry;
+	OSObject::free();
+}
+
+OSObject* IORegistryEntry::getProperty(const char* key) const
+{
+	std::lock_guard<std::recursive_mutex> lock(sRegistryLock);
+	auto property = mEntry->Properties.find(key);
+	return property != mEntry->Properties.end() ? property->second : NULL;
+}
+
+bool IORegistryEntry::setProperty(const char* key, OSObject* object)
+{
+	if (!object)
+		return false;
+
+	std::lock_guard<std::recursive_mutex> lock(sRegistryLock);
+	object->retain();
+	OSObject*& slot = mEntry->Properties[key];
+	if (slot)
+		slot->release();
+	slot = object;
+	return true;
+}
+
+bool IORegistryEntry::setProperty(const char* key, bool value)
+{
+	return setProperty(key, value ? kOSBooleanTrue : kOSBooleanFalse);
+}
+
+bool IORegistryEntry::setProperty(const char* key, unsigned long long value, unsigned numberOfBits)
+{
+	OSNumber* number = OSNumber::withNumber(value, numberOfBits);
+	bool result = setProperty(key, number);
+	number->release();
+	return result;
+}
+
+bool IORegistryEntry::setProperty(const char* key, const char* value)
+{
+	OSString* string = OSString::withCString(value);
+	bool result = setProperty(key, string);
+	string->release();
+	return result;
+}
+
+void IORegistryEntry::removeProperty(const char* key)
+{
+	std::lock_guard<std::recursive_mutex> lock(sRegistryLock);
+	auto property = mEntry->Properties.find(key);
+	if (property == mEntry->Properties.end())
+		return;
+
+	property->second->release();
+	mEntry->Properties.erase(property);
+}
+
+IORegistryEntry* IORegistryEntry::getParentEntry(const IORegistryPlane* plane) const
+{
+	std::lock_guard<std::recursive_mutex> lock(sRegistryLock);
+	return mEntry->Parent;
+}
+
+IORegistryEntry* IORegistryEntry::getChildEntry(const IORegistryPlane* plane) const
+{
+	std::lock_guard<std::recursive_mutex> lock(sRegistryLock);
+	return mEntry->Children.empty() ? NULL : mEntry->Children.front();
+}
+
+namespace
+{
+	class HostIterator : public OSIterator
+	{
+		std::vector<OSObject*> mItems;
+		size_t mNext = 0;
+
+	protected:
+		virtual void free()
+		{
+			for (OSObject* item : mItems)
+				item->release();
+			OSIterator::free();
+		}
+
+	public:
+		void add(OSObject* item) { item->retain(); mItems.push_back(item); }
+		virtual OSObject* getNextObject() { return mNext < mItems.size() ? mItems[mNext++] : NULL; }
+	};
+}
+
+OSIterator* IORegistryEntry::getChildIterator(const IORegistryPlane* plane) const
+{
+	std::lock_guard<std::recursive_mutex> lock(sRegistryLock);
+	HostIterator* iterator = new HostIterator;
+	for (IORegistryEntry* child : mEntry->Children)
+		iterator->add(child);
+	return iterator;
+}
+
+bool IORegistryEntry::getPath(char* path, int* length, const IORegistryPlane* plane) const
+{
+	std::string result;
+	{
+		std::lock_guard<std::recursive_mutex> lock(sRegistryLock);
+		for (const IORegistryEntry* entry = this; entry; entry = entry->mEntry->Parent)
+			result = "/" + std::string(entry->getName()) + result;
+	}
+	result = "IOService:" + result;
+
+	if ((int)result.size() >= *length)
+		return false;
+
+	strcpy(path, result.c_str());
+	*length = (int)result.size();
+	return true;
+}
+
+const char* IORegistryEntry::getName(const IORegistryPlane* plane) const
+{
+	std::lock_guard<std::recursive_mutex> lock(sRegistryLock);
+	if (mEntry->Name.empty())
+	{
+		// like IOKit, the class name unless the entry was given a name
+		int status;
+		char* name = abi::__cxa_demangle(typeid(*this).name(), NULL, NULL, &status);
+		mEntry->Name = name ? name : typeid(*this).name();
+		::free(name);
+	}
+	return mEntry->Name.c_str();
+}
+
+void IORegistryEntry::hostSetName(const char* name)
+{
+	std::lock_guard<std::recursive_mutex> lock(sRegistryLock);
+	mEntry->Name = name;
+}
+
+bool IORegistryEntry::attachToParent(IORegistryEntry* parent, const IORegistryPlane* plane)
+{
+	std::lock_guard<std::recursive_mutex> lock(sRegistryLock);
+	if (!parent || mEntry->Parent)
+		return false;
+
+	retain();
+	parent->retain();
+	parent->mEntry->Children.push_back(this);
+	mEntry->Parent = parent;
+	return true;
+}
+
+void IORegistryEntry::detachFromParent(IORegistryEntry* parent, const IORegistryPlane* plane)
+{
+	{
+		std::lock_guard<std::recursive_mutex> lock(sRegistryLock);
+		if (!parent || mEntry->Parent != parent)
+			return;
+
+		std::vector<IORegistryEntry*>& children = parent->mEntry->Children;
+		children.erase(std::remove(children.begin(), children.end(), this), children.end());
+		mEntry->Parent = NULL;
+	}
+	parent->release();
+	release();
+}
+
+/* IOService */
+
+// Interrupt sources registered with a provider, and the types of its interrupts
+struct HostInterrupts
+{
+	std::vector<int> Types;
+	std::vector<IOInterruptEventSource*> Sources;
+};
+
+static std::recursive_mutex sInterruptLock;
+
+// Drivers following the power changes of a service
+struct HostPowerInterest
+{
+	std::vector<IOService*> Drivers;
+};
+
+static std::mutex sPowerInterestLock;
+
+void IOService::free()
+{
+	delete mInterrupts;
+	delete mPowerInterest;
+	IORegistryEntry::free();
+}
+
+bool IOService::init(OSDictionary* dictionary)
+{
+	if (!OSObject::init())
+		return false;
+
+	// the personality becomes the initial property table
+	const char* key;
+	for (unsigned i = 0; dictionary && dictionary->hostGetObject(i, &key); i++)
+		setProperty(key, dictionary->hostGetObject(i, &key));
+	return true;
+}
+
+IOPMPowerFlags IOService::registerInterestedDriver(IOService* driver)
+{
+	std::lock_guard<std::mutex> lock(sPowerInterestLock);
+	if (!mPowerInterest)
+		mPowerInterest = new HostPowerInterest;
+	mPowerInterest->Drivers.push_back(driver);
+	return 0;
+}
+
+IOReturn IOService::deRegisterInterestedDriver(IOService* driver)
+{
+	std::lock_guard<std::mutex> lock(sPowerInterestLock);
+	if (mPowerInterest)
+	{
+		std::vector<IOService*>& drivers = mPowerInterest->Drivers;
+		drivers.erase(std::remove(drivers.begin(), drivers.end(), driver), drivers.end());
+	}
+	return kIOReturnSuccess;
+}
+
+void IOService::hostNotifyPowerChange(unsigned long stateNumber)
+{
+	std::vector<IOService*> drivers;
+	{
+		std::lock_guard<std::mutex> lock(sPowerInterestLock);
+		if (mPowerInterest)
+			drivers = mPowerInterest->Drivers;
+	}
+	for (IOService* driver : drivers)
+		driver->powerStateDidChangeTo(0, stateNumber, this);
+}
+
+IOReturn IOService::getInterruptType(int source, int* interruptType)
+{
+	std::lock_guard<std::recursive_mutex> lock(sInterruptLock);
+	if (!mInterrupts || source < 0 || source >= (int)mInterrupts->Types.size())
+		return kIOReturnNoInterrupt;
+
+	*interruptType = mInterrupts->Types[source];
+	return kIOReturnSuccess;
+}
+
+void IOService::hostSetInterruptTypes(const int* types, int count)
+{
+	std::lock_guard<std::recursive_mutex> lock(sInterruptLock);
+	if (!mInterrupts)
+		mInterrupts = new HostInterrupts;
+	mInterrupts->Types.assign(types, types + count);
+}
+
+void IOService::hostRaiseInterrupt(int source)
+{
+	std::lock_guard<std::recursive_mutex> lock(sInterruptLock);
+	if (!mInterrupts)
+		return;
+
+	for (IOInterruptEventSource* handler : mInterrupts->Sources)
+		if (handler->mSource == source)
+			handler->hostInterrupt();
+}
+
+/* memory */
+
+IOMemoryMap* IOMemoryDescriptor::map(IOOptionBits options)
+{
+	return new IOMemoryMap((IOVirtualAddress)(uintptr_t)mBytes, mLength);
+}
+
+IOByteCount IOMemoryDescriptor::readBytes(IOByteCount offset, void* bytes, IOByteCount length)
+{
+	if (offset > mLength)
+		return 0;
+	if (length > mLength - offset)
+		length = mLength - offset;
+	memcpy(bytes, (UInt8*)mBytes + offset, length);
+	return length;
+}
+
+IOByteCount IOMemoryDescriptor::writeBytes(IOByteCount offset, const void* bytes, IOByteCount length)
+{
+	if (offset > mLength)
+		return 0;
+	if (length > mLength - offset)
+		length = mLength - offset;
+	memcpy((UInt8*)mBytes + offset, bytes, length);
+	return length;
+}
+
+IOMemoryDescriptor* IOMemoryDescriptor::hostWithAddress(void* address, IOByteCount length)
+{
+	IOMemoryDescriptor* result = new IOMemoryDescriptor;
+	result->mBytes = address;
+	result->mLength = length;
+	return result;
+}
+
+IODeviceMemory* IODeviceMemory::hostWithAddress(void* address, IOByteCount length)
+{
+	IODeviceMemory* result = new IODeviceMemory;
+	result->mBytes = address;
+	result->mLength = length;
+	return result;
+}
+
+void IOBufferMemoryDescriptor::free()
+{
+	if (mMappedLength)
+		munmap(mBytes, mMappedLength);
+	else
+		::free(mBytes);
+	IOMemoryDescriptor::free();
+}
+
+IOBufferMemoryDescriptor* IOBufferMemoryDescriptor::inTaskWithOptions(task_t task, IOOptionBits options, size_t capacity,
+																		size_t alignment)
+{
+	if (alignment < sizeof(void*))
+		alignment = sizeof(void*);
+
+	IOBufferMemoryDescriptor* result = new IOBufferMemoryDescriptor;
+	size_t page = (size_t)sysconf(_SC_PAGESIZE);
+	if (alignment <= page)
+	{
+		// a page of its own, touching it after the release faults instead of reading a reused block
+		size_t length = (capacity + page - 1) / page * page;
+		void* bytes = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (bytes != MAP_FAILED)
+		{
+			result->mBytes = bytes;
+			result->mMappedLength = length;
+		}
+	}
+	else
+		result->mBytes = aligned_alloc(alignment, (capacity + alignment - 1) / alignment * alignment);
+	result->mLength = capacity;
+	if (!result->mBytes)
+	{
+		result->release();
+		return NULL;
+	}
+	return result;
+}
+
+IOBufferMemoryDescriptor* IOBufferMemoryDescriptor::inTaskWithPhysicalMask(task_t task, IOOptionBits options, size_t capacity,
+																			 mach_vm_address_t physicalMask)
+{
+	// host addresses are the "physical" ones, the mask only sets the alignment
+	return inTaskWithOptions(task, options, capacity, (size_t)(~physicalMask + 1));
+}
+
+/* work loops */
+
+struct HostWorkLoop
+{
+	std::recursive_mutex Gate;
+	std::atomic<std::thread::id> Owner;
+	int Depth = 0;
+	std::atomic<UInt32> Waiters;
+	std::atomic<bool> Busy;
+
+	std::mutex Lock;
+	std::condition_variable Wakeup;
+	bool Signaled = false;
+	bool Stop = false;
+	bool Detached = false;
+
+	std::vector<IOEventSource*> Sources;
+	std::thread Thread;
+
+	HostWorkLoop() : Waiters(0), Busy(false) { }
+
+	// waiting counts for hostGetGateWaiters, the loop thread itself is not counted
+	void closeGate(bool counted = false)
+	{
+		if (counted)
+			Waiters++;
+		Gate.lock();
+		if (counted)
+			Waiters--;
+		Owner = std::this_thread::get_id();
+		Depth++;
+	}
+
+	// without waiting, false if another thread holds the gate
+	bool tryCloseGate()
+	{
+		if (!Gate.try_lock())
+			return false;
+		Owner = std::this_thread::get_id();
+		Depth++;
+		return true;
+	}
+
+	void openGate()
+	{
+		if (!--Depth)
+			Owner = std::thread::id();
+		Gate.unlock();
+	}
+
+	// gate held by the caller
+	bool hasWork()
+	{
+		for (IOEventSource* source : Sources)
+			if (source->mEnabled && source->hostHasWork())
+				return true;
+		return false;
+	}
+
+	void signal()
+	{
+		std::lock_guard<std::mutex> lock(Lock);
+		Signaled = true;
+		Wakeup.notify_one();
+	}
+
+	void run();
+};
+
+static std::mutex sWorkLoopsLock;
+static std::vector<HostWorkLoop*> sWorkLoops;
+
+static void wakeWorkLoops()
+{
+	std::lock_guard<std::mutex> lock(sWorkLoopsLock);
+	for (HostWorkLoop* loop : sWorkLoops)
+		loop->signal();
+}
+
+void HostWorkLoop::run()
+{
+	for (;;)
+	{
+		{
+			std::lock_guard<std::mutex> lock(Lock);
+			if (Stop)
+				break;
+			Signaled = false;
+		}
+
+		// one pass over all sources, like IOWorkLoop::runEventSources
+		bool worked = false;
+		Busy = true;
+		closeGate();
+		for (size_t i = 0; i < Sources.size(); i++)
+		{
+			IOEventSource* source = Sources[i];
+			if (source->mEnabled && source->checkForWork())
+				worked = true;
+		}
+		openGate();
+		Busy = false;
+
+		if (worked)
+			continue;
+
+		// virtual time may pass without a signal, look again every millisecond
+		std::unique_lock<std::mutex> lock(Lock);
+		if (!Stop && !Signaled)
+			Wakeup.wait_for(lock, std::chrono::milliseconds(1));
+	}
+
+	bool detached;
+	{
+		std::lock_guard<std::mutex> lock(Lock);
+		detached = Detached;
+	}
+	if (detached)
+		delete this;
+}
+
+IOWorkLoop* IOWorkLoop::workLoop()
+{
+	IOWorkLoop* result = new IOWorkLoop;
+	HostWorkLoop* loop = result->mLoop = new HostWorkLoop;
+	{
+		std::lock_guard<std::mutex> lock(sWorkLoopsLock);
+		sWorkLoops.push_back(loop);
+	}
+	loop->Thread = std::thread([loop] { loop->run(); });
+	return result;
+}
+
+void IOWorkLoop::free()
+{
+	HostWorkLoop* loop = mLoop;
+	{
+		std::lock_guard<std::mutex> lock(sWorkLoopsLock);
+		sWorkLoops.erase(std::remove(sWorkLoops.begin(), sWorkLoops.end(), loop), sWorkLoops.end());
+	}
+
+	bool own = loop->Thread.get_id() == std::this_thread::get_id();
+	{
+		std::lock_guard<std::mutex> lock(loop->Lock);
+		loop->Stop = true;
+		loop->Detached = own;
+		loop->Wakeup.notify_one();
+	}
+
+	// sources still attached go with the work loop
+	std::vector<IOEventSource*> sources;
+	loop->closeGate();
+	sources.swap(loop->Sources);
+	for (IOEventSource* source : sources)
+		source->mWorkLoop = NULL;
+	loop->openGate();
+	for (IOEventSource* source : sources)
+		source->release();
+
+	if (own)
+		loop->Thread.detach();
+	else
+	{
+		loop->Thread.join();
+		delete loop;
+	}
+	OSObject::free();
+}
+
+IOReturn IOWorkLoop::addEventSource(IOEventSource* source)
+{
+	if (!source || source->mWorkLoop)
+		return kIOReturnBadArgument;
+
+	source->retain();
+	mLoop->closeGate();
+	mLoop->Sources.push_back(source);
+	source->mWorkLoop = this;
+	mLoop->openGate();
+	mLoop->signal();
+	return kIOReturnSuccess;
+}
+
+IOReturn IOWorkLoop::removeEventSource(IOEventSource* source)
+{
+	// taking the gate waits for an action of the source that is still running
+	mLoop->closeGate();
+	std::vector<IOEventSource*>& sources = mLoop->Sources;
+	auto item = std::find(sources.begin(), sources.end(), source);
+	bool found = item != sources.end();
+	if (found)
+	{
+		sources.erase(item);
+		source->mWorkLoop = NULL;
+	}
+	mLoop->openGate();
+
+	if (!found)
+		return kIOReturnBadArgument;
+
+	source->release();
+	return kIOReturnSuccess;
+}
+
+bool IOWorkLoop::inGate() const
+{
+	return mLoop->Owner == std::this_thread::get_id();
+}
+
+void IOWorkLoop::hostCloseGate()
+{
+	mLoop->closeGate(true);
+}
+
+void IOWorkLoop::hostOpenGate()
+{
+	mLoop->openGate();
+}
+
+UInt32 IOWorkLoop::hostGetGateWaiters() const
+{
+	return mLoop->Waiters;
+}
+
+void IOWorkLoop::hostSignal()
+{
+	mLoop->signal();
+}
+
+bool IOWorkLoop::hostHasWork()
+{
+	if (mLoop->Busy)
+		return true;
+
+	mLoop->closeGate();
+	bool work = mLoop->hasWork();
+	mLoop->openGate();
+	return work;
+}
+
+bool hostWaitIdle()
+{
+	// idle twice in a row, in case an action just handed work to another loop
+	auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+	int idle = 0;
+
+	while (std::chrono::steady_clock::now() < deadline)
+	{
+		bool work = false;
+		{
+			std::lock_guard<std::mutex> lock(sWorkLoopsLock);
+			for (HostWorkLoop* loop : sWorkLoops)
+			{
+				// a gate held elsewhere counts as work, waiting for it here would block
+				// a holder that advances the clock (which takes sWorkLoopsLock)
+				if (loop->Busy || !loop->tryCloseGate())
+				{
+					work = true;
+					break;
+				}
+				work = loop->hasWork();
+				loop->openGate();
+				if (work)
+					break;
+			}
+		}
+
+		idle = work ? 0 : idle + 1;
+		if (idle == 2)
+			return true;
+
+		std::this_thread::sleep_for(std::chrono::microseconds(200));
+	}
+	return false;
+}
+
+void IOEventSource::signalWorkAvailable()
+{
+	if (IOWorkLoop* workLoop = mWorkLoop)
+		workLoop->hostSignal();
+}
+
+IOCommandGate* IOCommandGate::commandGate(OSObject* owner, Action action)
+{
+	IOCommandGate* result = new IOCommandGate;
+	result->mOwner = owner;
+	return result;
+}
+
+IOReturn IOCommandGate::runAction(Action action, void* arg0, void* arg1, void* arg2, void* arg3)
+{
+	IOWorkLoop* workLoop = mWorkLoop;
+	if (!workLoop || !action)
+		return kIOReturnNotPermitted;
+
+	workLoop->hostCloseGate();
+	IOReturn result = action(mOwner, arg0, arg1, arg2, arg3);
+	workLoop->hostOpenGate();
+	return result;
+}
+
+IOTimerEventSource* IOTimerEventSource::timerEventSource(OSObject* owner, Action action)
+{
+	IOTimerEventSource* result = new IOTimerEventSource;
+	result->mOwner = owner;
+	result->mAction = action;
+	return result;
+}
+
+IOReturn IOTimerEventSource::setTimeoutMS(UInt32 milliseconds)
+{
+	return setTimeoutUS(milliseconds * 1000);
+}
+
+IOReturn IOTimerEventSource::setTimeoutUS(UInt32 microseconds)
+{
+	mDeadline = sTime + (UInt64)microseconds * 1000;
+	signalWorkAvailable();
+	return kIOReturnSuccess;
+}
+
+bool IOTimerEventSource::hostHasWork()
+{
+	UInt64 deadline = mDeadline;
+	return deadline && deadline <= sTime;
+}
+
+bool IOTimerEventSource::checkForWork()
+{
+	UInt64 deadline = mDeadline;
+	if (!deadline || deadline > sTime)
+		return false;
+
+	// the action may re-arm the timer, and so may any other thread meanwhile
+	if (__sync_bool_compare_and_swap(&mDeadline, deadline, 0) && mAction)
+		mAction(mOwner, this);
+	return true;
+}
+
+/* interrupts */
+
+bool IOInterruptEventSource::attachInterrupt(IOService* provider, int source)
+{
+	std::lock_guard<std::recursive_mutex> lock(sInterruptLock);
+	if (!provider->mInterrupts)
+	{
+		provider->mInterrupts = new HostInterrupts;
+		provider->mInterrupts->Types.push_back(kIOInterruptTypeLevel);
+	}
+	if (source < 0 || source >= (int)provider->mInterrupts->Types.size())
+		return false;
+
+	provider->retain();
+	mProvider = provider;
+	mSource = source;
+	provider->mInterrupts->Sources.push_back(this);
+	return true;
+}
+
+void IOInterruptEventSource::free()
+{
+	if (mProvider)
+	{
+		{
+			std::lock_guard<std::recursive_mutex> lock(sInterruptLock);
+			std::vector<IOInterruptEventSource*>& sources = mProvider->mInterrupts->Sources;
+			sources.erase(std::remove(sources.begin(), sources.end(), this), sources.end());
+		}
+		mProvider->release();
+	}
+	IOEventSource::free();
+}
+
+bool IOInterruptEventSource::hostHasWork()
+{
+	return mPending != 0;
+}
+
+bool IOInterruptEventSource::checkForWork()
+{
+	SInt32 count = __sync_lock_test_and_set(&mPending, 0);
+	if (!count)
+		return false;
+
+	if (mAction)
+		mAction(mOwner, this, count);
+	return true;
+}
+
+void IOInterruptEventSource::hostInterrupt()
+{
+	if (!mEnabled)
+		return;
+
+	__sync_fetch_and_add(&mPending, 1);
+	signalWorkAvailable();
+}
+
+IOFilterInterruptEventSource* IOFilterInterruptEventSource::filterInterruptEventSource(OSObject* owner,
+																					   IOInterruptEventSource::Action action,
+																					   Filter filter, IOService* provider,
+																					   int intIndex)
+{
+	IOFilterInterruptEventSource* result = new IOFilterInterruptEventSource;
+	result->mOwner = owner;
+	result->mAction = action;
+	result->mFilter = filter;
+
+	// the interrupt stays disabled at the provider until the source is enabled
+	result->mEnabled = false;
+	if (!provider || !result->attachInterrupt(provider, intIndex))
+	{
+		result->release();
+		return NULL;
+	}
+	return result;
+}
+
+void IOFilterInterruptEventSource::hostInterrupt()
+{
+	// primary interrupt context: the filter decides whether the action runs at all
+	if (mEnabled && mFilter && mFilter(mOwner, this))
+		signalInterrupt();
+}
+
+void IOFilterInterruptEventSource::signalInterrupt()
+{
+	__sync_fetch_and_add(&mPending, 1);
+	signalWorkAvailable();
+}
+
+/* devices */
+
+IOPCIDevice::IOPCIDevice()
+{
+	memset(mConfig, 0, sizeof(mConfig));
+}
+
+void IOPCIDevice::free()
+{
+	OSSafeReleaseNULL(mMemory);
+	IOService::free();
+}
+
+void IOPCIDevice::hostSetMemory(void* registers, IOByteCount length)
+{
+	OSSafeReleaseNULL(mMemory);
+	mMemory = IODeviceMemory::hostWithAddress(registers, length);
+}
+
+/* user clients */
+
+bool IOUserClient::initWithTask(task_t owningTask, void* securityToken, UInt32 type, OSDictionary* properties)
+{
+	return IOService::init(properties);
+}
+
+IOReturn IOUserClient::externalMethod(uint32_t selector, IOExternalMethodArguments* arguments,
+									  IOExternalMethodDispatch* dispatch, OSObject* target, void* reference)
+{
+	// same argument checks as IOUserClient::externalMethod
+	if (!dispatch || !target || !dispatch->function)
+		return kIOReturnBadArgument;
+
+	UInt32 inputSize = arguments->structureInputDescriptor ? (UInt32)arguments->structureInputDescriptor->getLength()
+														   : arguments->structureInputSize;
+	UInt32 outputSize = arguments->structureOutputDescriptor ? (UInt32)arguments->structureOutputDescriptor->getLength()
+															 : arguments->structureOutputSize;
+
+	if (dispatch->checkScalarInputCount != kIOUCVariableStructureSize &&
+		dispatch->checkScalarInputCount != arguments->scalarInputCount)
+		return kIOReturnBadArgument;
+	if (dispatch->checkStructureInputSize != kIOUCVariableStructureSize &&
+		dispatch->checkStructureInputSize != inputSize)
+		return kIOReturnBadArgument;
+	if (dispatch->checkScalarOutputCount != kIOUCVariableStructureSize &&
+		dispatch->checkScalarOutputCount != arguments->scalarOutputCount)
+		return kIOReturnBadArgument;
+	if (dispatch->checkStructureOutputSize != kIOUCVariableStructureSize &&
+		dispatch->checkStructureOutputSize != outputSize)
+		return kIOReturnBadArgument;
+
+	return dispatch->function(target, reference, arguments);
+}
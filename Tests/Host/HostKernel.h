@@ -0,0 +1,725 @@
+/*
+ *  Released under "The GNU General Public License (GPL-2.0)"
+ *
+ *  This program is free software; you can redistribute it and/or modify it
+ *  under the terms of the GNU General Public License as published by the
+ *  Free Software Foundation; either version 2 of the License, or (at your
+ *  option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ *  or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ *  for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ *
+ */
+
+#ifndef CodecCommander_HostKernel_h
+#define CodecCommander_HostKernel_h
+
+// Just enough of the kernel, libkern and IOKit to build the kext's sources into a host
+// process for the tests. Objects behave like their IOKit counterparts where the kext
+// relies on it: reference counts, registry parents and children, work loops with their
+// own thread and gate, timers and interrupt sources. Time is virtual and only moves when
+// somebody waits (IODelay, IOSleep), so timeouts cost nothing and results are exact.
+// Anything named host* is not IOKit, it is how the tests drive the shim.
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <strings.h>
+#include <stdio.h>
+#include <assert.h>
+
+typedef uint8_t UInt8;
+typedef uint16_t UInt16;
+typedef uint32_t UInt32;
+typedef unsigned long long UInt64;
+typedef int8_t SInt8;
+typedef int16_t SInt16;
+typedef int32_t SInt32;
+typedef long long SInt64;
+
+typedef int kern_return_t;
+typedef kern_return_t IOReturn;
+typedef UInt32 IOOptionBits;
+typedef UInt64 IOPhysicalAddress;
+typedef UInt64 IOPhysicalAddress64;
+typedef UInt64 IOVirtualAddress;
+typedef UInt64 IOByteCount;
+typedef UInt64 mach_vm_address_t;
+typedef UInt32 mach_port_t;
+typedef UInt32 IODirection;
+typedef UInt64 AbsoluteTime;
+typedef void* task_t;
+
+#define kIOReturnSuccess		0
+#define kIOReturnError			((IOReturn)0xe00002bc)
+#define kIOReturnNoMemory		((IOReturn)0xe00002bd)
+#define kIOReturnNoResources	((IOReturn)0xe00002be)
+#define kIOReturnBadArgument	((IOReturn)0xe00002c2)
+#define kIOReturnNoSpace		((IOReturn)0xe00002c4)
+#define kIOReturnUnsupported	((IOReturn)0xe00002c7)
+#define kIOReturnVMError		((IOReturn)0xe00002c9)
+#define kIOReturnTimeout		((IOReturn)0xe00002d6)
+#define kIOReturnNotReady		((IOReturn)0xe00002d8)
+#define kIOReturnNotPermitted	((IOReturn)0xe00002e2)
+#define kIOReturnNoInterrupt	((IOReturn)0xe00002e9)
+
+#define PAGE_SIZE				4096
+
+#define kIODirectionIn					1
+#define kIODirectionOut					2
+#define kIODirectionInOut				3
+#define kIOMemoryPhysicallyContiguous	0x00000010
+#define kIOMemoryKernelUserShared		0x00000200
+
+#define kIOInterruptTypeLevel			0x00000001
+#define kIOInterruptTypePCIMessaged		0x00010000
+
+#define kIOPCIConfigVendorID			0x00
+#define kIOPCIConfigDeviceID			0x02
+#define kIOPCIConfigSubSystemVendorID	0x2c
+
+#define IOPMAckImplied		0
+#define kIOPMDeviceUsable	0x00008000
+#define kIOPMDoze			0x00000400
+#define IOPMPowerOn			0x00000002
+
+
+extern "C"
+{
+	void IOLog(const char* format, ...) __attribute__((format(printf, 1, 2)));
+	void IOSleep(unsigned milliseconds);
+	void IODelay(unsigned microseconds);
+	void* IOMalloc(size_t size);
+	void IOFree(void* address, size_t size);
+
+	void clock_get_uptime(UInt64* result);
+	void absolutetime_to_nanoseconds(UInt64 abstime, UInt64* result);
+
+	const char* OSKextGetCurrentIdentifier(void);
+	UInt32 OSKextGetCurrentLoadTag(void);
+	const char* OSKextGetCurrentVersionString(void);
+}
+
+static inline bool OSCompareAndSwapPtr(void* oldValue, void* newValue, void* volatile* address)
+	{ return __sync_bool_compare_and_swap(address, oldValue, newValue); }
+static inline SInt32 OSIncrementAtomic(volatile SInt32* address)
+	{ return __sync_fetch_and_add(address, 1); }
+static inline void OSMemoryBarrier() { __sync_synchronize(); }
+static inline void OSSynchronizeIO() { __sync_synchronize(); }
+
+struct IOLock;
+IOLock* IOLockAlloc();
+void IOLockFree(IOLock* lock);
+void IOLockLock(IOLock* lock);
+void IOLockUnlock(IOLock* lock);
+
+// spinning in the kernel, shared with primary interrupt filters (interrupts are not masked here)
+struct IOSimpleLock;
+typedef long IOInterruptState;
+IOSimpleLock* IOSimpleLockAlloc();
+void IOSimpleLockFree(IOSimpleLock* lock);
+void IOSimpleLockLock(IOSimpleLock* lock);
+void IOSimpleLockUnlock(IOSimpleLock* lock);
+IOInterruptState IOSimpleLockLockDisableInterrupt(IOSimpleLock* lock);
+void IOSimpleLockUnlockEnableInterrupt(IOSimpleLock* lock, IOInterruptState state);
+
+struct IONamedValue
+{
+	int value;
+	const char* name;
+};
+const char* IOFindNameForValue(int value, const IONamedValue* table);
+
+typedef struct kmod_info
+{
+	char name[64];
+	char version[64];
+} kmod_info_t;
+
+/* libkern */
+
+class OSMetaClass;
+
+class OSMetaClassBase
+{
+public:
+	virtual ~OSMetaClassBase() { }
+	virtual void retain() const = 0;
+	virtual void release() const = 0;
+};
+
+class OSObject : public OSMetaClassBase
+{
+	mutable volatile SInt32 mRetainCount = 1;
+
+protected:
+	virtual void free();
+
+public:
+	virtual bool init() { return true; }
+	virtual void retain() const;
+	virtual void release() const;
+	SInt32 getRetainCount() const { return mRetainCount; }
+};
+
+#define OSDeclareDefaultStructors(className) \
+	public: static const OSMetaClass* const metaClass; private:
+#define OSDefineMetaClassAndStructors(className, superclassName) \
+	const OSMetaClass* const className::metaClass = NULL;
+
+#define OSDynamicCast(type, object) dynamic_cast<type*>((OSMetaClassBase*)(object))
+#define OSSafeRelease(object) do { if (object) (object)->release(); } while (0)
+#define OSSafeReleaseNULL(object) do { if (object) (object)->release(); (object) = NULL; } while (0)
+
+// What the kernel does for OSMemberFunctionCast, for the Itanium C++ ABI: a pointer to a
+// virtual member function holds 1 + its offset in the vtable, otherwise it is the function
+template <typename Function, typename Object, typename Member>
+static inline Function hostMemberFunctionCast(const Object* object, Member member)
+{
+	struct { uintptr_t function; ptrdiff_t adjust; } parts;
+	static_assert(sizeof(member) == sizeof(parts), "unexpected pointer to member layout");
+	memcpy(&parts, &member, sizeof(parts));
+
+	if (parts.function & 1)
+	{
+		const char* vtable = *(const char* const*)((const char*)object + parts.adjust);
+		return (Function)*(void* const*)(vtable + parts.function - 1);
+	}
+	return (Function)parts.function;
+}
+
+#define OSMemberFunctionCast(type, object, member) hostMemberFunctionCast<type>(object, member)
+
+class OSString;
+class OSSymbol;
+
+class OSIterator : public OSObject
+{
+public:
+	virtual OSObject* getNextObject() = 0;
+};
+
+class OSCollection : public OSObject
+{
+};
+
+class OSArray : public OSCollection
+{
+	struct HostArray* mItems;
+
+protected:
+	virtual void free();
+
+public:
+	OSArray();
+	static OSArray* withCapacity(unsigned capacity);
+
+	bool setObject(const OSMetaClassBase* object);
+	OSObject* getObject(unsigned index) const;
+	unsigned getCount() const;
+	void flushCollection();
+};
+
+class OSDictionary : public OSCollection
+{
+	struct HostDictionary* mItems;
+
+protected:
+	virtual void free();
+
+public:
+	OSDictionary();
+	static OSDictionary* withCapacity(unsigned capacity);
+	static OSDictionary* withDictionary(const OSDictionary* dictionary, unsigned capacity = 0);
+
+	bool setObject(const char* key, const OSMetaClassBase* object);
+	bool setObject(const OSString* key, const OSMetaClassBase* object);
+	OSObject* getObject(const char* key) const;
+	OSObject* getObject(const OSString* key) const;
+	void removeObject(const char* key);
+	bool merge(const OSDictionary* dictionary);
+	unsigned getCount() const;
+	void flushCollection();
+
+	// entries in key order
+	OSObject* hostGetObject(unsigned index, const char** key) const;
+};
+
+// over arrays only
+class OSCollectionIterator : public OSIterator
+{
+	const OSCollection* mCollection = NULL;
+	unsigned mNext = 0;
+
+protected:
+	virtual void free();
+
+public:
+	static OSCollectionIterator* withCollection(const OSCollection* collection);
+
+	virtual OSObject* getNextObject();
+};
+
+class OSString : public OSObject
+{
+protected:
+	char* mString = NULL;
+
+	virtual void free();
+
+public:
+	static OSString* withCString(const char* string);
+
+	const char* getCStringNoCopy() const { return mString; }
+	unsigned getLength() const { return (unsigned)strlen(mString); }
+	bool isEqualTo(const char* string) const { return !strcmp(mString, string); }
+};
+
+class OSSymbol : public OSString
+{
+public:
+	static const OSSymbol* withCString(const char* string);
+};
+
+class OSNumber : public OSObject
+{
+	UInt64 mValue = 0;
+	unsigned mBits = 64;
+
+public:
+	static OSNumber* withNumber(unsigned long long value, unsigned numberOfBits);
+
+	UInt8 unsigned8BitValue() const { return (UInt8)mValue; }
+	UInt16 unsigned16BitValue() const { return (UInt16)mValue; }
+	UInt32 unsigned32BitValue() const { return (UInt32)mValue; }
+	UInt64 unsigned64BitValue() const { return mValue; }
+	unsigned numberOfBits() const { return mBits; }
+	void setValue(unsigned long long value);
+};
+
+class OSBoolean : public OSObject
+{
+	bool mValue;
+
+public:
+	explicit OSBoolean(bool value) : mValue(value) { }
+
+	virtual void retain() const { }
+	virtual void release() const { }
+
+	bool getValue() const { return mValue; }
+	bool isTrue() const { return mValue; }
+	bool isFalse() const { return !mValue; }
+};
+
+extern OSBoolean* const kOSBooleanTrue;
+extern OSBoolean* const kOSBooleanFalse;
+
+class OSData : public OSObject
+{
+	void* mBytes = NULL;
+	unsigned mLength = 0;
+	unsigned mCapacity = 0;
+
+protected:
+	virtual void free();
+
+public:
+	static OSData* withBytes(const void* bytes, unsigned length);
+	static OSData* withCapacity(unsigned capacity);
+
+	bool appendByte(unsigned char byte, unsigned count);
+	unsigned getLength() const { return mLength; }
+	unsigned getCapacity() const { return mCapacity; }
+	const void* getBytesNoCopy() const { return mBytes; }
+};
+
+// Property list XML (plist files) to OSDictionary, OSArray, OSString, OSData, OSNumber or OSBoolean
+OSObject* OSUnserializeXML(const char* buffer, OSString** errorString = NULL);
+
+/* IOKit */
+
+class IORegistryPlane;
+extern const IORegistryPlane* gIOServicePlane;
+
+class IORegistryEntry : public OSObject
+{
+	struct HostRegistryEntry* mEntry;
+
+protected:
+	virtual void free();
+
+public:
+	IORegistryEntry();
+
+	OSObject* getProperty(const char* key) const;
+	bool setProperty(const char* key, OSObject* object);
+	bool setProperty(const char* key, bool value);
+	bool setProperty(const char* key, unsigned long long value, unsigned numberOfBits);
+	bool setProperty(const char* key, const char* value);
+	void removeProperty(const char* key);
+
+	IORegistryEntry* getParentEntry(const IORegistryPlane* plane) const;
+	IORegistryEntry* getChildEntry(const IORegistryPlane* plane) const;
+	OSIterator* getChildIterator(const IORegistryPlane* plane) const;
+	bool getPath(char* path, int* length, const IORegistryPlane* plane) const;
+	const char* getName(const IORegistryPlane* plane = 0) const;
+
+	// the registry keeps a reference to attached entries, like IOKit's
+	bool attachToParent(IORegistryEntry* parent, const IORegistryPlane* plane);
+	void detachFromParent(IORegistryEntry* parent, const IORegistryPlane* plane);
+	void hostSetName(const char* name);
+};
+
+typedef unsigned long IOPMPowerFlags;
+
+struct IOPMPowerState
+{
+	unsigned long version;
+	IOPMPowerFlags capabilityFlags;
+	IOPMPowerFlags outputPowerCharacter;
+	IOPMPowerFlags inputPowerRequirement;
+	unsigned long staticPower;
+	unsigned long unbudgetedPower;
+	unsigned long powerToAttain;
+	unsigned long timeToAttain;
+	unsigned long settleUpTime;
+	unsigned long timeToLower;
+	unsigned long settleDownTime;
+	unsigned long powerDomainBudget;
+};
+
+class IOWorkLoop;
+class IOInterruptEventSource;
+
+class IOService : public IORegistryEntry
+{
+	friend class IOInterruptEventSource;
+
+	struct HostInterrupts* mInterrupts = NULL;
+	struct HostPowerInterest* mPowerInterest = NULL;
+	volatile bool mInactive = false;
+	volatile UInt32 mPowerAcks = 0;
+
+protected:
+	virtual void free();
+
+public:
+	virtual bool init(OSDictionary* dictionary = 0);
+	virtual IOService* probe(IOService* provider, SInt32* score) { return this; }
+	virtual bool start(IOService* provider) { return true; }
+	virtual void stop(IOService* provider) { }
+
+	bool attach(IOService* provider) { return attachToParent(provider, gIOServicePlane); }
+	void detach(IOService* provider) { detachFromParent(provider, gIOServicePlane); }
+	bool isInactive() const { return mInactive; }
+	bool terminate(IOOptionBits options = 0) { mInactive = true; return true; }
+	void registerService(IOOptionBits options = 0) { }
+
+	// power management, only acknowledgements and interested drivers are recorded
+	void PMinit() { }
+	void PMstop() { }
+	IOReturn registerPowerDriver(IOService* driver, IOPMPowerState* states, unsigned long count) { return kIOReturnSuccess; }
+	IOReturn joinPMtree(IOService* driver) { return kIOReturnSuccess; }
+	IOPMPowerFlags registerInterestedDriver(IOService* driver);
+	IOReturn deRegisterInterestedDriver(IOService* driver);
+	// powerStateDidChangeTo of the interested drivers, as after a power change of this service
+	void hostNotifyPowerChange(unsigned long stateNumber);
+	IOReturn acknowledgeSetPowerState() { __sync_fetch_and_add(&mPowerAcks, 1); return kIOReturnSuccess; }
+	virtual IOReturn setPowerState(unsigned long powerStateOrdinal, IOService* whatDevice) { return IOPMAckImplied; }
+	virtual IOReturn powerStateDidChangeTo(IOPMPowerFlags capabilities, unsigned long stateNumber, IOService* whatDevice)
+		{ return IOPMAckImplied; }
+	UInt32 hostGetPowerAcks() const { return mPowerAcks; }
+
+	// interrupts of this (provider) service
+	virtual IOReturn getInterruptType(int source, int* interruptType);
+	void hostSetInterruptTypes(const int* types, int count);
+	// primary interrupt: runs the filters of the sources attached to this interrupt
+	void hostRaiseInterrupt(int source);
+};
+
+class IOMemoryMap : public OSObject
+{
+	IOVirtualAddress mAddress;
+	IOByteCount mLength;
+
+public:
+	IOMemoryMap(IOVirtualAddress address, IOByteCount length) : mAddress(address), mLength(length) { }
+
+	IOVirtualAddress getVirtualAddress() { return mAddress; }
+	IOByteCount getLength() { return mLength; }
+};
+
+// Host memory stands in for physical memory, the fake controller follows the same addresses
+class IOMemoryDescriptor : public OSObject
+{
+protected:
+	void* mBytes = NULL;
+	IOByteCount mLength = 0;
+
+public:
+	IOMemoryMap* map(IOOptionBits options = 0);
+	IOPhysicalAddress getPhysicalAddress() { return (IOPhysicalAddress)(uintptr_t)mBytes; }
+	IOByteCount getLength() const { return mLength; }
+	IOReturn prepare(IODirection direction = 0) { return kIOReturnSuccess; }
+	IOReturn complete(IODirection direction = 0) { return kIOReturnSuccess; }
+	IOByteCount readBytes(IOByteCount offset, void* bytes, IOByteCount length);
+	IOByteCount writeBytes(IOByteCount offset, const void* bytes, IOByteCount length);
+
+	static IOMemoryDescriptor* hostWithAddress(void* address, IOByteCount length);
+};
+
+class IODeviceMemory : public IOMemoryDescriptor
+{
+public:
+	static IODeviceMemory* hostWithAddress(void* address, IOByteCount length);
+};
+
+class IOBufferMemoryDescriptor : public IOMemoryDescriptor
+{
+	size_t mMappedLength = 0;	// whole pages, unmapped when freed so stale pointers fault
+
+protected:
+	virtual void free();
+
+public:
+	static IOBufferMemoryDescriptor* inTaskWithOptions(task_t task, IOOptionBits options, size_t capacity, size_t alignment = 1);
+	static IOBufferMemoryDescriptor* inTaskWithPhysicalMask(task_t task, IOOptionBits options, size_t capacity,
+															mach_vm_address_t physicalMask);
+
+	void* getBytesNoCopy() { return mBytes; }
+};
+
+extern task_t kernel_task;
+
+class IOEventSource : public OSObject
+{
+	friend class IOWorkLoop;
+	friend struct HostWorkLoop;
+
+protected:
+	OSObject* mOwner = NULL;
+	IOWorkLoop* mWorkLoop = NULL;
+	volatile bool mEnabled = true;
+
+	// called on the work loop thread with the gate held, true if an action ran
+	virtual bool checkForWork() { return false; }
+	// gate held, true if checkForWork would run an action now
+	virtual bool hostHasWork() { return false; }
+	void signalWorkAvailable();
+
+public:
+	virtual void enable() { mEnabled = true; signalWorkAvailable(); }
+	virtual void disable() { mEnabled = false; }
+	IOWorkLoop* getWorkLoop() const { return mWorkLoop; }
+};
+
+class IOWorkLoop : public OSObject
+{
+	friend class IOEventSource;
+
+	struct HostWorkLoop* mLoop = NULL;
+
+protected:
+	virtual void free();
+
+public:
+	static IOWorkLoop* workLoop();
+
+	IOReturn addEventSource(IOEventSource* source);
+	IOReturn removeEventSource(IOEventSource* source);
+	bool inGate() const;
+
+	// closes the gate like IOCommandGate::runAction
+	void hostCloseGate();
+	void hostOpenGate();
+	// threads blocked on the gate in runAction or hostCloseGate
+	UInt32 hostGetGateWaiters() const;
+	void hostSignal();
+	bool hostHasWork();
+};
+
+class IOCommandGate : public IOEventSource
+{
+public:
+	typedef IOReturn (*Action)(OSObject* owner, void* arg0, void* arg1, void* arg2, void* arg3);
+
+	static IOCommandGate* commandGate(OSObject* owner, Action action = 0);
+
+	IOReturn runAction(Action action, void* arg0 = 0, void* arg1 = 0, void* arg2 = 0, void* arg3 = 0);
+};
+
+class IOTimerEventSource : public IOEventSource
+{
+	typedef void (*ActionFunction)(OSObject* owner, IOTimerEventSource* sender);
+
+	ActionFunction mAction = NULL;
+	volatile UInt64 mDeadline = 0;
+
+protected:
+	virtual bool checkForWork();
+	virtual bool hostHasWork();
+
+public:
+	typedef ActionFunction Action;
+
+	static IOTimerEventSource* timerEventSource(OSObject* owner, Action action = 0);
+
+	IOReturn setTimeoutMS(UInt32 milliseconds);
+	IOReturn setTimeoutUS(UInt32 microseconds);
+	void cancelTimeout() { mDeadline = 0; }
+};
+
+class IOInterruptEventSource : public IOEventSource
+{
+public:
+	typedef void (*Action)(OSObject* owner, IOInterruptEventSource* sender, int count);
+
+protected:
+	Action mAction = NULL;
+	IOService* mProvider = NULL;
+	int mSource = 0;
+	volatile SInt32 mPending = 0;
+
+	virtual bool checkForWork();
+	virtual bool hostHasWork();
+	virtual void free();
+	bool attachInterrupt(IOService* provider, int source);
+
+	// primary interrupt context
+	friend class IOService;
+	virtual void hostInterrupt();
+};
+
+class IOFilterInterruptEventSource : public IOInterruptEventSource
+{
+public:
+	typedef bool (*Filter)(OSObject* owner, IOFilterInterruptEventSource* sender);
+
+private:
+	Filter mFilter = NULL;
+
+protected:
+	virtual void hostInterrupt();
+
+public:
+	static IOFilterInterruptEventSource* filterInterruptEventSource(OSObject* owner, IOInterruptEventSource::Action action,
+																	Filter filter, IOService* provider, int intIndex = 0);
+
+	void signalInterrupt();
+};
+
+class IOPCIDevice : public IOService
+{
+	IODeviceMemory* mMemory = NULL;
+	UInt8 mConfig[256];
+
+protected:
+	virtual void free();
+
+public:
+	IOPCIDevice();
+
+	unsigned getDeviceMemoryCount() { return mMemory ? 1 : 0; }
+	IODeviceMemory* getDeviceMemoryWithIndex(unsigned index) { return index == 0 ? mMemory : NULL; }
+	bool setMemoryEnable(bool enable) { return true; }
+	bool setBusMasterEnable(bool enable) { return true; }
+
+	UInt8 configRead8(UInt8 offset) { return mConfig[offset]; }
+	UInt16 configRead16(UInt8 offset) { UInt16 value; memcpy(&value, mConfig + offset, sizeof(value)); return value; }
+	UInt32 configRead32(UInt8 offset) { UInt32 value; memcpy(&value, mConfig + offset, sizeof(value)); return value; }
+	void configWrite8(UInt8 offset, UInt8 value) { mConfig[offset] = value; }
+	void configWrite16(UInt8 offset, UInt16 value) { memcpy(mConfig + offset, &value, sizeof(value)); }
+	void configWrite32(UInt8 offset, UInt32 value) { memcpy(mConfig + offset, &value, sizeof(value)); }
+
+	// BAR 0, the registers the driver maps
+	void hostSetMemory(void* registers, IOByteCount length);
+};
+
+enum IOAudioDevicePowerState
+{
+	kIOAudioDeviceSleep = 0,
+	kIOAudioDeviceIdle = 1,
+	kIOAudioDeviceActive = 2
+};
+
+class IOAudioDevice : public IOService
+{
+	volatile IOAudioDevicePowerState mPowerState = kIOAudioDeviceSleep;
+
+public:
+	IOAudioDevicePowerState getPowerState() { return mPowerState; }
+	// notify: as a power management change, otherwise only seen by polling (fugue, idle)
+	void hostSetPowerState(IOAudioDevicePowerState state, bool notify = false)
+	{
+		mPowerState = state;
+		if (notify)
+			hostNotifyPowerChange(state);
+	}
+};
+
+struct IOExternalMethodArguments
+{
+	UInt32 version;
+	UInt32 selector;
+	mach_port_t asyncWakePort;
+	UInt64* asyncReference;
+	UInt32 asyncReferenceCount;
+	const UInt64* scalarInput;
+	UInt32 scalarInputCount;
+	const void* structureInput;
+	UInt32 structureInputSize;
+	IOMemoryDescriptor* structureInputDescriptor;
+	UInt64* scalarOutput;
+	UInt32 scalarOutputCount;
+	void* structureOutput;
+	UInt32 structureOutputSize;
+	IOMemoryDescriptor* structureOutputDescriptor;
+	UInt32 structureOutputDescriptorSize;
+};
+
+typedef IOReturn (*IOExternalMethodAction)(OSObject* target, void* reference, IOExternalMethodArguments* arguments);
+
+struct IOExternalMethodDispatch
+{
+	IOExternalMethodAction function;
+	UInt32 checkScalarInputCount;
+	UInt32 checkStructureInputSize;
+	UInt32 checkScalarOutputCount;
+	UInt32 checkStructureOutputSize;
+};
+
+#define kIOUCVariableStructureSize 0xffffffff
+
+class IOUserClient : public IOService
+{
+public:
+	virtual bool initWithTask(task_t owningTask, void* securityToken, UInt32 type, OSDictionary* properties);
+	virtual IOReturn clientClose() { return kIOReturnUnsupported; }
+	virtual IOReturn clientMemoryForType(UInt32 type, IOOptionBits* options, IOMemoryDescriptor** memory)
+		{ return kIOReturnUnsupported; }
+	virtual IOReturn externalMethod(uint32_t selector, IOExternalMethodArguments* arguments,
+									IOExternalMethodDispatch* dispatch = 0, OSObject* target = 0, void* reference = 0);
+};
+
+/* host control */
+
+// Virtual time in microseconds (nanoseconds), without running the tick handler
+UInt64 hostGetTime();
+UInt64 hostGetNanoseconds();
+// Move virtual time forward, as if the calling thread waited
+void hostAdvanceTime(UInt64 microseconds);
+// Called whenever somebody reads the clock or waits, this is where the fake hardware runs
+void hostSetTickHandler(void (*handler)(void* context), void* context);
+// Wait (in real time) until no work loop has work due, false if they never settle
+bool hostWaitIdle();
+// Bytes allocated with IOMalloc and not freed yet
+size_t hostGetAllocated();
+
+#endif
@@ -0,0 +1,209 @@
+/*
+ *  Released under "The GNU General Public License (GPL-2.0)"
+ *
+ *  This program is free software; you can redistribute it and/or modify it
+ *  under the terms of the GNU General Public License as published by the
+ *  Free Software Foundation; either version 2 of the License, or (at your
+ *  option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ *  or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ *  for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ *
+ */
+
+// OSUnserializeXML for the plists of the kext (dict, array, string, data, integer, booleans)
+
+#include "HostKernel.h"
+#include <string>
+
+struct HostPlistReader
+{
+	const char* Position;
+	const char* Error = NULL;
+
+	void skipSpace()
+	{
+		for (;;)
+		{
+			while (*Position == ' ' || *Position == '\t' || *Position == '\r' || *Position == '\n')
+				Position++;
+
+			// prolog, doctype and comments
+			if (!strncmp(Position, "<?", 2) || !strncmp(Position, "<!", 2))
+			{
+				const char* end = strchr(Position, '>');
+				Position = end ? end + 1 : Position + strlen(Position);
+				continue;
+			}
+			return;
+		}
+	}
+
+	// next tag, name without the brackets, empty tags end with '/'
+	bool readTag(std::string* name)
+	{
+		skipSpace();
+		if (*Position != '<')
+			return false;
+
+		const char* end = strchr(Position, '>');
+		if (!end)
+			return false;
+
+		name->assign(Position + 1, end - Position - 1);
+		size_t space = name->find(' ');
+		if (space != std::string::npos)
+			name->erase(space, name->find('/', space) == std::string::npos ? std::string::npos : name->size() - space - 1);
+		Position = end + 1;
+		return true;
+	}
+
+	// text up to the closing tag, entities decoded
+	bool readText(const char* tag, std::string* text)
+	{
+		std::string close = std::string("</") + tag + ">";
+		const char* end = strstr(Position, close.c_str());
+		if (!end)
+			return false;
+
+		text->clear();
+		for (const char* p = Position; p < end; p++)
+		{
+			static const struct { const char* entity; char value; } entities[] =
+				{ { "&amp;", '&' }, { "&lt;", '<' }, { "&gt;", '>' }, { "&quot;", '"' }, { "&apos;", '\'' } };
+			bool decoded = false;
+			for (unsigned i = 0; i < sizeof(entities) / sizeof(entities[0]) && *p == '&'; i++)
+			{
+				size_t length = strlen(entities[i].entity);
+				if (!strncmp(p, entities[i].entity, length))
+				{
+					*text += entities[i].value;
+					p += length - 1;
+					decoded = true;
+					break;
+				}
+			}
+			if (!decoded)
+				*text += *p;
+		}
+		Position = end + close.size();
+		return true;
+	}
+
+	static OSData* decodeBase64(const std::string& text)
+	{
+		std::string bytes;
+		UInt32 bits = 0;
+		int count = 0;
+		for (char c : text)
+		{
+			int value;
+			if (c >= 'A' && c <= 'Z') value = c - 'A';
+			else if (c >= 'a' && c <= 'z') value = c - 'a' + 26;
+			else if (c >= '0' && c <= '9') value = c - '0' + 52;
+			else if (c == '+') value = 62;
+			else if (c == '/') value = 63;
+			else continue;
+
+			bits = bits << 6 | value;
+			if ((count += 6) >= 8)
+			{
+				count -= 8;
+				bytes += (char)(bits >> count & 0xFF);
+			}
+		}
+		return OSData::withBytes(bytes.data(), (unsigned)bytes.size());
+	}
+
+	OSObject* readObject(const std::string& tag)
+	{
+		std::string text;
+
+		if (tag == "dict/")
+			return OSDictionary::withCapacity(1);
+		if (tag == "array/")
+			return OSArray::withCapacity(1);
+		if (tag == "true/")
+			return kOSBooleanTrue;
+		if (tag == "false/")
+			return kOSBooleanFalse;
+		if (tag == "string/")
+			return OSString::withCString("");
+
+		if (tag == "dict")
+		{
+			OSDictionary* dict = OSDictionary::withCapacity(8);
+			std::string name, key;
+			while (readTag(&name) && name == "key")
+			{
+				if (!readText("key", &key) || !readTag(&name))
+					break;
+				OSObject* value = readObject(name);
+				if (!value)
+					break;
+				dict->setObject(key.c_str(), value);
+				value->release();
+			}
+			if (name == "/dict")
+				return dict;
+			dict->release();
+			return NULL;
+		}
+
+		if (tag == "array")
+		{
+			OSArray* array = OSArray::withCapacity(8);
+			std::string name;
+			while (readTag(&name) && name != "/array")
+			{
+				OSObject* value = readObject(name);
+				if (!value)
+				{
+					array->release();
+					return NULL;
+				}
+				array->setObject(value);
+				value->release();
+			}
+			return array;
+		}
+
+		if ((tag == "string" || tag == "integer" || tag == "data") && readText(tag.c_str(), &text))
+		{
+			if (tag == "string")
+				return OSString::withCString(text.c_str());
+			if (tag == "integer")
+				return OSNumber::withNumber(strtoull(text.c_str(), NULL, 0), 64);
+			return decodeBase64(text);
+		}
+
+		Error = "unsupported or malformed element";
+		return NULL;
+	}
+};
+
+OSObject* OSUnserializeXML(const char* buffer, OSString** errorString)
+{
+	HostPlistReader reader;
+	reader.Position = buffer;
+
+	std::string tag;
+	OSObject* result = NULL;
+	if (reader.readTag(&tag))
+	{
+		// the document element of a plist file holds the object
+		if (tag == "plist")
+			reader.readTag(&tag);
+		result = reader.readObject(tag);
+	}
+
+	if (!result && errorString)
+		*errorString = OSString::withCString(reader.Error ? reader.Error : "not a plist");
+	return result;
+}
@@ -0,0 +1,12 @@
+// Host build: the user space types the client's sources (codecdump.c) need, plain C
+#ifndef CodecCommander_HostIOKitLib_h
+#define CodecCommander_HostIOKitLib_h
+
+#include <stdint.h>
+
+typedef uint8_t UInt8;
+typedef uint16_t UInt16;
+typedef uint32_t UInt32;
+typedef unsigned long long UInt64;
+
+#endif
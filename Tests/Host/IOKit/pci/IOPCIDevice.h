@@ -0,0 +1,2 @@
+// Host build: everything the kext uses comes from one header, see HostKernel.h
+#include "../../HostKernel.h"
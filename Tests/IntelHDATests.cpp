@@ -0,0 +1,884 @@
+/*
+ *  Released under "The GNU General Public License (GPL-2.0)"
+ *
+ *  This program is free software; you can redistribute it and/or modify it
+ *  under the terms of the GNU General Public License as published by the
+ *  Free Software Foundation; either version 2 of the License, or (at your
+ *  option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ *  or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ *  for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ *
+ */
+
+#include "Harness.h"
+#include "FakeHDA.h"
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <unistd.h>
+
+// IntelHDA on top of the fake controller with an ALC269
+struct Engine
+{
+	FakeCodec* Codec;
+	FakeHDA* HDA;
+	IntelHDA* HDAEngine;
+	bool Initialized;
+
+	Engine(HDACommandMode mode)
+	{
+		Codec = FakeCodec::createALC269();
+		HDA = new FakeHDA(Codec);
+		HDAEngine = new IntelHDA(HDA->getCodecNub(), mode);
+		Initialized = HDAEngine->initialize();
+	}
+
+	~Engine()
+	{
+		delete HDAEngine;
+		delete HDA;
+		delete Codec;
+	}
+
+	UInt64 getStatistic(const char* key, const char* key2 = NULL, const char* key3 = NULL)
+	{
+		OSDictionary* statistics = HDAEngine->createStatistics();
+		UInt64 value = hostGetNumber(statistics, key, key2, key3);
+		statistics->release();
+		return value;
+	}
+
+	// Latency histogram of a transport, samples per bucket
+	void getBuckets(const char* transport, UInt32* buckets)
+	{
+		OSDictionary* statistics = HDAEngine->createStatistics();
+		OSDictionary* latency = OSDynamicCast(OSDictionary, statistics->getObject(transport));
+		OSArray* array = latency ? OSDynamicCast(OSArray, latency->getObject("Buckets")) : NULL;
+		for (UInt32 bucket = 0; bucket < kLatencyBuckets; bucket++)
+		{
+			OSNumber* number = array ? OSDynamicCast(OSNumber, array->getObject(bucket)) : NULL;
+			buckets[bucket] = number ? number->unsigned32BitValue() : 0;
+		}
+		statistics->release();
+	}
+
+	bool isBreakerOpen()
+	{
+		OSDictionary* statistics = HDAEngine->createStatistics();
+		OSDictionary* breaker = OSDynamicCast(OSDictionary, statistics->getObject("Breaker"));
+		bool open = breaker && breaker->getObject("Open") == kOSBooleanTrue;
+		statistics->release();
+		return open;
+	}
+};
+
+static UInt32 readTrace(IntelHDA* engine, UInt32 position, CodecCommanderTraceRecord* records, UInt32 maxCount)
+{
+	UInt32 count, lost;
+	engine->readTrace(position, records, maxCount, &count, &lost);
+	return count;
+}
+
+// Initialization and transport selection
+
+TEST(InitializeOverImmediateCommands)
+{
+	Engine engine(PIO);
+	ASSERT_TRUE(engine.Initialized);
+
+	EXPECT_EQ(PIO, engine.HDAEngine->getCommandMode());
+	EXPECT_EQ(0x10ec0269, engine.HDAEngine->getCodecVendorId());
+	EXPECT_EQ(0x1025029b, engine.HDAEngine->getSubsystemId());
+	EXPECT_EQ(0x1025029b, engine.HDAEngine->getPCISubId());
+	EXPECT_EQ(1, engine.HDAEngine->getAudioRoot());
+	EXPECT_EQ(2, engine.HDAEngine->getStartingNode());
+	EXPECT_EQ(34, engine.HDAEngine->getTotalNodes());
+	EXPECT_EQ(0x90170110, engine.HDAEngine->sendCommand(0x14, HDA_VERB_GET_CONFIG_DEFAULT, HDA_PARM_NULL));
+
+	// about one frame per verb
+	EXPECT_TRUE(engine.getStatistic("PIO", "P50") >= 20 && engine.getStatistic("PIO", "P50") <= 60);
+	EXPECT_EQ(0, engine.getStatistic("PIO", "Timeouts"));
+
+	engine.HDAEngine->applyIntelTCSEL();
+	EXPECT_EQ(0, engine.HDA->getDevice()->configRead8(0x44));
+}
+
+TEST(InitializeStartsCommandRings)
+{
+	Engine engine(DMA);
+	ASSERT_TRUE(engine.Initialized);
+
+	pHDA_REG regs = engine.HDA->getRegisters();
+	EXPECT_EQ(DMA, engine.HDAEngine->getCommandMode());
+	EXPECT_TRUE(regs->CORBRUN);
+	EXPECT_TRUE(regs->RINTCNT_RIRBDMAEN);
+	EXPECT_EQ(HDA_RING_SIZE_256, regs->CORBSIZE);
+	EXPECT_EQ(HDA_RING_SIZE_256, regs->RIRBSIZE);
+	EXPECT_EQ(0, regs->CORBRPRST);
+
+	EXPECT_EQ(0x1025029b, engine.HDAEngine->getSubsystemId());
+	EXPECT_TRUE(engine.getStatistic("DMA", "Count") > 0);
+	EXPECT_EQ(0, engine.getStatistic("DMA", "Timeouts"));
+}
+
+TEST(CommandRingsOfAnotherDriverAreLeftAlone)
+{
+	FakeCodec* codec = FakeCodec::createALC269();
+	FakeHDA* hda = new FakeHDA(codec);
+	hda->getRegisters()->CORBRUN = 1;
+
+	IntelHDA* engine = new IntelHDA(hda->getCodecNub(), DMA);
+	EXPECT_TRUE(engine->initialize());
+	EXPECT_EQ(PIO, engine->getCommandMode());
+	EXPECT_EQ(0, hda->getRegisters()->CORBLBASE);
+	EXPECT_EQ(0x1025029b, engine->getSubsystemId());
+
+	delete engine;
+	delete hda;
+	delete codec;
+}
+
+// Immediate commands: a tight spin for the frames a verb takes, then a doubling backoff
+
+TEST(PIOLatencyFollowsICSBusyTime)
+{
+	Engine engine(PIO);
+	ASSERT_TRUE(engine.Initialized);
+
+	static const UInt32 kFrames[] = { 1, 2, 4, 10, 48 };
+	for (UInt32 frames : kFrames)
+	{
+		engine.HDA->setImmediateFrames(frames);
+		UInt64 busy = frames * kFakeFrameNS / 1000, slowest = 0;
+		for (int i = 0; i < 20; i++)
+		{
+			UInt64 start = hostGetTime();
+			EXPECT_EQ(0x90170110, engine.HDAEngine->sendCommand(0x14, HDA_VERB_GET_CONFIG_DEFAULT, HDA_PARM_NULL));
+			UInt64 latency = hostGetTime() - start;
+			EXPECT_TRUE(latency >= busy);
+			slowest = std::max(slowest, latency);
+		}
+
+		// noticed within a microsecond or two while spinning, later never by more than
+		// the time waited so far nor by more than the longest backoff step (100 us)
+		UInt64 late = slowest - busy;
+		EXPECT_TRUE(late <= (busy < 42 ? 2 : std::min<UInt64>(busy, 100)));
+	}
+	EXPECT_EQ(0, engine.getStatistic("PIO", "Timeouts"));
+}
+
+// Latency statistics: a sample per verb, in the bucket of the virtual time it took
+
+static void testLatencyBuckets(HDACommandMode mode, const char* transport)
+{
+	Engine engine(mode);
+	ASSERT_TRUE(engine.Initialized && engine.HDAEngine->getCommandMode() == mode);
+
+	UInt32 before[kLatencyBuckets], after[kLatencyBuckets];
+	UInt64 count = engine.getStatistic(transport, "Count");
+	engine.getBuckets(transport, before);
+
+	// single verbs answered 300 us late: a frame more, all in bucket 9 (256-511 us)
+	engine.HDA->setResponseDelay(300);
+	for (int i = 0; i < 16; i++)
+		EXPECT_EQ(0x90170110, engine.HDAEngine->sendCommand(0x14, HDA_VERB_GET_CONFIG_DEFAULT, HDA_PARM_NULL));
+	EXPECT_EQ(count + 16, engine.getStatistic(transport, "Count"));
+	EXPECT_TRUE(engine.getStatistic(transport, "Max") >= 300 + kFakeFrameNS / 1000);
+	engine.getBuckets(transport, after);
+	for (int bucket = 0; bucket < kLatencyBuckets; bucket++)
+		EXPECT_EQ(before[bucket] + (bucket == 9 ? 16 : 0), after[bucket]);
+
+	// a batch at link speed: one sample per verb, a frame or two each (bucket 5 or 6)
+	engine.HDA->setResponseDelay(0);
+	UInt32 commands[32];
+	for (int i = 0; i < 32; i++)
+		commands[i] = HDA_COMMAND(0x14, HDA_VERB_GET_CONFIG_DEFAULT, HDA_PARM_NULL);
+	EXPECT_EQ(32, engine.HDAEngine->sendCommands(commands, 32, commands));
+	EXPECT_EQ(count + 16 + 32, engine.getStatistic(transport, "Count"));
+	engine.getBuckets(transport, before);
+	EXPECT_EQ(32, before[5] + before[6] - after[5] - after[6]);
+	for (int bucket = 0; bucket < kLatencyBuckets; bucket++)
+		if (bucket != 5 && bucket != 6)
+			EXPECT_EQ(after[bucket], before[bucket]);
+
+	// percentiles are bucket bounds, the late verbs are more than 1% of the samples
+	EXPECT_TRUE(engine.getStatistic(transport, "P50") <= 64);
+	EXPECT_EQ(512, engine.getStatistic(transport, "P99"));
+	EXPECT_EQ(0, engine.getStatistic(transport, "Timeouts"));
+}
+
+TEST(LatencyBucketsOverImmediateCommands)
+{
+	testLatencyBuckets(PIO, "PIO");
+}
+
+TEST(LatencyBucketsOverCommandRings)
+{
+	testLatencyBuckets(DMA, "DMA");
+}
+
+// Batches (several ring fills, responses in order)
+
+TEST(BatchLargerThanRings)
+{
+	Engine engine(DMA);
+	ASSERT_TRUE(engine.Initialized);
+
+	const size_t count = 600;
+	UInt32* commands = new UInt32[count];
+	UInt32* responses = new UInt32[count];
+	for (size_t i = 0; i < count; i++)
+		commands[i] = HDA_COMMAND(0x12 + i % 13, HDA_VERB_GET_CONFIG_DEFAULT, HDA_PARM_NULL);
+
+	EXPECT_EQ(count, engine.HDAEngine->sendCommands(commands, count, responses));
+	for (size_t i = 0; i < count; i++)
+	{
+		FakeWidget* widget = engine.Codec->getWidget(0x12 + i % 13);
+		EXPECT_EQ(widget ? widget->ConfigDefault : 0, responses[i]);
+	}
+
+	// in place, responses replace the commands
+	EXPECT_EQ(count, engine.HDAEngine->sendCommands(commands, count, commands));
+	EXPECT_EQ(0x90170110, commands[2]);
+
+	delete[] commands;
+	delete[] responses;
+}
+
+// CORB/RIRB
+
+TEST(LateResponseNotTakenByNextSubmission)
+{
+	Engine engine(DMA);
+	ASSERT_TRUE(engine.Initialized);
+
+	// first verb is answered after the 10ms timeout
+	engine.HDA->setResponseDelay(15000);
+	EXPECT_EQ((UInt32)-1, engine.HDAEngine->sendCommand(0x14, HDA_VERB_GET_CONFIG_DEFAULT, HDA_PARM_NULL));
+	EXPECT_EQ(1, engine.getStatistic("DMA", "Timeouts"));
+
+	engine.HDA->setResponseDelay(0);
+	EXPECT_EQ(0x0221101f, engine.HDAEngine->sendCommand(0x15, HDA_VERB_GET_CONFIG_DEFAULT, HDA_PARM_NULL));
+	EXPECT_EQ(0x02a11030, engine.HDAEngine->sendCommand(0x18, HDA_VERB_GET_CONFIG_DEFAULT, HDA_PARM_NULL));
+}
+
+TEST(LatencyAddsUpToWallTime)
+{
+	Engine engine(DMA);
+	ASSERT_TRUE(engine.Initialized);
+	ASSERT_TRUE(engine.HDAEngine->setTraceEnabled(true));
+
+	UInt32 commands[32];
+	for (int i = 0; i < 32; i++)
+		commands[i] = HDA_COMMAND(0x14, HDA_VERB_EAPDBTL_GET, HDA_PARM_NULL);
+
+	UInt32 position = engine.HDAEngine->getTracePosition();
+	UInt64 start = hostGetTime();
+	EXPECT_EQ(32, engine.HDAEngine->sendCommands(commands, 32, commands));
+	UInt64 elapsed = hostGetTime() - start;
+
+	CodecCommanderTraceRecord records[32];
+	ASSERT_TRUE(readTrace(engine.HDAEngine, position, records, 32) == 32);
+
+	UInt64 total = 0;
+	for (int i = 0; i < 32; i++)
+	{
+		EXPECT_EQ(kTraceTransportDMA, records[i].Transport);
+		EXPECT_TRUE(records[i].Latency < 2 * kFakeFrameNS / 1000 + 5);
+		total += records[i].Latency;
+	}
+
+	// the verbs are answered a frame apart, the latencies add up to the time the batch took
+	EXPECT_TRUE(elapsed >= 32 * kFakeFrameNS / 1000);
+	EXPECT_TRUE(total <= elapsed && total + 10 >= elapsed);
+}
+
+TEST(RingTakeoverFallsBackToImmediateCommands)
+{
+	Engine engine(DMA);
+	ASSERT_TRUE(engine.Initialized);
+	ASSERT_TRUE(engine.HDAEngine->setTraceEnabled(true));
+
+	engine.HDA->takeRings();
+
+	UInt32 commands[4];
+	for (int i = 0; i < 4; i++)
+		commands[i] = HDA_COMMAND(0x14 + i, HDA_VERB_GET_CONFIG_DEFAULT, HDA_PARM_NULL);
+
+	UInt32 position = engine.HDAEngine->getTracePosition();
+	EXPECT_EQ(4, engine.HDAEngine->sendCommands(commands, 4, commands));
+	EXPECT_EQ(PIO, engine.HDAEngine->getCommandMode());
+	EXPECT_EQ(0x90170110, commands[0]);
+	EXPECT_EQ(0x0221101f, commands[1]);
+
+	// sent over the immediate command interface, and traced as such
+	CodecCommanderTraceRecord records[4];
+	ASSERT_TRUE(readTrace(engine.HDAEngine, position, records, 4) == 4);
+	for (int i = 0; i < 4; i++)
+	{
+		EXPECT_EQ(kTraceTransportPIO, records[i].Transport);
+		EXPECT_TRUE(records[i].Latency > 0);
+	}
+	EXPECT_EQ(4, engine.getStatistic("PIO", "Count"));
+
+	// the rings stay with their new owner
+	EXPECT_TRUE(engine.HDA->getRegisters()->CORBRUN);
+}
+
+TEST(InterruptAcknowledgeClearsOnlyResponseInterrupt)
+{
+	Engine engine(DMA);
+	ASSERT_TRUE(engine.Initialized);
+	ASSERT_TRUE(engine.HDAEngine->enableUnsolicitedResponses());
+
+	engine.HDA->injectRirbOverrun();
+	engine.HDAEngine->sendCommand(0x14, HDA_VERB_EAPDBTL_GET, HDA_PARM_NULL);
+	EXPECT_TRUE(engine.HDA->getRirbStatus() & HDA_RIRBSTS_RINTFL);
+
+	// a solicited response only, nothing for the interrupt handler
+	EXPECT_FALSE(engine.HDAEngine->acknowledgeInterrupt());
+	hostAdvanceTime(1);
+
+	EXPECT_EQ(HDA_RIRBSTS_RINTFL, engine.HDA->getLastRirbStatusWrite());
+	EXPECT_FALSE(engine.HDA->getRirbStatus() & HDA_RIRBSTS_RINTFL);
+	EXPECT_TRUE(engine.HDA->getRirbStatus() & HDA_RIRBSTS_RIRBOIS);
+}
+
+// Unsolicited responses
+
+TEST(UnsolicitedResponseQueuedForInterruptHandler)
+{
+	Engine engine(DMA);
+	ASSERT_TRUE(engine.Initialized);
+	ASSERT_TRUE(engine.HDAEngine->enableUnsolicitedResponses());
+
+	EXPECT_TRUE(engine.HDA->getRegisters()->GCTL_UNSOL);
+	engine.HDAEngine->sendCommand(0x15, HDA_VERB_SET_UNSOL_ENABLE, HDA_UNSOL_ENABLE(0x15));
+
+	UInt32 interrupts = engine.HDA->getInterruptCount();
+	engine.HDA->plug(0x15, true);
+	hostAdvanceTime(100);
+	EXPECT_TRUE(engine.HDA->getInterruptCount() > interrupts);
+
+	EXPECT_TRUE(engine.HDAEngine->acknowledgeInterrupt());
+
+	UInt32 responses[kHDAUnsolicitedQueueSize];
+	ASSERT_TRUE(engine.HDAEngine->getUnsolicitedResponses(responses, kHDAUnsolicitedQueueSize) == 1);
+	EXPECT_EQ(0x15, HDA_UNSOL_TAG(responses[0]));
+
+	// one that arrives while verbs are in flight is kept for the handler as well
+	engine.HDA->plug(0x15, false);
+	EXPECT_TRUE(HDA_PIN_SENSE_IS_PRESENT(engine.HDAEngine->sendCommand(0x15, HDA_VERB_GET_PIN_SENSE, HDA_PARM_NULL)) == 0);
+	ASSERT_TRUE(engine.HDAEngine->getUnsolicitedResponses(responses, kHDAUnsolicitedQueueSize) == 1);
+	EXPECT_EQ(0x15, HDA_UNSOL_TAG(responses[0]));
+	EXPECT_EQ(0, engine.getStatistic("Unsolicited Dropped"));
+
+	engine.HDAEngine->disableUnsolicitedResponses();
+	EXPECT_FALSE(engine.HDA->getRegisters()->GCTL_UNSOL);
+}
+
+// Primary interrupt filter against the rings going away under it
+
+struct InterruptRace
+{
+	Engine* Owner;
+	std::atomic<bool> Stop;
+};
+
+// the filter runs on any CPU whenever the controller interrupts
+static void filterInterrupts(InterruptRace* race)
+{
+	while (!race->Stop)
+	{
+		race->Owner->HDA->raiseResponseInterrupt();
+		race->Owner->HDAEngine->acknowledgeInterrupt();
+	}
+}
+
+TEST(InterruptFilterSurvivesRingShutdown)
+{
+	Engine engine(DMA);
+	ASSERT_TRUE(engine.Initialized);
+	engine.HDAEngine->sendCommand(0x15, HDA_VERB_SET_UNSOL_ENABLE, HDA_UNSOL_ENABLE(0x15));
+
+	// ring memory faults once freed, a filter still reading it crashes the test
+	InterruptRace race = { &engine, { false } };
+	std::thread filter(filterInterrupts, &race);
+	bool present = false;
+	for (int i = 0; i < 5000; i++)
+	{
+		// an unsolicited response left in the RIRB, so that the filter reads the ring
+		EXPECT_TRUE(engine.HDAEngine->setCommandMode(DMA));
+		EXPECT_TRUE(engine.HDAEngine->enableUnsolicitedResponses());
+		engine.HDA->plug(0x15, present = !present);
+		hostAdvanceTime(50);
+		std::this_thread::yield();
+		EXPECT_TRUE(engine.HDAEngine->setCommandMode(PIO));
+	}
+	race.Stop = true;
+	filter.join();
+}
+
+// Parameter cache
+
+TEST(ParameterCacheAnswersRepeatedReads)
+{
+	Engine engine(DMA);
+	ASSERT_TRUE(engine.Initialized);
+
+	UInt32 hits = engine.getStatistic("Parameter Cache", "Hits");
+	UInt32 verbs = engine.Codec->getVerbCount();
+
+	EXPECT_EQ(0x00010014, engine.HDAEngine->sendCommand(0x14, HDA_VERB_GET_PARAM, HDA_PARM_PINCAP));
+	EXPECT_EQ(verbs + 1, engine.Codec->getVerbCount());
+	EXPECT_EQ(0x00010014, engine.HDAEngine->sendCommand(0x14, HDA_VERB_GET_PARAM, HDA_PARM_PINCAP));
+	EXPECT_EQ(verbs + 1, engine.Codec->getVerbCount());
+	EXPECT_EQ(hits + 1, engine.getStatistic("Parameter Cache", "Hits"));
+
+	// state is always read from the codec
+	engine.HDAEngine->sendCommand(0x14, HDA_VERB_EAPDBTL_GET, HDA_PARM_NULL);
+	engine.HDAEngine->sendCommand(0x14, HDA_VERB_EAPDBTL_GET, HDA_PARM_NULL);
+	EXPECT_EQ(verbs + 3, engine.Codec->getVerbCount());
+
+	// after a reset (or power loss) parameters are read again
+	engine.HDAEngine->invalidateParameterCache();
+	EXPECT_EQ(0, engine.getStatistic("Parameter Cache", "Entries"));
+	EXPECT_EQ(0x00010014, engine.HDAEngine->sendCommand(0x14, HDA_VERB_GET_PARAM, HDA_PARM_PINCAP));
+	EXPECT_EQ(verbs + 4, engine.Codec->getVerbCount());
+	EXPECT_EQ(1, engine.getStatistic("Parameter Cache", "Entries"));
+}
+
+TEST(ParameterCacheKeepsFailedReadsOut)
+{
+	Engine engine(PIO);
+	ASSERT_TRUE(engine.Initialized);
+
+	engine.Codec->dropResponses(1);
+	EXPECT_EQ((UInt32)-1, engine.HDAEngine->sendCommand(0x15, HDA_VERB_GET_PARAM, HDA_PARM_PINCAP));
+	EXPECT_EQ(0x0001001c, engine.HDAEngine->sendCommand(0x15, HDA_VERB_GET_PARAM, HDA_PARM_PINCAP));
+}
+
+// Circuit breaker
+
+TEST(BreakerTripsAndShortCircuits)
+{
+	Engine engine(DMA);
+	ASSERT_TRUE(engine.Initialized);
+
+	engine.Codec->setResponding(false);
+	// different nodes, a node that failed twice is short circuited on its own
+	const UInt8 pins[] = { 0x14, 0x15, 0x18 };
+	for (int i = 0; i < 3; i++)
+		EXPECT_EQ((UInt32)-1, engine.HDAEngine->sendCommand(pins[i], HDA_VERB_EAPDBTL_GET, HDA_PARM_NULL));
+	EXPECT_TRUE(engine.isBreakerOpen());
+	EXPECT_EQ(1, engine.getStatistic("Breaker", "Trips"));
+	EXPECT_FALSE(engine.HDAEngine->isCodecResponsive());
+
+	// a batch costs a single probe while the codec does not answer, cached parameters still work
+	UInt32 commands[10];
+	for (int i = 0; i < 10; i++)
+		commands[i] = HDA_COMMAND(0x14, HDA_VERB_EAPDBTL_SET, 0x02);
+	commands[9] = HDA_COMMAND(0, HDA_VERB_GET_PARAM, HDA_PARM_NODECOUNT);
+
+	UInt32 verbs = engine.Codec->getVerbCount();
+	UInt32 shorted = engine.getStatistic("Breaker", "Short Circuited");
+	UInt64 start = hostGetTime();
+	EXPECT_EQ(1, engine.HDAEngine->sendCommands(commands, 10, commands));
+	EXPECT_EQ(verbs + 1, engine.Codec->getVerbCount());
+	EXPECT_EQ(shorted + 9, engine.getStatistic("Breaker", "Short Circuited"));
+	// the probe waits out the late response of the last timeout, then its own
+	EXPECT_TRUE(hostGetTime() - start < 3 * 10000);
+	EXPECT_EQ(0x00010001, commands[9]);
+
+	// the first answer closes it
+	engine.Codec->setResponding(true);
+	EXPECT_TRUE(engine.HDAEngine->isCodecResponsive());
+	EXPECT_FALSE(engine.isBreakerOpen());
+	EXPECT_EQ(0x02, engine.HDAEngine->sendCommand(0x14, HDA_VERB_EAPDBTL_GET, HDA_PARM_NULL));
+}
+
+TEST(NodeBreakerRetriesAfterInterval)
+{
+	Engine engine(PIO);
+	ASSERT_TRUE(engine.Initialized);
+
+	engine.Codec->setSilentNode(0x18, true);
+	EXPECT_EQ((UInt32)-1, engine.HDAEngine->sendCommand(0x18, HDA_VERB_GET_PIN_SENSE, HDA_PARM_NULL));
+	EXPECT_EQ(0x02, engine.HDAEngine->sendCommand(0x14, HDA_VERB_EAPDBTL_GET, HDA_PARM_NULL));
+	EXPECT_EQ((UInt32)-1, engine.HDAEngine->sendCommand(0x18, HDA_VERB_GET_PIN_SENSE, HDA_PARM_NULL));
+
+	// the node failed twice: further verbs fail at once, the rest of the codec is fine
+	UInt32 verbs = engine.Codec->getVerbCount();
+	EXPECT_EQ((UInt32)-1, engine.HDAEngine->sendCommand(0x18, HDA_VERB_GET_PIN_SENSE, HDA_PARM_NULL));
+	EXPECT_EQ(verbs, engine.Codec->getVerbCount());
+	EXPECT_FALSE(engine.isBreakerOpen());
+	EXPECT_EQ(0x02, engine.HDAEngine->sendCommand(0x15, HDA_VERB_EAPDBTL_GET, HDA_PARM_NULL));
+
+	// one verb gets through per second to see whether the node is back
+	engine.Codec->setSilentNode(0x18, false);
+	hostAdvanceTime(1000000);
+	EXPECT_EQ(0, engine.HDAEngine->sendCommand(0x18, HDA_VERB_GET_PIN_SENSE, HDA_PARM_NULL));
+	EXPECT_EQ(0, engine.HDAEngine->sendCommand(0x18, HDA_VERB_GET_PIN_SENSE, HDA_PARM_NULL));
+
+	// or right away at the start of a power transition
+	engine.Codec->setSilentNode(0x19, true);
+	for (int i = 0; i < 2; i++)
+		engine.HDAEngine->sendCommand(0x19, HDA_VERB_GET_PIN_SENSE, HDA_PARM_NULL);
+	engine.Codec->setSilentNode(0x19, false);
+	engine.HDAEngine->resetNodeBreakers();
+	verbs = engine.Codec->getVerbCount();
+	EXPECT_EQ(0, engine.HDAEngine->sendCommand(0x19, HDA_VERB_GET_PIN_SENSE, HDA_PARM_NULL));
+	EXPECT_EQ(verbs + 1, engine.Codec->getVerbCount());
+}
+
+// Codec reset
+
+TEST(ResetPollsUntilCodecReady)
+{
+	Engine engine(DMA);
+	ASSERT_TRUE(engine.Initialized);
+
+	engine.Codec->getWidget(0x14)->State.Eapd = 0;
+	engine.Codec->setResetLatency(30000);
+
+	UInt64 start = hostGetTime();
+	engine.HDAEngine->resetCodec();
+	UInt64 elapsed = hostGetTime() - start;
+
+	// done a few ms after the codec came back, not after the 200ms allowed by the spec
+	EXPECT_EQ(2, engine.Codec->getResetCount());
+	EXPECT_TRUE(elapsed >= 30000 && elapsed < 40000);
+	EXPECT_EQ(1, engine.getStatistic("Reset", "Count"));
+	EXPECT_TRUE(engine.getStatistic("Reset", "Max") >= 29000);
+
+	// defaults restored, left in D3
+	EXPECT_EQ(0x02, engine.Codec->getWidget(0x14)->State.Eapd);
+	EXPECT_EQ(HDA_PARM_PS_D3_HOT, engine.Codec->getFunctionGroup()->State.PowerState);
+	EXPECT_FALSE(engine.isBreakerOpen());
+}
+
+TEST(ResetRevivesCodecInD3Cold)
+{
+	Engine engine(PIO);
+	ASSERT_TRUE(engine.Initialized);
+
+	engine.Codec->setResponding(false);
+	EXPECT_EQ((UInt32)-1, engine.HDAEngine->sendCommand(0x14, HDA_VERB_EAPDBTL_GET, HDA_PARM_NULL));
+
+	engine.HDAEngine->resetCodec();
+	EXPECT_EQ(0x02, engine.HDAEngine->sendCommand(0x14, HDA_VERB_EAPDBTL_GET, HDA_PARM_NULL));
+	EXPECT_TRUE(engine.HDAEngine->isCodecReady());
+}
+
+TEST(ReadinessPollsDoNotTripBreakers)
+{
+	Engine engine(PIO);
+	ASSERT_TRUE(engine.Initialized);
+
+	// polled until the codec is back from its reset
+	engine.Codec->setResetLatency(30000);
+	engine.HDAEngine->resetCodec();
+	EXPECT_EQ(0, engine.getStatistic("Breaker", "Trips"));
+
+	// a pin that does not answer yet is not failed either
+	const UInt8 pins[] = { 0x14, 0x15 };
+	engine.Codec->setSilentNode(0x14, true);
+	for (int i = 0; i < 4; i++)
+		EXPECT_FALSE(engine.HDAEngine->isCodecReady(pins, 2));
+	engine.Codec->setSilentNode(0x14, false);
+
+	UInt32 verbs = engine.Codec->getVerbCount();
+	EXPECT_EQ(0x02, engine.HDAEngine->sendCommand(0x14, HDA_VERB_EAPDBTL_GET, HDA_PARM_NULL));
+	EXPECT_EQ(verbs + 1, engine.Codec->getVerbCount());
+	EXPECT_FALSE(engine.isBreakerOpen());
+}
+
+TEST(ReadinessPollLeavesBreakerOpenUntilAnswered)
+{
+	Engine engine(DMA);
+	ASSERT_TRUE(engine.Initialized);
+
+	engine.Codec->setResponding(false);
+	const UInt8 pins[] = { 0x14, 0x15, 0x18 };
+	for (int i = 0; i < 3; i++)
+		engine.HDAEngine->sendCommand(pins[i], HDA_VERB_EAPDBTL_GET, HDA_PARM_NULL);
+	EXPECT_TRUE(engine.isBreakerOpen());
+
+	// each poll probes the codec once, verbs of others keep failing fast meanwhile
+	for (int i = 0; i < 3; i++)
+	{
+		UInt32 verbs = engine.Codec->getVerbCount();
+		EXPECT_FALSE(engine.HDAEngine->isCodecReady(pins, 3));
+		EXPECT_EQ(verbs + 1, engine.Codec->getVerbCount());
+		EXPECT_TRUE(engine.isBreakerOpen());
+	}
+
+	engine.Codec->setResponding(true);
+	EXPECT_TRUE(engine.HDAEngine->isCodecReady(pins, 3));
+	EXPECT_FALSE(engine.isBreakerOpen());
+	EXPECT_EQ(1, engine.getStatistic("Breaker", "Trips"));
+}
+
+static void resetCodec(IntelHDA* engine)
+{
+	engine->resetCodec();
+}
+
+TEST(ResetClosesBreakerUnderGate)
+{
+	Engine engine(PIO);
+	ASSERT_TRUE(engine.Initialized);
+
+	IOWorkLoop* workLoop = IOWorkLoop::workLoop();
+	IOCommandGate* gate = IOCommandGate::commandGate(engine.HDA->getCodecNub());
+	workLoop->addEventSource(gate);
+	engine.HDAEngine->setCommandGate(gate);
+
+	engine.Codec->setResponding(false);
+	for (int i = 0; i < 3; i++)
+		engine.HDAEngine->sendCommand(0x14 + i, HDA_VERB_EAPDBTL_GET, HDA_PARM_NULL);
+	EXPECT_TRUE(engine.isBreakerOpen());
+
+	// the breaker is left alone while somebody else holds the gate
+	workLoop->hostCloseGate();
+	std::thread reset(resetCodec, engine.HDAEngine);
+	for (int i = 0; i < 10000 && workLoop->hostGetGateWaiters() == 0; i++)
+		usleep(100);
+	EXPECT_EQ(1, workLoop->hostGetGateWaiters());
+	EXPECT_TRUE(engine.isBreakerOpen());
+	workLoop->hostOpenGate();
+	reset.join();
+
+	EXPECT_FALSE(engine.isBreakerOpen());
+	EXPECT_EQ(0x02, engine.HDAEngine->sendCommand(0x14, HDA_VERB_EAPDBTL_GET, HDA_PARM_NULL));
+
+	engine.HDAEngine->setCommandGate(NULL);
+	workLoop->removeEventSource(gate);
+	gate->release();
+	workLoop->release();
+}
+
+// Command gate and lanes
+
+struct LaneRace
+{
+	IntelHDA* HDAEngine;
+	IOWorkLoop* WorkLoop;
+	UInt32 ClientVerbs;
+	std::thread* Power;
+};
+
+static void sendPowerVerbs(LaneRace* race)
+{
+	UInt32 commands[8];
+	for (int i = 0; i < 8; i++)
+		commands[i] = HDA_COMMAND(0x14, HDA_VERB_EAPDBTL_SET, 0x02);
+	race->HDAEngine->sendCommands(commands, 8, commands, NULL, kHDALanePower);
+}
+
+static void submitDuringClientBatch(void* context, UInt32 command)
+{
+	LaneRace* race = (LaneRace*)context;
+
+	// end of the first chunk (64 verbs) of the client batch
+	if ((command & 0x0FFFFF00) != HDA_COMMAND(0x15, HDA_VERB_GET_PIN_SENSE, 0) || ++race->ClientVerbs != 64)
+		return;
+
+	race->Power = new std::thread(sendPowerVerbs, race);
+
+	// until the power verbs wait for the gate
+	for (int i = 0; i < 10000 && race->WorkLoop->hostGetGateWaiters() == 0; i++)
+		usleep(100);
+}
+
+static void testPowerLaneOvertakesClient(HDACommandMode mode)
+{
+	Engine engine(mode);
+	ASSERT_TRUE(engine.Initialized);
+
+	LaneRace race = { engine.HDAEngine, IOWorkLoop::workLoop(), 0, NULL };
+	IOCommandGate* gate = IOCommandGate::commandGate(engine.HDA->getCodecNub());
+	race.WorkLoop->addEventSource(gate);
+	engine.HDAEngine->setCommandGate(gate);
+	engine.HDAEngine->setTraceEnabled(true);
+	engine.HDA->setVerbHook(submitDuringClientBatch, &race);
+
+	const int count = 200;
+	UInt32 commands[count];
+	for (int i = 0; i < count; i++)
+		commands[i] = HDA_COMMAND(0x15, HDA_VERB_GET_PIN_SENSE, HDA_PARM_NULL);
+
+	UInt32 powerVerbs = engine.getStatistic("Lanes", "Power", "Verbs");
+	UInt32 position = engine.HDAEngine->getTracePosition();
+	EXPECT_EQ(count, engine.HDAEngine->sendCommands(commands, count, commands, NULL, kHDALaneClient));
+	ASSERT_TRUE(race.Power != NULL);
+	race.Power->join();
+	delete race.Power;
+	engine.HDA->setVerbHook(NULL, NULL);
+
+	// the power verbs went between the first and the second chunk of client verbs
+	CodecCommanderTraceRecord records[count + 8];
+	ASSERT_TRUE(readTrace(engine.HDAEngine, position, records, count + 8) == count + 8);
+	for (int i = 0; i < count + 8; i++)
+	{
+		bool power = i >= 64 && i < 72;
+		EXPECT_EQ(power ? kTraceLanePower : kTraceLaneClient, records[i].Lane);
+	}
+	EXPECT_EQ(powerVerbs + 8, engine.getStatistic("Lanes", "Power", "Verbs"));
+	EXPECT_EQ(count, engine.getStatistic("Lanes", "Client", "Verbs"));
+
+	engine.HDAEngine->setCommandGate(NULL);
+	race.WorkLoop->removeEventSource(gate);
+	gate->release();
+	race.WorkLoop->release();
+}
+
+TEST(PowerLaneOvertakesClientBatchDMA)
+{
+	testPowerLaneOvertakesClient(DMA);
+}
+
+TEST(PowerLaneOvertakesClientBatchPIO)
+{
+	testPowerLaneOvertakesClient(PIO);
+}
+
+// Submitters on several threads, each checking its responses against its own commands
+struct Submitter
+{
+	IntelHDA* HDAEngine;
+	const std::vector<UInt8>* Nodes;
+	int Index;
+	UInt32 Mismatched;
+	UInt32 Completed;
+};
+
+static const size_t kSubmitSizes[] = { 1, 7, 64, 65, 300 };
+static const HDACommandLane kSubmitLanes[] = { kHDALanePower, kHDALaneCustom, kHDALaneClient, kHDALaneDiagnostic };
+
+static void submitBatches(Submitter* submitter)
+{
+	UInt32 commands[300], responses[300];
+	UInt32 seed = submitter->Index * 2654435761U;
+
+	for (int round = 0; round < 24; round++)
+	{
+		size_t count = kSubmitSizes[(submitter->Index + round) % 5];
+		HDACommandLane lane = kSubmitLanes[(submitter->Index + round / 5) % 4];
+
+		// Get Config Default of any node, each node answers with its own value
+		for (size_t i = 0; i < count; i++)
+		{
+			seed = seed * 1103515245 + 12345;
+			UInt8 node = (*submitter->Nodes)[(seed >> 16) % submitter->Nodes->size()];
+			commands[i] = HDA_COMMAND(node, HDA_VERB_GET_CONFIG_DEFAULT, HDA_PARM_NULL);
+		}
+
+		submitter->Completed += submitter->HDAEngine->sendCommands(commands, count, responses, NULL, lane);
+		for (size_t i = 0; i < count; i++)
+			if (responses[i] != (0xC0DE0000 | (commands[i] >> 20 & 0xFF)))
+				submitter->Mismatched++;
+	}
+}
+
+static void testConcurrentSubmitters(HDACommandMode mode, bool gated)
+{
+	Engine engine(mode);
+	ASSERT_TRUE(engine.Initialized);
+	std::vector<UInt8> nodes;
+	for (int node = 0x02; node < 0x02 + 34; node++)
+	{
+		if (FakeWidget* widget = engine.Codec->getWidget(node))
+		{
+			widget->ConfigDefault = 0xC0DE0000 | node;
+			nodes.push_back(node);
+		}
+	}
+
+	IOWorkLoop* workLoop = IOWorkLoop::workLoop();
+	IOCommandGate* gate = IOCommandGate::commandGate(engine.HDA->getCodecNub());
+	workLoop->addEventSource(gate);
+	if (gated)
+		engine.HDAEngine->setCommandGate(gate);
+
+	const int count = 8;
+	Submitter submitters[count];
+	std::thread* threads[count];
+	for (int i = 0; i < count; i++)
+	{
+		submitters[i] = { engine.HDAEngine, &nodes, i, 0, 0 };
+		threads[i] = new std::thread(submitBatches, &submitters[i]);
+	}
+
+	UInt32 expected = 0;
+	for (int i = 0; i < count; i++)
+	{
+		threads[i]->join();
+		delete threads[i];
+
+		for (int round = 0; round < 24; round++)
+			expected += kSubmitSizes[(i + round) % 5];
+		EXPECT_EQ(0, submitters[i].Mismatched);
+	}
+
+	UInt32 completed = 0;
+	for (int i = 0; i < count; i++)
+		completed += submitters[i].Completed;
+	EXPECT_EQ(expected, completed);
+	EXPECT_EQ(0, engine.getStatistic(mode == DMA ? "DMA" : "PIO", "Timeouts"));
+
+	engine.HDAEngine->setCommandGate(NULL);
+	workLoop->removeEventSource(gate);
+	gate->release();
+	workLoop->release();
+}
+
+TEST(ConcurrentSubmittersGetTheirResponsesDMA)
+{
+	testConcurrentSubmitters(DMA, true);
+}
+
+TEST(ConcurrentSubmittersGetTheirResponsesPIO)
+{
+	testConcurrentSubmitters(PIO, true);
+}
+
+// before the gate is set and while it is removed
+TEST(ConcurrentSubmittersWithoutGateDMA)
+{
+	testConcurrentSubmitters(DMA, false);
+}
+
+TEST(ConcurrentSubmittersWithoutGatePIO)
+{
+	testConcurrentSubmitters(PIO, false);
+}
+
+TEST(ClientLaneThrottledByLinkTime)
+{
+	Engine engine(DMA);
+	ASSERT_TRUE(engine.Initialized);
+
+	UInt32 commands[200];
+	for (int round = 0; round < 4; round++)
+	{
+		for (int i = 0; i < 200; i++)
+			commands[i] = HDA_COMMAND(0x15, HDA_VERB_GET_PIN_SENSE, HDA_PARM_NULL);
+		EXPECT_EQ(200, engine.HDAEngine->sendCommands(commands, 200, commands, NULL, kHDALaneClient));
+	}
+	EXPECT_TRUE(engine.getStatistic("Lanes", "Client Throttled") > 0);
+
+	// power verbs are never held back
+	UInt32 throttled = engine.getStatistic("Lanes", "Client Throttled");
+	UInt64 start = hostGetTime();
+	engine.HDAEngine->sendCommand(HDA_COMMAND(0x14, HDA_VERB_EAPDBTL_GET, HDA_PARM_NULL), kHDALanePower);
+	EXPECT_TRUE(hostGetTime() - start < 1000);
+	EXPECT_EQ(throttled, engine.getStatistic("Lanes", "Client Throttled"));
+}
@@ -0,0 +1,282 @@
+/*
+ *  Released under "The GNU General Public License (GPL-2.0)"
+ *
+ *  This program is free software; you can redistribute it and/or modify it
+ *  under the terms of the GNU General Public License as published by the
+ *  Free Software Foundation; either version 2 of the License, or (at your
+ *  option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ *  or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ *  for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ *
+ */
+
+// Replays the sleep/wake transitions of a recorded verb trace (hda-verb trace record) on
+// the fake controller, with a codec rebuilt from the responses in the trace and the link
+// as slow as it was when recording. CC picks its profile from CodecCommander-Info.plist
+// just as on the machine the trace came from. The replayed trace is reported like
+// hda-verb trace report: verbs, link time and wall time per transition (the shim's
+// virtual clock), compared with the recording or another baseline trace. A replay fails
+// when a kind of transition sends more verbs or takes more than the threshold longer, or
+// when the rebuilt codec answers a parameter differently than the recorded one.
+//
+//	Replay [-b baseline] [-t percent] [-o replayed] trace
+//	Replay -r trace		records sleep/wake of the fake ALC269, with a codec dump first
+
+#include "FakeDriver.h"
+#include "TraceCodec.h"
+#include <chrono>
+#include <string>
+#include <vector>
+#include <unistd.h>
+
+extern "C" {
+#include "tracefile.h"
+}
+
+#define kRecordCycles		2
+
+static std::string readText(const char* path)
+{
+	std::string text;
+	if (FILE* file = fopen(path, "r"))
+	{
+		char buffer[16384];
+		size_t length;
+		while ((length = fread(buffer, 1, sizeof(buffer), file)) > 0)
+			text.append(buffer, length);
+		fclose(file);
+	}
+	return text;
+}
+
+// Codec Profile of the shipped Info.plist (retained), NULL if it cannot be read
+static OSDictionary* loadShippedProfiles()
+{
+	std::string text = readText(HOST_SOURCE_DIR "/CodecCommander/CodecCommander-Info.plist");
+	OSDictionary* plist = OSDynamicCast(OSDictionary, OSUnserializeXML(text.c_str()));
+	OSDictionary* personalities = plist ? OSDynamicCast(OSDictionary, plist->getObject("IOKitPersonalities")) : NULL;
+	OSDictionary* personality = personalities ? OSDynamicCast(OSDictionary, personalities->getObject("CodecCommander")) : NULL;
+	OSDictionary* profiles = personality ? OSDynamicCast(OSDictionary, personality->getObject(kCodecProfile)) : NULL;
+	if (profiles)
+		profiles->retain();
+	OSSafeReleaseNULL(plist);
+	return profiles;
+}
+
+// Driver on codec (taken over), awake as when a recording starts
+static Driver* startDriver(FakeCodec* codec)
+{
+	OSDictionary* profiles = loadShippedProfiles();
+	if (!profiles)
+	{
+		fprintf(stderr, "no Codec Profile in CodecCommander-Info.plist\n");
+		delete codec;
+		return NULL;
+	}
+
+	Driver* driver = new Driver(codec, profiles);
+	if (!driver->Started)
+	{
+		fprintf(stderr, "driver did not start\n");
+		delete driver;
+		return NULL;
+	}
+	driver->Commander->setPowerState(kPowerStateNormal, driver->Commander);
+	hostWaitIdle();
+	return driver;
+}
+
+static bool readAll(Driver* driver, UInt32 position, std::vector<CodecCommanderTraceRecord>* records, UInt32* lost)
+{
+	records->resize(kClientTraceEntries);
+	UInt32 count = 0;
+	if (driver->Commander->readTrace(&position, records->data(), kClientTraceEntries, &count, lost) != kIOReturnSuccess)
+		return false;
+	records->resize(count);
+	return true;
+}
+
+static bool writeTrace(const char* path, const std::vector<CodecCommanderTraceRecord>& records, UInt32 lost)
+{
+	FILE* file = fopen(path, "wb");
+	if (!file)
+		return false;
+	bool written = write_trace_header(file, records.size(), lost) &&
+				   fwrite(records.data(), sizeof(CodecCommanderTraceRecord), records.size(), file) == records.size();
+	return !fclose(file) && written;
+}
+
+static int record(const char* path)
+{
+	Driver* driver = startDriver(FakeCodec::createALC269());
+	if (!driver)
+		return 2;
+
+	UInt32 position;
+	driver->Commander->setTraceEnabled(true, &position);
+
+	// what hda-verb dump reads, then sleep/wake cycles
+	size_t size = sizeof(CodecCommanderDump) + kClientDumpMaxNodes * sizeof(CodecCommanderDumpNode);
+	CodecCommanderDump* dump = (CodecCommanderDump*)malloc(size);
+	driver->Commander->dumpCodec(dump, size);
+	free(dump);
+	for (int i = 0; i < kRecordCycles; i++)
+	{
+		driver->Commander->setPowerState(kPowerStateSleep, driver->Commander);
+		hostWaitIdle();
+		driver->Commander->setPowerState(kPowerStateNormal, driver->Commander);
+		hostWaitIdle();
+	}
+
+	std::vector<CodecCommanderTraceRecord> records;
+	UInt32 lost = 0;
+	bool written = readAll(driver, position, &records, &lost) && writeTrace(path, records, lost);
+	delete driver;
+	if (!written)
+	{
+		fprintf(stderr, "cannot write %s\n", path);
+		return 2;
+	}
+	printf("recorded %zu verbs to %s\n", records.size(), path);
+	return 0;
+}
+
+// Parameters, configuration defaults and subsystem id of the rebuilt codec that differ
+static UInt32 countMismatches(TraceCodecBuilder* builder, const std::vector<CodecCommanderTraceRecord>& records)
+{
+	UInt32 mismatches = 0;
+	for (const CodecCommanderTraceRecord& r : records)
+	{
+		UInt16 verb = r.Command >> 8 & 0xFFF;
+		UInt32 recorded;
+		if (r.Status != kTraceStatusOK || (verb != 0xF00 && verb != 0xF1C && verb != 0xF20))
+			continue;
+		if (builder->getResponse(r.Command, &recorded) && recorded != r.Response)
+		{
+			if (!mismatches)
+				fprintf(stderr, "rebuilt codec answers differently than the recorded one:\n");
+			fprintf(stderr, "  nid 0x%02x verb 0x%03x param 0x%02x: 0x%08x, recorded 0x%08x\n", r.Command >> 20 & 0xFF,
+					verb, r.Command & 0xFF, r.Response, recorded);
+			mismatches++;
+		}
+	}
+	return mismatches;
+}
+
+int main(int argc, char** argv)
+{
+	const char* output = NULL;
+	const char* baselinePath = NULL;
+	int threshold = kTraceDefaultThreshold;
+	bool recording = false;
+	int option;
+
+	while ((option = getopt(argc, argv, "b:t:o:r")) != -1)
+	{
+		switch (option)
+		{
+			case 'b': baselinePath = optarg; break;
+			case 't': threshold = atoi(optarg); break;
+			case 'o': output = optarg; break;
+			case 'r': recording = true; break;
+			default:
+				optind = argc;
+				break;
+		}
+	}
+	if (optind != argc - 1)
+	{
+		fprintf(stderr, "usage: %s [-b baseline] [-t percent] [-o replayed] trace\n       %s -r trace\n", argv[0], argv[0]);
+		return 2;
+	}
+	const char* path = argv[optind];
+	if (recording)
+		return record(path);
+
+	size_t count = 0, baseCount = 0;
+	UInt32 lost = 0, baseLost = 0;
+	CodecCommanderTraceRecord* recorded = read_trace_file(path, &count, &lost);
+	if (!recorded)
+		return 2;
+	CodecCommanderTraceRecord* baseline = baselinePath ? read_trace_file(baselinePath, &baseCount, &baseLost) : recorded;
+	if (!baseline)
+	{
+		free(recorded);
+		return 2;
+	}
+	if (!baselinePath)
+		baseCount = count;
+	if (lost)
+		printf("%u records were lost while recording\n", lost);
+
+	TraceCodecBuilder builder;
+	builder.add(recorded, count);
+	FakeCodec* codec = builder.finish();
+	Driver* driver = codec ? startDriver(codec) : NULL;
+	if (!driver)
+	{
+		if (!codec)
+			fprintf(stderr, "%s does not read the vendor id, record a codec dump with it\n", path);
+		free(recorded);
+		if (baseline != recorded)
+			free(baseline);
+		return 2;
+	}
+
+	// a verb is answered a frame after it was sent, anything on top is the codec's
+	UInt32 latency = builder.getLinkLatency(), frame = (kFakeFrameNS + 999) / 1000;
+	driver->HDA->setResponseDelay(latency > frame ? latency - frame : 0);
+
+	// sleep and wake as recorded, init happens before any recording starts
+	UInt32 position;
+	driver->Commander->setTraceEnabled(true, &position);
+	printf("%-10s %12s\n", "replayed", "host wall us");
+	for (size_t i = 0; i < count; i++)
+	{
+		const CodecCommanderTraceRecord& r = recorded[i];
+		if (r.Status != kTraceStatusMarker || r.Command != kTraceMarkerBegin || r.Response == kTraceTransitionInit)
+			continue;
+
+		bool sleep = r.Response == kTraceTransitionSleep;
+		auto start = std::chrono::steady_clock::now();
+		driver->Commander->setPowerState(sleep ? kPowerStateSleep : kPowerStateNormal, driver->Commander);
+		hostWaitIdle();
+		auto wall = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start);
+		printf("%-10s %12lld\n", sleep ? "Sleep" : "Wake", (long long)wall.count());
+	}
+	printf("\n");
+
+	std::vector<CodecCommanderTraceRecord> replayed;
+	UInt32 replayLost = 0;
+	int failed = 0;
+	if (!readAll(driver, position, &replayed, &replayLost) || replayLost)
+	{
+		fprintf(stderr, "replayed trace incomplete\n");
+		failed = 1;
+	}
+	if (countMismatches(&builder, replayed))
+		failed = 1;
+
+	int regressions = report_trace(stdout, replayed.data(), replayed.size(), baseline, baseCount, threshold);
+	if (regressions)
+		failed = 1;
+
+	if (output && !writeTrace(output, replayed, replayLost))
+	{
+		fprintf(stderr, "cannot write %s\n", output);
+		failed = 2;
+	}
+
+	delete driver;
+	free(recorded);
+	if (baseline != recorded)
+		free(baseline);
+	return failed;
+}